@@ -0,0 +1,33 @@
+/*-------------------------------------------------------------------------
+ *
+ * admission_queue.h
+ *	  definition of the queue of runs that wait to be started
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef ADMISSION_QUEUE_H
+#define ADMISSION_QUEUE_H
+
+
+/* run of a job that waits to be started */
+typedef struct AdmissionRequest
+{
+	int priority;
+	int64 sequenceNumber;
+	int64 jobId;
+} AdmissionRequest;
+
+
+extern void InitializeAdmissionQueue(void);
+extern void AddAdmissionRequest(int64 jobId, char *userName, int priority);
+extern bool PopAdmissionRequest(int maxRunningPerUser, AdmissionRequest *request);
+extern bool AdmissionRequestsPending(void);
+extern void ResetRunningJobCounts(void);
+extern void CountRunningJob(char *userName);
+extern bool UserMayStartJob(char *userName, int maxRunningPerUser);
+
+
+#endif
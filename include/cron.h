@@ -19,6 +19,9 @@
  *
  * $Id: cron.h,v 2.10 1994/01/15 20:43:43 vixie Exp $
  *
+ * pg_cron [drop the per-entry fields that pg_cron does not use]
+ * pg_cron [add interval schedules]
+ * pg_cron [parse schedules from memory, drop the FILE* shim]
  * marco 07nov16 [remove code not needed by pg_cron]
  * marco 04sep16 [integrate into pg_cron]
  * vix 14nov88 [rest of log is in RCS]
@@ -155,11 +158,6 @@ typedef int time_min;
 			 */
 
 typedef	struct _entry {
-	struct _entry	*next;
-	uid_t		uid;	
-	gid_t		gid;
-	char		**envp;
-	char		*cmd;
 	bitstr_t	bit_decl(minute, MINUTE_COUNT);
 	bitstr_t	bit_decl(hour,   HOUR_COUNT);
 	bitstr_t	bit_decl(dom,    DOM_COUNT);
@@ -171,6 +169,9 @@ typedef	struct _entry {
 #define	WHEN_REBOOT	0x04
 #define MIN_STAR	0x08
 #define HR_STAR		0x10
+#define WHEN_INTERVAL	0x20	/* every interval seconds */
+#define INTERVAL_FROM_END 0x40	/* counted from the end of the last run */
+	int		interval;	/* seconds between runs, for WHEN_INTERVAL */
 } entry;
 
 			/* the crontab database will be a list of the
@@ -206,27 +207,21 @@ typedef struct _orphan {
 	char            *tabname;
 } orphan;
 
-/*
- * Buffer used to mimick getc(FILE*) and ungetc(FILE*)
- */
-#define MAX_FILE_BUFFER_LENGTH 1000
-
-typedef struct _file_buffer {
-	char 		data[MAX_FILE_BUFFER_LENGTH];
-	int			length;
-	int			pointer;
-	char		unget_data[MAX_FILE_BUFFER_LENGTH];
-	int			unget_count;
-} file_buffer;
+			/* errors that can occur while parsing a schedule,
+			 * these correspond to ecodes, defined below.
+			 */
 
-void	unget_char(int, FILE *),
-		free_entry(entry *),
-		skip_comments(FILE *);
+typedef	enum ecode {
+	e_none, e_minute, e_hour, e_dom, e_month, e_dow,
+	e_cmd, e_timespec, e_username, e_cmd_len, e_interval
+} ecode_e;
 
-int		get_char(FILE *),
-		get_string(char *, int, FILE *, char *);
+typedef struct _parse_error {
+	ecode_e		ecode;		/* what went wrong */
+	int		position;	/* offset of the offending character */
+} parse_error;
 
-entry * parse_cron_entry(char *);
+int	parse_cron_entry(const char *, int, entry *, parse_error *);
 
 				/* in the C tradition, we only create
 				 * variables for the main program, just
@@ -263,6 +258,7 @@ char	*ecodes[] = {
 		"bad time specifier",
 		"bad username",
 		"command too long",
+		"bad interval",
 		NULL
 	};
 
@@ -284,6 +280,7 @@ char	*DebugFlagNames[] = {	/* sync with #defines */
 extern	char	*copyright[],
 		*MonthNames[],
 		*DowNames[],
+		*ecodes[],
 		*ProgramName;
 extern	int	LineNumber;
 extern	time_t	StartTime;
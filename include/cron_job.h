@@ -26,6 +26,21 @@ typedef struct FormData_cron_job
 	int nodePort;
 	text database;
 	text userName;
+	text timezone;
+	bytea scheduleBits;
+	bool readOnly;
+	int64 dependsOn[1];
+	int maxAttempts;
+	interval retryDelay;
+	float8 retryBackoff;
+	text retrySqlStates[1];
+	text settings[1];
+	int captureRows;
+	int captureBytes;
+	text logLevel;
+	text nodeGroup;
+	int fanoutConcurrency;
+	int priority;
 #endif
 } FormData_cron_job;
 
@@ -40,7 +55,7 @@ typedef FormData_cron_job *Form_cron_job;
  *      compiler constants for cron_job
  * ----------------
  */
-#define Natts_cron_job 7
+#define Natts_cron_job 22
 #define Anum_cron_job_jobid 1
 #define Anum_cron_job_schedule 2
 #define Anum_cron_job_command 3
@@ -48,6 +63,21 @@ typedef FormData_cron_job *Form_cron_job;
 #define Anum_cron_job_nodeport 5
 #define Anum_cron_job_database 6
 #define Anum_cron_job_username 7
+#define Anum_cron_job_timezone 8
+#define Anum_cron_job_schedule_bits 9
+#define Anum_cron_job_read_only 10
+#define Anum_cron_job_depends_on 11
+#define Anum_cron_job_max_attempts 12
+#define Anum_cron_job_retry_delay 13
+#define Anum_cron_job_retry_backoff 14
+#define Anum_cron_job_retry_sqlstates 15
+#define Anum_cron_job_settings 16
+#define Anum_cron_job_capture_rows 17
+#define Anum_cron_job_capture_bytes 18
+#define Anum_cron_job_log_level 19
+#define Anum_cron_job_node_group 20
+#define Anum_cron_job_fanout_concurrency 21
+#define Anum_cron_job_priority 22
 
 
 #endif /* CRON_JOB_H */
@@ -0,0 +1,56 @@
+/*-------------------------------------------------------------------------
+ *
+ * cron_job_node_status.h
+ *	  definition of the relation that holds the result of the last run of
+ *	  jobs on each node of their node group (cron.job_node_status).
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CRON_JOB_NODE_STATUS_H
+#define CRON_JOB_NODE_STATUS_H
+
+
+/* ----------------
+ *		cron_job_node_status definition.
+ * ----------------
+ */
+typedef struct FormData_cron_job_node_status
+{
+	int64 jobId;
+#ifdef CATALOG_VARLEN
+	text nodeName;
+	int nodePort;
+	int64 runId;
+	TimestampTz endTime;
+	bool succeeded;
+	text sqlState;
+	text userName;
+#endif
+} FormData_cron_job_node_status;
+
+/* ----------------
+ *      Form_cron_job_node_status corresponds to a pointer to a tuple with
+ *      the format of cron_job_node_status relation.
+ * ----------------
+ */
+typedef FormData_cron_job_node_status *Form_cron_job_node_status;
+
+/* ----------------
+ *      compiler constants for cron_job_node_status
+ * ----------------
+ */
+#define Natts_cron_job_node_status 8
+#define Anum_cron_job_node_status_jobid 1
+#define Anum_cron_job_node_status_nodename 2
+#define Anum_cron_job_node_status_nodeport 3
+#define Anum_cron_job_node_status_runid 4
+#define Anum_cron_job_node_status_end_time 5
+#define Anum_cron_job_node_status_succeeded 6
+#define Anum_cron_job_node_status_sqlstate 7
+#define Anum_cron_job_node_status_username 8
+
+
+#endif /* CRON_JOB_NODE_STATUS_H */
@@ -0,0 +1,54 @@
+/*-------------------------------------------------------------------------
+ *
+ * cron_job_output.h
+ *	  definition of the relation that holds the captured output of jobs
+ *	  (cron.job_output).
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CRON_JOB_OUTPUT_H
+#define CRON_JOB_OUTPUT_H
+
+
+/* ----------------
+ *		cron_job_output definition.
+ * ----------------
+ */
+typedef struct FormData_cron_job_output
+{
+	int64 jobId;
+	int64 runId;
+	TimestampTz endTime;
+#ifdef CATALOG_VARLEN
+	text userName;
+	int64 rowCount;
+	bool truncated;
+	text output;
+#endif
+} FormData_cron_job_output;
+
+/* ----------------
+ *      Form_cron_job_output corresponds to a pointer to a tuple with
+ *      the format of cron_job_output relation.
+ * ----------------
+ */
+typedef FormData_cron_job_output *Form_cron_job_output;
+
+/* ----------------
+ *      compiler constants for cron_job_output
+ * ----------------
+ */
+#define Natts_cron_job_output 7
+#define Anum_cron_job_output_jobid 1
+#define Anum_cron_job_output_runid 2
+#define Anum_cron_job_output_end_time 3
+#define Anum_cron_job_output_username 4
+#define Anum_cron_job_output_row_count 5
+#define Anum_cron_job_output_truncated 6
+#define Anum_cron_job_output_output 7
+
+
+#endif /* CRON_JOB_OUTPUT_H */
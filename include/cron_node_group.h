@@ -0,0 +1,46 @@
+/*-------------------------------------------------------------------------
+ *
+ * cron_node_group.h
+ *	  definition of the relation that holds the nodes of node groups
+ *	  (cron.node_group).
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CRON_NODE_GROUP_H
+#define CRON_NODE_GROUP_H
+
+
+/* ----------------
+ *		cron_node_group definition.
+ * ----------------
+ */
+typedef struct FormData_cron_node_group
+{
+#ifdef CATALOG_VARLEN
+	text groupName;
+	text nodeName;
+	int nodePort;
+#endif
+} FormData_cron_node_group;
+
+/* ----------------
+ *      Form_cron_node_group corresponds to a pointer to a tuple with
+ *      the format of cron_node_group relation.
+ * ----------------
+ */
+typedef FormData_cron_node_group *Form_cron_node_group;
+
+/* ----------------
+ *      compiler constants for cron_node_group
+ * ----------------
+ */
+#define Natts_cron_node_group 3
+#define Anum_cron_node_group_group_name 1
+#define Anum_cron_node_group_nodename 2
+#define Anum_cron_node_group_nodeport 3
+
+
+#endif /* CRON_NODE_GROUP_H */
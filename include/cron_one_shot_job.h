@@ -0,0 +1,50 @@
+/*-------------------------------------------------------------------------
+ *
+ * cron_one_shot_job.h
+ *	  definition of the relation that holds one-shot jobs
+ *	  (cron.one_shot_job).
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CRON_ONE_SHOT_JOB_H
+#define CRON_ONE_SHOT_JOB_H
+
+
+/* ----------------
+ *		cron_one_shot_job definition.
+ * ----------------
+ */
+typedef struct FormData_cron_one_shot_job
+{
+	int64 jobId;
+	TimestampTz runAt;
+#ifdef CATALOG_VARLEN
+	text command;
+	text database;
+	text userName;
+#endif
+} FormData_cron_one_shot_job;
+
+/* ----------------
+ *      Form_cron_one_shot_job corresponds to a pointer to a tuple with
+ *      the format of cron_one_shot_job relation.
+ * ----------------
+ */
+typedef FormData_cron_one_shot_job *Form_cron_one_shot_job;
+
+/* ----------------
+ *      compiler constants for cron_one_shot_job
+ * ----------------
+ */
+#define Natts_cron_one_shot_job 5
+#define Anum_cron_one_shot_job_jobid 1
+#define Anum_cron_one_shot_job_run_at 2
+#define Anum_cron_one_shot_job_command 3
+#define Anum_cron_one_shot_job_database 4
+#define Anum_cron_one_shot_job_username 5
+
+
+#endif /* CRON_ONE_SHOT_JOB_H */
@@ -0,0 +1,48 @@
+/*-------------------------------------------------------------------------
+ *
+ * cron_scheduler_lease.h
+ *	  definition of the relation that holds the leases of schedulers
+ *	  (cron.scheduler_lease).
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CRON_SCHEDULER_LEASE_H
+#define CRON_SCHEDULER_LEASE_H
+
+
+/* ----------------
+ *		cron_scheduler_lease definition.
+ * ----------------
+ */
+typedef struct FormData_cron_scheduler_lease
+{
+#ifdef CATALOG_VARLEN
+	text leaseName;
+	text holder;
+	int64 token;
+	TimestampTz expiresAt;
+#endif
+} FormData_cron_scheduler_lease;
+
+/* ----------------
+ *      Form_cron_scheduler_lease corresponds to a pointer to a tuple with
+ *      the format of cron_scheduler_lease relation.
+ * ----------------
+ */
+typedef FormData_cron_scheduler_lease *Form_cron_scheduler_lease;
+
+/* ----------------
+ *      compiler constants for cron_scheduler_lease
+ * ----------------
+ */
+#define Natts_cron_scheduler_lease 4
+#define Anum_cron_scheduler_lease_lease_name 1
+#define Anum_cron_scheduler_lease_holder 2
+#define Anum_cron_scheduler_lease_token 3
+#define Anum_cron_scheduler_lease_expires_at 4
+
+
+#endif /* CRON_SCHEDULER_LEASE_H */
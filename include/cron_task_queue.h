@@ -0,0 +1,48 @@
+/*-------------------------------------------------------------------------
+ *
+ * cron_task_queue.h
+ *	  definition of the relation that holds queued tasks that did not fit
+ *	  in shared memory (cron.task_queue).
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CRON_TASK_QUEUE_H
+#define CRON_TASK_QUEUE_H
+
+
+/* ----------------
+ *		cron_task_queue definition.
+ * ----------------
+ */
+typedef struct FormData_cron_task_queue
+{
+	int64 taskId;
+#ifdef CATALOG_VARLEN
+	text command;
+	text database;
+	text userName;
+#endif
+} FormData_cron_task_queue;
+
+/* ----------------
+ *      Form_cron_task_queue corresponds to a pointer to a tuple with
+ *      the format of cron_task_queue relation.
+ * ----------------
+ */
+typedef FormData_cron_task_queue *Form_cron_task_queue;
+
+/* ----------------
+ *      compiler constants for cron_task_queue
+ * ----------------
+ */
+#define Natts_cron_task_queue 4
+#define Anum_cron_task_queue_taskid 1
+#define Anum_cron_task_queue_command 2
+#define Anum_cron_task_queue_database 3
+#define Anum_cron_task_queue_username 4
+
+
+#endif /* CRON_TASK_QUEUE_H */
@@ -0,0 +1,39 @@
+/*-------------------------------------------------------------------------
+ *
+ * host_cache.h
+ *	  definition of the cache of resolved node addresses
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef HOST_CACHE_H
+#define HOST_CACHE_H
+
+
+#include "utils/timestamp.h"
+
+
+/* result of looking up the addresses of a node */
+typedef enum
+{
+	HOST_LOOKUP_DONE = 0,
+	HOST_LOOKUP_PENDING = 1,
+	HOST_LOOKUP_FAILED = 2
+} HostLookupResult;
+
+
+/* global settings */
+extern int HostCacheTTL;
+
+
+extern void InitializeHostCache(void);
+extern HostLookupResult LookupHostAddresses(char *nodeName, TimestampTz currentTime,
+											char **hostList, char **hostAddrList);
+extern bool NextHostLookupCheckTime(TimestampTz currentTime,
+									TimestampTz *checkTime);
+extern void CompleteHostLookups(TimestampTz currentTime);
+
+
+#endif
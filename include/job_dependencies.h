@@ -0,0 +1,25 @@
+/*-------------------------------------------------------------------------
+ *
+ * job_dependencies.h
+ *	  definition of the functions that start jobs after their dependencies
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef JOB_DEPENDENCIES_H
+#define JOB_DEPENDENCIES_H
+
+
+#include "nodes/pg_list.h"
+#include "task_states.h"
+
+
+extern void InitializeJobDependencies(void);
+extern void RebuildJobDependencies(List *taskList);
+extern void StartDependentRuns(CronTask *task, TimestampTz currentTime);
+extern void StartDependentRunIfMet(CronTask *task, TimestampTz currentTime);
+
+
+#endif
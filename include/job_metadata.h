@@ -13,6 +13,35 @@
 
 
 #include "nodes/pg_list.h"
+#include "time_zones.h"
+
+
+/*
+ * Version of the format in which parsed schedules are stored in the
+ * schedule_bits column of cron.job. Schedules stored in a different
+ * format are parsed again when loading jobs.
+ */
+#define SCHEDULE_BITS_VERSION 2
+
+
+/* which jobs are loaded, depending on the role of the server */
+typedef enum
+{
+	CRON_JOBS_NONE = 0,
+	CRON_JOBS_ALL = 1,
+	CRON_JOBS_READ_ONLY = 2,
+	CRON_JOBS_READ_WRITE = 3
+} CronJobSelection;
+
+
+/* which lines are logged about the runs of a job */
+typedef enum
+{
+	CRON_LOG_DEFAULT = 0,
+	CRON_LOG_NONE = 1,
+	CRON_LOG_ERRORS = 2,
+	CRON_LOG_ALL = 3
+} CronJobLogLevel;
 
 
 /* job metadata data structure */
@@ -26,11 +55,43 @@ typedef struct CronJob
 	int nodePort;
 	char *database;
 	char *userName;
+	char *timeZoneName;
+	CronTimeZone *timeZone;
+	bool readOnly;
+	int64 *dependsOn;
+	int dependsOnCount;
+	int maxAttempts;
+	int64 retryDelay;
+	double retryBackoff;
+	char **retrySqlStates;
+	int retrySqlStateCount;
+
+	/* libpq options that apply the settings of the job, or NULL */
+	char *connectionOptions;
+
+	/* how many rows and bytes of output to capture, 0 rows for none */
+	int captureRows;
+	int captureBytes;
+
+	/* which lines are logged about runs, by default per cron.log_statement */
+	CronJobLogLevel logLevel;
+
+	/*
+	 * Node group that the job runs on instead of its node, or NULL, and a
+	 * copy of the job for each node in the group.
+	 */
+	char *nodeGroup;
+	int fanOutConcurrency;
+	List *memberJobs;
+
+	/* runs of jobs with a higher priority start first */
+	int priority;
 } CronJob;
 
 
 /* global settings */
 extern bool CronJobCacheValid;
+extern CronJobSelection LoadedJobSelection;
 
 
 /* functions for retrieving job metadata */
@@ -38,6 +99,9 @@ extern void InitializeJobMetadataCache(void);
 extern void ResetJobMetadataCache(void);
 extern List * LoadCronJobList(void);
 extern CronJob * GetCronJob(int64 jobId);
+extern CronJobSelection CurrentJobSelection(void);
+extern bool PgCronHasBeenLoaded(void);
+extern Oid CronExtensionOwner(void);
 
 
 #endif
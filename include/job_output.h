@@ -0,0 +1,62 @@
+/*-------------------------------------------------------------------------
+ *
+ * job_output.h
+ *	  definition of the functions that capture the output of jobs
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef JOB_OUTPUT_H
+#define JOB_OUTPUT_H
+
+
+#include "job_metadata.h"
+#include "lib/stringinfo.h"
+#include "libpq-fe.h"
+#include "utils/timestamp.h"
+
+
+/* upper bound on the number of bytes of output that a job can capture */
+#define MAX_CAPTURE_BYTES (1024 * 1024)
+
+
+/*
+ * TaskOutput holds the output of a run that is being captured. Only the
+ * rows of the last result of the command that returned rows are kept.
+ */
+typedef struct TaskOutput
+{
+	int64 jobId;
+	int64 runId;
+	char *userName;
+	TimestampTz endTime;
+
+	/* limits of the job */
+	int maxRows;
+	int maxBytes;
+
+	/* rows in the result that is being received */
+	int64 resultRowCount;
+
+	/* rows in the captured result, and whether they were all captured */
+	int64 rowCount;
+	bool truncated;
+
+	/* header and captured rows */
+	StringInfoData buffer;
+} TaskOutput;
+
+
+extern void InitializeJobOutput(void);
+extern TaskOutput * StartTaskOutput(CronJob *cronJob, int64 runId);
+extern void CaptureResultRow(TaskOutput *output, PGresult *result);
+extern int64 EndTaskResult(TaskOutput *output);
+extern void CompleteTaskOutput(TaskOutput *output, TimestampTz endTime);
+extern void DiscardTaskOutput(TaskOutput *output);
+extern void SaveTaskOutputs(void);
+extern void DeleteJobOutput(int64 jobId);
+
+
+#endif
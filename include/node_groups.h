@@ -0,0 +1,28 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_groups.h
+ *	  definition of the functions that run jobs on groups of nodes
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef NODE_GROUPS_H
+#define NODE_GROUPS_H
+
+
+#include "job_metadata.h"
+#include "task_states.h"
+#include "utils/timestamp.h"
+
+
+extern void InitializeNodeGroups(void);
+extern void LoadNodeGroupMembers(List *jobList);
+extern void RecordNodeResult(CronTask *member, bool succeeded,
+							 TimestampTz endTime);
+extern void SaveNodeResults(void);
+extern void DeleteJobNodeResults(int64 jobId);
+
+
+#endif
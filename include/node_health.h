@@ -0,0 +1,40 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_health.h
+ *	  definition of the circuit breakers for the nodes that jobs run on
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef NODE_HEALTH_H
+#define NODE_HEALTH_H
+
+
+#include "utils/timestamp.h"
+
+
+/* state of the circuit breaker of a node */
+typedef enum
+{
+	NODE_CIRCUIT_CLOSED = 0,
+	NODE_CIRCUIT_OPEN = 1,
+	NODE_CIRCUIT_HALF_OPEN = 2
+} NodeCircuitState;
+
+
+/* global settings */
+extern int NodeFailureThreshold;
+extern int NodeRetryInterval;
+
+
+extern void InitializeNodeHealth(void);
+extern bool NodeAcceptsConnection(char *nodeName, int nodePort,
+								  TimestampTz currentTime);
+extern void RecordNodeSuccess(char *nodeName, int nodePort);
+extern void RecordNodeFailure(char *nodeName, int nodePort,
+							  TimestampTz currentTime);
+
+
+#endif
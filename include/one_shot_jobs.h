@@ -0,0 +1,27 @@
+/*-------------------------------------------------------------------------
+ *
+ * one_shot_jobs.h
+ *	  definition of functions for jobs that run once at a given time
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef ONE_SHOT_JOBS_H
+#define ONE_SHOT_JOBS_H
+
+
+#include "nodes/pg_list.h"
+#include "utils/timestamp.h"
+
+
+extern void InitializeOneShotJobs(void);
+extern void UpdateOneShotTimers(void);
+extern void StartOneShotJobs(List *timerList, TimestampTz currentTime);
+extern void CompleteOneShotJob(int64 jobId);
+extern void RemoveCompletedOneShotJobs(void);
+extern int RunningOneShotJobCount(void);
+
+
+#endif
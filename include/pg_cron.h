@@ -14,6 +14,7 @@
 
 /* global settings */
 extern char *CronTableDatabaseName;
+extern bool EnableStandbyScheduler;
 
 
 #endif
@@ -0,0 +1,35 @@
+/*-------------------------------------------------------------------------
+ *
+ * run_log.h
+ *	  definition of the functions that decide what is logged about runs
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef RUN_LOG_H
+#define RUN_LOG_H
+
+
+#include "job_metadata.h"
+#include "task_states.h"
+#include "utils/timestamp.h"
+
+
+/* global settings */
+extern bool CronLogStatement;
+extern int CronLogSummaryInterval;
+extern int CronLogErrorInterval;
+
+
+extern bool ShouldLogRun(CronJob *cronJob);
+extern bool ShouldLogRunFailure(CronTask *task, TimestampTz currentTime,
+								int *suppressedCount);
+extern void RecordRunCompletion(TimestampTz startTime, TimestampTz endTime,
+								bool succeeded);
+extern bool NextRunSummaryTime(TimestampTz *summaryTime);
+extern void LogRunSummary(TimestampTz currentTime);
+
+
+#endif
@@ -0,0 +1,62 @@
+/*-------------------------------------------------------------------------
+ *
+ * schedule_index.h
+ *	  definition of the inverted index over job schedules
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SCHEDULE_INDEX_H
+#define SCHEDULE_INDEX_H
+
+
+#include "nodes/pg_list.h"
+#include "task_states.h"
+
+
+/* positions of the per-value bitmaps of each schedule field in the index */
+#define INDEX_MINUTE_OFFSET 0
+#define INDEX_HOUR_OFFSET (INDEX_MINUTE_OFFSET + MINUTE_COUNT)
+#define INDEX_DOM_OFFSET (INDEX_HOUR_OFFSET + HOUR_COUNT)
+#define INDEX_MONTH_OFFSET (INDEX_DOM_OFFSET + DOM_COUNT)
+#define INDEX_DOW_OFFSET (INDEX_MONTH_OFFSET + MONTH_COUNT)
+
+/* jobs with DOM_STAR or DOW_STAR, which need both day fields to match */
+#define INDEX_DAY_STAR_OFFSET (INDEX_DOW_OFFSET + DOW_COUNT)
+
+/* jobs with MIN_STAR or HR_STAR, which are wildcard jobs */
+#define INDEX_WILD_OFFSET (INDEX_DAY_STAR_OFFSET + 1)
+
+#define INDEX_BITMAP_COUNT (INDEX_WILD_OFFSET + 1)
+
+
+/*
+ * ScheduleIndex is an inverted index over the schedules of a set of tasks.
+ * For every value of every schedule field, it holds a bitmap with a bit
+ * per task slot, such that the tasks that are due in a given minute can be
+ * found by combining a few bitmaps one 64-bit word at a time.
+ */
+typedef struct ScheduleIndex
+{
+	int taskCount;
+	int wordCount;
+
+	/* task in each slot */
+	CronTask **tasks;
+
+	/* INDEX_BITMAP_COUNT bitmaps of wordCount words each */
+	uint64 *bitmaps;
+} ScheduleIndex;
+
+
+extern void InitializeScheduleIndexes(void);
+extern void RebuildScheduleIndexes(List *taskList);
+extern void AddPendingRunsForMinute(ScheduleIndex *index, struct tm *tm,
+									bool doWild, bool doNonWild);
+extern List * DueTasksForMinute(ScheduleIndex *index, struct tm *tm);
+extern bool AnyTaskDueInMinute(ScheduleIndex *index, struct tm *tm);
+
+
+#endif
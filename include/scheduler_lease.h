@@ -0,0 +1,46 @@
+/*-------------------------------------------------------------------------
+ *
+ * scheduler_lease.h
+ *	  definition of the leases that elect the scheduler that starts runs
+ *	  and hand read-only jobs over to a standby
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SCHEDULER_LEASE_H
+#define SCHEDULER_LEASE_H
+
+
+#include "utils/timestamp.h"
+
+
+/* maximum number of leases that are renewed at the same time */
+#define MAX_LEASE_SOCKETS 2
+
+
+/* global settings */
+extern char *CronLeaseConnInfo;
+extern char *CronLeaseName;
+extern int CronLeaseTime;
+extern char *CronLeaseTokenSetting;
+extern char *CronPrimaryConnInfo;
+
+
+extern void InitializeSchedulerLease(void);
+extern bool RenewSchedulerLease(TimestampTz currentTime);
+extern bool RenewStandbyLease(TimestampTz currentTime);
+extern bool HoldsSchedulerLease(TimestampTz currentTime);
+extern bool HoldsStandbyLease(TimestampTz currentTime);
+extern int64 SchedulerLeaseToken(void);
+extern void CheckStandbyLease(TimestampTz currentTime);
+extern bool StandbyLeaseIsHeld(TimestampTz currentTime);
+extern bool NextLeaseRenewalTime(TimestampTz *renewalTime);
+extern bool NextJobSelectionChangeTime(TimestampTz currentTime,
+									   TimestampTz *changeTime);
+extern int SchedulerLeaseSockets(int *socketArray, bool *forWriteArray);
+extern void ReleaseSchedulerLease(void);
+
+
+#endif
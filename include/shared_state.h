@@ -0,0 +1,133 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_state.h
+ *	  definition of the state shared between backends and the scheduler
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_STATE_H
+#define SHARED_STATE_H
+
+
+#include "storage/latch.h"
+#include "storage/spin.h"
+#include "utils/timestamp.h"
+
+
+/* maximum number of run requests that can wait for the scheduler */
+#define MAX_RUN_REQUESTS 1024
+
+/*
+ * Maximum number of queued tasks in shared memory and the maximum size of
+ * their commands. Other tasks are kept in the cron.task_queue table.
+ */
+#define MAX_QUEUED_TASKS 256
+#define QUEUED_COMMAND_SIZE 1024
+
+/* maximum number of new one-shot jobs that can wait for the scheduler */
+#define MAX_ONE_SHOT_REQUESTS 1024
+
+
+/* request to run a job immediately */
+typedef struct RunRequest
+{
+	int64 jobId;
+	int64 runId;
+} RunRequest;
+
+
+/* ad-hoc task that was queued through cron.enqueue */
+typedef struct QueuedTask
+{
+	int64 taskId;
+	char database[NAMEDATALEN];
+	char userName[NAMEDATALEN];
+	char command[QUEUED_COMMAND_SIZE];
+} QueuedTask;
+
+
+/* notification of a new one-shot job */
+typedef struct OneShotRequest
+{
+	int64 jobId;
+	TimestampTz runAt;
+} OneShotRequest;
+
+
+/*
+ * CronSharedState is the state in shared memory through which backends
+ * wake up the scheduler. All fields are protected by the mutex.
+ */
+typedef struct CronSharedState
+{
+	slock_t mutex;
+
+	/* latch of the scheduler, or NULL if it is not running */
+	Latch *schedulerLatch;
+
+	/* counter for assigning unique run IDs */
+	int64 nextRunId;
+
+	/* ring buffer of run requests */
+	int requestHead;
+	int requestCount;
+	RunRequest requests[MAX_RUN_REQUESTS];
+
+	/*
+	 * Ring buffer of queued tasks. Slots are reserved before commit and
+	 * filled after commit, such that tasks never run before the data
+	 * written by the enqueueing transaction is visible.
+	 */
+	int taskHead;
+	int taskCount;
+	int reservedTaskCount;
+	QueuedTask tasks[MAX_QUEUED_TASKS];
+
+	/* whether the cron.task_queue table may contain tasks */
+	bool tasksOverflowed;
+
+	/* ring buffer of new one-shot jobs */
+	int oneShotHead;
+	int oneShotCount;
+	OneShotRequest oneShotRequests[MAX_ONE_SHOT_REQUESTS];
+
+	/* whether the scheduler should reload all one-shot jobs */
+	bool oneShotReloadNeeded;
+
+	/* whether cron.job changed since the scheduler last loaded it */
+	bool jobReloadNeeded;
+
+	/* until when the scheduler holds the scheduler lease, 0 if it does not */
+	TimestampTz leaseValidUntil;
+} CronSharedState;
+
+
+extern void RequestCronSharedState(void);
+extern void AttachScheduler(Latch *schedulerLatch);
+extern int64 NextRunId(void);
+extern int64 RequestJobRun(int64 jobId);
+extern int DequeueRunRequests(RunRequest *requests, int maxRequests);
+extern bool RunRequestsPending(void);
+extern void WakeScheduler(void);
+extern int ReserveQueuedTasks(int taskCount);
+extern void ReleaseQueuedTasks(int taskCount);
+extern void PushQueuedTask(QueuedTask *task);
+extern bool PopQueuedTask(QueuedTask *task);
+extern void SetQueuedTasksOverflowed(void);
+extern bool TakeQueuedTasksOverflowed(void);
+extern bool QueuedTasksPending(void);
+extern void PushOneShotRequest(OneShotRequest *request);
+extern int DequeueOneShotRequests(OneShotRequest *requests, int maxRequests);
+extern void SetOneShotReloadNeeded(void);
+extern bool TakeOneShotReloadNeeded(void);
+extern bool OneShotRequestsPending(void);
+extern void SetJobReloadNeeded(void);
+extern bool TakeJobReloadNeeded(void);
+extern void SetSchedulerLeaseExpiry(TimestampTz validUntil);
+extern TimestampTz SchedulerLeaseExpiry(void);
+
+
+#endif
@@ -0,0 +1,36 @@
+/*-------------------------------------------------------------------------
+ *
+ * task_queue.h
+ *	  definition of the queue of ad-hoc tasks
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+
+#include "nodes/pg_list.h"
+#include "job_metadata.h"
+
+
+/*
+ * Queued tasks are run as jobs with the negated task ID as job ID, such
+ * that they can share the task hash with scheduled jobs.
+ */
+#define IsQueuedJobId(jobId) ((jobId) < 0)
+
+
+extern int64 NextTaskId(void);
+extern void InitializeQueuedJobHash(void);
+extern CronJob * CreateQueuedJob(int64 taskId, char *command, char *database,
+								 char *userName);
+extern List * DequeueQueuedJobs(int maxJobCount);
+extern CronJob * GetQueuedJob(int64 jobId);
+extern void RemoveQueuedJob(int64 jobId);
+extern int QueuedJobCount(void);
+
+
+#endif
@@ -13,6 +13,7 @@
 
 
 #include "job_metadata.h"
+#include "lib/ilist.h"
 #include "libpq-fe.h"
 #include "utils/timestamp.h"
 
@@ -26,7 +27,8 @@ typedef enum
 	CRON_TASK_RUNNING = 4,
 	CRON_TASK_RECEIVING = 5,
 	CRON_TASK_DONE = 6,
-	CRON_TASK_ERROR = 7
+	CRON_TASK_ERROR = 7,
+	CRON_TASK_FANNING_OUT = 8
 } CronTaskState;
 
 typedef struct CronTask
@@ -35,20 +37,95 @@ typedef struct CronTask
 	int64 runId;
 	CronTaskState state;
 	uint pendingRunCount;
+	List *runRequests;
 	PGconn *connection;
 	PostgresPollingStatusType pollingStatus;
 	TimestampTz startDeadline;
 	bool isSocketReady;
 	bool isActive;
 	char *errorMessage;
+
+	/* for interval schedules, when the next run is due and the interval */
+	TimestampTz nextDueTime;
+	int interval;
+
+	/* when a run last succeeded, and when the dependencies were last met */
+	TimestampTz lastSuccessTime;
+	TimestampTz dependenciesMetTime;
+
+	/* attempts of the current run, and when a failed run is retried */
+	int attemptCount;
+	bool retryPending;
+	TimestampTz retryDueTime;
+	char sqlState[6];
+
+	/* when the current run started */
+	TimestampTz runStartTime;
+
+	/* whether the task waits in CRON_TASK_START for its host to resolve */
+	bool awaitingHost;
+
+	/* whether the connection of the current run reached the node */
+	bool connectionMade;
+
+	/* token of the scheduler lease under which the connection was opened */
+	int64 leaseToken;
+
+	/* when a failure of the job was last logged, and how many were not since */
+	TimestampTz lastFailureLogTime;
+	int suppressedFailureCount;
+
+	/* whether the connection was opened before a run was due, and until when */
+	bool isPrewarmed;
+	TimestampTz prewarmTime;
+
+	/* position among the due jobs of the same user when prewarming */
+	int prewarmTurn;
+
+	/* output of the current run, if the job captures it */
+	struct TaskOutput *output;
+
+	/* job of the task, valid until the next reload of the job cache */
+	CronJob *cronJob;
+
+	/* whether the task is in the list of tasks that can make progress */
+	bool isRunnable;
+	dlist_node runnableNode;
+
+	/* whether a due run waits in the admission queue, or may start */
+	bool awaitingAdmission;
+	bool isAdmitted;
+
+	/* for a job on a node group, the task of each node and their outcomes */
+	List *memberTasks;
+	int memberSuccessCount;
+	int memberFailureCount;
+
+	/* for the task of a node in a group, the task of the job and the node */
+	struct CronTask *parentTask;
+	char *memberNodeName;
+	int memberNodePort;
+	bool memberPending;
+	bool memberRunning;
 } CronTask;
 
 
 extern void InitializeTaskStateHash(void);
 extern void RefreshTaskHash(void);
 extern List * CurrentTaskList(void);
+extern List * RunnableTaskList(void);
+extern long CronTaskCount(void);
+extern void MarkTaskRunnable(CronTask *task);
+extern void MarkTaskAdmitted(CronTask *task);
+extern List * RunningTaskList(void);
 extern void InitializeCronTask(CronTask *task, int64 jobId);
+extern void ResetCronTask(CronTask *task);
+extern CronTask * FindCronTask(int64 jobId);
 extern void RemoveTask(int64 jobId);
+extern bool AddRunRequest(int64 jobId, int64 runId);
+extern void AddQueuedTask(int64 jobId);
+extern void StartMemberRun(CronTask *member, int64 runId);
+extern void RemoveMemberTask(CronTask *member);
 
 
 #endif
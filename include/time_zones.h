@@ -0,0 +1,62 @@
+/*-------------------------------------------------------------------------
+ *
+ * time_zones.h
+ *	  definition of the time zone cache used for per-job time zones
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef TIME_ZONES_H
+#define TIME_ZONES_H
+
+
+#include "nodes/pg_list.h"
+#include "pgtime.h"
+#include "utils/timestamp.h"
+
+
+#define DEFAULT_TIME_ZONE_NAME "GMT"
+
+
+/* cached time zone in which one or more jobs are scheduled */
+typedef struct CronTimeZone
+{
+	char name[TZ_STRLEN_MAX + 1];
+	pg_tz *tz;
+
+	/* UTC offset in seconds that applies in [validFrom, validUntil) */
+	long gmtOffset;
+	pg_time_t validFrom;
+	pg_time_t validUntil;
+
+	/* start of the last local minute for which runs were started */
+	TimestampTz lastMinute;
+
+	/* start of the last local minute in which we checked for runs */
+	TimestampTz lastClockMinute;
+
+	/* start of the last local minute for which connections were prewarmed */
+	TimestampTz prewarmedMinute;
+
+	/* next local minute in which a job is due, as of the checked minute */
+	TimestampTz nextRunMinute;
+	TimestampTz nextRunCheckedMinute;
+
+	/* index over the schedules of jobs in this time zone */
+	struct ScheduleIndex *scheduleIndex;
+
+	/* tasks of jobs in this time zone, only used while building the index */
+	List *taskList;
+} CronTimeZone;
+
+
+extern void InitializeTimeZoneCache(void);
+extern CronTimeZone * GetCronTimeZone(const char *timeZoneName);
+extern List * CronTimeZoneList(void);
+extern TimestampTz TimestampToLocalTime(CronTimeZone *timeZone,
+										TimestampTz time);
+
+
+#endif
@@ -0,0 +1,43 @@
+/*-------------------------------------------------------------------------
+ *
+ * timer_heap.h
+ *	  definition of the heap of timers used by the scheduler
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef TIMER_HEAP_H
+#define TIMER_HEAP_H
+
+
+#include "utils/timestamp.h"
+
+
+/* kinds of events for which the scheduler keeps a timer */
+typedef enum
+{
+	CRON_TIMER_ONE_SHOT = 0,
+	CRON_TIMER_INTERVAL = 1,
+	CRON_TIMER_RETRY = 2
+} CronTimerKind;
+
+
+/* timer that expires at a given time */
+typedef struct CronTimer
+{
+	TimestampTz dueTime;
+	CronTimerKind kind;
+	int64 id;
+} CronTimer;
+
+
+extern void InitializeTimerHeap(void);
+extern void AddTimer(CronTimerKind kind, int64 id, TimestampTz dueTime);
+extern bool PopDueTimer(TimestampTz currentTime, CronTimer *timer);
+extern bool NextTimerDueTime(TimestampTz *dueTime);
+extern void RemoveTimers(CronTimerKind kind);
+
+
+#endif
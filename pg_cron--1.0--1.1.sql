@@ -0,0 +1,128 @@
+/* pg_cron--1.0--1.1.sql */
+
+ALTER TABLE cron.job ADD COLUMN timezone text;
+ALTER TABLE cron.job ADD COLUMN schedule_bits bytea;
+ALTER TABLE cron.job ADD COLUMN read_only boolean not null default false;
+ALTER TABLE cron.job ADD COLUMN depends_on bigint[];
+ALTER TABLE cron.job ADD COLUMN max_attempts integer not null default 1;
+ALTER TABLE cron.job ADD COLUMN retry_delay interval not null default '10 seconds';
+ALTER TABLE cron.job ADD COLUMN retry_backoff double precision not null default 2;
+ALTER TABLE cron.job ADD COLUMN retry_sqlstates text[];
+ALTER TABLE cron.job ADD COLUMN settings text[];
+ALTER TABLE cron.job ADD COLUMN capture_rows integer not null default 0;
+ALTER TABLE cron.job ADD COLUMN capture_bytes integer not null default 8192;
+ALTER TABLE cron.job ADD COLUMN log_level text;
+ALTER TABLE cron.job ADD COLUMN node_group text;
+ALTER TABLE cron.job ADD COLUMN fanout_concurrency integer not null default 8;
+ALTER TABLE cron.job ADD COLUMN priority integer not null default 0;
+
+CREATE FUNCTION cron.alter_job(job_id bigint,
+							   timezone text default null,
+							   read_only boolean default null,
+							   depends_on bigint[] default null,
+							   max_attempts integer default null,
+							   retry_delay interval default null,
+							   retry_backoff double precision default null,
+							   retry_sqlstates text[] default null,
+							   settings text[] default null,
+							   capture_rows integer default null,
+							   capture_bytes integer default null,
+							   log_level text default null,
+							   node_group text default null,
+							   fanout_concurrency integer default null,
+							   priority integer default null)
+    RETURNS void
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$cron_alter_job$$;
+COMMENT ON FUNCTION cron.alter_job(bigint,text,boolean,bigint[],integer,interval,double precision,text[],text[],integer,integer,text,text,integer,integer)
+    IS 'alter the settings of a pg_cron job';
+
+CREATE FUNCTION cron.run_now(job_id bigint)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_run_now$$;
+COMMENT ON FUNCTION cron.run_now(bigint)
+    IS 'run a pg_cron job immediately';
+
+CREATE SEQUENCE cron.taskid_seq;
+
+CREATE TABLE cron.task_queue (
+	taskid bigint primary key default nextval('cron.taskid_seq'),
+	command text not null,
+	database text not null,
+	username text not null
+);
+
+CREATE FUNCTION cron.enqueue(command text,
+							 database text default current_database(),
+							 username text default current_user)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_enqueue$$;
+COMMENT ON FUNCTION cron.enqueue(text,text,text)
+    IS 'run a command once in the background';
+
+CREATE TABLE cron.one_shot_job (
+	jobid bigint primary key default nextval('cron.taskid_seq'),
+	run_at timestamptz not null,
+	command text not null,
+	database text not null default current_database(),
+	username text not null default current_user
+);
+GRANT SELECT ON cron.one_shot_job TO public;
+ALTER TABLE cron.one_shot_job ENABLE ROW LEVEL SECURITY;
+CREATE POLICY cron_one_shot_job_policy ON cron.one_shot_job USING (username = current_user);
+
+CREATE FUNCTION cron.schedule_at(run_at timestamptz, command text)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_schedule_at$$;
+COMMENT ON FUNCTION cron.schedule_at(timestamptz,text)
+    IS 'schedule a command to run once at a given time';
+
+CREATE TABLE cron.job_output (
+	jobid bigint primary key,
+	runid bigint not null,
+	end_time timestamptz not null,
+	username text not null,
+	row_count bigint not null,
+	truncated boolean not null,
+	output text not null
+);
+GRANT SELECT ON cron.job_output TO public;
+ALTER TABLE cron.job_output ENABLE ROW LEVEL SECURITY;
+CREATE POLICY cron_job_output_policy ON cron.job_output USING (username = current_user);
+
+CREATE TABLE cron.scheduler_lease (
+	lease_name text primary key,
+	holder text not null,
+	token bigint not null,
+	expires_at timestamptz not null
+);
+
+CREATE TABLE cron.node_group (
+	group_name text not null,
+	nodename text not null,
+	nodeport int not null,
+	primary key (group_name, nodename, nodeport)
+);
+
+CREATE TRIGGER cron_node_group_cache_invalidate
+    AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE
+    ON cron.node_group
+    FOR STATEMENT EXECUTE PROCEDURE cron.job_cache_invalidate();
+
+CREATE TABLE cron.job_node_status (
+	jobid bigint not null,
+	nodename text not null,
+	nodeport int not null,
+	runid bigint not null,
+	end_time timestamptz not null,
+	succeeded boolean not null,
+	sqlstate text,
+	username text not null,
+	primary key (jobid, nodename, nodeport)
+);
+GRANT SELECT ON cron.job_node_status TO public;
+ALTER TABLE cron.job_node_status ENABLE ROW LEVEL SECURITY;
+CREATE POLICY cron_job_node_status_policy ON cron.job_node_status USING (username = current_user);
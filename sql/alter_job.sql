@@ -0,0 +1,56 @@
+CREATE EXTENSION pg_cron;
+SELECT cron.schedule('0 0 * * *', 'SELECT 1');
+SELECT cron.schedule('@manual', 'SELECT 2');
+SELECT cron.schedule('@manual', 'SELECT 3');
+
+-- new jobs take the defaults of the columns of cron.job
+SELECT jobid, timezone, read_only, depends_on, max_attempts, retry_delay,
+       retry_backoff, retry_sqlstates, settings
+FROM cron.job ORDER BY jobid;
+SELECT jobid, capture_rows, capture_bytes, log_level, node_group,
+       fanout_concurrency, priority
+FROM cron.job ORDER BY jobid;
+
+-- invalid arguments are rejected before the job is changed
+SELECT cron.alter_job(NULL, priority := 1);
+SELECT cron.alter_job(42, priority := 1);
+SELECT cron.alter_job(1, timezone := 'Mars/Olympus_Mons');
+SELECT cron.alter_job(1, max_attempts := 0);
+SELECT cron.alter_job(1, retry_delay := '-1 second');
+SELECT cron.alter_job(1, retry_backoff := 0.5);
+SELECT cron.alter_job(1, retry_sqlstates := '{40001,4000}');
+SELECT cron.alter_job(1, retry_sqlstates := ARRAY[NULL::text]);
+SELECT cron.alter_job(1, settings := '{work_mem}');
+SELECT cron.alter_job(1, settings := '{"work mem=1MB"}');
+SELECT cron.alter_job(1, capture_rows := -1);
+SELECT cron.alter_job(1, capture_bytes := 0);
+SELECT cron.alter_job(1, log_level := 'verbose');
+SELECT cron.alter_job(1, fanout_concurrency := 0);
+SELECT cron.alter_job(1, depends_on := ARRAY[NULL::bigint]);
+SELECT cron.alter_job(1, depends_on := '{42}');
+
+-- dependencies may not form a cycle
+SELECT cron.alter_job(1, depends_on := '{1}');
+SELECT cron.alter_job(2, depends_on := '{1}');
+SELECT cron.alter_job(3, depends_on := '{2}');
+SELECT cron.alter_job(1, depends_on := '{3}');
+
+SELECT cron.alter_job(1, timezone := 'Europe/Amsterdam', read_only := true,
+                      max_attempts := 3, retry_delay := '1 minute',
+                      retry_backoff := 1.5, retry_sqlstates := '{40001,08}',
+                      settings := '{work_mem=64MB,statement_timeout=1h}',
+                      capture_rows := 10, capture_bytes := 1024,
+                      log_level := 'errors', priority := 5);
+SELECT jobid, timezone, read_only, depends_on, max_attempts, retry_delay,
+       retry_backoff, retry_sqlstates, settings
+FROM cron.job ORDER BY jobid;
+SELECT jobid, capture_rows, capture_bytes, log_level, priority
+FROM cron.job ORDER BY jobid;
+
+-- NULL leaves a setting unchanged, while an empty array and 'default' reset it
+SELECT cron.alter_job(1, settings := '{}', log_level := 'default');
+SELECT jobid, timezone, max_attempts, settings, log_level, priority
+FROM cron.job WHERE jobid = 1;
+
+SELECT cron.unschedule(jobid) FROM cron.job ORDER BY jobid;
+DROP EXTENSION pg_cron;
@@ -0,0 +1,78 @@
+CREATE EXTENSION pg_cron;
+
+-- cron.job.schedule_bits holds the parsed schedule, decode the bit strings
+CREATE FUNCTION schedule_values(bits bytea, first_byte int, byte_count int,
+                                first_value int)
+RETURNS int[] LANGUAGE sql AS $$
+  SELECT coalesce(array_agg(first_value + n ORDER BY n), '{}')
+  FROM generate_series(0, byte_count * 8 - 1) n
+  WHERE get_byte(bits, first_byte + n / 8) & (1 << (n % 8)) <> 0
+$$;
+
+-- flags fit in the first or the last byte, depending on byte order
+CREATE FUNCTION schedule_flags(bits bytea)
+RETURNS int LANGUAGE sql AS $$
+  SELECT get_byte(bits, 8) | get_byte(bits, 11)
+$$;
+
+-- likewise for the seconds of intervals below 65536 seconds
+CREATE FUNCTION schedule_interval(bits bytea)
+RETURNS int LANGUAGE sql AS $$
+  SELECT (get_byte(bits, 12) | get_byte(bits, 15)) +
+         (get_byte(bits, 13) | get_byte(bits, 14)) * 256
+$$;
+
+-- errors report the field and the position of the offending character
+SELECT cron.schedule('60 * * * *', 'SELECT 1');
+SELECT cron.schedule('* 24 * * *', 'SELECT 1');
+SELECT cron.schedule('0 0 32 * *', 'SELECT 1');
+SELECT cron.schedule('0 0 * 13 *', 'SELECT 1');
+SELECT cron.schedule('0 0 * Foo *', 'SELECT 1');
+SELECT cron.schedule('0 0 * * 8', 'SELECT 1');
+SELECT cron.schedule('0 0 * *', 'SELECT 1');
+SELECT cron.schedule('1/5 * * * *', 'SELECT 1');
+SELECT cron.schedule('*/0 * * * *', 'SELECT 1');
+SELECT cron.schedule('5-64/30 * * * *', 'SELECT 1');
+SELECT cron.schedule('@sometimes', 'SELECT 1');
+SELECT cron.schedule('', 'SELECT 1');
+
+-- a job runs when either a restricted day of month or day of week matches,
+-- which the scheduler knows from DOM_STAR (1) and DOW_STAR (2)
+SELECT cron.schedule('0 0 1,15 * 1', 'SELECT 1');
+SELECT cron.schedule('0 0 * * Mon-Fri', 'SELECT 1');
+SELECT cron.schedule('0 0 1 * *', 'SELECT 1');
+SELECT cron.schedule('0 0 * * 7', 'SELECT 1');
+SELECT cron.schedule('*/15 * * * *', 'SELECT 1');
+SELECT cron.schedule('@manual', 'SELECT 1');
+
+SELECT jobid, schedule,
+       schedule_flags(schedule_bits) & 3 AS star_flags,
+       schedule_values(schedule_bits, 27, 4, 1) AS doms,
+       schedule_values(schedule_bits, 33, 1, 0) AS dows
+FROM cron.job ORDER BY jobid;
+
+SELECT schedule_values(schedule_bits, 16, 8, 0) AS minutes
+FROM cron.job WHERE schedule = '*/15 * * * *';
+
+-- interval schedules set WHEN_INTERVAL (32), and INTERVAL_FROM_END (64)
+SELECT cron.schedule('every 90 minutes', 'SELECT 1');
+SELECT cron.schedule('every 30 seconds from end', 'SELECT 1');
+SELECT cron.schedule('EVERY 2 Hours from start', 'SELECT 1');
+
+SELECT jobid, schedule,
+       schedule_flags(schedule_bits) AS flags,
+       schedule_interval(schedule_bits) AS seconds
+FROM cron.job WHERE schedule_flags(schedule_bits) & 32 <> 0 ORDER BY jobid;
+
+SELECT cron.schedule('every 0 minutes', 'SELECT 1');
+SELECT cron.schedule('every 5 fortnights', 'SELECT 1');
+SELECT cron.schedule('every 5 minutes from middle', 'SELECT 1');
+SELECT cron.schedule('every 2 hours trailing', 'SELECT 1');
+SELECT cron.schedule('everyday', 'SELECT 1');
+
+SELECT cron.unschedule(jobid) FROM cron.job ORDER BY jobid;
+
+DROP FUNCTION schedule_values(bytea, int, int, int);
+DROP FUNCTION schedule_flags(bytea);
+DROP FUNCTION schedule_interval(bytea);
+DROP EXTENSION pg_cron;
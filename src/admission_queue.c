@@ -0,0 +1,427 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/admission_queue.c
+ *
+ * Queue of the runs that are due but not started yet. Each user has a
+ * max-heap of runs, ordered by the priority of their job and then by the
+ * order in which they fell due. The scheduler starts runs while fewer
+ * than cron.max_running_jobs runs are in progress. Among the users that
+ * run fewer than cron.max_running_jobs_per_user jobs, the run with the
+ * highest priority starts first, and the users whose best runs share that
+ * priority take turns. The per-user limit bounds how far a user with many
+ * jobs, or with high priorities, can delay the jobs of other users.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "admission_queue.h"
+
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+#define INITIAL_REQUEST_CAPACITY 16
+#define INITIAL_USER_CAPACITY 8
+
+#define RequestParent(position) (((position) - 1) / 2)
+#define RequestLeftChild(position) (2 * (position) + 1)
+
+
+/*
+ * UserQueue holds the runs of the jobs of one user that wait to be started,
+ * and the number of jobs of the user that are running.
+ */
+typedef struct UserQueue
+{
+	char userName[NAMEDATALEN];
+
+	AdmissionRequest *requests;
+	int requestCount;
+	int requestCapacity;
+
+	int runningCount;
+} UserQueue;
+
+
+/* forward declarations */
+static UserQueue * GetUserQueue(char *userName);
+static void AddWaitingUser(UserQueue *userQueue);
+static void RemoveWaitingUser(int userIndex);
+static void SiftUp(UserQueue *userQueue, int position);
+static void SiftDown(UserQueue *userQueue, int position);
+static inline bool RequestPrecedes(AdmissionRequest *request,
+								   AdmissionRequest *otherRequest);
+static inline void SwapRequests(UserQueue *userQueue, int position,
+								int otherPosition);
+
+/* global variables */
+static MemoryContext AdmissionContext = NULL;
+static HTAB *UserQueueHash = NULL;
+static int64 NextSequenceNumber = 0;
+
+/*
+ * Users that have runs in the queue, in the order in which they take
+ * turns, and the position of the user whose turn is next.
+ */
+static UserQueue **WaitingUsers = NULL;
+static int WaitingUserCount = 0;
+static int WaitingUserCapacity = 0;
+static int NextUserIndex = 0;
+
+
+/*
+ * InitializeAdmissionQueue creates the hash of the queues of users.
+ */
+void
+InitializeAdmissionQueue(void)
+{
+	HASHCTL info;
+	int hashFlags = 0;
+
+	AdmissionContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "pg_cron admission context",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = NAMEDATALEN;
+	info.entrysize = sizeof(UserQueue);
+	info.hash = string_hash;
+	info.hcxt = AdmissionContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	UserQueueHash = hash_create("pg_cron admission queues", 8, &info, hashFlags);
+
+	WaitingUserCapacity = INITIAL_USER_CAPACITY;
+	WaitingUserCount = 0;
+	WaitingUsers = (UserQueue **)
+				   MemoryContextAlloc(AdmissionContext,
+									  WaitingUserCapacity * sizeof(UserQueue *));
+}
+
+
+/*
+ * GetUserQueue returns the queue of the given user, which starts out empty.
+ */
+static UserQueue *
+GetUserQueue(char *userName)
+{
+	char userKey[NAMEDATALEN];
+	UserQueue *userQueue = NULL;
+	bool isPresent = false;
+
+	memset(userKey, 0, sizeof(userKey));
+	strlcpy(userKey, userName, NAMEDATALEN);
+
+	userQueue = hash_search(UserQueueHash, userKey, HASH_ENTER, &isPresent);
+	if (!isPresent)
+	{
+		userQueue->requests = NULL;
+		userQueue->requestCount = 0;
+		userQueue->requestCapacity = 0;
+		userQueue->runningCount = 0;
+	}
+
+	return userQueue;
+}
+
+
+/*
+ * AddAdmissionRequest adds a run of the given job with the given priority
+ * to the queue of the given user, behind the runs of the same priority
+ * that are already in it.
+ */
+void
+AddAdmissionRequest(int64 jobId, char *userName, int priority)
+{
+	UserQueue *userQueue = GetUserQueue(userName);
+	AdmissionRequest *request = NULL;
+
+	if (userQueue->requestCount == 0)
+	{
+		AddWaitingUser(userQueue);
+	}
+
+	if (userQueue->requests == NULL)
+	{
+		userQueue->requestCapacity = INITIAL_REQUEST_CAPACITY;
+		userQueue->requests = (AdmissionRequest *)
+							  MemoryContextAlloc(AdmissionContext,
+												 userQueue->requestCapacity *
+												 sizeof(AdmissionRequest));
+	}
+	else if (userQueue->requestCount == userQueue->requestCapacity)
+	{
+		userQueue->requestCapacity *= 2;
+		userQueue->requests = (AdmissionRequest *)
+							  repalloc(userQueue->requests,
+									   userQueue->requestCapacity *
+									   sizeof(AdmissionRequest));
+	}
+
+	request = &userQueue->requests[userQueue->requestCount];
+	request->priority = priority;
+	request->sequenceNumber = NextSequenceNumber++;
+	request->jobId = jobId;
+
+	userQueue->requestCount++;
+
+	SiftUp(userQueue, userQueue->requestCount - 1);
+}
+
+
+/*
+ * PopAdmissionRequest removes the run that should start next from the
+ * queue, copies it into request, and returns true. Only users that run
+ * fewer than maxRunningPerUser jobs may start a run, unless it is 0. The
+ * run is the one with the highest priority among those users, and the
+ * users whose best runs have that priority take turns. It returns false
+ * if no user may start a run.
+ */
+bool
+PopAdmissionRequest(int maxRunningPerUser, AdmissionRequest *request)
+{
+	UserQueue *userQueue = NULL;
+	int chosenIndex = -1;
+	int topPriority = 0;
+	int turn = 0;
+
+	for (turn = 0; turn < WaitingUserCount; turn++)
+	{
+		int userIndex = (NextUserIndex + turn) % WaitingUserCount;
+		UserQueue *candidate = WaitingUsers[userIndex];
+
+		if (maxRunningPerUser > 0 && candidate->runningCount >= maxRunningPerUser)
+		{
+			continue;
+		}
+
+		/* the first user in turn wins among those with the top priority */
+		if (chosenIndex < 0 || candidate->requests[0].priority > topPriority)
+		{
+			chosenIndex = userIndex;
+			topPriority = candidate->requests[0].priority;
+		}
+	}
+
+	if (chosenIndex < 0)
+	{
+		return false;
+	}
+
+	userQueue = WaitingUsers[chosenIndex];
+
+	*request = userQueue->requests[0];
+
+	userQueue->requestCount--;
+	if (userQueue->requestCount > 0)
+	{
+		userQueue->requests[0] = userQueue->requests[userQueue->requestCount];
+		SiftDown(userQueue, 0);
+
+		/* the next user takes the next turn */
+		NextUserIndex = (chosenIndex + 1) % WaitingUserCount;
+	}
+	else
+	{
+		/* the users behind it move up, so the next user is at its index */
+		RemoveWaitingUser(chosenIndex);
+		NextUserIndex = WaitingUserCount > 0 ? chosenIndex % WaitingUserCount : 0;
+	}
+
+	return true;
+}
+
+
+/*
+ * AdmissionRequestsPending returns whether any run waits to be started.
+ */
+bool
+AdmissionRequestsPending(void)
+{
+	return WaitingUserCount > 0;
+}
+
+
+/*
+ * ResetRunningJobCounts sets the number of running jobs of all users to 0,
+ * before they are counted again with CountRunningJob.
+ */
+void
+ResetRunningJobCounts(void)
+{
+	HASH_SEQ_STATUS status;
+	UserQueue *userQueue = NULL;
+
+	hash_seq_init(&status, UserQueueHash);
+
+	while ((userQueue = hash_seq_search(&status)) != NULL)
+	{
+		userQueue->runningCount = 0;
+	}
+}
+
+
+/*
+ * CountRunningJob adds a running job to the given user.
+ */
+void
+CountRunningJob(char *userName)
+{
+	UserQueue *userQueue = GetUserQueue(userName);
+
+	userQueue->runningCount++;
+}
+
+
+/*
+ * UserMayStartJob returns whether the given user runs fewer than
+ * maxRunningPerUser jobs, which is always the case if it is 0.
+ */
+bool
+UserMayStartJob(char *userName, int maxRunningPerUser)
+{
+	if (maxRunningPerUser <= 0)
+	{
+		return true;
+	}
+
+	return GetUserQueue(userName)->runningCount < maxRunningPerUser;
+}
+
+
+/*
+ * AddWaitingUser adds a user to the users that take turns, right before
+ * the user whose turn is next, such that it gets its turn last.
+ */
+static void
+AddWaitingUser(UserQueue *userQueue)
+{
+	if (WaitingUserCount == WaitingUserCapacity)
+	{
+		WaitingUserCapacity *= 2;
+		WaitingUsers = (UserQueue **)
+					   repalloc(WaitingUsers,
+								WaitingUserCapacity * sizeof(UserQueue *));
+	}
+
+	memmove(&WaitingUsers[NextUserIndex + 1], &WaitingUsers[NextUserIndex],
+			(WaitingUserCount - NextUserIndex) * sizeof(UserQueue *));
+
+	WaitingUsers[NextUserIndex] = userQueue;
+	WaitingUserCount++;
+	NextUserIndex = (NextUserIndex + 1) % WaitingUserCount;
+}
+
+
+/*
+ * RemoveWaitingUser removes the user at the given index from the users
+ * that take turns.
+ */
+static void
+RemoveWaitingUser(int userIndex)
+{
+	memmove(&WaitingUsers[userIndex], &WaitingUsers[userIndex + 1],
+			(WaitingUserCount - userIndex - 1) * sizeof(UserQueue *));
+
+	WaitingUserCount--;
+}
+
+
+/*
+ * SiftUp moves the request at the given position up until its parent
+ * precedes it.
+ */
+static void
+SiftUp(UserQueue *userQueue, int position)
+{
+	AdmissionRequest *requests = userQueue->requests;
+
+	while (position > 0)
+	{
+		int parent = RequestParent(position);
+
+		if (!RequestPrecedes(&requests[position], &requests[parent]))
+		{
+			break;
+		}
+
+		SwapRequests(userQueue, position, parent);
+		position = parent;
+	}
+}
+
+
+/*
+ * SiftDown moves the request at the given position down until it precedes
+ * both of its children.
+ */
+static void
+SiftDown(UserQueue *userQueue, int position)
+{
+	AdmissionRequest *requests = userQueue->requests;
+
+	while (true)
+	{
+		int leftChild = RequestLeftChild(position);
+		int rightChild = leftChild + 1;
+		int first = position;
+
+		if (leftChild < userQueue->requestCount &&
+			RequestPrecedes(&requests[leftChild], &requests[first]))
+		{
+			first = leftChild;
+		}
+
+		if (rightChild < userQueue->requestCount &&
+			RequestPrecedes(&requests[rightChild], &requests[first]))
+		{
+			first = rightChild;
+		}
+
+		if (first == position)
+		{
+			break;
+		}
+
+		SwapRequests(userQueue, position, first);
+		position = first;
+	}
+}
+
+
+/*
+ * RequestPrecedes returns whether request should start before otherRequest,
+ * which is when it has a higher priority, or the same priority and fell due
+ * earlier.
+ */
+static inline bool
+RequestPrecedes(AdmissionRequest *request, AdmissionRequest *otherRequest)
+{
+	if (request->priority != otherRequest->priority)
+	{
+		return request->priority > otherRequest->priority;
+	}
+
+	return request->sequenceNumber < otherRequest->sequenceNumber;
+}
+
+
+/*
+ * SwapRequests swaps the requests of a user at the given positions.
+ */
+static inline void
+SwapRequests(UserQueue *userQueue, int position, int otherPosition)
+{
+	AdmissionRequest request = userQueue->requests[position];
+
+	userQueue->requests[position] = userQueue->requests[otherPosition];
+	userQueue->requests[otherPosition] = request;
+}
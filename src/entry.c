@@ -15,7 +15,10 @@
  * Paul Vixie          <paul@vix.com>          uunet!decwrl!vixie!paul
  */
 
-/* marco 04sep16 [integrated into pg_cron]
+/* pg_cron [add @manual for jobs that only run on demand]
+ * pg_cron [add "every N seconds|minutes|hours" interval schedules]
+ * pg_cron [parse from an in-memory span without allocating]
+ * marco 04sep16 [integrated into pg_cron]
  * vix 26jan87 [RCS'd; rest of log is in RCS file]
  * vix 01jan87 [added line-level error recovery]
  * vix 31dec86 [added /step to the from-to range, per bob@acornrc]
@@ -30,83 +33,81 @@
 #include "cron.h"
 
 
-typedef	enum ecode {
-	e_none, e_minute, e_hour, e_dom, e_month, e_dow,
-	e_cmd, e_timespec, e_username, e_cmd_len
-} ecode_e;
+/* upper bound on numbers, well above any valid value or step size */
+#define	MAX_NUMBER	100000
 
-static char	get_list(bitstr_t *, int, int, char *[], int, FILE *),
-		get_range(bitstr_t *, int, int, char *[], int, FILE *),
-		get_number(int *, int, char *[], int, FILE *);
-static int	set_element(bitstr_t *, int, int, int);
+typedef	struct _span_reader {
+	const char	*data;		/* schedule text, not NUL-terminated */
+	int		length;		/* number of bytes in data */
+	int		pointer;	/* offset of the next character */
+	int		position;	/* offset of the last character read */
+} span_reader;
 
+static int	get_char(span_reader *),
+		skip_comments(span_reader *),
+		get_list(bitstr_t *, int, int, char *[], int, span_reader *),
+		get_range(bitstr_t *, int, int, char *[], int, span_reader *),
+		get_number(int *, int, char *[], int, span_reader *),
+		get_interval(entry *, int, span_reader *),
+		get_word(int *, int *, int, span_reader *),
+		set_element(bitstr_t *, int, int, int);
+static int	match_word(span_reader *, int, int, const char *);
 
-void
-free_entry(e)
-	entry	*e;
-{
-	free(e->cmd);
-	free(e);
-}
 
-
-/* return NULL if eof or syntax error occurs;
- * otherwise return a pointer to a new entry.
+/* return FALSE if a syntax error occurs, after filling in error (if
+ * given) with the error code and the offset of the offending character;
+ * otherwise fill in e and return TRUE.
  *
  * Note: This function is a modified version of load_entry in Vixie
- * cron. It only parses the schedule part of a cron entry and uses
- * an in-memry buffer.
+ * cron. It only parses the schedule part of a cron entry, reads it
+ * directly from the given span of memory and never allocates, such
+ * that it is safe to call on arbitrary input inside a backend.
  */
-entry *
-parse_cron_entry(char *schedule)
+int
+parse_cron_entry(const char *schedule, int length, entry *e,
+				 parse_error *error)
 {
-	/* this function reads one crontab entry -- the next -- from a file.
-	 * it skips any leading blank lines, ignores comments, and returns
-	 * EOF if for any reason the entry can't be read and parsed.
-	 *
-	 * the entry is also parsed here.
+	/* this function parses one crontab entry.
+	 * it skips any leading blank lines and ignores comments.
 	 *
 	 * syntax:
 	 *   user crontab:
 	 *	minutes hours doms months dows cmd\n
-	 *   system crontab (/etc/crontab):
-	 *	minutes hours doms months dows USERNAME cmd\n
+	 *   interval:
+	 *	every number units [from start|end]
 	 */
 
 	ecode_e	ecode = e_none;
-	entry *e = NULL;
 	int	ch = 0;
-	char cmd[MAX_COMMAND];
-	file_buffer buffer = {{},0,0,{},0};
-	FILE *file = (FILE *) &buffer;
-
-	int scheduleLength = strlen(schedule); 
-	if (scheduleLength >= MAX_FILE_BUFFER_LENGTH)
-	{
-		ecode = e_cmd_len;
-		goto eof;
-	}
+	span_reader reader = {schedule, length, 0, 0};
 
-	strcpy(buffer.data, schedule);
-	buffer.length = scheduleLength;
-	buffer.pointer = 0;
+	memset(e, 0, sizeof(entry));
 
 	Debug(DPARS, ("load_entry()...about to eat comments\n"))
 
-	skip_comments(file);
-
-	ch = get_char(file);
-	if (ch == EOF)
-		return NULL;
+	ch = skip_comments(&reader);
+	if (ch == '\0') {
+		ecode = e_timespec;
+		goto eof;
+	}
 
 	/* ch is now the first useful character of a useful line.
 	 * it may be an @special or it may be the first character
 	 * of a list of minutes.
 	 */
 
-	e = (entry *) calloc(sizeof(entry), sizeof(char));
+	if (ch == 'e' || ch == 'E') {
+		/* not a wall clock schedule, but a fixed interval, which
+		 * leaves all the bit strings empty.
+		 */
+		ch = get_interval(e, ch, &reader);
+		if (ch == EOF) {
+			ecode = e_interval;
+			goto eof;
+		}
 
-	if (ch == '@') {
+		return TRUE;
+	} else if (ch == '@') {
 		/* all of these should be flagged and load-limited; i.e.,
 		 * instead of @hourly meaning "0 * * * *" it should mean
 		 * "close to the front of every hour but not 'til the
@@ -119,37 +120,51 @@ parse_cron_entry(char *schedule)
 		 * anymore.  too much for my overloaded brain. (vix, jan90)
 		 * HINT
 		 */
-		ch = get_string(cmd, MAX_COMMAND, file, " \t\n");
-		if (!strcmp("reboot", cmd)) {
+		int	start = reader.pointer;
+		int	len = 0;
+
+		ch = get_char(&reader);
+		while (ch != '\0' && ch != ' ' && ch != '\t' && ch != '\n') {
+			len++;
+			ch = get_char(&reader);
+		}
+
+		if (match_word(&reader, start, len, "reboot")) {
 			e->flags |= WHEN_REBOOT;
-		} else if (!strcmp("yearly", cmd) || !strcmp("annually", cmd)){
+		} else if (match_word(&reader, start, len, "manual")) {
+			/* only runs on demand or after the jobs it depends
+			 * on, which leaves all the bit strings empty.
+			 */
+		} else if (match_word(&reader, start, len, "yearly") ||
+			   match_word(&reader, start, len, "annually")) {
 			bit_set(e->minute, 0);
 			bit_set(e->hour, 0);
 			bit_set(e->dom, 0);
 			bit_set(e->month, 0);
 			bit_nset(e->dow, 0, (LAST_DOW-FIRST_DOW+1));
-                        e->flags |= DOW_STAR; 
-		} else if (!strcmp("monthly", cmd)) {
+			e->flags |= DOW_STAR;
+		} else if (match_word(&reader, start, len, "monthly")) {
 			bit_set(e->minute, 0);
 			bit_set(e->hour, 0);
 			bit_set(e->dom, 0);
 			bit_nset(e->month, 0, (LAST_MONTH-FIRST_MONTH+1));
 			bit_nset(e->dow, 0, (LAST_DOW-FIRST_DOW+1));
-                        e->flags |= DOW_STAR;
-		} else if (!strcmp("weekly", cmd)) {
+			e->flags |= DOW_STAR;
+		} else if (match_word(&reader, start, len, "weekly")) {
 			bit_set(e->minute, 0);
 			bit_set(e->hour, 0);
 			bit_nset(e->dom, 0, (LAST_DOM-FIRST_DOM+1));
 			e->flags |= DOM_STAR;
 			bit_nset(e->month, 0, (LAST_MONTH-FIRST_MONTH+1));
 			bit_nset(e->dow, 0,0);
-		} else if (!strcmp("daily", cmd) || !strcmp("midnight", cmd)) {
+		} else if (match_word(&reader, start, len, "daily") ||
+			   match_word(&reader, start, len, "midnight")) {
 			bit_set(e->minute, 0);
 			bit_set(e->hour, 0);
 			bit_nset(e->dom, 0, (LAST_DOM-FIRST_DOM+1));
 			bit_nset(e->month, 0, (LAST_MONTH-FIRST_MONTH+1));
 			bit_nset(e->dow, 0, (LAST_DOW-FIRST_DOW+1));
-		} else if (!strcmp("hourly", cmd)) {
+		} else if (match_word(&reader, start, len, "hourly")) {
 			bit_set(e->minute, 0);
 			bit_nset(e->hour, 0, (LAST_HOUR-FIRST_HOUR+1));
 			bit_nset(e->dom, 0, (LAST_DOM-FIRST_DOM+1));
@@ -157,6 +172,7 @@ parse_cron_entry(char *schedule)
 			bit_nset(e->dow, 0, (LAST_DOW-FIRST_DOW+1));
 			e->flags |= HR_STAR;
 		} else {
+			reader.position = start;
 			ecode = e_timespec;
 			goto eof;
 		}
@@ -166,7 +182,7 @@ parse_cron_entry(char *schedule)
 		if (ch == '*')
 			e->flags |= MIN_STAR;
 		ch = get_list(e->minute, FIRST_MINUTE, LAST_MINUTE,
-			      PPC_NULL, ch, file);
+			      PPC_NULL, ch, &reader);
 		if (ch == EOF) {
 			ecode = e_minute;
 			goto eof;
@@ -178,7 +194,7 @@ parse_cron_entry(char *schedule)
 		if (ch == '*')
 			e->flags |= HR_STAR;
 		ch = get_list(e->hour, FIRST_HOUR, LAST_HOUR,
-			      PPC_NULL, ch, file);
+			      PPC_NULL, ch, &reader);
 		if (ch == EOF) {
 			ecode = e_hour;
 			goto eof;
@@ -190,7 +206,7 @@ parse_cron_entry(char *schedule)
 		if (ch == '*')
 			e->flags |= DOM_STAR;
 		ch = get_list(e->dom, FIRST_DOM, LAST_DOM,
-			      PPC_NULL, ch, file);
+			      PPC_NULL, ch, &reader);
 		if (ch == EOF) {
 			ecode = e_dom;
 			goto eof;
@@ -200,7 +216,7 @@ parse_cron_entry(char *schedule)
 		 */
 
 		ch = get_list(e->month, FIRST_MONTH, LAST_MONTH,
-			      MonthNames, ch, file);
+			      MonthNames, ch, &reader);
 		if (ch == EOF) {
 			ecode = e_month;
 			goto eof;
@@ -212,9 +228,9 @@ parse_cron_entry(char *schedule)
 		if (ch == '*')
 			e->flags |= DOW_STAR;
 		ch = get_list(e->dow, FIRST_DOW, LAST_DOW,
-			      DowNames, ch, file);
+			      DowNames, ch, &reader);
 		if (ch == EOF) {
-			ecode = e_month;
+			ecode = e_dow;
 			goto eof;
 		}
 	}
@@ -225,28 +241,98 @@ parse_cron_entry(char *schedule)
 		bit_set(e->dow, 7);
 	}
 
-	/* success, fini, return pointer to the entry we just created...
+	/* success, fini, the entry is filled in.
 	 */
-	return e;
+	return TRUE;
 
  eof:
-	elog(LOG, "failed to parse entry %d", ecode);
-	if (e->cmd)
-		free(e->cmd);
-	free(e);
-	while (ch != EOF && ch != '\n')
-		ch = get_char(file);
-	return NULL;
+	if (error != NULL) {
+		error->ecode = ecode;
+		error->position = reader.position;
+	}
+	memset(e, 0, sizeof(entry));
+	return FALSE;
 }
 
 
-static char
-get_list(bits, low, high, names, ch, file)
+/* get_char(reader) : like getc() on the span, returns '\0' at the end
+ */
+static int
+get_char(reader)
+	span_reader	*reader;
+{
+	if (reader->pointer >= reader->length) {
+		reader->position = reader->length;
+		return '\0';
+	}
+
+	reader->position = reader->pointer;
+	return (unsigned char) reader->data[reader->pointer++];
+}
+
+
+/* skip_comments(reader) : read past blank lines and comments (if any),
+ *	returns the first non-blank character of the first useful line
+ */
+static int
+skip_comments(reader)
+	span_reader	*reader;
+{
+	int	ch;
+
+	while ('\0' != (ch = get_char(reader))) {
+		/* ch is now the first character of a line.
+		 */
+
+		while (ch == ' ' || ch == '\t')
+			ch = get_char(reader);
+
+		if (ch == '\0')
+			break;
+
+		/* ch is now the first non-blank character of a line.
+		 */
+
+		if (ch != '\n' && ch != '#')
+			break;
+
+		/* ch must be a newline or comment as first non-blank
+		 * character on a line.
+		 */
+
+		while (ch != '\n' && ch != '\0')
+			ch = get_char(reader);
+
+		/* ch is now the newline of a line which we're going to
+		 * ignore.
+		 */
+	}
+
+	return ch;
+}
+
+
+/* match_word(reader, start, len, word) : whether the len characters at
+ *	offset start of the span are equal to word, ignoring case
+ */
+static int
+match_word(reader, start, len, word)
+	span_reader	*reader;
+	int		start, len;
+	const char	*word;
+{
+	return (strlen(word) == (size_t) len &&
+		pg_strncasecmp(reader->data + start, word, len) == 0);
+}
+
+
+static int
+get_list(bits, low, high, names, ch, reader)
 	bitstr_t	*bits;		/* one bit per flag, default=FALSE */
 	int		low, high;	/* bounds, impl. offset for bitstr */
 	char		*names[];	/* NULL or *[] of names for these elements */
 	int		ch;		/* current character being processed */
-	FILE		*file;		/* file being read */
+	span_reader	*reader;	/* span being read */
 {
 	register int	done;
 
@@ -269,17 +355,20 @@ get_list(bits, low, high, names, ch, file)
 	 */
 	done = FALSE;
 	while (!done) {
-		ch = get_range(bits, low, high, names, ch, file);
+		ch = get_range(bits, low, high, names, ch, reader);
 		if (ch == ',')
-			ch = get_char(file);
+			ch = get_char(reader);
 		else
 			done = TRUE;
 	}
 
+	if (ch == EOF)
+		return EOF;
+
 	/* exiting.  skip to some blanks, then skip over the blanks.
 	 */
-	Skip_Nonblanks(ch, file)
-	Skip_Blanks(ch, file)
+	Skip_Nonblanks(ch, reader)
+	Skip_Blanks(ch, reader)
 
 	Debug(DPARS|DEXT, ("get_list()...exiting w/ %02x\n", ch))
 
@@ -287,13 +376,13 @@ get_list(bits, low, high, names, ch, file)
 }
 
 
-static char
-get_range(bits, low, high, names, ch, file)
+static int
+get_range(bits, low, high, names, ch, reader)
 	bitstr_t	*bits;		/* one bit per flag, default=FALSE */
 	int		low, high;	/* bounds, impl. offset for bitstr */
 	char		*names[];	/* NULL or names of elements */
 	int		ch;		/* current character being processed */
-	FILE 		*file;		/* file being read */
+	span_reader	*reader;	/* span being read */
 {
 	/* range = number | number "-" number [ "/" number ]
 	 */
@@ -308,11 +397,11 @@ get_range(bits, low, high, names, ch, file)
 		 */
 		num1 = low;
 		num2 = high;
-		ch = get_char(file);
+		ch = get_char(reader);
 		if (ch == EOF)
 			return EOF;
 	} else {
-		if (EOF == (ch = get_number(&num1, low, names, ch, file)))
+		if (EOF == (ch = get_number(&num1, low, names, ch, reader)))
 			return EOF;
 
 		if (ch != '-') {
@@ -331,13 +420,13 @@ get_range(bits, low, high, names, ch, file)
 		} else {
 			/* eat the dash
 			 */
-			ch = get_char(file);
+			ch = get_char(reader);
 			if (ch == EOF)
 				return EOF;
 
 			/* get the number following the dash
 			 */
-			ch = get_number(&num2, low, names, ch, file);
+			ch = get_number(&num2, low, names, ch, reader);
 			if (ch == EOF)
 				return EOF;
 		}
@@ -348,7 +437,7 @@ get_range(bits, low, high, names, ch, file)
 	if (ch == '/') {
 		/* eat the slash
 		 */
-		ch = get_char(file);
+		ch = get_char(reader);
 		if (ch == EOF)
 			return EOF;
 
@@ -357,7 +446,7 @@ get_range(bits, low, high, names, ch, file)
 		 * element id, it's a step size.  'low' is
 		 * sent as a 0 since there is no offset either.
 		 */
-		ch = get_number(&num3, 0, PPC_NULL, ch, file);
+		ch = get_number(&num3, 0, PPC_NULL, ch, reader);
 		if (ch == EOF || num3 <= 0)
 			return EOF;
 	} else {
@@ -390,34 +479,32 @@ get_range(bits, low, high, names, ch, file)
 }
 
 
-static char
-get_number(numptr, low, names, ch, file)
+static int
+get_number(numptr, low, names, ch, reader)
 	int	*numptr;	/* where does the result go? */
 	int	low;		/* offset applied to result if symbolic enum used */
 	char	*names[];	/* symbolic names, if any, for enums */
 	int	ch;		/* current character */
-	FILE 		*file;		/* source */
+	span_reader	*reader;	/* source */
 {
-	char	temp[MAX_TEMPSTR], *pc;
-	int	len, i, all_digits;
+	int	start, len, i, all_digits, value;
 
-	/* collect alphanumerics into our fixed-size temp array
+	/* scan the alphanumerics in place, computing the magnitude as
+	 * we go, but without letting it grow past MAX_NUMBER
 	 */
-	pc = temp;
+	start = reader->position;
 	len = 0;
+	value = 0;
 	all_digits = TRUE;
 	while (isalnum(ch)) {
-		if (++len >= MAX_TEMPSTR)
-			return EOF;
-
-		*pc++ = ch;
-
 		if (!isdigit(ch))
 			all_digits = FALSE;
+		else if (value <= MAX_NUMBER)
+			value = value * 10 + (ch - '0');
 
-		ch = get_char(file);
+		len++;
+		ch = get_char(reader);
 	}
-	*pc = '\0';
 
         if (len == 0) {
             return EOF;
@@ -427,9 +514,7 @@ get_number(numptr, low, names, ch, file)
 	 */
 	if (names) {
 		for (i = 0;  names[i] != NULL;  i++) {
-			Debug(DPARS|DEXT,
-				("get_num, compare(%s,%s)\n", names[i], temp))
-			if (!strcasecmp(names[i], temp)) {
+			if (match_word(reader, start, len, names[i])) {
 				*numptr = i+low;
 				return ch;
 			}
@@ -441,7 +526,7 @@ get_number(numptr, low, names, ch, file)
 	 * otherwise, it's an error.
 	 */
 	if (all_digits) {
-		*numptr = atoi(temp);
+		*numptr = value;
 		return ch;
 	}
 
@@ -449,6 +534,102 @@ get_number(numptr, low, names, ch, file)
 }
 
 
+/* get_interval(e, ch, reader) : parse "every number units [from start|end]"
+ *	where units are seconds, minutes or hours, and fill in e.  returns
+ *	EOF on error, with the reader positioned at the offending character.
+ */
+static int
+get_interval(e, ch, reader)
+	entry		*e;
+	int		ch;
+	span_reader	*reader;
+{
+	int	start, len, number, unit;
+
+	ch = get_word(&start, &len, ch, reader);
+	if (!match_word(reader, start, len, "every")) {
+		reader->position = start;
+		return EOF;
+	}
+	Skip_Blanks(ch, reader)
+
+	start = reader->position;
+	ch = get_number(&number, 0, PPC_NULL, ch, reader);
+	if (ch == EOF || number <= 0 || number > MAX_NUMBER) {
+		reader->position = start;
+		return EOF;
+	}
+	Skip_Blanks(ch, reader)
+
+	ch = get_word(&start, &len, ch, reader);
+	if (match_word(reader, start, len, "second") ||
+	    match_word(reader, start, len, "seconds")) {
+		unit = 1;
+	} else if (match_word(reader, start, len, "minute") ||
+		   match_word(reader, start, len, "minutes")) {
+		unit = SECONDS_PER_MINUTE;
+	} else if (match_word(reader, start, len, "hour") ||
+		   match_word(reader, start, len, "hours")) {
+		unit = 60 * SECONDS_PER_MINUTE;
+	} else {
+		reader->position = start;
+		return EOF;
+	}
+	Skip_Blanks(ch, reader)
+
+	e->flags |= WHEN_INTERVAL;
+	e->interval = number * unit;
+
+	/* optional anchor, the start of the last run by default
+	 */
+	if (ch != '\0') {
+		ch = get_word(&start, &len, ch, reader);
+		if (!match_word(reader, start, len, "from")) {
+			reader->position = start;
+			return EOF;
+		}
+		Skip_Blanks(ch, reader)
+
+		ch = get_word(&start, &len, ch, reader);
+		if (match_word(reader, start, len, "end")) {
+			e->flags |= INTERVAL_FROM_END;
+		} else if (!match_word(reader, start, len, "start")) {
+			reader->position = start;
+			return EOF;
+		}
+		Skip_Blanks(ch, reader)
+	}
+
+	/* nothing may follow an interval
+	 */
+	if (ch != '\0')
+		return EOF;
+
+	return ch;
+}
+
+
+/* get_word(startptr, lenptr, ch, reader) : scan the letters starting at
+ *	ch in place, returns the character that follows them
+ */
+static int
+get_word(startptr, lenptr, ch, reader)
+	int		*startptr, *lenptr;
+	int		ch;
+	span_reader	*reader;
+{
+	*startptr = reader->position;
+	*lenptr = 0;
+
+	while (isalpha(ch)) {
+		(*lenptr)++;
+		ch = get_char(reader);
+	}
+
+	return ch;
+}
+
+
 static int
 set_element(bits, low, high, number)
 	bitstr_t	*bits; 		/* one bit per flag, default=FALSE */
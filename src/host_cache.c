@@ -0,0 +1,424 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/host_cache.c
+ *
+ * Cache of the addresses that node names resolve to. libpq resolves the
+ * host of a connection synchronously, which would block the scheduler on
+ * a slow resolver for every run. Instead, node names are resolved once
+ * per cron.host_cache_ttl and the addresses are passed as hostaddr.
+ *
+ * Where the C library provides getaddrinfo_a, names are resolved in the
+ * background. Lookups are started without any notification, and the main
+ * loop checks whether they completed, such that the scheduler never waits
+ * for the resolver and no signal handlers are involved. An entry that
+ * expired keeps being used while it is refreshed, and also when the
+ * refresh fails. Elsewhere, names are resolved synchronously.
+ *
+ * Names that cannot be resolved are looked up again after a delay that
+ * doubles with every failure, up to cron.host_cache_ttl.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "host_cache.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "lib/stringinfo.h"
+#include "libpq-fe.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* getaddrinfo_a is a GNU extension */
+#if defined(__GLIBC__) && defined(GAI_NOWAIT)
+#define HAVE_ASYNC_LOOKUP
+#endif
+
+#define MAX_HOST_NAME_LENGTH 256
+
+/* failed lookups are repeated sooner than successful ones, at first */
+#define FAILED_LOOKUP_TTL 5000
+#define MAX_FAILED_LOOKUP_SHIFT 10
+
+/* how often lookups in flight are checked for completion */
+#define LOOKUP_CHECK_INTERVAL 20
+
+/* libpq accepts lists of hosts as of version 10, and then we pass up to 8 */
+#define MAX_HOST_ADDRESSES 8
+
+
+typedef struct HostCacheEntry
+{
+	char nodeName[MAX_HOST_NAME_LENGTH];
+	bool isResolved;
+	bool lookupPending;
+	int failureCount;
+	char *hostList;
+	char *hostAddrList;
+	TimestampTz expiryTime;
+} HostCacheEntry;
+
+
+#ifdef HAVE_ASYNC_LOOKUP
+
+/*
+ * HostLookup is a lookup that getaddrinfo_a resolves in the background.
+ * The request, the name and the hints must stay valid until it completes.
+ */
+typedef struct HostLookup
+{
+	struct HostLookup *next;
+	char nodeName[MAX_HOST_NAME_LENGTH];
+	struct addrinfo hints;
+	struct gaicb request;
+} HostLookup;
+
+#endif
+
+
+/* forward declarations */
+static void StartHostLookup(HostCacheEntry *cacheEntry, TimestampTz currentTime);
+static void CompleteHostLookup(HostCacheEntry *cacheEntry, int lookupResult,
+							   struct addrinfo *addressList,
+							   TimestampTz currentTime);
+static int MaxHostAddresses(void);
+
+/* global settings */
+int HostCacheTTL = 60000;
+
+/* global variables */
+static MemoryContext HostCacheContext = NULL;
+static HTAB *HostCacheHash = NULL;
+
+#ifdef HAVE_ASYNC_LOOKUP
+static HostLookup *LookupsInFlight = NULL;
+#endif
+
+
+/*
+ * InitializeHostCache creates the hash that holds the resolved addresses
+ * of node names.
+ */
+void
+InitializeHostCache(void)
+{
+	HASHCTL info;
+	int hashFlags = 0;
+
+	HostCacheContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "pg_cron host cache context",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = MAX_HOST_NAME_LENGTH;
+	info.entrysize = sizeof(HostCacheEntry);
+	info.hcxt = HostCacheContext;
+	hashFlags = (HASH_ELEM | HASH_CONTEXT);
+
+	HostCacheHash = hash_create("pg_cron host cache", 32, &info, hashFlags);
+}
+
+
+/*
+ * LookupHostAddresses returns the host and hostaddr values to connect to
+ * the given node. The hostaddr list is NULL if libpq should resolve the
+ * name itself. A name that is not in the cache yet starts a lookup and
+ * HOST_LOOKUP_PENDING is returned, in which case the caller tries again
+ * at NextHostLookupCheckTime. An expired entry is refreshed in the
+ * background while its addresses are returned.
+ */
+HostLookupResult
+LookupHostAddresses(char *nodeName, TimestampTz currentTime, char **hostList,
+					char **hostAddrList)
+{
+	HostCacheEntry *cacheEntry = NULL;
+	bool isPresent = false;
+
+	*hostList = nodeName;
+	*hostAddrList = NULL;
+
+	/* Unix-domain socket directories and long names are not cached */
+	if (HostCacheTTL <= 0 || nodeName[0] == '/' || nodeName[0] == '\0' ||
+		strlen(nodeName) >= MAX_HOST_NAME_LENGTH)
+	{
+		return HOST_LOOKUP_DONE;
+	}
+
+	CompleteHostLookups(currentTime);
+
+	cacheEntry = hash_search(HostCacheHash, nodeName, HASH_ENTER, &isPresent);
+	if (!isPresent)
+	{
+		cacheEntry->isResolved = false;
+		cacheEntry->lookupPending = false;
+		cacheEntry->failureCount = 0;
+		cacheEntry->hostList = NULL;
+		cacheEntry->hostAddrList = NULL;
+		cacheEntry->expiryTime = 0;
+	}
+
+	if (!cacheEntry->lookupPending &&
+		(!isPresent || currentTime >= cacheEntry->expiryTime))
+	{
+		StartHostLookup(cacheEntry, currentTime);
+	}
+
+	if (!cacheEntry->isResolved)
+	{
+		/* the name was never resolved, or failed until the lookup in flight */
+		return cacheEntry->lookupPending ? HOST_LOOKUP_PENDING :
+			   HOST_LOOKUP_FAILED;
+	}
+
+	if (cacheEntry->hostAddrList != NULL)
+	{
+		*hostList = cacheEntry->hostList;
+		*hostAddrList = cacheEntry->hostAddrList;
+	}
+
+	return HOST_LOOKUP_DONE;
+}
+
+
+/*
+ * NextHostLookupCheckTime sets checkTime to the time at which the lookups
+ * in flight should be checked for completion, and returns whether there
+ * are any.
+ */
+bool
+NextHostLookupCheckTime(TimestampTz currentTime, TimestampTz *checkTime)
+{
+#ifdef HAVE_ASYNC_LOOKUP
+	if (LookupsInFlight != NULL)
+	{
+		*checkTime = TimestampTzPlusMilliseconds(currentTime,
+												 LOOKUP_CHECK_INTERVAL);
+		return true;
+	}
+#endif
+
+	return false;
+}
+
+
+/*
+ * CompleteHostLookups stores the results of the lookups that completed in
+ * the cache. It only asks whether each lookup is done, and never waits.
+ */
+void
+CompleteHostLookups(TimestampTz currentTime)
+{
+#ifdef HAVE_ASYNC_LOOKUP
+	HostLookup **lookupPointer = &LookupsInFlight;
+
+	while (*lookupPointer != NULL)
+	{
+		HostLookup *lookup = *lookupPointer;
+		HostCacheEntry *cacheEntry = NULL;
+		int lookupResult = gai_error(&lookup->request);
+		bool isPresent = false;
+
+		if (lookupResult == EAI_INPROGRESS)
+		{
+			lookupPointer = &lookup->next;
+			continue;
+		}
+
+		*lookupPointer = lookup->next;
+
+		cacheEntry = hash_search(HostCacheHash, lookup->nodeName, HASH_FIND,
+								 &isPresent);
+		if (isPresent)
+		{
+			CompleteHostLookup(cacheEntry, lookupResult,
+							   lookup->request.ar_result, currentTime);
+		}
+
+		if (lookup->request.ar_result != NULL)
+		{
+			freeaddrinfo(lookup->request.ar_result);
+		}
+
+		pfree(lookup);
+	}
+#endif
+}
+
+
+/*
+ * StartHostLookup starts to resolve the name of the given entry in the
+ * background or, if that is not possible, resolves it right away.
+ */
+static void
+StartHostLookup(HostCacheEntry *cacheEntry, TimestampTz currentTime)
+{
+	struct addrinfo hints;
+	struct addrinfo *addressList = NULL;
+	int lookupResult = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+#ifdef HAVE_ASYNC_LOOKUP
+	{
+		HostLookup *lookup = (HostLookup *)
+			MemoryContextAllocZero(HostCacheContext, sizeof(HostLookup));
+		struct gaicb *requestList[1];
+
+		strlcpy(lookup->nodeName, cacheEntry->nodeName, MAX_HOST_NAME_LENGTH);
+		lookup->hints = hints;
+		lookup->request.ar_name = lookup->nodeName;
+		lookup->request.ar_request = &lookup->hints;
+		requestList[0] = &lookup->request;
+
+		/* without a sigevent, completion is only seen through gai_error */
+		if (getaddrinfo_a(GAI_NOWAIT, requestList, 1, NULL) == 0)
+		{
+			lookup->next = LookupsInFlight;
+			LookupsInFlight = lookup;
+			cacheEntry->lookupPending = true;
+			return;
+		}
+
+		/* the lookup could not be queued, resolve the name right away */
+		pfree(lookup);
+	}
+#endif
+
+	lookupResult = getaddrinfo(cacheEntry->nodeName, NULL, &hints, &addressList);
+
+	CompleteHostLookup(cacheEntry, lookupResult, addressList, currentTime);
+
+	if (addressList != NULL)
+	{
+		freeaddrinfo(addressList);
+	}
+}
+
+
+/*
+ * CompleteHostLookup stores the numeric addresses of a completed lookup in
+ * the given cache entry, along with a host list of the same length as libpq
+ * requires, and sets the time at which the entry expires. A failed lookup
+ * keeps the addresses of the entry, if it had any. When libpq cannot take
+ * all the addresses of a name, the name is left to libpq, which tries each
+ * of them in turn.
+ */
+static void
+CompleteHostLookup(HostCacheEntry *cacheEntry, int lookupResult,
+				   struct addrinfo *addressList, TimestampTz currentTime)
+{
+	MemoryContext oldContext = NULL;
+	struct addrinfo *address = NULL;
+	StringInfoData hostList;
+	StringInfoData hostAddrList;
+	int maxAddressCount = MaxHostAddresses();
+	int addressCount = 0;
+
+	cacheEntry->lookupPending = false;
+
+	if (lookupResult != 0)
+	{
+		int failedLookupTTL = 0;
+
+		cacheEntry->failureCount++;
+		failedLookupTTL = FAILED_LOOKUP_TTL <<
+						  Min(cacheEntry->failureCount - 1, MAX_FAILED_LOOKUP_SHIFT);
+
+		ereport(LOG, (errmsg("pg_cron could not resolve host %s: %s",
+							 cacheEntry->nodeName, gai_strerror(lookupResult)),
+					  cacheEntry->isResolved ?
+					  errdetail("The previous addresses are used until the "
+								"host can be resolved.") : 0));
+
+		cacheEntry->expiryTime =
+			TimestampTzPlusMilliseconds(currentTime,
+										Min(HostCacheTTL, failedLookupTTL));
+		return;
+	}
+
+	if (cacheEntry->hostList != NULL)
+	{
+		pfree(cacheEntry->hostList);
+		pfree(cacheEntry->hostAddrList);
+		cacheEntry->hostList = NULL;
+		cacheEntry->hostAddrList = NULL;
+	}
+
+	cacheEntry->isResolved = true;
+	cacheEntry->failureCount = 0;
+	cacheEntry->expiryTime = TimestampTzPlusMilliseconds(currentTime,
+														 HostCacheTTL);
+
+	oldContext = MemoryContextSwitchTo(HostCacheContext);
+
+	initStringInfo(&hostList);
+	initStringInfo(&hostAddrList);
+
+	for (address = addressList; address != NULL; address = address->ai_next)
+	{
+		char addressString[NI_MAXHOST];
+
+		if (getnameinfo(address->ai_addr, address->ai_addrlen, addressString,
+						sizeof(addressString), NULL, 0, NI_NUMERICHOST) != 0)
+		{
+			continue;
+		}
+
+		if (addressCount == maxAddressCount)
+		{
+			/* only the first addresses fit, which is fine for a long list */
+			addressCount++;
+			break;
+		}
+
+		if (addressCount > 0)
+		{
+			appendStringInfoChar(&hostList, ',');
+			appendStringInfoChar(&hostAddrList, ',');
+		}
+
+		appendStringInfoString(&hostList, cacheEntry->nodeName);
+		appendStringInfoString(&hostAddrList, addressString);
+		addressCount++;
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	/*
+	 * Leave the name to libpq if it has no addresses, or if libpq can only
+	 * take one and there are more, such that it can try each of them.
+	 */
+	if (addressCount == 0 || (maxAddressCount == 1 && addressCount > 1))
+	{
+		pfree(hostList.data);
+		pfree(hostAddrList.data);
+		return;
+	}
+
+	cacheEntry->hostList = hostList.data;
+	cacheEntry->hostAddrList = hostAddrList.data;
+}
+
+
+/*
+ * MaxHostAddresses returns the number of addresses that can be passed to
+ * libpq for a single connection. Lists of hosts were added in libpq 10,
+ * which need not match the version of the server we are built for.
+ */
+static int
+MaxHostAddresses(void)
+{
+	return PQlibVersion() >= 100000 ? MAX_HOST_ADDRESSES : 1;
+}
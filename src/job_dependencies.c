@@ -0,0 +1,226 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/job_dependencies.c
+ *
+ * Starts jobs when the jobs they depend on have completed successfully.
+ * A map from each job to the tasks of the jobs that depend on it is
+ * rebuilt whenever the job cache is reloaded, such that dependent runs
+ * can be started directly when a run completes.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "cron.h"
+#include "pg_cron.h"
+#include "job_dependencies.h"
+#include "job_metadata.h"
+#include "task_states.h"
+
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* tasks of the jobs that depend on a given job */
+typedef struct DependentTasks
+{
+	int64 jobId;
+	List *taskList;
+} DependentTasks;
+
+
+/* forward declarations */
+static HTAB * CreateDependentTaskHash(void);
+static bool DependenciesMet(CronTask *task);
+
+/* global variables */
+static MemoryContext CronDependencyContext = NULL;
+static HTAB *DependentTaskHash = NULL;
+
+
+/*
+ * InitializeJobDependencies creates the memory context for the map of
+ * dependent tasks.
+ */
+void
+InitializeJobDependencies(void)
+{
+	CronDependencyContext = AllocSetContextCreate(CurrentMemoryContext,
+												  "pg_cron dependency context",
+												  ALLOCSET_DEFAULT_MINSIZE,
+												  ALLOCSET_DEFAULT_INITSIZE,
+												  ALLOCSET_DEFAULT_MAXSIZE);
+
+	DependentTaskHash = CreateDependentTaskHash();
+}
+
+
+/*
+ * CreateDependentTaskHash creates the hash that maps a job ID to the tasks
+ * of the jobs that depend on it.
+ */
+static HTAB *
+CreateDependentTaskHash(void)
+{
+	HTAB *dependentTaskHash = NULL;
+	HASHCTL info;
+	int hashFlags = 0;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(int64);
+	info.entrysize = sizeof(DependentTasks);
+	info.hash = tag_hash;
+	info.hcxt = CronDependencyContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	dependentTaskHash = hash_create("pg_cron dependent tasks", 32, &info,
+									hashFlags);
+
+	return dependentTaskHash;
+}
+
+
+/*
+ * RebuildJobDependencies replaces the map of dependent tasks by one over
+ * the given tasks. The tasks must remain valid until the next rebuild, as
+ * for the schedule indexes.
+ */
+void
+RebuildJobDependencies(List *taskList)
+{
+	MemoryContext oldContext = NULL;
+	ListCell *taskCell = NULL;
+
+	MemoryContextResetAndDeleteChildren(CronDependencyContext);
+
+	DependentTaskHash = CreateDependentTaskHash();
+
+	oldContext = MemoryContextSwitchTo(CronDependencyContext);
+
+	foreach(taskCell, taskList)
+	{
+		CronTask *task = (CronTask *) lfirst(taskCell);
+		CronJob *cronJob = task->cronJob;
+		int dependencyIndex = 0;
+
+		if (cronJob == NULL)
+		{
+			continue;
+		}
+
+		for (dependencyIndex = 0; dependencyIndex < cronJob->dependsOnCount;
+			 dependencyIndex++)
+		{
+			int64 upstreamJobId = cronJob->dependsOn[dependencyIndex];
+			bool isPresent = false;
+			DependentTasks *dependents = hash_search(DependentTaskHash,
+													 &upstreamJobId,
+													 HASH_ENTER, &isPresent);
+
+			if (!isPresent)
+			{
+				dependents->taskList = NIL;
+			}
+
+			dependents->taskList = lappend(dependents->taskList, task);
+		}
+	}
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * StartDependentRuns records that a run of the given task completed
+ * successfully and adds a pending run to each task of a job that depends
+ * on it, if all the jobs that the dependent job depends on have completed
+ * successfully since its last run was started this way. Dependents that
+ * are running are left alone, since their runs are dropped when they
+ * finish, and check their dependencies again at that point.
+ */
+void
+StartDependentRuns(CronTask *task, TimestampTz currentTime)
+{
+	DependentTasks *dependents = NULL;
+	ListCell *dependentCell = NULL;
+	bool isPresent = false;
+
+	task->lastSuccessTime = currentTime;
+
+	dependents = hash_search(DependentTaskHash, &task->jobId, HASH_FIND,
+							 &isPresent);
+	if (dependents == NULL)
+	{
+		return;
+	}
+
+	foreach(dependentCell, dependents->taskList)
+	{
+		CronTask *dependentTask = (CronTask *) lfirst(dependentCell);
+
+		if (dependentTask->state != CRON_TASK_WAITING)
+		{
+			continue;
+		}
+
+		StartDependentRunIfMet(dependentTask, currentTime);
+	}
+}
+
+
+/*
+ * StartDependentRunIfMet adds a pending run to the given task if all the
+ * jobs that its job depends on have completed successfully since its last
+ * run was started this way. It is called when the task returns to the
+ * waiting state, to start the run that was due while it ran.
+ */
+void
+StartDependentRunIfMet(CronTask *task, TimestampTz currentTime)
+{
+	if (!task->isActive || !DependenciesMet(task))
+	{
+		return;
+	}
+
+	task->dependenciesMetTime = currentTime;
+	task->pendingRunCount += 1;
+	MarkTaskRunnable(task);
+}
+
+
+/*
+ * DependenciesMet returns whether every job that the job of the given task
+ * depends on completed successfully since the dependencies of the task
+ * were last met. Jobs that are not scheduled on this server never do, and
+ * jobs without dependencies never have them met.
+ */
+static bool
+DependenciesMet(CronTask *task)
+{
+	CronJob *cronJob = task->cronJob;
+	int dependencyIndex = 0;
+
+	if (cronJob == NULL || cronJob->dependsOnCount == 0)
+	{
+		return false;
+	}
+
+	for (dependencyIndex = 0; dependencyIndex < cronJob->dependsOnCount;
+		 dependencyIndex++)
+	{
+		CronTask *upstreamTask = FindCronTask(cronJob->dependsOn[dependencyIndex]);
+
+		if (upstreamTask == NULL ||
+			upstreamTask->lastSuccessTime <= task->dependenciesMetTime)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -16,9 +16,16 @@
 #include "cron.h"
 #include "pg_cron.h"
 #include "job_metadata.h"
+#include "job_output.h"
 #include "cron_job.h"
+#include "node_groups.h"
+#include "scheduler_lease.h"
+#include "shared_state.h"
+#include "task_queue.h"
+#include "time_zones.h"
 
 #include "access/genam.h"
+#include "access/hash.h"
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/skey.h"
@@ -27,13 +34,20 @@
 #include "catalog/pg_extension.h"
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_type.h"
 #include "commands/extension.h"
 #include "commands/sequence.h"
 #include "commands/trigger.h"
+#include "executor/executor.h"
+#include "lib/stringinfo.h"
 #include "postmaster/postmaster.h"
 #include "pgstat.h"
+#include "pgtime.h"
+#include "rewrite/rewriteHandler.h"
 #include "storage/lock.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
 #include "utils/fmgroids.h"
 #include "utils/inval.h"
 #include "utils/lsyscache.h"
@@ -42,6 +56,7 @@
 #include "utils/relcache.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 
 
 #define EXTENSION_NAME "pg_cron"
@@ -50,31 +65,118 @@
 #define JOB_ID_INDEX_NAME "job_pkey"
 #define JOB_ID_SEQUENCE_NAME "cron.jobid_seq"
 
+/* strings of jobs are copied into blocks of this size, unless they are large */
+#define JOB_ARENA_BLOCK_SIZE (64 * 1024)
+#define JOB_ARENA_MAX_STRING_SIZE (JOB_ARENA_BLOCK_SIZE / 4)
+
+
+/*
+ * SerializedSchedule is the layout of the schedule_bits column of cron.job,
+ * which holds a parsed schedule along with a hash of the schedule text it
+ * was parsed from, such that schedules changed by hand are detected.
+ */
+typedef struct SerializedSchedule
+{
+	uint32 version;
+	uint32 scheduleHash;
+	int32 flags;
+	int32 interval;
+	bitstr_t bit_decl(minute, MINUTE_COUNT);
+	bitstr_t bit_decl(hour, HOUR_COUNT);
+	bitstr_t bit_decl(dom, DOM_COUNT);
+	bitstr_t bit_decl(month, MONTH_COUNT);
+	bitstr_t bit_decl(dow, DOW_COUNT);
+} SerializedSchedule;
+
+
+/*
+ * InternedString is an entry in the hash of strings that are shared by
+ * the jobs in the cache, such as node names, databases and user names.
+ * The key points into the tuple while looking up and into the arena once
+ * the string has been added.
+ */
+typedef struct InternedStringKey
+{
+	const char *data;
+	int length;
+} InternedStringKey;
+
+typedef struct InternedString
+{
+	InternedStringKey key;
+	char *string;
+} InternedString;
+
+
+/* a job and the jobs it depends on, used to find dependency cycles */
+typedef struct JobDependencyNode
+{
+	int64 jobId;
+	int64 *dependsOn;
+	int dependsOnCount;
+	bool isVisited;
+} JobDependencyNode;
+
 
 /* forward declarations */
 static HTAB * CreateCronJobHash(void);
+static HTAB * CreateInternedStringHash(void);
+static uint32 InternedStringHashFunction(const void *key, Size keySize);
+static int InternedStringMatch(const void *key, const void *otherKey,
+							   Size keySize);
+static char * InternText(Datum textDatum);
+static char * CopyTextToArena(Datum textDatum);
+static char * ArenaStrndup(const char *data, int length);
+static bytea * SerializeSchedule(entry *schedule, const char *scheduleText,
+								 int scheduleLength);
+static bool DeserializeSchedule(bytea *scheduleBits, const char *scheduleText,
+								int scheduleLength, entry *schedule);
 
 static int64 NextJobId(void);
-static Oid CronExtensionOwner(void);
+static void SetColumnDefaults(Relation relation, Datum *values, bool *isNulls,
+							  bool *useDefaults);
+static void EnsureJobAdministrator(const char *argumentName);
+static void EnsureJobOwner(TupleDesc tupleDescriptor, HeapTuple heapTuple,
+						   AclMode mode);
+static void ArrayToJobIds(ArrayType *jobIdArray, int64 **jobIds, int *jobIdCount);
+static void EnsureValidDependencies(Relation cronJobsTable, int64 jobId,
+									int64 *dependsOn, int dependsOnCount);
+static bool JobDependsOn(HTAB *dependencyHash, int64 jobId, int64 targetJobId);
+static void EnsureValidSqlStates(ArrayType *sqlStateArray);
+static void EnsureValidSettings(ArrayType *settingsArray);
+static char * SettingsToConnectionOptions(ArrayType *settingsArray);
+static CronJobLogLevel ParseJobLogLevel(char *logLevelName);
+static int64 IntervalToMilliseconds(Interval *interval);
 static void InvalidateJobCacheCallback(Datum argument, Oid relationId);
 static void InvalidateJobCache(void);
+static void JobCacheXactCallback(XactEvent event, void *arg);
 static Oid CronJobRelationId(void);
 
+static bool JobIsSelected(TupleDesc tupleDescriptor, HeapTuple heapTuple,
+						  CronJobSelection jobSelection);
 static CronJob * TupleToCronJob(TupleDesc tupleDescriptor, HeapTuple heapTuple);
-static bool PgCronHasBeenLoaded(void);
 
 
 /* SQL-callable functions */
 PG_FUNCTION_INFO_V1(cron_schedule);
 PG_FUNCTION_INFO_V1(cron_unschedule);
+PG_FUNCTION_INFO_V1(cron_alter_job);
+PG_FUNCTION_INFO_V1(cron_run_now);
 PG_FUNCTION_INFO_V1(cron_job_cache_invalidate);
 
 
 /* global variables */
 static MemoryContext CronJobContext = NULL;
 static HTAB *CronJobHash = NULL;
+static HTAB *InternedStringHash = NULL;
+static char *JobArenaBlock = NULL;
+static Size JobArenaFreeSize = 0;
+static Size JobArenaUsedSize = 0;	/* bytes of strings copied, large ones too */
 static Oid CachedCronJobRelationId = InvalidOid;
+static bool JobCacheXactCallbackRegistered = false;
+static bool JobReloadPending = false;
 bool CronJobCacheValid = false;
+CronJobSelection LoadedJobSelection = CRON_JOBS_NONE;
 
 
 /*
@@ -94,6 +196,7 @@ InitializeJobMetadataCache(void)
 										   ALLOCSET_DEFAULT_MAXSIZE);
 
 	CronJobHash = CreateCronJobHash();
+	InternedStringHash = CreateInternedStringHash();
 }
 
 
@@ -107,11 +210,18 @@ ResetJobMetadataCache(void)
 	MemoryContextResetAndDeleteChildren(CronJobContext);
 
 	CronJobHash = CreateCronJobHash();
+	InternedStringHash = CreateInternedStringHash();
+
+	JobArenaBlock = NULL;
+	JobArenaFreeSize = 0;
+	JobArenaUsedSize = 0;
 }
 
 
 /*
- * CreateCronJobHash creates the hash for caching job metadata.
+ * CreateCronJobHash creates the hash for caching job metadata. The jobs
+ * live in the entries of this hash, which dynahash allocates in batches,
+ * and only their strings are copied into the job arena.
  */
 static HTAB *
 CreateCronJobHash(void)
@@ -133,6 +243,155 @@ CreateCronJobHash(void)
 }
 
 
+/*
+ * CreateInternedStringHash creates the hash of strings that are shared by
+ * the cached jobs.
+ */
+static HTAB *
+CreateInternedStringHash(void)
+{
+	HTAB *stringHash = NULL;
+	HASHCTL info;
+	int hashFlags = 0;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(InternedStringKey);
+	info.entrysize = sizeof(InternedString);
+	info.hash = InternedStringHashFunction;
+	info.match = InternedStringMatch;
+	info.hcxt = CronJobContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+	stringHash = hash_create("pg_cron interned strings", 32, &info, hashFlags);
+
+	return stringHash;
+}
+
+
+/*
+ * InternedStringHashFunction hashes the characters of an interned string
+ * key.
+ */
+static uint32
+InternedStringHashFunction(const void *key, Size keySize)
+{
+	const InternedStringKey *stringKey = (const InternedStringKey *) key;
+
+	return DatumGetUInt32(hash_any((const unsigned char *) stringKey->data,
+								   stringKey->length));
+}
+
+
+/*
+ * InternedStringMatch compares the characters of two interned string keys
+ * and returns 0 if they are equal.
+ */
+static int
+InternedStringMatch(const void *key, const void *otherKey, Size keySize)
+{
+	const InternedStringKey *stringKey = (const InternedStringKey *) key;
+	const InternedStringKey *otherStringKey = (const InternedStringKey *) otherKey;
+
+	if (stringKey->length != otherStringKey->length)
+	{
+		return 1;
+	}
+
+	return memcmp(stringKey->data, otherStringKey->data, stringKey->length);
+}
+
+
+/*
+ * InternText returns the cached copy of the given text datum, copying it
+ * into the arena the first time it is seen. This is meant for the fields
+ * of jobs that nearly always hold the same few values.
+ */
+static char *
+InternText(Datum textDatum)
+{
+	text *textValue = DatumGetTextPP(textDatum);
+	InternedStringKey key;
+	InternedString *internedString = NULL;
+	bool isPresent = false;
+
+	key.data = VARDATA_ANY(textValue);
+	key.length = VARSIZE_ANY_EXHDR(textValue);
+
+	internedString = hash_search(InternedStringHash, &key, HASH_ENTER,
+								 &isPresent);
+	if (!isPresent)
+	{
+		internedString->string = ArenaStrndup(key.data, key.length);
+		internedString->key.data = internedString->string;
+	}
+
+	if ((Pointer) textValue != DatumGetPointer(textDatum))
+	{
+		pfree(textValue);
+	}
+
+	return internedString->string;
+}
+
+
+/*
+ * CopyTextToArena returns a copy of the given text datum in the arena.
+ */
+static char *
+CopyTextToArena(Datum textDatum)
+{
+	text *textValue = DatumGetTextPP(textDatum);
+	char *string = ArenaStrndup(VARDATA_ANY(textValue),
+								VARSIZE_ANY_EXHDR(textValue));
+
+	if ((Pointer) textValue != DatumGetPointer(textDatum))
+	{
+		pfree(textValue);
+	}
+
+	return string;
+}
+
+
+/*
+ * ArenaStrndup copies a string into the current block of the job arena,
+ * which avoids the chunk header and rounding of a separate allocation per
+ * string and keeps the strings of the cached jobs close together. Blocks
+ * are freed when the job cache is reset.
+ */
+static char *
+ArenaStrndup(const char *data, int length)
+{
+	char *string = NULL;
+	Size stringSize = length + 1;
+
+	if (stringSize > JOB_ARENA_MAX_STRING_SIZE)
+	{
+		string = (char *) MemoryContextAlloc(CronJobContext, stringSize);
+	}
+	else
+	{
+		if (stringSize > JobArenaFreeSize)
+		{
+			JobArenaBlock = (char *) MemoryContextAlloc(CronJobContext,
+														JOB_ARENA_BLOCK_SIZE);
+			JobArenaFreeSize = JOB_ARENA_BLOCK_SIZE;
+		}
+
+		string = JobArenaBlock;
+		JobArenaBlock += stringSize;
+		JobArenaFreeSize -= stringSize;
+	}
+
+	memcpy(string, data, length);
+	string[length] = '\0';
+
+	JobArenaUsedSize += stringSize;
+
+	return string;
+}
+
+
 /*
  * GetCronJob gets the cron job with the given id.
  */
@@ -143,6 +402,11 @@ GetCronJob(int64 jobId)
 	int64 hashKey = jobId;
 	bool isPresent = false;
 
+	if (IsQueuedJobId(jobId))
+	{
+		return GetQueuedJob(jobId);
+	}
+
 	job = hash_search(CronJobHash, &hashKey, HASH_FIND, &isPresent);
 
 	return job;
@@ -160,7 +424,8 @@ cron_schedule(PG_FUNCTION_ARGS)
 
 	char *schedule = text_to_cstring(scheduleText);
 	char *command = text_to_cstring(commandText);
-	entry *parsedSchedule = NULL;
+	entry parsedSchedule;
+	parse_error parseError;
 
 	int64 jobId = 0;
 	Datum jobIdDatum = 0;
@@ -173,22 +438,25 @@ cron_schedule(PG_FUNCTION_ARGS)
 	HeapTuple heapTuple = NULL;
 	Datum values[Natts_cron_job];
 	bool isNulls[Natts_cron_job];
+	bool useDefaults[Natts_cron_job];
 
 	Oid userId = GetUserId();
 	char *userName = GetUserNameFromId(userId, false);
 
-	parsedSchedule = parse_cron_entry(schedule);
-	if (parsedSchedule == NULL)
+	if (!parse_cron_entry(schedule, strlen(schedule), &parsedSchedule,
+						  &parseError))
 	{
 		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-						errmsg("invalid schedule: %s", schedule)));
+						errmsg("invalid schedule: %s", schedule),
+						errdetail("%s at position %d",
+								  ecodes[parseError.ecode],
+								  parseError.position + 1)));
 	}
 
-	free_entry(parsedSchedule);
-
 	/* form new job tuple */
 	memset(values, 0, sizeof(values));
 	memset(isNulls, false, sizeof(isNulls));
+	memset(useDefaults, false, sizeof(useDefaults));
 
 	jobId = NextJobId();
 	jobIdDatum = Int64GetDatum(jobId);
@@ -200,6 +468,25 @@ cron_schedule(PG_FUNCTION_ARGS)
 	values[Anum_cron_job_nodeport - 1] = Int32GetDatum(PostPortNumber);
 	values[Anum_cron_job_database - 1] = CStringGetTextDatum(CronTableDatabaseName);
 	values[Anum_cron_job_username - 1] = CStringGetTextDatum(userName);
+	isNulls[Anum_cron_job_timezone - 1] = true;
+	values[Anum_cron_job_schedule_bits - 1] =
+		PointerGetDatum(SerializeSchedule(&parsedSchedule, schedule,
+										  strlen(schedule)));
+	values[Anum_cron_job_read_only - 1] = BoolGetDatum(false);
+
+	/* the remaining columns get the defaults of the table */
+	useDefaults[Anum_cron_job_depends_on - 1] = true;
+	useDefaults[Anum_cron_job_max_attempts - 1] = true;
+	useDefaults[Anum_cron_job_retry_delay - 1] = true;
+	useDefaults[Anum_cron_job_retry_backoff - 1] = true;
+	useDefaults[Anum_cron_job_retry_sqlstates - 1] = true;
+	useDefaults[Anum_cron_job_settings - 1] = true;
+	useDefaults[Anum_cron_job_capture_rows - 1] = true;
+	useDefaults[Anum_cron_job_capture_bytes - 1] = true;
+	useDefaults[Anum_cron_job_log_level - 1] = true;
+	useDefaults[Anum_cron_job_node_group - 1] = true;
+	useDefaults[Anum_cron_job_fanout_concurrency - 1] = true;
+	useDefaults[Anum_cron_job_priority - 1] = true;
 
 	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
 	cronJobsRelationId = get_relname_relid(JOBS_TABLE_NAME, cronSchemaId);
@@ -207,6 +494,8 @@ cron_schedule(PG_FUNCTION_ARGS)
 	/* open jobs relation and insert new tuple */
 	cronJobsTable = heap_open(cronJobsRelationId, RowExclusiveLock);
 
+	SetColumnDefaults(cronJobsTable, values, isNulls, useDefaults);
+
 	tupleDescriptor = RelationGetDescr(cronJobsTable);
 	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
 
@@ -223,6 +512,63 @@ cron_schedule(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * SetColumnDefaults fills in the default values of the given relation for
+ * the columns of a new row that are marked in useDefaults, such that the
+ * defaults of cron.job are only defined in the extension script. Columns
+ * without a default are set to NULL.
+ */
+static void
+SetColumnDefaults(Relation relation, Datum *values, bool *isNulls,
+				  bool *useDefaults)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	EState *estate = CreateExecutorState();
+	ExprContext *econtext = GetPerTupleExprContext(estate);
+	int attributeIndex = 0;
+
+	for (attributeIndex = 0; attributeIndex < tupleDescriptor->natts;
+		 attributeIndex++)
+	{
+		Form_pg_attribute attribute = tupleDescriptor->attrs[attributeIndex];
+		Node *defaultExpr = NULL;
+		ExprState *defaultState = NULL;
+		Datum defaultValue = 0;
+		bool defaultIsNull = false;
+
+		if (!useDefaults[attributeIndex])
+		{
+			continue;
+		}
+
+		defaultExpr = build_column_default(relation, attributeIndex + 1);
+		if (defaultExpr == NULL)
+		{
+			values[attributeIndex] = 0;
+			isNulls[attributeIndex] = true;
+			continue;
+		}
+
+		defaultState = ExecPrepareExpr((Expr *) defaultExpr, estate);
+
+#if PG_VERSION_NUM >= 100000
+		defaultValue = ExecEvalExpr(defaultState, econtext, &defaultIsNull);
+#else
+		defaultValue = ExecEvalExpr(defaultState, econtext, &defaultIsNull,
+									NULL);
+#endif
+
+		/* the value lives in the executor state, which is freed below */
+		values[attributeIndex] = defaultIsNull ? 0 :
+								 datumCopy(defaultValue, attribute->attbyval,
+										   attribute->attlen);
+		isNulls[attributeIndex] = defaultIsNull;
+	}
+
+	FreeExecutorState(estate);
+}
+
+
 /*
  * NextJobId returns a new, unique job ID using the job ID sequence.
  */
@@ -265,7 +611,7 @@ NextJobId(void)
  * CronExtensionOwner returns the name of the user that owns the
  * extension.
  */
-static Oid
+Oid
 CronExtensionOwner(void)
 {
 	Relation extensionRelation = NULL;
@@ -320,11 +666,6 @@ cron_unschedule(PG_FUNCTION_ARGS)
 	bool indexOK = true;
 	TupleDesc tupleDescriptor = NULL;
 	HeapTuple heapTuple = NULL;
-	bool isNull = false;
-	Oid userId = InvalidOid;
-	char *userName = NULL;
-	Datum ownerNameDatum = 0;
-	char *ownerName = NULL;
 
 	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
 	cronJobIndexId = get_relname_relid(JOB_ID_INDEX_NAME, cronSchemaId);
@@ -347,24 +688,7 @@ cron_unschedule(PG_FUNCTION_ARGS)
 							   UINT64_FORMAT, jobId)));
 	}
 
-	/* check if the current user owns the row */
-	userId = GetUserId();
-	userName = GetUserNameFromId(userId, false);
-
-	ownerNameDatum = heap_getattr(heapTuple, Anum_cron_job_username,
-								  tupleDescriptor, &isNull);
-	ownerName = TextDatumGetCString(ownerNameDatum);
-	if (pg_strcasecmp(userName, ownerName) != 0)
-	{
-		/* otherwise, allow if the user has DELETE permission */
-		AclResult aclResult = pg_class_aclcheck(CronJobRelationId(), GetUserId(),
-												ACL_DELETE);
-		if (aclResult != ACLCHECK_OK)
-		{
-			aclcheck_error(aclResult, ACL_KIND_CLASS,
-						   get_rel_name(CronJobRelationId()));
-		}
-	}
+	EnsureJobOwner(tupleDescriptor, heapTuple, ACL_DELETE);
 
 	simple_heap_delete(cronJobsTable, &heapTuple->t_self);
 	CommandCounterIncrement();
@@ -372,6 +696,9 @@ cron_unschedule(PG_FUNCTION_ARGS)
 	systable_endscan(scanDescriptor);
 	heap_close(cronJobsTable, RowExclusiveLock);
 
+	DeleteJobOutput(jobId);
+	DeleteJobNodeResults(jobId);
+
 	InvalidateJobCache();
 
 	PG_RETURN_BOOL(true);
@@ -379,145 +706,1074 @@ cron_unschedule(PG_FUNCTION_ARGS)
 
 
 /*
- * cron_job_cache_invalidate invalidates the job cache in response to
- * a trigger.
+ * cron_alter_job changes the settings of an existing cron job. Settings
+ * that are passed as NULL are left unchanged.
  */
 Datum
-cron_job_cache_invalidate(PG_FUNCTION_ARGS)
+cron_alter_job(PG_FUNCTION_ARGS)
 {
-	if (!CALLED_AS_TRIGGER(fcinfo))
+	int64 jobId = 0;
+
+	Oid cronSchemaId = InvalidOid;
+	Oid cronJobIndexId = InvalidOid;
+
+	Relation cronJobsTable = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	HeapTuple newTuple = NULL;
+	Datum values[Natts_cron_job];
+	bool isNulls[Natts_cron_job];
+	bool replaces[Natts_cron_job];
+	int64 *dependsOn = NULL;
+	int dependsOnCount = 0;
+	LOCKMODE lockMode = RowExclusiveLock;
+
+	if (PG_ARGISNULL(0))
 	{
-		ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
-						errmsg("must be called as trigger")));
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("job_id can not be NULL")));
 	}
 
-	InvalidateJobCache();
+	jobId = PG_GETARG_INT64(0);
 
-	PG_RETURN_DATUM(PointerGetDatum(NULL));
-}
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+	memset(replaces, false, sizeof(replaces));
 
+	if (!PG_ARGISNULL(1))
+	{
+		char *timeZoneName = text_to_cstring(PG_GETARG_TEXT_P(1));
 
-/*
- * Invalidate job cache ensures the job cache is reloaded on the next
- * iteration of pg_cron.
- */
-static void
-InvalidateJobCache(void)
-{
-	HeapTuple classTuple = NULL;
+		if (pg_tzset(timeZoneName) == NULL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid time zone: %s", timeZoneName)));
+		}
 
-	classTuple = SearchSysCache1(RELOID, ObjectIdGetDatum(CronJobRelationId()));
-	if (HeapTupleIsValid(classTuple))
-	{
-		CacheInvalidateRelcacheByTuple(classTuple);
-		ReleaseSysCache(classTuple);
+		values[Anum_cron_job_timezone - 1] = CStringGetTextDatum(timeZoneName);
+		replaces[Anum_cron_job_timezone - 1] = true;
 	}
-}
-
 
-/*
- * InvalidateJobCacheCallback invalidates the job cache in response to
- * an invalidation event.
- */
-static void
-InvalidateJobCacheCallback(Datum argument, Oid relationId)
-{
-	if (relationId == CachedCronJobRelationId ||
-		CachedCronJobRelationId == InvalidOid)
+	if (!PG_ARGISNULL(2))
 	{
-		CronJobCacheValid = false;
-		CachedCronJobRelationId = InvalidOid;
+		values[Anum_cron_job_read_only - 1] = BoolGetDatum(PG_GETARG_BOOL(2));
+		replaces[Anum_cron_job_read_only - 1] = true;
 	}
-}
 
-
-/*
- * CachedCronJobRelationId returns a cached oid of the cron.job relation.
- */
-static Oid
-CronJobRelationId(void)
-{
-	if (CachedCronJobRelationId == InvalidOid)
+	if (!PG_ARGISNULL(3))
 	{
-		Oid cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+		ArrayType *dependsOnArray = PG_GETARG_ARRAYTYPE_P(3);
 
-		CachedCronJobRelationId = get_relname_relid(JOBS_TABLE_NAME, cronSchemaId);
-	}
+		if (array_contains_nulls(dependsOnArray))
+		{
+			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+							errmsg("depends_on can not contain NULL")));
+		}
 
-	return CachedCronJobRelationId;
-}
+		ArrayToJobIds(dependsOnArray, &dependsOn, &dependsOnCount);
 
+		values[Anum_cron_job_depends_on - 1] = PointerGetDatum(dependsOnArray);
+		replaces[Anum_cron_job_depends_on - 1] = true;
 
-/*
- * LoadCronJobList loads the current list of jobs from the
- * cron.job table and adds each job to the CronJobHash.
- */
-List *
-LoadCronJobList(void)
-{
-	List *jobList = NIL;
+		/* prevent concurrent changes from forming a cycle */
+		lockMode = ShareRowExclusiveLock;
+	}
 
-	Relation cronJobTable = NULL;
+	if (!PG_ARGISNULL(4))
+	{
+		int32 maxAttempts = PG_GETARG_INT32(4);
 
-	SysScanDesc scanDescriptor = NULL;
-	ScanKeyData scanKey[1];
-	int scanKeyCount = 0;
-	HeapTuple heapTuple = NULL;
-	TupleDesc tupleDescriptor = NULL;
+		if (maxAttempts < 1)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("max_attempts must be at least 1")));
+		}
 
-	SetCurrentStatementStartTimestamp();
-	StartTransactionCommand();
-	PushActiveSnapshot(GetTransactionSnapshot());
+		values[Anum_cron_job_max_attempts - 1] = Int32GetDatum(maxAttempts);
+		replaces[Anum_cron_job_max_attempts - 1] = true;
+	}
 
-	/*
-	 * If the pg_cron extension has not been created yet or
-	 * we are on a hot standby, the job table is treated as
-	 * being empty.
-	 */
-	if (!PgCronHasBeenLoaded() || RecoveryInProgress())
+	if (!PG_ARGISNULL(5))
 	{
-		PopActiveSnapshot();
-		CommitTransactionCommand();
-		pgstat_report_activity(STATE_IDLE, NULL);
+		Interval *retryDelay = PG_GETARG_INTERVAL_P(5);
 
-		return NIL;
+		if (IntervalToMilliseconds(retryDelay) < 0)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("retry_delay can not be negative")));
+		}
+
+		values[Anum_cron_job_retry_delay - 1] = IntervalPGetDatum(retryDelay);
+		replaces[Anum_cron_job_retry_delay - 1] = true;
 	}
 
-	cronJobTable = heap_open(CronJobRelationId(), AccessShareLock);
+	if (!PG_ARGISNULL(6))
+	{
+		float8 retryBackoff = PG_GETARG_FLOAT8(6);
 
-	scanDescriptor = systable_beginscan(cronJobTable,
-										InvalidOid, false,
-										NULL, scanKeyCount, scanKey);
+		if (!(retryBackoff >= 1.0))
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("retry_backoff must be at least 1")));
+		}
 
-	tupleDescriptor = RelationGetDescr(cronJobTable);
+		values[Anum_cron_job_retry_backoff - 1] = Float8GetDatum(retryBackoff);
+		replaces[Anum_cron_job_retry_backoff - 1] = true;
+	}
 
-	heapTuple = systable_getnext(scanDescriptor);
-	while (HeapTupleIsValid(heapTuple))
+	if (!PG_ARGISNULL(7))
 	{
-		MemoryContext oldContext = NULL;
-		CronJob *job = NULL;
-
-		oldContext = MemoryContextSwitchTo(CronJobContext);
-
-		job = TupleToCronJob(tupleDescriptor, heapTuple);
-		jobList = lappend(jobList, job);
+		ArrayType *sqlStateArray = PG_GETARG_ARRAYTYPE_P(7);
 
-		MemoryContextSwitchTo(oldContext);
+		EnsureValidSqlStates(sqlStateArray);
 
-		heapTuple = systable_getnext(scanDescriptor);
+		values[Anum_cron_job_retry_sqlstates - 1] = PointerGetDatum(sqlStateArray);
+		replaces[Anum_cron_job_retry_sqlstates - 1] = true;
 	}
 
-	systable_endscan(scanDescriptor);
-	heap_close(cronJobTable, AccessShareLock);
+	if (!PG_ARGISNULL(8))
+	{
+		ArrayType *settingsArray = PG_GETARG_ARRAYTYPE_P(8);
 
-	PopActiveSnapshot();
-	CommitTransactionCommand();
-	pgstat_report_activity(STATE_IDLE, NULL);
+		EnsureValidSettings(settingsArray);
+
+		/* an empty array removes the settings */
+		if (ArrayGetNItems(ARR_NDIM(settingsArray), ARR_DIMS(settingsArray)) > 0)
+		{
+			values[Anum_cron_job_settings - 1] = PointerGetDatum(settingsArray);
+		}
+		else
+		{
+			isNulls[Anum_cron_job_settings - 1] = true;
+		}
+
+		replaces[Anum_cron_job_settings - 1] = true;
+	}
+
+	if (!PG_ARGISNULL(9))
+	{
+		int32 captureRows = PG_GETARG_INT32(9);
+
+		if (captureRows < 0)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("capture_rows can not be negative")));
+		}
+
+		values[Anum_cron_job_capture_rows - 1] = Int32GetDatum(captureRows);
+		replaces[Anum_cron_job_capture_rows - 1] = true;
+	}
+
+	if (!PG_ARGISNULL(10))
+	{
+		int32 captureBytes = PG_GETARG_INT32(10);
+
+		if (captureBytes < 1 || captureBytes > MAX_CAPTURE_BYTES)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("capture_bytes must be between 1 and %d",
+								   MAX_CAPTURE_BYTES)));
+		}
+
+		values[Anum_cron_job_capture_bytes - 1] = Int32GetDatum(captureBytes);
+		replaces[Anum_cron_job_capture_bytes - 1] = true;
+	}
+
+	if (!PG_ARGISNULL(11))
+	{
+		char *logLevelName = text_to_cstring(PG_GETARG_TEXT_P(11));
+
+		/* 'default' removes the log level */
+		if (strcmp(logLevelName, "default") == 0)
+		{
+			isNulls[Anum_cron_job_log_level - 1] = true;
+		}
+		else if (ParseJobLogLevel(logLevelName) != CRON_LOG_DEFAULT)
+		{
+			values[Anum_cron_job_log_level - 1] = CStringGetTextDatum(logLevelName);
+		}
+		else
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid log level: %s", logLevelName),
+							errhint("Valid log levels are all, errors, none, "
+									"and default.")));
+		}
+
+		replaces[Anum_cron_job_log_level - 1] = true;
+	}
+
+	if (!PG_ARGISNULL(12))
+	{
+		char *nodeGroup = text_to_cstring(PG_GETARG_TEXT_P(12));
+
+		EnsureJobAdministrator("node_group");
+
+		/* an empty node group runs the job on its own node again */
+		if (nodeGroup[0] == '\0')
+		{
+			isNulls[Anum_cron_job_node_group - 1] = true;
+		}
+		else
+		{
+			values[Anum_cron_job_node_group - 1] = CStringGetTextDatum(nodeGroup);
+		}
+
+		replaces[Anum_cron_job_node_group - 1] = true;
+	}
+
+	if (!PG_ARGISNULL(13))
+	{
+		int32 fanOutConcurrency = PG_GETARG_INT32(13);
+
+		EnsureJobAdministrator("fanout_concurrency");
+
+		if (fanOutConcurrency < 1)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("fanout_concurrency must be at least 1")));
+		}
+
+		values[Anum_cron_job_fanout_concurrency - 1] =
+			Int32GetDatum(fanOutConcurrency);
+		replaces[Anum_cron_job_fanout_concurrency - 1] = true;
+	}
+
+	if (!PG_ARGISNULL(14))
+	{
+		values[Anum_cron_job_priority - 1] = Int32GetDatum(PG_GETARG_INT32(14));
+		replaces[Anum_cron_job_priority - 1] = true;
+	}
+
+	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+	cronJobIndexId = get_relname_relid(JOB_ID_INDEX_NAME, cronSchemaId);
+
+	cronJobsTable = heap_open(CronJobRelationId(), lockMode);
+
+	if (replaces[Anum_cron_job_depends_on - 1])
+	{
+		EnsureValidDependencies(cronJobsTable, jobId, dependsOn, dependsOnCount);
+	}
+
+	ScanKeyInit(&scanKey[0], Anum_cron_job_jobid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(jobId));
+
+	scanDescriptor = systable_beginscan(cronJobsTable,
+										cronJobIndexId, indexOK,
+										NULL, scanKeyCount, scanKey);
+
+	tupleDescriptor = RelationGetDescr(cronJobsTable);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		ereport(ERROR, (errmsg("could not find valid entry for job "
+							   UINT64_FORMAT, jobId)));
+	}
+
+	EnsureJobOwner(tupleDescriptor, heapTuple, ACL_UPDATE);
+
+	newTuple = heap_modify_tuple(heapTuple, tupleDescriptor, values, isNulls,
+								 replaces);
+
+	simple_heap_update(cronJobsTable, &heapTuple->t_self, newTuple);
+	CatalogUpdateIndexes(cronJobsTable, newTuple);
+	CommandCounterIncrement();
+
+	systable_endscan(scanDescriptor);
+	heap_close(cronJobsTable, lockMode);
+
+	InvalidateJobCache();
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * cron_run_now asks the scheduler to start a run of an existing cron job
+ * right away and returns the ID of the run.
+ */
+Datum
+cron_run_now(PG_FUNCTION_ARGS)
+{
+	int64 jobId = PG_GETARG_INT64(0);
+	int64 runId = 0;
+
+	Oid cronSchemaId = InvalidOid;
+	Oid cronJobIndexId = InvalidOid;
+
+	Relation cronJobsTable = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+
+	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+	cronJobIndexId = get_relname_relid(JOB_ID_INDEX_NAME, cronSchemaId);
+
+	cronJobsTable = heap_open(CronJobRelationId(), AccessShareLock);
+
+	ScanKeyInit(&scanKey[0], Anum_cron_job_jobid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(jobId));
+
+	scanDescriptor = systable_beginscan(cronJobsTable,
+										cronJobIndexId, indexOK,
+										NULL, scanKeyCount, scanKey);
+
+	tupleDescriptor = RelationGetDescr(cronJobsTable);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		ereport(ERROR, (errmsg("could not find valid entry for job "
+							   UINT64_FORMAT, jobId)));
+	}
+
+	EnsureJobOwner(tupleDescriptor, heapTuple, ACL_UPDATE);
+
+	systable_endscan(scanDescriptor);
+	heap_close(cronJobsTable, AccessShareLock);
+
+	/* a scheduler without the lease would drop the run */
+	if (CronLeaseConnInfo[0] != '\0' &&
+		GetCurrentTimestamp() >= SchedulerLeaseExpiry())
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("the pg_cron scheduler of this server does not "
+							   "hold lease %s", CronLeaseName),
+						errhint("Run the job on the server whose scheduler "
+								"holds the lease.")));
+	}
+
+	runId = RequestJobRun(jobId);
+
+	PG_RETURN_INT64(runId);
+}
+
+
+/*
+ * EnsureJobAdministrator throws an error if the current user may not set
+ * the given argument of a job. Node groups are shared by all users and
+ * fanning out opens connections to many nodes, so setting them requires
+ * UPDATE on cron.job rather than owning the job.
+ */
+static void
+EnsureJobAdministrator(const char *argumentName)
+{
+	AclResult aclResult = pg_class_aclcheck(CronJobRelationId(), GetUserId(),
+											ACL_UPDATE);
+	if (aclResult != ACLCHECK_OK)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("permission denied to set %s", argumentName),
+						errhint("Only superusers and roles with UPDATE on "
+								"cron.job can set %s.", argumentName)));
+	}
+}
+
+
+/*
+ * EnsureJobOwner throws an error if the current user does not own the
+ * given job and does not have the given permission on cron.job.
+ */
+static void
+EnsureJobOwner(TupleDesc tupleDescriptor, HeapTuple heapTuple, AclMode mode)
+{
+	bool isNull = false;
+	Oid userId = GetUserId();
+	char *userName = GetUserNameFromId(userId, false);
+
+	Datum ownerNameDatum = heap_getattr(heapTuple, Anum_cron_job_username,
+										tupleDescriptor, &isNull);
+	char *ownerName = TextDatumGetCString(ownerNameDatum);
+
+	if (pg_strcasecmp(userName, ownerName) != 0)
+	{
+		/* otherwise, allow if the user has the requested permission */
+		AclResult aclResult = pg_class_aclcheck(CronJobRelationId(), userId,
+												mode);
+		if (aclResult != ACLCHECK_OK)
+		{
+			aclcheck_error(aclResult, ACL_KIND_CLASS,
+						   get_rel_name(CronJobRelationId()));
+		}
+	}
+}
+
+
+/*
+ * ArrayToJobIds extracts the job IDs from a bigint[] array, skipping NULLs.
+ */
+static void
+ArrayToJobIds(ArrayType *jobIdArray, int64 **jobIds, int *jobIdCount)
+{
+	Datum *elementValues = NULL;
+	bool *elementNulls = NULL;
+	int elementCount = 0;
+	int elementIndex = 0;
+
+	deconstruct_array(jobIdArray, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd',
+					  &elementValues, &elementNulls, &elementCount);
+
+	*jobIds = (int64 *) palloc0(Max(elementCount, 1) * sizeof(int64));
+	*jobIdCount = 0;
+
+	for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+	{
+		if (!elementNulls[elementIndex])
+		{
+			(*jobIds)[(*jobIdCount)++] = DatumGetInt64(elementValues[elementIndex]);
+		}
+	}
+}
+
+
+/*
+ * EnsureValidDependencies throws an error if one of the jobs that the given
+ * job should depend on does not exist or is not owned by the current user,
+ * or if the new dependencies form a cycle, in which case none of the jobs
+ * in the cycle would ever run.
+ */
+static void
+EnsureValidDependencies(Relation cronJobsTable, int64 jobId,
+						int64 *dependsOn, int dependsOnCount)
+{
+	HTAB *dependencyHash = NULL;
+	HASHCTL info;
+	int hashFlags = 0;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 0;
+	HeapTuple heapTuple = NULL;
+	TupleDesc tupleDescriptor = RelationGetDescr(cronJobsTable);
+	int dependencyIndex = 0;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(int64);
+	info.entrysize = sizeof(JobDependencyNode);
+	info.hash = tag_hash;
+	info.hcxt = CurrentMemoryContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	dependencyHash = hash_create("pg_cron job dependencies", 32, &info,
+								 hashFlags);
+
+	/* build the dependency graph as it will be after the change */
+	scanDescriptor = systable_beginscan(cronJobsTable,
+										InvalidOid, false,
+										NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		bool isNull = false;
+		bool isPresent = false;
+		Datum jobIdDatum = heap_getattr(heapTuple, Anum_cron_job_jobid,
+										tupleDescriptor, &isNull);
+		Datum dependsOnDatum = heap_getattr(heapTuple, Anum_cron_job_depends_on,
+											tupleDescriptor, &isNull);
+		int64 nodeJobId = DatumGetInt64(jobIdDatum);
+		JobDependencyNode *node = hash_search(dependencyHash, &nodeJobId,
+											  HASH_ENTER, &isPresent);
+
+		node->isVisited = false;
+
+		if (nodeJobId == jobId)
+		{
+			node->dependsOn = dependsOn;
+			node->dependsOnCount = dependsOnCount;
+		}
+		else if (!isNull)
+		{
+			ArrayToJobIds(DatumGetArrayTypeP(dependsOnDatum), &node->dependsOn,
+						  &node->dependsOnCount);
+		}
+		else
+		{
+			node->dependsOn = NULL;
+			node->dependsOnCount = 0;
+		}
+
+		for (dependencyIndex = 0; dependencyIndex < dependsOnCount;
+			 dependencyIndex++)
+		{
+			if (dependsOn[dependencyIndex] == nodeJobId)
+			{
+				EnsureJobOwner(tupleDescriptor, heapTuple, ACL_UPDATE);
+				break;
+			}
+		}
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+
+	for (dependencyIndex = 0; dependencyIndex < dependsOnCount; dependencyIndex++)
+	{
+		int64 upstreamJobId = dependsOn[dependencyIndex];
+		bool isPresent = false;
+
+		hash_search(dependencyHash, &upstreamJobId, HASH_FIND, &isPresent);
+		if (!isPresent)
+		{
+			ereport(ERROR, (errmsg("could not find valid entry for job "
+								   INT64_FORMAT, upstreamJobId)));
+		}
+
+		if (JobDependsOn(dependencyHash, upstreamJobId, jobId))
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("job " INT64_FORMAT " can not depend on job "
+								   INT64_FORMAT, jobId, upstreamJobId),
+							errdetail("The dependencies would form a cycle.")));
+		}
+	}
+
+	hash_destroy(dependencyHash);
+}
+
+
+/*
+ * JobDependsOn returns whether the given job is, or directly or indirectly
+ * depends on, the target job. Jobs that were already visited are known not
+ * to lead to the target job.
+ */
+static bool
+JobDependsOn(HTAB *dependencyHash, int64 jobId, int64 targetJobId)
+{
+	JobDependencyNode *node = NULL;
+	bool isPresent = false;
+	int dependencyIndex = 0;
+
+	check_stack_depth();
+
+	if (jobId == targetJobId)
+	{
+		return true;
+	}
+
+	node = hash_search(dependencyHash, &jobId, HASH_FIND, &isPresent);
+	if (node == NULL || node->isVisited)
+	{
+		return false;
+	}
+
+	node->isVisited = true;
+
+	for (dependencyIndex = 0; dependencyIndex < node->dependsOnCount;
+		 dependencyIndex++)
+	{
+		if (JobDependsOn(dependencyHash, node->dependsOn[dependencyIndex],
+						 targetJobId))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * EnsureValidSqlStates throws an error if the given text[] array contains
+ * anything other than SQLSTATE codes or SQLSTATE classes.
+ */
+static void
+EnsureValidSqlStates(ArrayType *sqlStateArray)
+{
+	Datum *elementValues = NULL;
+	bool *elementNulls = NULL;
+	int elementCount = 0;
+	int elementIndex = 0;
+
+	deconstruct_array(sqlStateArray, TEXTOID, -1, false, 'i',
+					  &elementValues, &elementNulls, &elementCount);
+
+	for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+	{
+		char *sqlState = NULL;
+		int sqlStateLength = 0;
+		int charIndex = 0;
+
+		if (elementNulls[elementIndex])
+		{
+			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+							errmsg("retry_sqlstates can not contain NULL")));
+		}
+
+		sqlState = TextDatumGetCString(elementValues[elementIndex]);
+		sqlStateLength = strlen(sqlState);
+
+		for (charIndex = 0; charIndex < sqlStateLength; charIndex++)
+		{
+			if (!isdigit((unsigned char) sqlState[charIndex]) &&
+				!isupper((unsigned char) sqlState[charIndex]))
+			{
+				break;
+			}
+		}
+
+		if ((sqlStateLength != 2 && sqlStateLength != 5) ||
+			charIndex != sqlStateLength)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid SQLSTATE code or class: \"%s\"",
+								   sqlState),
+							errhint("Use a 5-character SQLSTATE code such "
+									"as 40001, or a 2-character class such "
+									"as 08.")));
+		}
+	}
+}
+
+
+/*
+ * EnsureValidSettings throws an error if the given text[] array contains
+ * anything other than name=value pairs of configuration parameters. The
+ * parameters themselves are checked when a run connects, since the job
+ * may run on a node with different extensions loaded.
+ */
+static void
+EnsureValidSettings(ArrayType *settingsArray)
+{
+	Datum *elementValues = NULL;
+	bool *elementNulls = NULL;
+	int elementCount = 0;
+	int elementIndex = 0;
+
+	deconstruct_array(settingsArray, TEXTOID, -1, false, 'i',
+					  &elementValues, &elementNulls, &elementCount);
+
+	for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+	{
+		char *setting = NULL;
+		char *separator = NULL;
+		char *character = NULL;
+
+		if (elementNulls[elementIndex])
+		{
+			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+							errmsg("settings can not contain NULL")));
+		}
+
+		setting = TextDatumGetCString(elementValues[elementIndex]);
+		separator = strchr(setting, '=');
+
+		if (separator == NULL || separator == setting)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid setting: \"%s\"", setting),
+							errhint("Use name=value, for example "
+									"work_mem=256MB.")));
+		}
+
+		for (character = setting; character < separator; character++)
+		{
+			if (!isalnum((unsigned char) *character) && *character != '_' &&
+				*character != '.')
+			{
+				ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+								errmsg("invalid configuration parameter name "
+									   "in setting: \"%s\"", setting)));
+			}
+		}
+	}
+}
+
+
+/*
+ * SettingsToConnectionOptions converts the name=value pairs in the given
+ * text[] array into a libpq options string that sets them at connection
+ * start, for example "-c work_mem=256MB -c statement_timeout=1h". Spaces
+ * and backslashes in values are escaped with a backslash. It returns NULL
+ * if there are no settings.
+ */
+static char *
+SettingsToConnectionOptions(ArrayType *settingsArray)
+{
+	Datum *elementValues = NULL;
+	bool *elementNulls = NULL;
+	int elementCount = 0;
+	int elementIndex = 0;
+	StringInfoData options;
+	char *connectionOptions = NULL;
+
+	deconstruct_array(settingsArray, TEXTOID, -1, false, 'i',
+					  &elementValues, &elementNulls, &elementCount);
+
+	initStringInfo(&options);
+
+	for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+	{
+		char *setting = NULL;
+		char *character = NULL;
+
+		if (elementNulls[elementIndex])
+		{
+			continue;
+		}
+
+		setting = TextDatumGetCString(elementValues[elementIndex]);
+
+		if (options.len > 0)
+		{
+			appendStringInfoChar(&options, ' ');
+		}
+
+		appendStringInfoString(&options, "-c ");
+
+		for (character = setting; *character != '\0'; character++)
+		{
+			if (isspace((unsigned char) *character) || *character == '\\')
+			{
+				appendStringInfoChar(&options, '\\');
+			}
+
+			appendStringInfoChar(&options, *character);
+		}
+
+		pfree(setting);
+	}
+
+	if (options.len > 0)
+	{
+		connectionOptions = ArenaStrndup(options.data, options.len);
+	}
+
+	pfree(options.data);
+
+	return connectionOptions;
+}
+
+
+/*
+ * ParseJobLogLevel returns the log level with the given name, or
+ * CRON_LOG_DEFAULT if there is none.
+ */
+static CronJobLogLevel
+ParseJobLogLevel(char *logLevelName)
+{
+	if (strcmp(logLevelName, "all") == 0)
+	{
+		return CRON_LOG_ALL;
+	}
+	else if (strcmp(logLevelName, "errors") == 0)
+	{
+		return CRON_LOG_ERRORS;
+	}
+	else if (strcmp(logLevelName, "none") == 0)
+	{
+		return CRON_LOG_NONE;
+	}
+
+	return CRON_LOG_DEFAULT;
+}
+
+
+/*
+ * IntervalToMilliseconds converts an interval to milliseconds, counting
+ * a month as 30 days.
+ */
+static int64
+IntervalToMilliseconds(Interval *interval)
+{
+	int64 milliseconds = 0;
+
+#ifdef HAVE_INT64_TIMESTAMP
+	milliseconds = interval->time / 1000;
+#else
+	milliseconds = (int64) (interval->time * 1000.0);
+#endif
+
+	milliseconds += (int64) interval->day * SECS_PER_DAY * 1000;
+	milliseconds += (int64) interval->month * DAYS_PER_MONTH * SECS_PER_DAY * 1000;
+
+	return milliseconds;
+}
+
+
+/*
+ * cron_job_cache_invalidate invalidates the job cache in response to
+ * a trigger.
+ */
+Datum
+cron_job_cache_invalidate(PG_FUNCTION_ARGS)
+{
+	if (!CALLED_AS_TRIGGER(fcinfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+						errmsg("must be called as trigger")));
+	}
+
+	InvalidateJobCache();
+
+	PG_RETURN_DATUM(PointerGetDatum(NULL));
+}
+
+
+/*
+ * Invalidate job cache ensures the job cache is reloaded on the next
+ * iteration of pg_cron, and that the scheduler is woken up once the
+ * current transaction commits.
+ */
+static void
+InvalidateJobCache(void)
+{
+	HeapTuple classTuple = NULL;
+
+	classTuple = SearchSysCache1(RELOID, ObjectIdGetDatum(CronJobRelationId()));
+	if (HeapTupleIsValid(classTuple))
+	{
+		CacheInvalidateRelcacheByTuple(classTuple);
+		ReleaseSysCache(classTuple);
+	}
+
+	if (!JobCacheXactCallbackRegistered)
+	{
+		RegisterXactCallback(JobCacheXactCallback, NULL);
+		JobCacheXactCallbackRegistered = true;
+	}
+
+	JobReloadPending = true;
+}
+
+
+/*
+ * JobCacheXactCallback tells the scheduler to reload the jobs when a
+ * transaction that changed cron.job commits. The relcache invalidation is
+ * only sent after the transaction callbacks run, so the scheduler cannot
+ * rely on it being visible when it wakes up.
+ */
+static void
+JobCacheXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		{
+			if (JobReloadPending)
+			{
+				SetJobReloadNeeded();
+				JobReloadPending = false;
+			}
+
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		{
+			JobReloadPending = false;
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * InvalidateJobCacheCallback invalidates the job cache in response to
+ * an invalidation event.
+ */
+static void
+InvalidateJobCacheCallback(Datum argument, Oid relationId)
+{
+	if (relationId == CachedCronJobRelationId ||
+		CachedCronJobRelationId == InvalidOid)
+	{
+		CronJobCacheValid = false;
+		CachedCronJobRelationId = InvalidOid;
+	}
+}
+
+
+/*
+ * CachedCronJobRelationId returns a cached oid of the cron.job relation.
+ */
+static Oid
+CronJobRelationId(void)
+{
+	if (CachedCronJobRelationId == InvalidOid)
+	{
+		Oid cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+
+		CachedCronJobRelationId = get_relname_relid(JOBS_TABLE_NAME, cronSchemaId);
+	}
+
+	return CachedCronJobRelationId;
+}
+
+
+/*
+ * LoadCronJobList loads the current list of jobs from the
+ * cron.job table and adds each job to the CronJobHash.
+ */
+List *
+LoadCronJobList(void)
+{
+	List *jobList = NIL;
+
+	Relation cronJobTable = NULL;
+
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 0;
+	HeapTuple heapTuple = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	CronJobSelection jobSelection = CRON_JOBS_NONE;
+	MemoryContext oldContext = NULL;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	jobSelection = CurrentJobSelection();
+	LoadedJobSelection = jobSelection;
+
+	/*
+	 * If the pg_cron extension has not been created yet or
+	 * we are on a hot standby without the standby scheduler,
+	 * the job table is treated as being empty.
+	 */
+	if (!PgCronHasBeenLoaded() || jobSelection == CRON_JOBS_NONE)
+	{
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		return NIL;
+	}
+
+	cronJobTable = heap_open(CronJobRelationId(), AccessShareLock);
+
+	scanDescriptor = systable_beginscan(cronJobTable,
+										InvalidOid, false,
+										NULL, scanKeyCount, scanKey);
+
+	tupleDescriptor = RelationGetDescr(cronJobTable);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		CronJob *job = NULL;
+
+		if (!JobIsSelected(tupleDescriptor, heapTuple, jobSelection))
+		{
+			heapTuple = systable_getnext(scanDescriptor);
+			continue;
+		}
+
+		oldContext = MemoryContextSwitchTo(CronJobContext);
+
+		job = TupleToCronJob(tupleDescriptor, heapTuple);
+		jobList = lappend(jobList, job);
+
+		MemoryContextSwitchTo(oldContext);
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(cronJobTable, AccessShareLock);
+
+	oldContext = MemoryContextSwitchTo(CronJobContext);
+	LoadNodeGroupMembers(jobList);
+	MemoryContextSwitchTo(oldContext);
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	elog(DEBUG1, "pg_cron loaded %d jobs and copied %zu bytes of their "
+				 "strings, sharing %ld distinct values", list_length(jobList),
+		 JobArenaUsedSize, hash_get_num_entries(InternedStringHash));
 
 	return jobList;
 }
 
 
+/*
+ * CurrentJobSelection returns which jobs the scheduler should run. On a
+ * hot standby, the standby scheduler only runs read-only jobs, and only
+ * while it holds its lease on the primary. While a standby scheduler
+ * holds that lease, the primary leaves read-only jobs to it. After
+ * promotion, or when no standby scheduler holds the lease, the primary
+ * runs all jobs such that read-only jobs are never left behind.
+ */
+CronJobSelection
+CurrentJobSelection(void)
+{
+	TimestampTz currentTime = GetCurrentTimestamp();
+
+	if (RecoveryInProgress())
+	{
+		return EnableStandbyScheduler && HoldsStandbyLease(currentTime) ?
+			   CRON_JOBS_READ_ONLY : CRON_JOBS_NONE;
+	}
+
+	if (EnableStandbyScheduler && StandbyLeaseIsHeld(currentTime))
+	{
+		return CRON_JOBS_READ_WRITE;
+	}
+
+	return CRON_JOBS_ALL;
+}
+
+
+/*
+ * JobIsSelected returns whether the job in the given tuple should be
+ * loaded given the current job selection.
+ */
+static bool
+JobIsSelected(TupleDesc tupleDescriptor, HeapTuple heapTuple,
+			  CronJobSelection jobSelection)
+{
+	bool isNull = false;
+	bool readOnly = false;
+	Datum readOnlyDatum = heap_getattr(heapTuple, Anum_cron_job_read_only,
+									   tupleDescriptor, &isNull);
+
+	if (!isNull)
+	{
+		readOnly = DatumGetBool(readOnlyDatum);
+	}
+
+	switch (jobSelection)
+	{
+		case CRON_JOBS_ALL:
+		{
+			return true;
+		}
+
+		case CRON_JOBS_READ_ONLY:
+		{
+			return readOnly;
+		}
+
+		case CRON_JOBS_READ_WRITE:
+		{
+			return !readOnly;
+		}
+
+		case CRON_JOBS_NONE:
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
 /*
  * TupleToCronJob takes a heap tuple and converts it into a CronJob
  * struct.
@@ -529,7 +1785,8 @@ TupleToCronJob(TupleDesc tupleDescriptor, HeapTuple heapTuple)
 	int64 jobKey = 0;
 	bool isNull = false;
 	bool isPresent = false;
-	entry *parsedSchedule = NULL;
+	text *scheduleText = NULL;
+	parse_error parseError;
 
 	Datum jobId = heap_getattr(heapTuple, Anum_cron_job_jobid,
 							   tupleDescriptor, &isNull);
@@ -545,47 +1802,259 @@ TupleToCronJob(TupleDesc tupleDescriptor, HeapTuple heapTuple)
 								  tupleDescriptor, &isNull);
 	Datum userName = heap_getattr(heapTuple, Anum_cron_job_username,
 								  tupleDescriptor, &isNull);
-
-	Assert(!HeapTupleHasNulls(heapTuple));
+	Datum timeZoneName = heap_getattr(heapTuple, Anum_cron_job_timezone,
+									  tupleDescriptor, &isNull);
+	bool timeZoneIsNull = isNull;
+	Datum scheduleBits = heap_getattr(heapTuple, Anum_cron_job_schedule_bits,
+									  tupleDescriptor, &isNull);
+	bool scheduleBitsIsNull = isNull;
+	Datum readOnly = heap_getattr(heapTuple, Anum_cron_job_read_only,
+								  tupleDescriptor, &isNull);
+	bool readOnlyIsNull = isNull;
+	Datum dependsOn = heap_getattr(heapTuple, Anum_cron_job_depends_on,
+								   tupleDescriptor, &isNull);
+	bool dependsOnIsNull = isNull;
+	Datum maxAttempts = heap_getattr(heapTuple, Anum_cron_job_max_attempts,
+									 tupleDescriptor, &isNull);
+	bool maxAttemptsIsNull = isNull;
+	Datum retryDelay = heap_getattr(heapTuple, Anum_cron_job_retry_delay,
+									tupleDescriptor, &isNull);
+	bool retryDelayIsNull = isNull;
+	Datum retryBackoff = heap_getattr(heapTuple, Anum_cron_job_retry_backoff,
+									  tupleDescriptor, &isNull);
+	bool retryBackoffIsNull = isNull;
+	Datum retrySqlStates = heap_getattr(heapTuple, Anum_cron_job_retry_sqlstates,
+										tupleDescriptor, &isNull);
+	bool retrySqlStatesIsNull = isNull;
+	Datum settings = heap_getattr(heapTuple, Anum_cron_job_settings,
+								  tupleDescriptor, &isNull);
+	bool settingsIsNull = isNull;
+	Datum captureRows = heap_getattr(heapTuple, Anum_cron_job_capture_rows,
+									 tupleDescriptor, &isNull);
+	bool captureRowsIsNull = isNull;
+	Datum captureBytes = heap_getattr(heapTuple, Anum_cron_job_capture_bytes,
+									  tupleDescriptor, &isNull);
+	bool captureBytesIsNull = isNull;
+	Datum logLevel = heap_getattr(heapTuple, Anum_cron_job_log_level,
+								  tupleDescriptor, &isNull);
+	bool logLevelIsNull = isNull;
+	Datum nodeGroup = heap_getattr(heapTuple, Anum_cron_job_node_group,
+								   tupleDescriptor, &isNull);
+	bool nodeGroupIsNull = isNull;
+	Datum fanOutConcurrency = heap_getattr(heapTuple,
+										   Anum_cron_job_fanout_concurrency,
+										   tupleDescriptor, &isNull);
+	bool fanOutConcurrencyIsNull = isNull;
+	Datum priority = heap_getattr(heapTuple, Anum_cron_job_priority,
+								  tupleDescriptor, &isNull);
+	bool priorityIsNull = isNull;
 
 	jobKey = DatumGetUInt32(jobId);
 	job = hash_search(CronJobHash, &jobKey, HASH_ENTER, &isPresent);
 
 	job->jobId = DatumGetUInt32(jobId);
-	job->scheduleText = TextDatumGetCString(schedule);
-	job->command = TextDatumGetCString(command);
-	job->nodeName = TextDatumGetCString(nodeName);
+	job->scheduleText = CopyTextToArena(schedule);
+	job->command = CopyTextToArena(command);
+	job->nodeName = InternText(nodeName);
 	job->nodePort = DatumGetUInt32(nodePort);
-	job->userName = TextDatumGetCString(userName);
-	job->database = TextDatumGetCString(database);
+	job->userName = InternText(userName);
+	job->database = InternText(database);
+	job->readOnly = !readOnlyIsNull && DatumGetBool(readOnly);
+	job->dependsOn = NULL;
+	job->dependsOnCount = 0;
+
+	if (!dependsOnIsNull)
+	{
+		ArrayToJobIds(DatumGetArrayTypeP(dependsOn), &job->dependsOn,
+					  &job->dependsOnCount);
+	}
+
+	/* without a retry policy, a failed run is not retried */
+	job->maxAttempts = maxAttemptsIsNull ? 1 : DatumGetInt32(maxAttempts);
+	job->retryDelay = retryDelayIsNull ? 0 :
+					  IntervalToMilliseconds(DatumGetIntervalP(retryDelay));
+	job->retryBackoff = retryBackoffIsNull ? 1.0 : DatumGetFloat8(retryBackoff);
+	job->retrySqlStates = NULL;
+	job->retrySqlStateCount = 0;
+
+	if (!retrySqlStatesIsNull)
+	{
+		Datum *elementValues = NULL;
+		bool *elementNulls = NULL;
+		int elementCount = 0;
+		int elementIndex = 0;
+
+		deconstruct_array(DatumGetArrayTypeP(retrySqlStates), TEXTOID, -1,
+						  false, 'i', &elementValues, &elementNulls,
+						  &elementCount);
+
+		job->retrySqlStates = (char **) palloc0(Max(elementCount, 1) *
+												sizeof(char *));
+
+		for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+		{
+			if (!elementNulls[elementIndex])
+			{
+				job->retrySqlStates[job->retrySqlStateCount++] =
+					TextDatumGetCString(elementValues[elementIndex]);
+			}
+		}
+	}
+
+	job->connectionOptions = NULL;
+
+	if (!settingsIsNull)
+	{
+		job->connectionOptions =
+			SettingsToConnectionOptions(DatumGetArrayTypeP(settings));
+	}
+
+	/* output is only captured by jobs that opt in */
+	job->captureRows = captureRowsIsNull ? 0 : DatumGetInt32(captureRows);
+	job->captureBytes = captureBytesIsNull ? 0 : DatumGetInt32(captureBytes);
+	job->logLevel = CRON_LOG_DEFAULT;
 
-	parsedSchedule = parse_cron_entry(job->scheduleText);
-	if (parsedSchedule != NULL)
+	if (!logLevelIsNull)
 	{
-		/* copy the schedule and free the allocated memory immediately */
+		char *logLevelName = TextDatumGetCString(logLevel);
 
-		job->schedule = *parsedSchedule;
-		free_entry(parsedSchedule);
+		job->logLevel = ParseJobLogLevel(logLevelName);
+		pfree(logLevelName);
+	}
+
+	/* the nodes of the group are added by LoadNodeGroupMembers */
+	job->nodeGroup = nodeGroupIsNull ? NULL : InternText(nodeGroup);
+	job->fanOutConcurrency = fanOutConcurrencyIsNull ? 8 :
+							 DatumGetInt32(fanOutConcurrency);
+	job->memberJobs = NIL;
+	job->priority = priorityIsNull ? 0 : DatumGetInt32(priority);
+
+	/* jobs without a time zone are scheduled in GMT */
+	if (!timeZoneIsNull)
+	{
+		job->timeZoneName = InternText(timeZoneName);
 	}
 	else
 	{
-		ereport(LOG, (errmsg("invalid pg_cron schedule for job %ld: %s",
-							 jobId, job->scheduleText)));
+		job->timeZoneName = DEFAULT_TIME_ZONE_NAME;
+	}
+
+	job->timeZone = GetCronTimeZone(job->timeZoneName);
+	if (job->timeZone == NULL)
+	{
+		ereport(LOG, (errmsg("invalid pg_cron time zone for job %ld: %s",
+							 job->jobId, job->timeZoneName)));
+	}
 
-		/* a zeroed out schedule never runs */
-		memset(&job->schedule, 0, sizeof(entry));
+	scheduleText = DatumGetTextPP(schedule);
+
+	/*
+	 * Use the stored parsed schedule if it is still valid, otherwise parse
+	 * straight from the tuple. A failed parse zeroes the schedule.
+	 */
+	if (scheduleBitsIsNull ||
+		!DeserializeSchedule(DatumGetByteaPP(scheduleBits),
+							 VARDATA_ANY(scheduleText),
+							 VARSIZE_ANY_EXHDR(scheduleText),
+							 &job->schedule))
+	{
+		if (!parse_cron_entry(VARDATA_ANY(scheduleText),
+							  VARSIZE_ANY_EXHDR(scheduleText),
+							  &job->schedule, &parseError))
+		{
+			/* a zeroed out schedule never runs */
+			ereport(LOG, (errmsg("invalid pg_cron schedule for job %ld: %s",
+								 job->jobId, job->scheduleText),
+						  errdetail("%s at position %d",
+									ecodes[parseError.ecode],
+									parseError.position + 1)));
+		}
 	}
 
 	return job;
 }
 
 
+/*
+ * SerializeSchedule converts a parsed schedule into the format stored in
+ * the schedule_bits column of cron.job.
+ */
+static bytea *
+SerializeSchedule(entry *schedule, const char *scheduleText, int scheduleLength)
+{
+	bytea *scheduleBits = (bytea *) palloc0(VARHDRSZ + sizeof(SerializedSchedule));
+	SerializedSchedule *serialized = (SerializedSchedule *) VARDATA(scheduleBits);
+
+	SET_VARSIZE(scheduleBits, VARHDRSZ + sizeof(SerializedSchedule));
+
+	serialized->version = SCHEDULE_BITS_VERSION;
+	serialized->scheduleHash =
+		DatumGetUInt32(hash_any((const unsigned char *) scheduleText,
+								scheduleLength));
+	serialized->flags = schedule->flags;
+	serialized->interval = schedule->interval;
+	memcpy(serialized->minute, schedule->minute, sizeof(serialized->minute));
+	memcpy(serialized->hour, schedule->hour, sizeof(serialized->hour));
+	memcpy(serialized->dom, schedule->dom, sizeof(serialized->dom));
+	memcpy(serialized->month, schedule->month, sizeof(serialized->month));
+	memcpy(serialized->dow, schedule->dow, sizeof(serialized->dow));
+
+	return scheduleBits;
+}
+
+
+/*
+ * DeserializeSchedule copies a schedule stored in the schedule_bits column
+ * of cron.job into the given entry. It returns false if the stored schedule
+ * is in a different format or was not parsed from the given schedule text,
+ * in which case the schedule needs to be parsed.
+ */
+static bool
+DeserializeSchedule(bytea *scheduleBits, const char *scheduleText,
+					int scheduleLength, entry *schedule)
+{
+	SerializedSchedule serialized;
+	uint32 scheduleHash = 0;
+
+	if (VARSIZE_ANY_EXHDR(scheduleBits) != sizeof(SerializedSchedule))
+	{
+		return false;
+	}
+
+	/* the datum may not be aligned, so copy it out first */
+	memcpy(&serialized, VARDATA_ANY(scheduleBits), sizeof(SerializedSchedule));
+
+	if (serialized.version != SCHEDULE_BITS_VERSION)
+	{
+		return false;
+	}
+
+	scheduleHash = DatumGetUInt32(hash_any((const unsigned char *) scheduleText,
+										   scheduleLength));
+	if (serialized.scheduleHash != scheduleHash)
+	{
+		return false;
+	}
+
+	memset(schedule, 0, sizeof(entry));
+	schedule->flags = serialized.flags;
+	schedule->interval = serialized.interval;
+	memcpy(schedule->minute, serialized.minute, sizeof(serialized.minute));
+	memcpy(schedule->hour, serialized.hour, sizeof(serialized.hour));
+	memcpy(schedule->dom, serialized.dom, sizeof(serialized.dom));
+	memcpy(schedule->month, serialized.month, sizeof(serialized.month));
+	memcpy(schedule->dow, serialized.dow, sizeof(serialized.dow));
+
+	return true;
+}
+
+
 /*
  * PgCronHasBeenLoaded returns true if the pg_cron extension has been created
  * in the current database and the extension script has been executed. Otherwise,
  * it returns false. The result is cached as this is called very frequently.
  */
-static bool
+bool
 PgCronHasBeenLoaded(void)
 {
 	bool extensionLoaded = false;
@@ -0,0 +1,433 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/job_output.c
+ *
+ * Capture of the output of jobs that opt in to it. The rows of a run are
+ * received one at a time in single-row mode and only the first rows and
+ * bytes are kept, such that a job that returns a large result does not
+ * use a lot of memory in the scheduler. When a run succeeds, its output
+ * replaces the previous output of the job in the cron.job_output table.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "cron.h"
+#include "pg_cron.h"
+#include "cron_job_output.h"
+#include "job_metadata.h"
+#include "job_output.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/skey.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "mb/pg_wchar.h"
+#include "pgstat.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+
+#define CRON_SCHEMA_NAME "cron"
+#define JOB_OUTPUT_TABLE_NAME "job_output"
+#define JOB_OUTPUT_ID_INDEX_NAME "job_output_pkey"
+
+
+/* forward declarations */
+static void AppendOutput(TaskOutput *output, const char *data, int length);
+static void FreeTaskOutput(TaskOutput *output);
+static void SaveTaskOutput(Relation jobOutputTable, Oid jobIdIndexId,
+						   TaskOutput *output);
+static Oid JobOutputRelationId(void);
+
+/* global variables */
+static MemoryContext JobOutputContext = NULL;
+static List *CompletedOutputList = NIL;
+
+
+/*
+ * InitializeJobOutput creates the memory context for captured output.
+ */
+void
+InitializeJobOutput(void)
+{
+	JobOutputContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "pg_cron output context",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+
+/*
+ * StartTaskOutput starts capturing the output of a run of the given job,
+ * or returns NULL if the job does not capture its output.
+ */
+TaskOutput *
+StartTaskOutput(CronJob *cronJob, int64 runId)
+{
+	MemoryContext oldContext = NULL;
+	TaskOutput *output = NULL;
+
+	if (cronJob->captureRows <= 0 || cronJob->captureBytes <= 0)
+	{
+		return NULL;
+	}
+
+	oldContext = MemoryContextSwitchTo(JobOutputContext);
+
+	output = (TaskOutput *) palloc0(sizeof(TaskOutput));
+	output->jobId = cronJob->jobId;
+	output->runId = runId;
+	output->userName = pstrdup(cronJob->userName);
+	output->maxRows = cronJob->captureRows;
+	output->maxBytes = Min(cronJob->captureBytes, MAX_CAPTURE_BYTES);
+
+	initStringInfo(&output->buffer);
+
+	MemoryContextSwitchTo(oldContext);
+
+	return output;
+}
+
+
+/*
+ * CaptureResultRow adds the row in a PGRES_SINGLE_TUPLE result to the
+ * output as a line of tab-separated values, in which NULLs are empty. The
+ * first row of a result replaces the rows of the previous result, and is
+ * preceded by a line with the column names.
+ */
+void
+CaptureResultRow(TaskOutput *output, PGresult *result)
+{
+	int columnCount = PQnfields(result);
+	int columnIndex = 0;
+
+	if (output->resultRowCount == 0)
+	{
+		resetStringInfo(&output->buffer);
+		output->rowCount = 0;
+		output->truncated = false;
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			char *columnName = PQfname(result, columnIndex);
+
+			if (columnIndex > 0)
+			{
+				AppendOutput(output, "\t", 1);
+			}
+
+			AppendOutput(output, columnName, strlen(columnName));
+		}
+
+		AppendOutput(output, "\n", 1);
+	}
+
+	output->resultRowCount++;
+
+	if (output->truncated)
+	{
+		return;
+	}
+
+	if (output->resultRowCount > output->maxRows)
+	{
+		output->truncated = true;
+		return;
+	}
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		if (columnIndex > 0)
+		{
+			AppendOutput(output, "\t", 1);
+		}
+
+		if (!PQgetisnull(result, 0, columnIndex))
+		{
+			AppendOutput(output, PQgetvalue(result, 0, columnIndex),
+						 PQgetlength(result, 0, columnIndex));
+		}
+	}
+
+	AppendOutput(output, "\n", 1);
+}
+
+
+/*
+ * AppendOutput appends data to the captured output, up to the byte limit
+ * of the job. Data that does not fit is cut at a character boundary and
+ * marks the output as truncated.
+ */
+static void
+AppendOutput(TaskOutput *output, const char *data, int length)
+{
+	int freeBytes = output->maxBytes - output->buffer.len;
+
+	if (output->truncated)
+	{
+		return;
+	}
+
+	if (length > freeBytes)
+	{
+		int clippedLength = pg_mbcliplen(data, length, freeBytes);
+
+		appendBinaryStringInfo(&output->buffer, data, clippedLength);
+		output->truncated = true;
+
+		return;
+	}
+
+	appendBinaryStringInfo(&output->buffer, data, length);
+}
+
+
+/*
+ * EndTaskResult is called when a result of the command is complete, and
+ * returns the number of rows that the result had.
+ */
+int64
+EndTaskResult(TaskOutput *output)
+{
+	int64 resultRowCount = output->resultRowCount;
+
+	if (resultRowCount > 0)
+	{
+		output->rowCount = resultRowCount;
+	}
+
+	output->resultRowCount = 0;
+
+	return resultRowCount;
+}
+
+
+/*
+ * CompleteTaskOutput records the output of a run that succeeded, such that
+ * it is saved by the next call to SaveTaskOutputs.
+ */
+void
+CompleteTaskOutput(TaskOutput *output, TimestampTz endTime)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(JobOutputContext);
+
+	output->endTime = endTime;
+
+	CompletedOutputList = lappend(CompletedOutputList, output);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * DiscardTaskOutput frees the output of a run that failed.
+ */
+void
+DiscardTaskOutput(TaskOutput *output)
+{
+	FreeTaskOutput(output);
+}
+
+
+/*
+ * FreeTaskOutput frees the memory used by the given output.
+ */
+static void
+FreeTaskOutput(TaskOutput *output)
+{
+	pfree(output->buffer.data);
+	pfree(output->userName);
+	pfree(output);
+}
+
+
+/*
+ * SaveTaskOutputs writes the output of runs that completed to the
+ * cron.job_output table. Output of jobs that were removed in the meantime
+ * is dropped, as is all output on a standby.
+ */
+void
+SaveTaskOutputs(void)
+{
+	Relation jobOutputTable = NULL;
+	Oid cronSchemaId = InvalidOid;
+	Oid jobIdIndexId = InvalidOid;
+	ListCell *outputCell = NULL;
+
+	if (CompletedOutputList == NIL)
+	{
+		return;
+	}
+
+	if (!RecoveryInProgress())
+	{
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		if (PgCronHasBeenLoaded() && JobOutputRelationId() != InvalidOid)
+		{
+			cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+			jobIdIndexId = get_relname_relid(JOB_OUTPUT_ID_INDEX_NAME,
+											 cronSchemaId);
+
+			jobOutputTable = heap_open(JobOutputRelationId(), RowExclusiveLock);
+
+			foreach(outputCell, CompletedOutputList)
+			{
+				TaskOutput *output = (TaskOutput *) lfirst(outputCell);
+
+				if (GetCronJob(output->jobId) == NULL)
+				{
+					continue;
+				}
+
+				SaveTaskOutput(jobOutputTable, jobIdIndexId, output);
+			}
+
+			heap_close(jobOutputTable, RowExclusiveLock);
+		}
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+	}
+
+	foreach(outputCell, CompletedOutputList)
+	{
+		FreeTaskOutput((TaskOutput *) lfirst(outputCell));
+	}
+
+	list_free(CompletedOutputList);
+	CompletedOutputList = NIL;
+}
+
+
+/*
+ * SaveTaskOutput inserts the given output into cron.job_output, or replaces
+ * the previous output of the job.
+ */
+static void
+SaveTaskOutput(Relation jobOutputTable, Oid jobIdIndexId, TaskOutput *output)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(jobOutputTable);
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_cron_job_output];
+	bool isNulls[Natts_cron_job_output];
+	bool replaces[Natts_cron_job_output];
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+	memset(replaces, true, sizeof(replaces));
+
+	values[Anum_cron_job_output_jobid - 1] = Int64GetDatum(output->jobId);
+	values[Anum_cron_job_output_runid - 1] = Int64GetDatum(output->runId);
+	values[Anum_cron_job_output_end_time - 1] =
+		TimestampTzGetDatum(output->endTime);
+	values[Anum_cron_job_output_username - 1] =
+		CStringGetTextDatum(output->userName);
+	values[Anum_cron_job_output_row_count - 1] = Int64GetDatum(output->rowCount);
+	values[Anum_cron_job_output_truncated - 1] = BoolGetDatum(output->truncated);
+	values[Anum_cron_job_output_output - 1] =
+		CStringGetTextDatum(output->buffer.data);
+
+	ScanKeyInit(&scanKey[0], Anum_cron_job_output_jobid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(output->jobId));
+
+	scanDescriptor = systable_beginscan(jobOutputTable, jobIdIndexId, true,
+										NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		HeapTuple newTuple = heap_modify_tuple(heapTuple, tupleDescriptor,
+											   values, isNulls, replaces);
+
+		simple_heap_update(jobOutputTable, &heapTuple->t_self, newTuple);
+		CatalogUpdateIndexes(jobOutputTable, newTuple);
+	}
+	else
+	{
+		HeapTuple newTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+		simple_heap_insert(jobOutputTable, newTuple);
+		CatalogUpdateIndexes(jobOutputTable, newTuple);
+	}
+
+	systable_endscan(scanDescriptor);
+
+	CommandCounterIncrement();
+}
+
+
+/*
+ * DeleteJobOutput removes the output of the given job from
+ * cron.job_output, if any. It is called when the job is unscheduled.
+ */
+void
+DeleteJobOutput(int64 jobId)
+{
+	Relation jobOutputTable = NULL;
+	Oid cronSchemaId = InvalidOid;
+	Oid jobIdIndexId = InvalidOid;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+
+	if (JobOutputRelationId() == InvalidOid)
+	{
+		return;
+	}
+
+	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+	jobIdIndexId = get_relname_relid(JOB_OUTPUT_ID_INDEX_NAME, cronSchemaId);
+
+	jobOutputTable = heap_open(JobOutputRelationId(), RowExclusiveLock);
+
+	ScanKeyInit(&scanKey[0], Anum_cron_job_output_jobid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(jobId));
+
+	scanDescriptor = systable_beginscan(jobOutputTable, jobIdIndexId, true,
+										NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		simple_heap_delete(jobOutputTable, &heapTuple->t_self);
+		CommandCounterIncrement();
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(jobOutputTable, RowExclusiveLock);
+}
+
+
+/*
+ * JobOutputRelationId returns the oid of the cron.job_output relation, or
+ * InvalidOid if the extension has not been updated to a version that has
+ * it.
+ */
+static Oid
+JobOutputRelationId(void)
+{
+	Oid cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+
+	return get_relname_relid(JOB_OUTPUT_TABLE_NAME, cronSchemaId);
+}
@@ -0,0 +1,444 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/node_groups.c
+ *
+ * Jobs that have a node group run on every node in the cron.node_group
+ * table with that group name. Each node of a job gets a copy of the job
+ * with its own node name and port, which the scheduler runs as a member
+ * of the task of the job. The result of the last run on each node is
+ * kept in the cron.job_node_status table.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "cron.h"
+#include "pg_cron.h"
+#include "cron_job_node_status.h"
+#include "cron_node_group.h"
+#include "job_metadata.h"
+#include "node_groups.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/skey.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "pgstat.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+
+#define CRON_SCHEMA_NAME "cron"
+#define NODE_GROUP_TABLE_NAME "node_group"
+#define JOB_NODE_STATUS_TABLE_NAME "job_node_status"
+#define JOB_NODE_STATUS_INDEX_NAME "job_node_status_pkey"
+
+
+/*
+ * NodeResult is the result of a run of a job on one node, which is kept
+ * until it is saved in cron.job_node_status.
+ */
+typedef struct NodeResult
+{
+	int64 jobId;
+	int64 runId;
+	char *nodeName;
+	int nodePort;
+	char *userName;
+	TimestampTz endTime;
+	bool succeeded;
+	char sqlState[6];
+} NodeResult;
+
+
+/* forward declarations */
+static void SaveNodeResult(Relation nodeStatusTable, Oid nodeStatusIndexId,
+						   NodeResult *nodeResult);
+static void FreeNodeResult(NodeResult *nodeResult);
+static Oid NodeGroupRelationId(void);
+static Oid JobNodeStatusRelationId(void);
+
+/* global variables */
+static MemoryContext NodeGroupContext = NULL;
+static List *NodeResultList = NIL;
+
+
+/*
+ * InitializeNodeGroups creates the memory context for the results of runs
+ * on node groups.
+ */
+void
+InitializeNodeGroups(void)
+{
+	NodeGroupContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "pg_cron node group context",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+
+/*
+ * LoadNodeGroupMembers adds a copy of each job in the given list that has a
+ * node group to its memberJobs for every node in the group. The copies are
+ * allocated in the current memory context. It is called in the transaction
+ * that loads the jobs.
+ */
+void
+LoadNodeGroupMembers(List *jobList)
+{
+	Relation nodeGroupTable = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	ListCell *jobCell = NULL;
+	bool hasNodeGroups = false;
+
+	foreach(jobCell, jobList)
+	{
+		CronJob *job = (CronJob *) lfirst(jobCell);
+
+		if (job->nodeGroup != NULL)
+		{
+			hasNodeGroups = true;
+			break;
+		}
+	}
+
+	if (!hasNodeGroups || NodeGroupRelationId() == InvalidOid)
+	{
+		return;
+	}
+
+	nodeGroupTable = heap_open(NodeGroupRelationId(), AccessShareLock);
+
+	scanDescriptor = systable_beginscan(nodeGroupTable, InvalidOid, false,
+										NULL, 0, scanKey);
+
+	tupleDescriptor = RelationGetDescr(nodeGroupTable);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		bool isNull = false;
+		Datum groupNameDatum = heap_getattr(heapTuple,
+											Anum_cron_node_group_group_name,
+											tupleDescriptor, &isNull);
+		Datum nodeNameDatum = heap_getattr(heapTuple,
+										   Anum_cron_node_group_nodename,
+										   tupleDescriptor, &isNull);
+		Datum nodePortDatum = heap_getattr(heapTuple,
+										   Anum_cron_node_group_nodeport,
+										   tupleDescriptor, &isNull);
+		char *groupName = TextDatumGetCString(groupNameDatum);
+		char *nodeName = NULL;
+
+		foreach(jobCell, jobList)
+		{
+			CronJob *job = (CronJob *) lfirst(jobCell);
+			CronJob *memberJob = NULL;
+
+			if (job->nodeGroup == NULL || strcmp(job->nodeGroup, groupName) != 0)
+			{
+				continue;
+			}
+
+			if (nodeName == NULL)
+			{
+				nodeName = TextDatumGetCString(nodeNameDatum);
+			}
+
+			/* the output of a run is only captured for the job as a whole */
+			memberJob = (CronJob *) palloc(sizeof(CronJob));
+			*memberJob = *job;
+			memberJob->nodeName = nodeName;
+			memberJob->nodePort = DatumGetInt32(nodePortDatum);
+			memberJob->captureRows = 0;
+			memberJob->nodeGroup = NULL;
+			memberJob->memberJobs = NIL;
+
+			job->memberJobs = lappend(job->memberJobs, memberJob);
+		}
+
+		pfree(groupName);
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(nodeGroupTable, AccessShareLock);
+}
+
+
+/*
+ * RecordNodeResult records the result of a run of a job on the node of the
+ * given member task, such that it is saved by the next call to
+ * SaveNodeResults.
+ */
+void
+RecordNodeResult(CronTask *member, bool succeeded, TimestampTz endTime)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(NodeGroupContext);
+	NodeResult *nodeResult = (NodeResult *) palloc0(sizeof(NodeResult));
+
+	nodeResult->jobId = member->jobId;
+	nodeResult->runId = member->runId;
+	nodeResult->nodeName = pstrdup(member->memberNodeName);
+	nodeResult->nodePort = member->memberNodePort;
+	nodeResult->userName = pstrdup(member->cronJob->userName);
+	nodeResult->endTime = endTime;
+	nodeResult->succeeded = succeeded;
+
+	if (!succeeded)
+	{
+		strlcpy(nodeResult->sqlState, member->sqlState,
+				sizeof(nodeResult->sqlState));
+	}
+
+	NodeResultList = lappend(NodeResultList, nodeResult);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * SaveNodeResults writes the results of runs on nodes that completed to the
+ * cron.job_node_status table. Results of jobs that were removed in the
+ * meantime are dropped, as are all results on a standby.
+ */
+void
+SaveNodeResults(void)
+{
+	Relation nodeStatusTable = NULL;
+	Oid cronSchemaId = InvalidOid;
+	Oid nodeStatusIndexId = InvalidOid;
+	ListCell *resultCell = NULL;
+
+	if (NodeResultList == NIL)
+	{
+		return;
+	}
+
+	if (!RecoveryInProgress())
+	{
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		if (PgCronHasBeenLoaded() && JobNodeStatusRelationId() != InvalidOid)
+		{
+			cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+			nodeStatusIndexId = get_relname_relid(JOB_NODE_STATUS_INDEX_NAME,
+												  cronSchemaId);
+
+			nodeStatusTable = heap_open(JobNodeStatusRelationId(),
+										RowExclusiveLock);
+
+			foreach(resultCell, NodeResultList)
+			{
+				NodeResult *nodeResult = (NodeResult *) lfirst(resultCell);
+
+				if (GetCronJob(nodeResult->jobId) == NULL)
+				{
+					continue;
+				}
+
+				SaveNodeResult(nodeStatusTable, nodeStatusIndexId, nodeResult);
+			}
+
+			heap_close(nodeStatusTable, RowExclusiveLock);
+		}
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+	}
+
+	foreach(resultCell, NodeResultList)
+	{
+		FreeNodeResult((NodeResult *) lfirst(resultCell));
+	}
+
+	list_free(NodeResultList);
+	NodeResultList = NIL;
+}
+
+
+/*
+ * SaveNodeResult inserts the given result into cron.job_node_status, or
+ * replaces the previous result of the job on the node.
+ */
+static void
+SaveNodeResult(Relation nodeStatusTable, Oid nodeStatusIndexId,
+			   NodeResult *nodeResult)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(nodeStatusTable);
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[3];
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_cron_job_node_status];
+	bool isNulls[Natts_cron_job_node_status];
+	bool replaces[Natts_cron_job_node_status];
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+	memset(replaces, true, sizeof(replaces));
+
+	values[Anum_cron_job_node_status_jobid - 1] = Int64GetDatum(nodeResult->jobId);
+	values[Anum_cron_job_node_status_nodename - 1] =
+		CStringGetTextDatum(nodeResult->nodeName);
+	values[Anum_cron_job_node_status_nodeport - 1] =
+		Int32GetDatum(nodeResult->nodePort);
+	values[Anum_cron_job_node_status_runid - 1] = Int64GetDatum(nodeResult->runId);
+	values[Anum_cron_job_node_status_end_time - 1] =
+		TimestampTzGetDatum(nodeResult->endTime);
+	values[Anum_cron_job_node_status_succeeded - 1] =
+		BoolGetDatum(nodeResult->succeeded);
+	values[Anum_cron_job_node_status_username - 1] =
+		CStringGetTextDatum(nodeResult->userName);
+
+	/* failures that did not reach the node have no SQLSTATE */
+	if (nodeResult->sqlState[0] != '\0')
+	{
+		values[Anum_cron_job_node_status_sqlstate - 1] =
+			CStringGetTextDatum(nodeResult->sqlState);
+	}
+	else
+	{
+		isNulls[Anum_cron_job_node_status_sqlstate - 1] = true;
+	}
+
+	ScanKeyInit(&scanKey[0], Anum_cron_job_node_status_jobid,
+				BTEqualStrategyNumber, F_INT8EQ,
+				Int64GetDatum(nodeResult->jobId));
+	ScanKeyInit(&scanKey[1], Anum_cron_job_node_status_nodename,
+				BTEqualStrategyNumber, F_TEXTEQ,
+				CStringGetTextDatum(nodeResult->nodeName));
+	ScanKeyInit(&scanKey[2], Anum_cron_job_node_status_nodeport,
+				BTEqualStrategyNumber, F_INT4EQ,
+				Int32GetDatum(nodeResult->nodePort));
+
+	scanDescriptor = systable_beginscan(nodeStatusTable, nodeStatusIndexId, true,
+										NULL, 3, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		HeapTuple newTuple = heap_modify_tuple(heapTuple, tupleDescriptor,
+											   values, isNulls, replaces);
+
+		simple_heap_update(nodeStatusTable, &heapTuple->t_self, newTuple);
+		CatalogUpdateIndexes(nodeStatusTable, newTuple);
+	}
+	else
+	{
+		HeapTuple newTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+		simple_heap_insert(nodeStatusTable, newTuple);
+		CatalogUpdateIndexes(nodeStatusTable, newTuple);
+	}
+
+	systable_endscan(scanDescriptor);
+
+	CommandCounterIncrement();
+}
+
+
+/*
+ * FreeNodeResult frees the memory used by the given result.
+ */
+static void
+FreeNodeResult(NodeResult *nodeResult)
+{
+	pfree(nodeResult->nodeName);
+	pfree(nodeResult->userName);
+	pfree(nodeResult);
+}
+
+
+/*
+ * DeleteJobNodeResults removes the results of the given job on its nodes
+ * from cron.job_node_status. It is called when the job is unscheduled.
+ */
+void
+DeleteJobNodeResults(int64 jobId)
+{
+	Relation nodeStatusTable = NULL;
+	Oid cronSchemaId = InvalidOid;
+	Oid nodeStatusIndexId = InvalidOid;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+
+	if (JobNodeStatusRelationId() == InvalidOid)
+	{
+		return;
+	}
+
+	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+	nodeStatusIndexId = get_relname_relid(JOB_NODE_STATUS_INDEX_NAME,
+										  cronSchemaId);
+
+	nodeStatusTable = heap_open(JobNodeStatusRelationId(), RowExclusiveLock);
+
+	ScanKeyInit(&scanKey[0], Anum_cron_job_node_status_jobid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(jobId));
+
+	scanDescriptor = systable_beginscan(nodeStatusTable, nodeStatusIndexId, true,
+										NULL, 1, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		simple_heap_delete(nodeStatusTable, &heapTuple->t_self);
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	CommandCounterIncrement();
+
+	systable_endscan(scanDescriptor);
+	heap_close(nodeStatusTable, RowExclusiveLock);
+}
+
+
+/*
+ * NodeGroupRelationId returns the oid of the cron.node_group relation, or
+ * InvalidOid if the extension has not been updated to a version that has
+ * it.
+ */
+static Oid
+NodeGroupRelationId(void)
+{
+	Oid cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+
+	return get_relname_relid(NODE_GROUP_TABLE_NAME, cronSchemaId);
+}
+
+
+/*
+ * JobNodeStatusRelationId returns the oid of the cron.job_node_status
+ * relation, or InvalidOid if the extension has not been updated to a
+ * version that has it.
+ */
+static Oid
+JobNodeStatusRelationId(void)
+{
+	Oid cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+
+	return get_relname_relid(JOB_NODE_STATUS_TABLE_NAME, cronSchemaId);
+}
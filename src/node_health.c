@@ -0,0 +1,229 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/node_health.c
+ *
+ * Circuit breakers for the nodes that jobs run on. After a number of
+ * consecutive connection failures, the circuit of a node opens and runs
+ * on that node fail right away instead of waiting for a connection
+ * timeout. Once the retry interval has passed, a single run is let
+ * through as a probe, which closes the circuit if it can connect.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "node_health.h"
+
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+#define MAX_NODE_NAME_LENGTH 256
+
+
+/* node names are truncated in the key, at worst sharing a circuit */
+typedef struct NodeHealthKey
+{
+	char nodeName[MAX_NODE_NAME_LENGTH];
+	int nodePort;
+} NodeHealthKey;
+
+typedef struct NodeHealth
+{
+	NodeHealthKey key;
+	NodeCircuitState state;
+	int failureCount;
+	TimestampTz openTime;
+	TimestampTz probeTime;
+} NodeHealth;
+
+
+/* forward declarations */
+static NodeHealth * GetNodeHealth(char *nodeName, int nodePort);
+
+/* global settings */
+int NodeFailureThreshold = 5;
+int NodeRetryInterval = 30000;
+
+/* global variables */
+static MemoryContext NodeHealthContext = NULL;
+static HTAB *NodeHealthHash = NULL;
+
+
+/*
+ * InitializeNodeHealth creates the hash that holds the circuit breaker of
+ * each node.
+ */
+void
+InitializeNodeHealth(void)
+{
+	HASHCTL info;
+	int hashFlags = 0;
+
+	NodeHealthContext = AllocSetContextCreate(CurrentMemoryContext,
+											  "pg_cron node health context",
+											  ALLOCSET_DEFAULT_MINSIZE,
+											  ALLOCSET_DEFAULT_INITSIZE,
+											  ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(NodeHealthKey);
+	info.entrysize = sizeof(NodeHealth);
+	info.hash = tag_hash;
+	info.hcxt = NodeHealthContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	NodeHealthHash = hash_create("pg_cron node health", 32, &info, hashFlags);
+}
+
+
+/*
+ * GetNodeHealth returns the circuit breaker of the given node, which
+ * starts out closed.
+ */
+static NodeHealth *
+GetNodeHealth(char *nodeName, int nodePort)
+{
+	NodeHealthKey key;
+	NodeHealth *nodeHealth = NULL;
+	bool isPresent = false;
+
+	memset(&key, 0, sizeof(key));
+	strlcpy(key.nodeName, nodeName, MAX_NODE_NAME_LENGTH);
+	key.nodePort = nodePort;
+
+	nodeHealth = hash_search(NodeHealthHash, &key, HASH_ENTER, &isPresent);
+	if (!isPresent)
+	{
+		nodeHealth->state = NODE_CIRCUIT_CLOSED;
+		nodeHealth->failureCount = 0;
+		nodeHealth->openTime = 0;
+		nodeHealth->probeTime = 0;
+	}
+
+	return nodeHealth;
+}
+
+
+/*
+ * NodeAcceptsConnection returns whether a run may connect to the given
+ * node. While the circuit is open, only a probe is let through after each
+ * retry interval, such that a probe that never completes (e.g. because
+ * its job was removed) does not keep the circuit open forever.
+ */
+bool
+NodeAcceptsConnection(char *nodeName, int nodePort, TimestampTz currentTime)
+{
+	NodeHealth *nodeHealth = NULL;
+
+	if (NodeFailureThreshold <= 0)
+	{
+		return true;
+	}
+
+	nodeHealth = GetNodeHealth(nodeName, nodePort);
+
+	switch (nodeHealth->state)
+	{
+		case NODE_CIRCUIT_OPEN:
+		{
+			if (!TimestampDifferenceExceeds(nodeHealth->openTime, currentTime,
+											NodeRetryInterval))
+			{
+				return false;
+			}
+
+			nodeHealth->state = NODE_CIRCUIT_HALF_OPEN;
+			nodeHealth->probeTime = currentTime;
+
+			return true;
+		}
+
+		case NODE_CIRCUIT_HALF_OPEN:
+		{
+			if (!TimestampDifferenceExceeds(nodeHealth->probeTime, currentTime,
+											NodeRetryInterval))
+			{
+				return false;
+			}
+
+			nodeHealth->probeTime = currentTime;
+
+			return true;
+		}
+
+		case NODE_CIRCUIT_CLOSED:
+		default:
+		{
+			return true;
+		}
+	}
+}
+
+
+/*
+ * RecordNodeSuccess closes the circuit of a node after a run connected to
+ * it.
+ */
+void
+RecordNodeSuccess(char *nodeName, int nodePort)
+{
+	NodeHealth *nodeHealth = NULL;
+
+	if (NodeFailureThreshold <= 0)
+	{
+		return;
+	}
+
+	nodeHealth = GetNodeHealth(nodeName, nodePort);
+
+	if (nodeHealth->state != NODE_CIRCUIT_CLOSED)
+	{
+		ereport(LOG, (errmsg("pg_cron node %s:%d is available again",
+							 nodeName, nodePort)));
+	}
+
+	nodeHealth->state = NODE_CIRCUIT_CLOSED;
+	nodeHealth->failureCount = 0;
+}
+
+
+/*
+ * RecordNodeFailure counts a failure to connect to, or a lost connection
+ * with, a node and opens its circuit once the failure threshold is reached
+ * or when a probe fails.
+ */
+void
+RecordNodeFailure(char *nodeName, int nodePort, TimestampTz currentTime)
+{
+	NodeHealth *nodeHealth = NULL;
+
+	if (NodeFailureThreshold <= 0)
+	{
+		return;
+	}
+
+	nodeHealth = GetNodeHealth(nodeName, nodePort);
+	nodeHealth->failureCount++;
+
+	if (nodeHealth->state == NODE_CIRCUIT_HALF_OPEN ||
+		(nodeHealth->state == NODE_CIRCUIT_CLOSED &&
+		 nodeHealth->failureCount >= NodeFailureThreshold))
+	{
+		if (nodeHealth->state == NODE_CIRCUIT_CLOSED)
+		{
+			ereport(LOG, (errmsg("pg_cron node %s:%d is unavailable after %d "
+								 "failures, skipping its jobs for %d ms",
+								 nodeName, nodePort, nodeHealth->failureCount,
+								 NodeRetryInterval)));
+		}
+
+		nodeHealth->state = NODE_CIRCUIT_OPEN;
+		nodeHealth->openTime = currentTime;
+	}
+}
@@ -0,0 +1,541 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/one_shot_jobs.c
+ *
+ * Jobs that run once at a given time. One-shot jobs are kept in the
+ * cron.one_shot_job table, which is separate from cron.job such that
+ * adding them does not invalidate the job cache. Instead, the scheduler
+ * is notified of new one-shot jobs through shared memory and keeps a
+ * timer for each of them. When a timer expires, the job is run in the
+ * same way as a queued task, and removed from the table once it is done.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "cron.h"
+#include "pg_cron.h"
+#include "job_metadata.h"
+#include "cron_one_shot_job.h"
+#include "one_shot_jobs.h"
+#include "shared_state.h"
+#include "task_queue.h"
+#include "task_states.h"
+#include "timer_heap.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/skey.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "pgstat.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+
+#define CRON_SCHEMA_NAME "cron"
+#define ONE_SHOT_JOB_TABLE_NAME "one_shot_job"
+#define ONE_SHOT_JOB_ID_INDEX_NAME "one_shot_job_pkey"
+
+
+/* forward declarations */
+static void OneShotJobXactCallback(XactEvent event, void *arg);
+static Oid OneShotJobRelationId(void);
+static void ReloadOneShotTimers(void);
+
+
+/* SQL-callable functions */
+PG_FUNCTION_INFO_V1(cron_schedule_at);
+
+
+/* global variables */
+static bool XactCallbackRegistered = false;
+static List *PendingRequestList = NIL;
+static MemoryContext OneShotJobContext = NULL;
+static HTAB *RunningOneShotJobHash = NULL;
+static List *CompletedOneShotJobList = NIL;
+
+
+/*
+ * cron_schedule_at schedules a command to run once at the given time and
+ * returns the ID of the one-shot job.
+ */
+Datum
+cron_schedule_at(PG_FUNCTION_ARGS)
+{
+	TimestampTz runAt = PG_GETARG_TIMESTAMPTZ(0);
+	char *command = text_to_cstring(PG_GETARG_TEXT_P(1));
+	char *userName = GetUserNameFromId(GetUserId(), false);
+	int64 jobId = 0;
+
+	Relation oneShotJobTable = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_cron_one_shot_job];
+	bool isNulls[Natts_cron_one_shot_job];
+	MemoryContext oldContext = NULL;
+	OneShotRequest *request = NULL;
+
+	if (TIMESTAMP_NOT_FINITE(runAt))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("run_at must be finite")));
+	}
+
+	/* one-shot jobs use the same IDs as queued tasks */
+	jobId = NextTaskId();
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_cron_one_shot_job_jobid - 1] = Int64GetDatum(jobId);
+	values[Anum_cron_one_shot_job_run_at - 1] = TimestampTzGetDatum(runAt);
+	values[Anum_cron_one_shot_job_command - 1] = CStringGetTextDatum(command);
+	values[Anum_cron_one_shot_job_database - 1] =
+		CStringGetTextDatum(CronTableDatabaseName);
+	values[Anum_cron_one_shot_job_username - 1] = CStringGetTextDatum(userName);
+
+	oneShotJobTable = heap_open(OneShotJobRelationId(), RowExclusiveLock);
+
+	tupleDescriptor = RelationGetDescr(oneShotJobTable);
+	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	simple_heap_insert(oneShotJobTable, heapTuple);
+	CatalogUpdateIndexes(oneShotJobTable, heapTuple);
+	CommandCounterIncrement();
+
+	heap_close(oneShotJobTable, RowExclusiveLock);
+
+	/* notify the scheduler once the job is visible */
+	if (!XactCallbackRegistered)
+	{
+		RegisterXactCallback(OneShotJobXactCallback, NULL);
+		XactCallbackRegistered = true;
+	}
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	request = (OneShotRequest *) palloc(sizeof(OneShotRequest));
+	request->jobId = jobId;
+	request->runAt = runAt;
+
+	PendingRequestList = lappend(PendingRequestList, request);
+
+	MemoryContextSwitchTo(oldContext);
+
+	PG_RETURN_INT64(jobId);
+}
+
+
+/*
+ * OneShotJobXactCallback notifies the scheduler of the one-shot jobs that
+ * were scheduled in a transaction when it commits. Jobs that were rolled
+ * back in a subtransaction are not found by the scheduler and skipped.
+ */
+static void
+OneShotJobXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_PRE_PREPARE:
+		{
+			if (PendingRequestList != NIL)
+			{
+				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+								errmsg("cannot prepare a transaction that "
+									   "scheduled one-shot jobs")));
+			}
+
+			break;
+		}
+
+		case XACT_EVENT_COMMIT:
+		{
+			ListCell *requestCell = NULL;
+
+			if (PendingRequestList == NIL)
+			{
+				break;
+			}
+
+			foreach(requestCell, PendingRequestList)
+			{
+				OneShotRequest *request = (OneShotRequest *) lfirst(requestCell);
+
+				PushOneShotRequest(request);
+			}
+
+			/* the list itself lives in TopTransactionContext */
+			PendingRequestList = NIL;
+
+			WakeScheduler();
+
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		{
+			PendingRequestList = NIL;
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * OneShotJobRelationId returns the oid of the cron.one_shot_job relation,
+ * or InvalidOid if the extension has not been updated to a version that
+ * has it.
+ */
+static Oid
+OneShotJobRelationId(void)
+{
+	Oid cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+
+	return get_relname_relid(ONE_SHOT_JOB_TABLE_NAME, cronSchemaId);
+}
+
+
+/*
+ * InitializeOneShotJobs initializes the data structures for tracking
+ * one-shot jobs in the scheduler.
+ */
+void
+InitializeOneShotJobs(void)
+{
+	HASHCTL info;
+	int hashFlags = 0;
+
+	OneShotJobContext = AllocSetContextCreate(CurrentMemoryContext,
+											  "pg_cron one-shot job context",
+											  ALLOCSET_DEFAULT_MINSIZE,
+											  ALLOCSET_DEFAULT_INITSIZE,
+											  ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(int64);
+	info.entrysize = sizeof(int64);
+	info.hash = tag_hash;
+	info.hcxt = OneShotJobContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	RunningOneShotJobHash = hash_create("pg_cron running one-shot jobs", 32,
+										&info, hashFlags);
+}
+
+
+/*
+ * UpdateOneShotTimers adds a timer for each new one-shot job that the
+ * scheduler was notified of, or reloads the timers of all one-shot jobs
+ * if notifications were lost.
+ */
+void
+UpdateOneShotTimers(void)
+{
+	OneShotRequest requests[64];
+	int requestCount = 0;
+
+	while ((requestCount = DequeueOneShotRequests(requests, lengthof(requests))) > 0)
+	{
+		int requestIndex = 0;
+
+		for (requestIndex = 0; requestIndex < requestCount; requestIndex++)
+		{
+			OneShotRequest *request = &requests[requestIndex];
+
+			AddTimer(CRON_TIMER_ONE_SHOT, request->jobId, request->runAt);
+		}
+	}
+
+	/* one-shot jobs only run on the primary */
+	if (!RecoveryInProgress() && TakeOneShotReloadNeeded())
+	{
+		ReloadOneShotTimers();
+	}
+}
+
+
+/*
+ * ReloadOneShotTimers replaces the timers of one-shot jobs by a timer for
+ * each job in the cron.one_shot_job table that is not running.
+ */
+static void
+ReloadOneShotTimers(void)
+{
+	Relation oneShotJobTable = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 0;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (!PgCronHasBeenLoaded() || OneShotJobRelationId() == InvalidOid)
+	{
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		return;
+	}
+
+	RemoveTimers(CRON_TIMER_ONE_SHOT);
+
+	oneShotJobTable = heap_open(OneShotJobRelationId(), AccessShareLock);
+
+	scanDescriptor = systable_beginscan(oneShotJobTable,
+										InvalidOid, false,
+										NULL, scanKeyCount, scanKey);
+
+	tupleDescriptor = RelationGetDescr(oneShotJobTable);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		bool isNull = false;
+		bool isPresent = false;
+		Datum jobIdDatum = heap_getattr(heapTuple, Anum_cron_one_shot_job_jobid,
+										tupleDescriptor, &isNull);
+		Datum runAtDatum = heap_getattr(heapTuple, Anum_cron_one_shot_job_run_at,
+										tupleDescriptor, &isNull);
+		int64 jobId = DatumGetInt64(jobIdDatum);
+
+		hash_search(RunningOneShotJobHash, &jobId, HASH_FIND, &isPresent);
+		if (!isPresent)
+		{
+			AddTimer(CRON_TIMER_ONE_SHOT, jobId, DatumGetTimestampTz(runAtDatum));
+		}
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(oneShotJobTable, AccessShareLock);
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+
+/*
+ * StartOneShotJobs starts the one-shot jobs whose timers expired. Jobs
+ * that were removed in the meantime are skipped, and jobs whose time was
+ * changed get a new timer.
+ */
+void
+StartOneShotJobs(List *timerList, TimestampTz currentTime)
+{
+	Relation oneShotJobTable = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Oid cronSchemaId = InvalidOid;
+	Oid jobIdIndexId = InvalidOid;
+	ListCell *timerCell = NULL;
+
+	if (RecoveryInProgress())
+	{
+		return;
+	}
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (!PgCronHasBeenLoaded() || OneShotJobRelationId() == InvalidOid)
+	{
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		return;
+	}
+
+	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+	jobIdIndexId = get_relname_relid(ONE_SHOT_JOB_ID_INDEX_NAME, cronSchemaId);
+
+	oneShotJobTable = heap_open(OneShotJobRelationId(), AccessShareLock);
+	tupleDescriptor = RelationGetDescr(oneShotJobTable);
+
+	foreach(timerCell, timerList)
+	{
+		CronTimer *timer = (CronTimer *) lfirst(timerCell);
+		int64 jobId = timer->id;
+		SysScanDesc scanDescriptor = NULL;
+		ScanKeyData scanKey[1];
+		HeapTuple heapTuple = NULL;
+		bool isPresent = false;
+
+		hash_search(RunningOneShotJobHash, &jobId, HASH_FIND, &isPresent);
+		if (isPresent)
+		{
+			continue;
+		}
+
+		ScanKeyInit(&scanKey[0], Anum_cron_one_shot_job_jobid,
+					BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(jobId));
+
+		scanDescriptor = systable_beginscan(oneShotJobTable, jobIdIndexId, true,
+											NULL, 1, scanKey);
+
+		heapTuple = systable_getnext(scanDescriptor);
+		if (HeapTupleIsValid(heapTuple))
+		{
+			bool isNull = false;
+			Datum runAt = heap_getattr(heapTuple, Anum_cron_one_shot_job_run_at,
+									   tupleDescriptor, &isNull);
+			Datum command = heap_getattr(heapTuple, Anum_cron_one_shot_job_command,
+										 tupleDescriptor, &isNull);
+			Datum database = heap_getattr(heapTuple, Anum_cron_one_shot_job_database,
+										  tupleDescriptor, &isNull);
+			Datum userName = heap_getattr(heapTuple, Anum_cron_one_shot_job_username,
+										  tupleDescriptor, &isNull);
+
+			if (DatumGetTimestampTz(runAt) > currentTime)
+			{
+				AddTimer(CRON_TIMER_ONE_SHOT, jobId, DatumGetTimestampTz(runAt));
+			}
+			else
+			{
+				CronJob *job = CreateQueuedJob(jobId, TextDatumGetCString(command),
+											   TextDatumGetCString(database),
+											   TextDatumGetCString(userName));
+
+				AddQueuedTask(job->jobId);
+
+				hash_search(RunningOneShotJobHash, &jobId, HASH_ENTER, &isPresent);
+			}
+		}
+
+		systable_endscan(scanDescriptor);
+	}
+
+	heap_close(oneShotJobTable, AccessShareLock);
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+
+/*
+ * CompleteOneShotJob marks the one-shot job that ran as the given queued
+ * job ID as done, such that it is removed from cron.one_shot_job. Queued
+ * tasks that are not one-shot jobs are ignored.
+ */
+void
+CompleteOneShotJob(int64 jobId)
+{
+	int64 oneShotJobId = -jobId;
+	bool isPresent = false;
+	MemoryContext oldContext = NULL;
+	int64 *completedJobId = NULL;
+
+	hash_search(RunningOneShotJobHash, &oneShotJobId, HASH_REMOVE, &isPresent);
+	if (!isPresent)
+	{
+		return;
+	}
+
+	oldContext = MemoryContextSwitchTo(OneShotJobContext);
+
+	completedJobId = (int64 *) palloc(sizeof(int64));
+	*completedJobId = oneShotJobId;
+
+	CompletedOneShotJobList = lappend(CompletedOneShotJobList, completedJobId);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * RemoveCompletedOneShotJobs removes the one-shot jobs that are done from
+ * the cron.one_shot_job table.
+ */
+void
+RemoveCompletedOneShotJobs(void)
+{
+	Relation oneShotJobTable = NULL;
+	Oid cronSchemaId = InvalidOid;
+	Oid jobIdIndexId = InvalidOid;
+	ListCell *jobIdCell = NULL;
+
+	if (CompletedOneShotJobList == NIL || RecoveryInProgress())
+	{
+		return;
+	}
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (PgCronHasBeenLoaded() && OneShotJobRelationId() != InvalidOid)
+	{
+		cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+		jobIdIndexId = get_relname_relid(ONE_SHOT_JOB_ID_INDEX_NAME, cronSchemaId);
+
+		oneShotJobTable = heap_open(OneShotJobRelationId(), RowExclusiveLock);
+
+		foreach(jobIdCell, CompletedOneShotJobList)
+		{
+			int64 jobId = *((int64 *) lfirst(jobIdCell));
+			SysScanDesc scanDescriptor = NULL;
+			ScanKeyData scanKey[1];
+			HeapTuple heapTuple = NULL;
+
+			ScanKeyInit(&scanKey[0], Anum_cron_one_shot_job_jobid,
+						BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(jobId));
+
+			scanDescriptor = systable_beginscan(oneShotJobTable, jobIdIndexId,
+												true, NULL, 1, scanKey);
+
+			heapTuple = systable_getnext(scanDescriptor);
+			if (HeapTupleIsValid(heapTuple))
+			{
+				simple_heap_delete(oneShotJobTable, &heapTuple->t_self);
+			}
+
+			systable_endscan(scanDescriptor);
+		}
+
+		heap_close(oneShotJobTable, RowExclusiveLock);
+	}
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	list_free_deep(CompletedOneShotJobList);
+	CompletedOneShotJobList = NIL;
+}
+
+
+/*
+ * RunningOneShotJobCount returns the number of one-shot jobs that are
+ * running.
+ */
+int
+RunningOneShotJobCount(void)
+{
+	return hash_get_num_entries(RunningOneShotJobHash);
+}
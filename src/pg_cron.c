@@ -28,7 +28,21 @@
 
 #include "pg_cron.h"
 #include "task_states.h"
+#include "admission_queue.h"
+#include "job_dependencies.h"
+#include "host_cache.h"
 #include "job_metadata.h"
+#include "job_output.h"
+#include "node_groups.h"
+#include "node_health.h"
+#include "one_shot_jobs.h"
+#include "run_log.h"
+#include "schedule_index.h"
+#include "scheduler_lease.h"
+#include "shared_state.h"
+#include "task_queue.h"
+#include "time_zones.h"
+#include "timer_heap.h"
 
 #include "poll.h"
 #include "sys/time.h"
@@ -55,6 +69,7 @@
 #include "postmaster/postmaster.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/guc.h"
 #include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
@@ -62,6 +77,9 @@
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
 #include "utils/timestamp.h"
+#if PG_VERSION_NUM >= 100000
+#include "utils/varlena.h"
+#endif
 #include "tcop/utility.h"
 
 
@@ -85,34 +103,119 @@ static void pg_cron_sigterm(SIGNAL_ARGS);
 static void pg_cron_sighup(SIGNAL_ARGS);
 static void PgCronWorkerMain(Datum arg);
 
-static void StartAllPendingRuns(List *taskList, TimestampTz currentTime);
-static void StartPendingRuns(CronTask *task, ClockProgress clockProgress,
+static void StartRequestedRuns(TimestampTz currentTime);
+static void StartQueuedTasks(void);
+static void StartTimerRuns(TimestampTz currentTime);
+static void ScheduleIntervalTasks(TimestampTz currentTime);
+static void StartIntervalRun(CronTimer *timer, TimestampTz currentTime);
+static void ScheduleIntervalRun(CronTask *task, TimestampTz dueTime);
+static bool ShouldRetryRun(CronTask *task, CronJob *cronJob);
+static void ScheduleRetry(CronTask *task, CronJob *cronJob,
+						  TimestampTz currentTime, bool logRetry);
+static void StartRetryRun(CronTimer *timer);
+static void StartAllPendingRuns(TimestampTz currentTime);
+static void PrewarmConnections(TimestampTz currentTime);
+static int CompareTaskPriority(const void *leftElement, const void *rightElement);
+static int CompareTaskTurn(const void *leftElement, const void *rightElement);
+static int CountRunningJobs(void);
+static void AdmitDueRuns(void);
+static void StartTimeZonePendingRuns(CronTimeZone *timeZone,
+									 TimestampTz currentTime);
+static void StartPendingRuns(ScheduleIndex *index, ClockProgress clockProgress,
 							 TimestampTz lastMinute, TimestampTz currentTime);
+static void StartMinutePendingRuns(ScheduleIndex *index,
+								   TimestampTz virtualTime, bool doWild,
+								   bool doNonWild);
 static int MinutesPassed(TimestampTz startTime, TimestampTz stopTime);
 static TimestampTz TimestampMinuteStart(TimestampTz time);
 static TimestampTz TimestampMinuteEnd(TimestampTz time);
-static bool ShouldRunTask(entry *schedule, TimestampTz currentMinute,
-						  bool doWild, bool doNonWild);
 
+static char * ConnectionHostName(CronJob *cronJob);
+static void RecordConnectionFailure(CronTask *task, CronJob *cronJob,
+									TimestampTz currentTime);
+static bool LibpqHasTcpUserTimeout(void);
+static bool IsLocalNode(CronJob *cronJob);
+static char * LocalSocketDirectory(void);
+static void BuildConnectionParams(CronJob *cronJob, int64 leaseToken,
+								  char *hostList, char *hostAddrList,
+								  const char **keywordArray,
+								  const char **valueArray);
 static void WaitForCronTasks(List *taskList);
+static TimestampTz NextWakeTime(TimestampTz currentTime, int maxWait);
+static TimestampTz NextScheduledRunTime(TimestampTz currentTime,
+										TimestampTz maxTime);
+static TimestampTz NextDueLocalMinute(ScheduleIndex *index,
+									  TimestampTz localMinute, int maxMinutes);
 static void PollForTasks(List *taskList);
+static int WaitForSockets(struct pollfd *pollFDs, int fdCount, int timeout,
+						  bool socketsMayChange);
+#if PG_VERSION_NUM >= 90600
+static void BuildSocketWaitSet(struct pollfd *pollFDs, int *fdIndexArray,
+							   uint32 *waitFlagsArray, int socketCount);
+#endif
 static void ManageCronTasks(List *taskList, TimestampTz currentTime);
 static void ManageCronTask(CronTask *task, TimestampTz currentTime);
+static bool TakeNextRun(CronTask *task);
+static void StartFanOut(CronTask *task, TimestampTz currentTime);
+static void AdvanceFanOut(CronTask *task);
+static void CompleteMemberRun(CronTask *member, bool succeeded,
+							  TimestampTz currentTime);
 
 
 /* global settings */
 char *CronTableDatabaseName = "postgres";
-static bool CronLogStatement = true;
+bool EnableStandbyScheduler = false;
+static bool CronUseLocalSocket = false;
+static int CronQueueConcurrency = 4;
+static int CronMaxRunningJobs = 0;
+static int CronMaxRunningJobsPerUser = 0;
+static int CronPrewarmTime = 0;
+static int CronKeepalivesIdle = 30;
+static int CronKeepalivesInterval = 10;
+static int CronKeepalivesCount = 3;
+static int CronTcpUserTimeout = 0;
 
 /* flags set by signal handlers */
 static volatile sig_atomic_t got_sigterm = false;
+static volatile sig_atomic_t got_sighup = false;
+
+/* errors without an SQLSTATE come from the connection to the node */
+#define CONNECTION_EXCEPTION_SQLSTATE "08000"
+
+/* room for all keywords passed to PQconnectStartParams, and a NULL */
+#define MAX_CONNECTION_PARAMS 16
+
+/* upper bound on the delay between attempts of a failed run */
+#define MAX_RETRY_DELAY_MS (24 * 60 * 60 * 1000)
 
 /* global variables */
-static int64 RunCount = 0; /* counter for assigning unique run IDs */
 static int CronTaskStartTimeout = 10000; /* maximum connection time */
 static const int MaxWait = 1000; /* maximum time in ms that poll() can block */
+
+#if PG_VERSION_NUM >= 90600
+
+/* wait event set of our latch and the sockets, kept across waits */
+static WaitEventSet *SocketWaitSet = NULL;
+static WaitEvent *SocketWaitEvents = NULL;
+static pgsocket *SocketWaitSockets = NULL;
+static uint32 *SocketWaitFlags = NULL;
+static int SocketWaitCount = 0;
+
+/* position of the first socket, after our latch and postmaster death */
+#define FIRST_SOCKET_WAIT_POSITION 2
+#endif
+
+/*
+ * Maximum time in ms that the scheduler sleeps while no task is running.
+ * Job changes and requests set the latch, so this only bounds how late we
+ * notice changes in the wall clock.
+ */
+static const int MaxIdleWait = 10 * 60 * 1000;
 static bool RebootJobsScheduled = false;
 
+/* whether libpq accepts the tcp_user_timeout keyword, -1 until checked */
+static int TcpUserTimeoutSupport = -1;
+
 
 /*
  * _PG_init gets called when the extension is loaded.
@@ -142,16 +245,279 @@ _PG_init(void)
 	DefineCustomBoolVariable(
 		"cron.log_statement",
 		gettext_noop("Log all cron statements prior to execution."),
-		NULL,
+		gettext_noop("Jobs with a log level set through cron.alter_job "
+					 "ignore this setting."),
 		&CronLogStatement,
 		true,
+		PGC_SIGHUP,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.log_summary_interval",
+		gettext_noop("Time between log lines that summarize the runs of "
+					 "all jobs."),
+		gettext_noop("A value of 0 logs no summary."),
+		&CronLogSummaryInterval,
+		0,
+		0,
+		INT_MAX,
+		PGC_SIGHUP,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.log_error_interval",
+		gettext_noop("Minimum time between log lines about failures of "
+					 "the same job."),
+		gettext_noop("A value of 0 logs every failure."),
+		&CronLogErrorInterval,
+		0,
+		0,
+		INT_MAX,
+		PGC_SIGHUP,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomStringVariable(
+		"cron.lease_conninfo",
+		gettext_noop("Connection string of the database in which schedulers "
+					 "compete for the lease to start runs."),
+		gettext_noop("An empty string lets the scheduler start runs without "
+					 "a lease."),
+		&CronLeaseConnInfo,
+		"",
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomStringVariable(
+		"cron.lease_name",
+		gettext_noop("Name of the lease for which schedulers compete."),
+		gettext_noop("Schedulers of different clusters that share a lease "
+					 "database use different names."),
+		&CronLeaseName,
+		"pg_cron",
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.lease_time",
+		gettext_noop("Time after which the lease of a scheduler that stopped "
+					 "renewing it can be taken over."),
+		NULL,
+		&CronLeaseTime,
+		10000,
+		3000,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomStringVariable(
+		"cron.lease_token",
+		gettext_noop("Token of the scheduler lease under which the run of "
+					 "the current session was started."),
+		gettext_noop("Set by the scheduler when it connects for a run, "
+					 "while cron.lease_conninfo is set."),
+		&CronLeaseTokenSetting,
+		"",
+		PGC_BACKEND,
+		GUC_NOT_IN_SAMPLE,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"cron.enable_standby_scheduler",
+		gettext_noop("Run read-only jobs on a hot standby."),
+		gettext_noop("While the standby scheduler holds its lease on the "
+					 "primary, the primary leaves read-only jobs to it."),
+		&EnableStandbyScheduler,
+		false,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomStringVariable(
+		"cron.primary_conninfo",
+		gettext_noop("Connection string of the primary with which the "
+					 "standby scheduler registers to run read-only jobs."),
+		gettext_noop("An empty string keeps read-only jobs on the primary."),
+		&CronPrimaryConnInfo,
+		"",
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.queue_concurrency",
+		gettext_noop("Maximum number of queued tasks that run at the same time."),
+		NULL,
+		&CronQueueConcurrency,
+		4,
+		1,
+		1024,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.max_running_jobs",
+		gettext_noop("Maximum number of jobs that run at the same time."),
+		gettext_noop("Runs that are due while the limit is reached start "
+					 "later, in order of job priority. A value of 0 means "
+					 "no limit."),
+		&CronMaxRunningJobs,
+		0,
+		0,
+		INT_MAX,
+		PGC_SIGHUP,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.max_running_jobs_per_user",
+		gettext_noop("Maximum number of jobs of the same user that run at "
+					 "the same time."),
+		gettext_noop("Runs of users below the limit start in order of "
+					 "priority, and users take turns to start runs of the "
+					 "same priority. A value of 0 means no limit."),
+		&CronMaxRunningJobsPerUser,
+		0,
+		0,
+		INT_MAX,
+		PGC_SIGHUP,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.node_failure_threshold",
+		gettext_noop("Number of consecutive connection failures after which "
+					 "jobs on a node are skipped."),
+		gettext_noop("A value of 0 never skips jobs."),
+		&NodeFailureThreshold,
+		5,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.node_retry_interval",
+		gettext_noop("Time after which a job is allowed to probe a node "
+					 "whose jobs are skipped."),
+		NULL,
+		&NodeRetryInterval,
+		30000,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.prewarm_time",
+		gettext_noop("Time before the start of a minute at which connections "
+					 "for the jobs due in that minute are opened."),
+		gettext_noop("A value of 0 opens connections when jobs are due."),
+		&CronPrewarmTime,
+		0,
+		0,
+		30000,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"cron.use_local_socket",
+		gettext_noop("Connect to the local server through a Unix-domain socket."),
+		gettext_noop("Jobs on localhost at the port of the server use the "
+					 "first directory in unix_socket_directories, such that "
+					 "pg_hba.conf entries of type local apply."),
+		&CronUseLocalSocket,
+		false,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.host_cache_ttl",
+		gettext_noop("Time for which resolved addresses of node names are "
+					 "cached."),
+		gettext_noop("A value of 0 leaves name lookups to libpq."),
+		&HostCacheTTL,
+		60000,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.tcp_keepalives_idle",
+		gettext_noop("Time between TCP keepalives on job connections."),
+		gettext_noop("A value of 0 uses the system default."),
+		&CronKeepalivesIdle,
+		30,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_S,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.tcp_keepalives_interval",
+		gettext_noop("Time between TCP keepalive retransmits on job connections."),
+		gettext_noop("A value of 0 uses the system default."),
+		&CronKeepalivesInterval,
+		10,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_S,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.tcp_keepalives_count",
+		gettext_noop("Maximum number of TCP keepalive retransmits on job "
+					 "connections."),
+		gettext_noop("A value of 0 uses the system default."),
+		&CronKeepalivesCount,
+		3,
+		0,
+		INT_MAX,
 		PGC_POSTMASTER,
 		GUC_SUPERUSER_ONLY,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"cron.tcp_user_timeout",
+		gettext_noop("Time that transmitted data may remain unacknowledged "
+					 "on job connections."),
+		gettext_noop("A value of 0 uses the system default. Ignored if libpq "
+					 "is older than version 12."),
+		&CronTcpUserTimeout,
+		0,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
 	/* set up common data for all our workers */
 	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
-	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+
+	if (EnableStandbyScheduler)
+	{
+		/* start during recovery, and keep running after promotion */
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	}
+	else
+	{
+		worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	}
+
 	worker.bgw_restart_time = 1;
 	worker.bgw_main = PgCronWorkerMain;
 	worker.bgw_main_arg = Int32GetDatum(0);
@@ -160,6 +526,8 @@ _PG_init(void)
 	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cron_scheduler");
 
 	RegisterBackgroundWorker(&worker);
+
+	RequestCronSharedState();
 }
 
 
@@ -182,11 +550,13 @@ pg_cron_sigterm(SIGNAL_ARGS)
 
 /*
  * Signal handler for SIGHUP
- *		Set a flag to tell the main loop to reload the cron jobs.
+ *		Set flags to tell the main loop to reload the configuration file and
+ *		the cron jobs.
  */
 static void
 pg_cron_sighup(SIGNAL_ARGS)
 {
+	got_sighup = true;
 	CronJobCacheValid = false;
 
 	if (MyProc != NULL)
@@ -222,8 +592,23 @@ PgCronWorkerMain(Datum arg)
 											ALLOCSET_DEFAULT_INITSIZE,
 											ALLOCSET_DEFAULT_MAXSIZE);
 
+	InitializeTimeZoneCache();
+	InitializeScheduleIndexes();
 	InitializeJobMetadataCache();
 	InitializeTaskStateHash();
+	InitializeJobDependencies();
+	InitializeQueuedJobHash();
+	InitializeTimerHeap();
+	InitializeAdmissionQueue();
+	InitializeOneShotJobs();
+	InitializeNodeHealth();
+	InitializeHostCache();
+	InitializeJobOutput();
+	InitializeNodeGroups();
+	InitializeSchedulerLease();
+
+	/* allow backends to wake us up when runs are requested */
+	AttachScheduler(MyLatch);
 
 	ereport(LOG, (errmsg("pg_cron scheduler started")));
 
@@ -236,22 +621,69 @@ PgCronWorkerMain(Datum arg)
 
 		AcceptInvalidationMessages();
 
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		/* names resolved since the last round are ready for the tasks */
+		CompleteHostLookups(GetCurrentTimestamp());
+
+		RenewStandbyLease(GetCurrentTimestamp());
+		CheckStandbyLease(GetCurrentTimestamp());
+
+		if (CurrentJobSelection() != LoadedJobSelection)
+		{
+			/* promoted, or a standby scheduler took or gave up its lease */
+			CronJobCacheValid = false;
+		}
+
+		if (TakeJobReloadNeeded())
+		{
+			/* a transaction that changed cron.job committed */
+			CronJobCacheValid = false;
+		}
+
 		if (!CronJobCacheValid)
 		{
 			RefreshTaskHash();
+			ScheduleIntervalTasks(GetCurrentTimestamp());
 		}
 
-		taskList = CurrentTaskList();
+		RenewSchedulerLease(GetCurrentTimestamp());
+
+		RemoveCompletedOneShotJobs();
+		SaveTaskOutputs();
+		SaveNodeResults();
+		UpdateOneShotTimers();
+
 		currentTime = GetCurrentTimestamp();
 
-		StartAllPendingRuns(taskList, currentTime);
+		LogRunSummary(currentTime);
+
+		StartRequestedRuns(currentTime);
+		StartTimerRuns(currentTime);
+		StartAllPendingRuns(currentTime);
+
+		/* without the lease, leave queued tasks for the holder */
+		if (HoldsSchedulerLease(currentTime))
+		{
+			StartQueuedTasks();
+			PrewarmConnections(currentTime);
+		}
+
+		taskList = RunnableTaskList();
 
 		WaitForCronTasks(taskList);
 		ManageCronTasks(taskList, currentTime);
+		AdmitDueRuns();
 
 		MemoryContextReset(CronLoopContext);
 	}
 
+	ReleaseSchedulerLease();
+
 	ereport(LOG, (errmsg("pg_cron scheduler shutting down")));
 
 	proc_exit(0);
@@ -259,202 +691,829 @@ PgCronWorkerMain(Datum arg)
 
 
 /*
- * StartPendingRuns goes through the list of tasks and kicks of
- * runs for tasks that should start, taking clock changes into
- * into consideration.
+ * StartRequestedRuns moves the run requests from the shared queue onto
+ * the tasks of the requested jobs. Requests are dropped while another
+ * scheduler holds the lease.
  */
 static void
-StartAllPendingRuns(List *taskList, TimestampTz currentTime)
+StartRequestedRuns(TimestampTz currentTime)
 {
-	static TimestampTz lastMinute = 0;
+	bool holdsLease = HoldsSchedulerLease(currentTime);
 
-	int minutesPassed = 0;
-	ListCell *taskCell = NULL;
-	ClockProgress clockProgress;
+	RunRequest requests[64];
+	int requestCount = 0;
 
-	if (!RebootJobsScheduled)
+	while ((requestCount = DequeueRunRequests(requests, lengthof(requests))) > 0)
 	{
-		/* find jobs with @reboot as a schedule */
-		foreach(taskCell, taskList)
+		int requestIndex = 0;
+
+		for (requestIndex = 0; requestIndex < requestCount; requestIndex++)
 		{
-			CronTask *task = (CronTask *) lfirst(taskCell);
-			CronJob *cronJob = GetCronJob(task->jobId);
-			entry *schedule = &cronJob->schedule;
+			RunRequest *request = &requests[requestIndex];
 
-			if (schedule->flags & WHEN_REBOOT)
+			if (!holdsLease)
 			{
-				task->pendingRunCount += 1;
+				ereport(LOG, (errmsg("cron job %ld run %ld requested, but "
+									 "another scheduler holds the lease",
+									 request->jobId, request->runId)));
+			}
+			else if (!AddRunRequest(request->jobId, request->runId))
+			{
+				ereport(LOG, (errmsg("cron job %ld run %ld requested, but the "
+									 "job is not scheduled on this server",
+									 request->jobId, request->runId)));
 			}
 		}
-
-		RebootJobsScheduled = true;
 	}
+}
 
-	if (lastMinute == 0)
-	{
-		lastMinute = TimestampMinuteStart(currentTime);
-	}
 
-	minutesPassed = MinutesPassed(lastMinute, currentTime);
-	if (minutesPassed == 0)
+/*
+ * StartQueuedTasks creates tasks for queued tasks, such that at most
+ * cron.queue_concurrency queued tasks run at the same time.
+ */
+static void
+StartQueuedTasks(void)
+{
+	List *jobList = NIL;
+	ListCell *jobCell = NULL;
+	int runningTaskCount = QueuedJobCount() - RunningOneShotJobCount();
+	int freeSlotCount = CronQueueConcurrency - runningTaskCount;
+
+	if (freeSlotCount <= 0)
 	{
-		/* wait for new minute */
 		return;
 	}
 
-	/* use Vixie cron logic for clock jumps */
-	if (minutesPassed > (3*MINUTE_COUNT))
-	{
-		/* clock jumped forward by more than 3 hours */
-		clockProgress = CLOCK_CHANGE;
-	}
-	else if (minutesPassed > 5)
-	{
-		/* clock went forward by more than 5 minutes (DST?) */
-		clockProgress = CLOCK_JUMP_FORWARD;
-	}
-	else if (minutesPassed > 0)
-	{
-		/* clock went forward by 1-5 minutes */
-		clockProgress = CLOCK_PROGRESSED;
-	}
-	else if (minutesPassed > -(3*MINUTE_COUNT))
-	{
-		/* clock jumped backwards by less than 3 hours (DST?) */
-		clockProgress = CLOCK_JUMP_BACKWARD;
-	}
-	else
-	{
-		/* clock jumped backwards 3 hours or more */
-		clockProgress = CLOCK_CHANGE;
-	}
+	jobList = DequeueQueuedJobs(freeSlotCount);
 
-	foreach(taskCell, taskList)
+	foreach(jobCell, jobList)
 	{
-		CronTask *task = (CronTask *) lfirst(taskCell);
-
-		StartPendingRuns(task, clockProgress, lastMinute, currentTime);
-	}
+		CronJob *job = (CronJob *) lfirst(jobCell);
 
-	/*
-	 * If the clock jump backwards then we avoid repeating the fixed-time
-	 * tasks by preserving the last minute from before the clock jump,
-	 * until the clock has caught up (clockProgress will be
-	 * CLOCK_JUMP_BACKWARD until then).
-	 */
-	if (clockProgress != CLOCK_JUMP_BACKWARD)
-	{
-		lastMinute = TimestampMinuteStart(currentTime);
+		AddQueuedTask(job->jobId);
 	}
 }
 
 
 /*
- * StartPendingRuns kicks off pending runs for a task if it
- * should start, taking clock changes into consideration.
+ * StartTimerRuns starts the runs for timers that expired.
  */
 static void
-StartPendingRuns(CronTask *task, ClockProgress clockProgress,
-				 TimestampTz lastMinute, TimestampTz currentTime)
+StartTimerRuns(TimestampTz currentTime)
 {
-	CronJob *cronJob = GetCronJob(task->jobId);
-	entry *schedule = &cronJob->schedule;
-	TimestampTz virtualTime = lastMinute;
-	TimestampTz currentMinute = TimestampMinuteStart(currentTime);
+	List *oneShotTimerList = NIL;
+	CronTimer timer;
 
-
-	switch (clockProgress)
+	while (PopDueTimer(currentTime, &timer))
 	{
-		case CLOCK_PROGRESSED:
+		switch (timer.kind)
 		{
-			/*
-			 * case 1: minutesPassed is a small positive number
-			 * run jobs for each virtual minute until caught up.
-			 */
-
-			do
+			case CRON_TIMER_ONE_SHOT:
 			{
-				virtualTime = TimestampTzPlusMilliseconds(virtualTime,
-														  60*1000);
+				CronTimer *dueTimer = (CronTimer *) palloc(sizeof(CronTimer));
 
-				if (ShouldRunTask(schedule, virtualTime, true, true))
-				{
-					task->pendingRunCount += 1;
-				}
-			}
-			while (virtualTime < currentMinute);
+				*dueTimer = timer;
+				oneShotTimerList = lappend(oneShotTimerList, dueTimer);
 
-			break;
-		}
+				break;
+			}
 
-		case CLOCK_JUMP_FORWARD:
-		{
-			/*
-			 * case 2: minutesPassed is a medium-sized positive number,
-			 * for example because we went to DST run wildcard
-			 * jobs once, then run any fixed-time jobs that would
-			 * otherwise be skipped if we use up our minute
-			 * (possible, if there are a lot of jobs to run) go
-			 * around the loop again so that wildcard jobs have
-			 * a chance to run, and we do our housekeeping
-			 */
+			case CRON_TIMER_INTERVAL:
+			{
+				StartIntervalRun(&timer, currentTime);
+				break;
+			}
 
-			/* run fixed-time jobs for each minute missed */
-			do
+			case CRON_TIMER_RETRY:
 			{
-				virtualTime = TimestampTzPlusMilliseconds(virtualTime,
-														  60*1000);
+				StartRetryRun(&timer);
+				break;
+			}
+		}
+	}
 
-				if (ShouldRunTask(schedule, virtualTime, false, true))
-				{
-					task->pendingRunCount += 1;
-				}
+	/* the timers are added again when we take the lease */
+	if (oneShotTimerList != NIL && HoldsSchedulerLease(currentTime))
+	{
+		StartOneShotJobs(oneShotTimerList, currentTime);
+	}
+}
 
-			} while (virtualTime < currentMinute);
 
-			/* run wildcard jobs for current minute */
-			if (ShouldRunTask(schedule, currentMinute, true, false))
-			{
-				task->pendingRunCount += 1;
-			}
+/*
+ * ScheduleIntervalTasks sets a timer for the next run of each task with an
+ * interval schedule that does not have one yet, or whose interval changed.
+ * The first run of a new interval job is one interval after it is loaded.
+ */
+static void
+ScheduleIntervalTasks(TimestampTz currentTime)
+{
+	List *taskList = CurrentTaskList();
+	ListCell *taskCell = NULL;
 
-			break;
-		}
+	foreach(taskCell, taskList)
+	{
+		CronTask *task = (CronTask *) lfirst(taskCell);
+		CronJob *cronJob = task->cronJob;
+		entry *schedule = NULL;
 
-		case CLOCK_JUMP_BACKWARD:
+		if (cronJob == NULL || !task->isActive)
 		{
-			/*
-			 * case 3: timeDiff is a small or medium-sized
-			 * negative num, eg. because of DST ending just run
-			 * the wildcard jobs. The fixed-time jobs probably
-			 * have already run, and should not be repeated
-			 * virtual time does not change until we are caught up
-			 */
+			continue;
+		}
 
-			if (ShouldRunTask(schedule, currentMinute, true, false))
-			{
-				task->pendingRunCount += 1;
-			}
+		schedule = &cronJob->schedule;
 
-			break;
+		if (!(schedule->flags & WHEN_INTERVAL))
+		{
+			/* stale timers are ignored once nextDueTime is cleared */
+			task->nextDueTime = 0;
+			task->interval = 0;
+			continue;
 		}
 
-		default:
+		if (task->interval == schedule->interval && task->nextDueTime != 0)
+		{
+			continue;
+		}
+
+		if (task->interval == schedule->interval &&
+			(schedule->flags & INTERVAL_FROM_END) &&
+			task->state != CRON_TASK_WAITING)
+		{
+			/* the next run is timed when the current one is done */
+			continue;
+		}
+
+		task->interval = schedule->interval;
+		ScheduleIntervalRun(task, TimestampTzPlusMilliseconds(currentTime,
+															  (int64) task->interval * 1000));
+	}
+}
+
+
+/*
+ * StartIntervalRun adds a pending run to the task of an interval job whose
+ * timer expired, and sets the timer for the next run if it is counted from
+ * the start of this one. Timers that were superseded are ignored.
+ */
+static void
+StartIntervalRun(CronTimer *timer, TimestampTz currentTime)
+{
+	CronTask *task = FindCronTask(timer->id);
+	CronJob *cronJob = NULL;
+	entry *schedule = NULL;
+	TimestampTz nextDueTime = 0;
+
+	if (task == NULL || !task->isActive || task->nextDueTime != timer->dueTime)
+	{
+		return;
+	}
+
+	cronJob = task->cronJob;
+	if (cronJob == NULL || !(cronJob->schedule.flags & WHEN_INTERVAL))
+	{
+		return;
+	}
+
+	schedule = &cronJob->schedule;
+
+	task->pendingRunCount += 1;
+	MarkTaskRunnable(task);
+
+	if (schedule->flags & INTERVAL_FROM_END)
+	{
+		/* the next run is timed when this one is done */
+		task->nextDueTime = 0;
+		return;
+	}
+
+	nextDueTime = TimestampTzPlusMilliseconds(timer->dueTime,
+											  (int64) task->interval * 1000);
+	if (nextDueTime <= currentTime)
+	{
+		/* we fell behind, keep the rate rather than catching up */
+		nextDueTime = TimestampTzPlusMilliseconds(currentTime,
+												  (int64) task->interval * 1000);
+	}
+
+	ScheduleIntervalRun(task, nextDueTime);
+}
+
+
+/*
+ * ScheduleIntervalRun sets the timer for the next run of an interval job.
+ */
+static void
+ScheduleIntervalRun(CronTask *task, TimestampTz dueTime)
+{
+	task->nextDueTime = dueTime;
+
+	AddTimer(CRON_TIMER_INTERVAL, task->jobId, dueTime);
+}
+
+
+/*
+ * ShouldRetryRun returns whether the failed run of the given task should
+ * be attempted again according to the retry policy of its job.
+ */
+static bool
+ShouldRetryRun(CronTask *task, CronJob *cronJob)
+{
+	const char *sqlState = task->sqlState;
+	int sqlStateIndex = 0;
+
+	if (task->attemptCount >= cronJob->maxAttempts)
+	{
+		return false;
+	}
+
+	/* without a filter, all errors are retried */
+	if (cronJob->retrySqlStateCount == 0)
+	{
+		return true;
+	}
+
+	if (sqlState[0] == '\0')
+	{
+		sqlState = CONNECTION_EXCEPTION_SQLSTATE;
+	}
+
+	/* the filter holds SQLSTATE codes and 2-character classes */
+	for (sqlStateIndex = 0; sqlStateIndex < cronJob->retrySqlStateCount;
+		 sqlStateIndex++)
+	{
+		char *retrySqlState = cronJob->retrySqlStates[sqlStateIndex];
+
+		if (strncmp(sqlState, retrySqlState, strlen(retrySqlState)) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ScheduleRetry sets a timer for the next attempt of a failed run. The
+ * delay grows by the backoff factor of the job with every attempt. The
+ * retry is logged along with the failure.
+ */
+static void
+ScheduleRetry(CronTask *task, CronJob *cronJob, TimestampTz currentTime,
+			  bool logRetry)
+{
+	double retryDelay = cronJob->retryDelay;
+	int attemptIndex = 0;
+
+	for (attemptIndex = 1; attemptIndex < task->attemptCount &&
+		 retryDelay < MAX_RETRY_DELAY_MS; attemptIndex++)
+	{
+		retryDelay *= cronJob->retryBackoff;
+	}
+
+	retryDelay = Min(retryDelay, MAX_RETRY_DELAY_MS);
+
+	if (logRetry)
+	{
+		ereport(LOG, (errmsg("cron job %ld will be retried in %.0f ms "
+							 "(attempt %d of %d)", task->jobId, retryDelay,
+							 task->attemptCount + 1, cronJob->maxAttempts)));
+	}
+
+	task->retryDueTime = TimestampTzPlusMilliseconds(currentTime,
+													 (int64) retryDelay);
+
+	AddTimer(CRON_TIMER_RETRY, task->jobId, task->retryDueTime);
+}
+
+
+/*
+ * StartRetryRun marks the failed run of a task for another attempt when
+ * its retry timer expires. Timers of retries that were superseded by a
+ * new run are ignored.
+ */
+static void
+StartRetryRun(CronTimer *timer)
+{
+	CronTask *task = FindCronTask(timer->id);
+
+	if (task == NULL || !task->isActive || task->retryDueTime != timer->dueTime)
+	{
+		return;
+	}
+
+	task->retryDueTime = 0;
+	task->retryPending = true;
+
+	MarkTaskRunnable(task);
+}
+
+
+/*
+ * StartAllPendingRuns kicks off runs for tasks that should start,
+ * taking clock changes into into consideration.
+ */
+static void
+StartAllPendingRuns(TimestampTz currentTime)
+{
+	ListCell *taskCell = NULL;
+	ListCell *timeZoneCell = NULL;
+	List *timeZoneList = NIL;
+
+	if (!RebootJobsScheduled)
+	{
+		List *taskList = CurrentTaskList();
+
+		/* find jobs with @reboot as a schedule */
+		foreach(taskCell, taskList)
+		{
+			CronTask *task = (CronTask *) lfirst(taskCell);
+			CronJob *cronJob = task->cronJob;
+			entry *schedule = NULL;
+
+			if (cronJob == NULL)
+			{
+				continue;
+			}
+
+			schedule = &cronJob->schedule;
+
+			if (schedule->flags & WHEN_REBOOT)
+			{
+				task->pendingRunCount += 1;
+				MarkTaskRunnable(task);
+			}
+		}
+
+		RebootJobsScheduled = true;
+	}
+
+	/*
+	 * Schedules are evaluated in local time, so each time zone has its own
+	 * notion of when a new minute starts and of DST-related clock jumps.
+	 */
+	timeZoneList = CronTimeZoneList();
+
+	foreach(timeZoneCell, timeZoneList)
+	{
+		CronTimeZone *timeZone = (CronTimeZone *) lfirst(timeZoneCell);
+
+		StartTimeZonePendingRuns(timeZone, currentTime);
+	}
+}
+
+
+/*
+ * PrewarmConnections starts connecting the idle tasks that are due at the
+ * start of the next minute once it is less than cron.prewarm_time away,
+ * such that their commands can be sent right when the minute starts. Jobs
+ * connect in order of priority, and users take turns among jobs of the
+ * same priority, like in the admission queue. Prewarmed connections count against
+ * cron.max_running_jobs and cron.max_running_jobs_per_user.
+ */
+static void
+PrewarmConnections(TimestampTz currentTime)
+{
+	List *timeZoneList = NIL;
+	ListCell *timeZoneCell = NULL;
+	int runningCount = 0;
+
+	if (CronPrewarmTime <= 0)
+	{
+		return;
+	}
+
+	timeZoneList = CronTimeZoneList();
+	runningCount = CountRunningJobs();
+
+	foreach(timeZoneCell, timeZoneList)
+	{
+		CronTimeZone *timeZone = (CronTimeZone *) lfirst(timeZoneCell);
+		TimestampTz localTime = TimestampToLocalTime(timeZone, currentTime);
+		TimestampTz nextLocalMinute = TimestampMinuteEnd(localTime);
+		TimestampTz minuteStartTime = 0;
+		time_t nextLocalMinute_t = 0;
+		struct tm tm;
+		List *dueTaskList = NIL;
+		ListCell *taskCell = NULL;
+		CronTask **prewarmTasks = NULL;
+		int prewarmTaskCount = 0;
+		int taskIndex = 0;
+
+		if (timeZone->scheduleIndex == NULL ||
+			timeZone->prewarmedMinute == nextLocalMinute ||
+			TimestampDifferenceExceeds(localTime, nextLocalMinute,
+									   CronPrewarmTime))
+		{
+			continue;
+		}
+
+		timeZone->prewarmedMinute = nextLocalMinute;
+
+		/* the moment at which the next local minute starts */
+		minuteStartTime = currentTime + (nextLocalMinute - localTime);
+
+		/* nextLocalMinute is shifted to local time, so UTC fields are local */
+		nextLocalMinute_t = timestamptz_to_time_t(nextLocalMinute);
+		gmtime_r(&nextLocalMinute_t, &tm);
+
+		dueTaskList = DueTasksForMinute(timeZone->scheduleIndex, &tm);
+
+		prewarmTasks = (CronTask **) palloc(Max(list_length(dueTaskList), 1) *
+											sizeof(CronTask *));
+
+		foreach(taskCell, dueTaskList)
+		{
+			CronTask *task = (CronTask *) lfirst(taskCell);
+
+			/* jobs on a node group connect through their members */
+			if (task->state != CRON_TASK_WAITING || !task->isActive ||
+				task->pendingRunCount > 0 || task->runRequests != NIL ||
+				task->retryPending || task->cronJob->nodeGroup != NULL)
+			{
+				continue;
+			}
+
+			prewarmTasks[prewarmTaskCount++] = task;
+		}
+
+		/* number the jobs of each user in order of priority */
+		qsort(prewarmTasks, prewarmTaskCount, sizeof(CronTask *),
+			  CompareTaskPriority);
+
+		for (taskIndex = 0; taskIndex < prewarmTaskCount; taskIndex++)
+		{
+			CronTask *task = prewarmTasks[taskIndex];
+			CronTask *previousTask = taskIndex > 0 ?
+									 prewarmTasks[taskIndex - 1] : NULL;
+
+			if (previousTask != NULL &&
+				strcmp(previousTask->cronJob->userName,
+					   task->cronJob->userName) == 0)
+			{
+				task->prewarmTurn = previousTask->prewarmTurn + 1;
+			}
+			else
+			{
+				task->prewarmTurn = 0;
+			}
+		}
+
+		/* then let the users take turns within each priority */
+		qsort(prewarmTasks, prewarmTaskCount, sizeof(CronTask *),
+			  CompareTaskTurn);
+
+		for (taskIndex = 0; taskIndex < prewarmTaskCount; taskIndex++)
+		{
+			CronTask *task = prewarmTasks[taskIndex];
+
+			if (CronMaxRunningJobs > 0 && runningCount >= CronMaxRunningJobs)
+			{
+				break;
+			}
+
+			if (!UserMayStartJob(task->cronJob->userName,
+								 CronMaxRunningJobsPerUser))
+			{
+				continue;
+			}
+
+			task->isPrewarmed = true;
+			task->prewarmTime = minuteStartTime;
+			task->state = CRON_TASK_START;
+
+			/* the run is admitted ahead of time */
+			MarkTaskAdmitted(task);
+			CountRunningJob(task->cronJob->userName);
+			runningCount++;
+		}
+
+		pfree(prewarmTasks);
+	}
+}
+
+
+/*
+ * CompareTaskPriority orders tasks by the user of their job, then by
+ * descending priority of their job, and then by job ID.
+ */
+static int
+CompareTaskPriority(const void *leftElement, const void *rightElement)
+{
+	CronTask *leftTask = *((CronTask **) leftElement);
+	CronTask *rightTask = *((CronTask **) rightElement);
+	int userComparison = strcmp(leftTask->cronJob->userName,
+								rightTask->cronJob->userName);
+
+	if (userComparison != 0)
+	{
+		return userComparison;
+	}
+
+	if (leftTask->cronJob->priority != rightTask->cronJob->priority)
+	{
+		return leftTask->cronJob->priority > rightTask->cronJob->priority ? -1 : 1;
+	}
+
+	if (leftTask->jobId != rightTask->jobId)
+	{
+		return leftTask->jobId < rightTask->jobId ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * CompareTaskTurn orders tasks by descending priority of their job, then
+ * by their turn to prewarm, and then by job ID.
+ */
+static int
+CompareTaskTurn(const void *leftElement, const void *rightElement)
+{
+	CronTask *leftTask = *((CronTask **) leftElement);
+	CronTask *rightTask = *((CronTask **) rightElement);
+
+	if (leftTask->cronJob->priority != rightTask->cronJob->priority)
+	{
+		return leftTask->cronJob->priority > rightTask->cronJob->priority ? -1 : 1;
+	}
+
+	if (leftTask->prewarmTurn != rightTask->prewarmTurn)
+	{
+		return leftTask->prewarmTurn < rightTask->prewarmTurn ? -1 : 1;
+	}
+
+	if (leftTask->jobId != rightTask->jobId)
+	{
+		return leftTask->jobId < rightTask->jobId ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * CountRunningJobs counts the running jobs of each user for the admission
+ * queue, and returns the number of running jobs.
+ */
+static int
+CountRunningJobs(void)
+{
+	List *runningTaskList = RunningTaskList();
+	ListCell *taskCell = NULL;
+
+	ResetRunningJobCounts();
+
+	foreach(taskCell, runningTaskList)
+	{
+		CronTask *task = (CronTask *) lfirst(taskCell);
+
+		/* jobs that were removed while they run no longer count */
+		if (task->cronJob != NULL)
+		{
+			CountRunningJob(task->cronJob->userName);
+		}
+	}
+
+	return list_length(runningTaskList);
+}
+
+
+/*
+ * AdmitDueRuns lets the runs in the admission queue start while fewer than
+ * cron.max_running_jobs jobs are running, in order of priority across
+ * users. Users that run cron.max_running_jobs_per_user jobs are skipped,
+ * and users take turns to start runs of the same priority. The admitted tasks start
+ * connecting in the next round, in the same order.
+ */
+static void
+AdmitDueRuns(void)
+{
+	AdmissionRequest request;
+	int runningCount = 0;
+
+	if (!AdmissionRequestsPending())
+	{
+		return;
+	}
+
+	runningCount = CountRunningJobs();
+
+	while (CronMaxRunningJobs == 0 || runningCount < CronMaxRunningJobs)
+	{
+		CronTask *task = NULL;
+
+		if (!PopAdmissionRequest(CronMaxRunningJobsPerUser, &request))
+		{
+			break;
+		}
+
+		/* skip requests of jobs that were removed in the meantime */
+		task = FindCronTask(request.jobId);
+		if (task == NULL || !task->awaitingAdmission || !task->isActive)
+		{
+			continue;
+		}
+
+		MarkTaskAdmitted(task);
+		CountRunningJob(task->cronJob->userName);
+		runningCount++;
+	}
+}
+
+
+/*
+ * StartTimeZonePendingRuns kicks off pending runs for the tasks in a
+ * time zone, taking clock changes in local time (including DST changes)
+ * into consideration.
+ */
+static void
+StartTimeZonePendingRuns(CronTimeZone *timeZone, TimestampTz currentTime)
+{
+	TimestampTz localTime = TimestampToLocalTime(timeZone, currentTime);
+	TimestampTz localMinute = TimestampMinuteStart(localTime);
+	int minutesPassed = 0;
+	ClockProgress clockProgress;
+
+	if (timeZone->lastMinute == 0)
+	{
+		timeZone->lastMinute = localMinute;
+		timeZone->lastClockMinute = localMinute;
+	}
+
+	if (localMinute == timeZone->lastClockMinute)
+	{
+		/* wait for new minute */
+		return;
+	}
+
+	timeZone->lastClockMinute = localMinute;
+
+	minutesPassed = MinutesPassed(timeZone->lastMinute, localTime);
+	if (minutesPassed == 0)
+	{
+		/* caught up with the last minute from before a backward jump */
+		return;
+	}
+
+	/* use Vixie cron logic for clock jumps */
+	if (minutesPassed > (3*MINUTE_COUNT))
+	{
+		/* clock jumped forward by more than 3 hours */
+		clockProgress = CLOCK_CHANGE;
+	}
+	else if (minutesPassed > 5)
+	{
+		/* clock went forward by more than 5 minutes (DST?) */
+		clockProgress = CLOCK_JUMP_FORWARD;
+	}
+	else if (minutesPassed > 0)
+	{
+		/* clock went forward by 1-5 minutes */
+		clockProgress = CLOCK_PROGRESSED;
+	}
+	else if (minutesPassed > -(3*MINUTE_COUNT))
+	{
+		/* clock jumped backwards by less than 3 hours (DST?) */
+		clockProgress = CLOCK_JUMP_BACKWARD;
+	}
+	else
+	{
+		/* clock jumped backwards 3 hours or more */
+		clockProgress = CLOCK_CHANGE;
+	}
+
+	if (timeZone->scheduleIndex != NULL)
+	{
+		StartPendingRuns(timeZone->scheduleIndex, clockProgress,
+						 timeZone->lastMinute, localTime);
+	}
+
+	/*
+	 * If the clock jump backwards then we avoid repeating the fixed-time
+	 * tasks by preserving the last minute from before the clock jump,
+	 * until the clock has caught up (clockProgress will be
+	 * CLOCK_JUMP_BACKWARD until then).
+	 */
+	if (clockProgress != CLOCK_JUMP_BACKWARD)
+	{
+		timeZone->lastMinute = TimestampMinuteStart(localTime);
+	}
+}
+
+
+/*
+ * StartPendingRuns kicks off pending runs for the tasks in the schedule
+ * index of a time zone if they should start, taking clock changes into
+ * consideration. Times are in local time.
+ */
+static void
+StartPendingRuns(ScheduleIndex *index, ClockProgress clockProgress,
+				 TimestampTz lastMinute, TimestampTz currentTime)
+{
+	TimestampTz virtualTime = lastMinute;
+	TimestampTz currentMinute = TimestampMinuteStart(currentTime);
+
+	switch (clockProgress)
+	{
+		case CLOCK_PROGRESSED:
+		{
+			/*
+			 * case 1: minutesPassed is a small positive number
+			 * run jobs for each virtual minute until caught up.
+			 */
+
+			do
+			{
+				virtualTime = TimestampTzPlusMilliseconds(virtualTime,
+														  60*1000);
+
+				StartMinutePendingRuns(index, virtualTime, true, true);
+			}
+			while (virtualTime < currentMinute);
+
+			break;
+		}
+
+		case CLOCK_JUMP_FORWARD:
+		{
+			/*
+			 * case 2: minutesPassed is a medium-sized positive number,
+			 * for example because we went to DST run wildcard
+			 * jobs once, then run any fixed-time jobs that would
+			 * otherwise be skipped if we use up our minute
+			 * (possible, if there are a lot of jobs to run) go
+			 * around the loop again so that wildcard jobs have
+			 * a chance to run, and we do our housekeeping
+			 */
+
+			/* run fixed-time jobs for each minute missed */
+			do
+			{
+				virtualTime = TimestampTzPlusMilliseconds(virtualTime,
+														  60*1000);
+
+				StartMinutePendingRuns(index, virtualTime, false, true);
+
+			} while (virtualTime < currentMinute);
+
+			/* run wildcard jobs for current minute */
+			StartMinutePendingRuns(index, currentMinute, true, false);
+
+			break;
+		}
+
+		case CLOCK_JUMP_BACKWARD:
+		{
+			/*
+			 * case 3: timeDiff is a small or medium-sized
+			 * negative num, eg. because of DST ending just run
+			 * the wildcard jobs. The fixed-time jobs probably
+			 * have already run, and should not be repeated
+			 * virtual time does not change until we are caught up
+			 */
+
+			StartMinutePendingRuns(index, currentMinute, true, false);
+
+			break;
+		}
+
+		default:
 		{
 			/*
 			 * other: time has changed a *lot*, skip over any
 			 * intermediate fixed-time jobs and go back to
 			 * normal operation.
 			 */
-			if (ShouldRunTask(schedule, currentMinute, true, true))
-			{
-				task->pendingRunCount += 1;
-			}
+			StartMinutePendingRuns(index, currentMinute, true, true);
 		}
 	}
 }
 
 
+/*
+ * StartMinutePendingRuns adds a pending run to each task in the index
+ * whose schedule matches the given local minute. The broken-down time
+ * is computed once for all tasks.
+ */
+static void
+StartMinutePendingRuns(ScheduleIndex *index, TimestampTz virtualTime,
+					   bool doWild, bool doNonWild)
+{
+	time_t virtualTime_t = timestamptz_to_time_t(virtualTime);
+	struct tm tm;
+
+	/* virtualTime is shifted to local time, so UTC fields are local fields */
+	gmtime_r(&virtualTime_t, &tm);
+
+	AddPendingRunsForMinute(index, &tm, doWild, doNonWild);
+}
+
+
 /*
  * MinutesPassed returns the number of minutes between startTime and
  * stopTime rounded down to the closest integer.
@@ -462,14 +1521,17 @@ StartPendingRuns(CronTask *task, ClockProgress clockProgress,
 static int
 MinutesPassed(TimestampTz startTime, TimestampTz stopTime)
 {
-	int microsPassed = 0;
-	long secondsPassed = 0;
 	int minutesPassed = 0;
 
-	TimestampDifference(startTime, stopTime,
-						&secondsPassed, &microsPassed);
-
-	minutesPassed = secondsPassed / 60;
+	/*
+	 * TimestampDifference clamps negative differences to 0, but we need
+	 * the sign to detect the clock going backwards (e.g. end of DST).
+	 */
+#ifdef HAVE_INT64_TIMESTAMP
+	minutesPassed = (stopTime - startTime) / USECS_PER_MINUTE;
+#else
+	minutesPassed = (stopTime - startTime) / SECS_PER_MINUTE;
+#endif
 
 	return minutesPassed;
 }
@@ -509,79 +1571,488 @@ TimestampMinuteEnd(TimestampTz time)
 	result += 60;
 #endif
 
-	return result;
+	return result;
+}
+
+
+/*
+ * RecordConnectionFailure counts a connection attempt that failed against
+ * the circuit of the node of the given job, unless the connection to the
+ * node was made. A connection that fails after that was rejected by the
+ * server, for instance because authentication failed or the database does
+ * not exist. Such errors only concern the job, and show that the node is
+ * reachable, so they close its circuit instead. libpq does not expose the
+ * SQLSTATE of a failed connection, and its messages may be translated, so
+ * the progress of the connection is all we go by.
+ */
+static void
+RecordConnectionFailure(CronTask *task, CronJob *cronJob,
+						TimestampTz currentTime)
+{
+	if (task->connectionMade)
+	{
+		RecordNodeSuccess(cronJob->nodeName, cronJob->nodePort);
+		return;
+	}
+
+	RecordNodeFailure(cronJob->nodeName, cronJob->nodePort, currentTime);
+}
+
+
+/*
+ * LibpqHasTcpUserTimeout returns whether the libpq that we are linked with
+ * accepts the tcp_user_timeout keyword, which was added in version 12 and
+ * would otherwise make every connection fail. This does not depend on the
+ * version of the server we are built for.
+ */
+static bool
+LibpqHasTcpUserTimeout(void)
+{
+	PQconninfoOption *optionArray = NULL;
+	PQconninfoOption *option = NULL;
+
+	if (TcpUserTimeoutSupport >= 0)
+	{
+		return TcpUserTimeoutSupport == 1;
+	}
+
+	TcpUserTimeoutSupport = 0;
+
+	optionArray = PQconndefaults();
+	for (option = optionArray; option != NULL && option->keyword != NULL;
+		 option++)
+	{
+		if (strcmp(option->keyword, "tcp_user_timeout") == 0)
+		{
+			TcpUserTimeoutSupport = 1;
+			break;
+		}
+	}
+
+	if (optionArray != NULL)
+	{
+		PQconninfoFree(optionArray);
+	}
+
+	if (TcpUserTimeoutSupport == 0 && CronTcpUserTimeout > 0)
+	{
+		ereport(LOG, (errmsg("cron.tcp_user_timeout is ignored, since libpq "
+							 "does not support it")));
+	}
+
+	return TcpUserTimeoutSupport == 1;
+}
+
+
+/*
+ * ConnectionHostName returns the host to connect to for a run of the given
+ * job, which is the socket directory of the server for jobs on the local
+ * server if cron.use_local_socket is enabled.
+ */
+static char *
+ConnectionHostName(CronJob *cronJob)
+{
+	char *socketDirectory = NULL;
+
+	if (!CronUseLocalSocket || !IsLocalNode(cronJob))
+	{
+		return cronJob->nodeName;
+	}
+
+	socketDirectory = LocalSocketDirectory();
+	if (socketDirectory == NULL)
+	{
+		return cronJob->nodeName;
+	}
+
+	return socketDirectory;
+}
+
+
+/*
+ * IsLocalNode returns whether the given job runs on the local server over
+ * the loopback interface, as jobs created by cron.schedule do. Only the
+ * names "localhost", "127.0.0.1" and "::1" are recognised, not other
+ * names or addresses of the server.
+ */
+static bool
+IsLocalNode(CronJob *cronJob)
+{
+	if (cronJob->nodePort != PostPortNumber)
+	{
+		return false;
+	}
+
+	return strcmp(cronJob->nodeName, "localhost") == 0 ||
+		   strcmp(cronJob->nodeName, "127.0.0.1") == 0 ||
+		   strcmp(cronJob->nodeName, "::1") == 0;
+}
+
+
+/*
+ * LocalSocketDirectory returns the first directory in
+ * unix_socket_directories, or NULL if the server does not listen on a
+ * Unix-domain socket. Since the setting cannot change while the server
+ * runs, the directory is only determined once.
+ */
+static char *
+LocalSocketDirectory(void)
+{
+	static bool socketDirectoryKnown = false;
+	static char socketDirectory[MAXPGPATH];
+
+#ifdef HAVE_UNIX_SOCKETS
+	if (!socketDirectoryKnown && Unix_socket_directories != NULL)
+	{
+		char *rawDirectories = pstrdup(Unix_socket_directories);
+		List *directoryList = NIL;
+
+		/* parse the setting the way the postmaster does */
+		if (SplitDirectoriesString(rawDirectories, ',', &directoryList) &&
+			directoryList != NIL)
+		{
+			char *directory = (char *) linitial(directoryList);
+
+			/* only absolute paths can be passed as host to libpq */
+			if (is_absolute_path(directory))
+			{
+				strlcpy(socketDirectory, directory, MAXPGPATH);
+			}
+		}
+
+		list_free_deep(directoryList);
+		pfree(rawDirectories);
+	}
+#endif
+
+	socketDirectoryKnown = true;
+
+	return socketDirectory[0] != '\0' ? socketDirectory : NULL;
+}
+
+
+/*
+ * BuildConnectionParams fills in the NULL-terminated keywords and values
+ * to pass to PQconnectStartParams for a run of the given job on the given
+ * hosts. Values are allocated in the current memory context, since libpq
+ * copies them.
+ */
+static void
+BuildConnectionParams(CronJob *cronJob, int64 leaseToken, char *hostList,
+					  char *hostAddrList, const char **keywordArray,
+					  const char **valueArray)
+{
+	int paramIndex = 0;
+	StringInfoData options;
+
+	keywordArray[paramIndex] = "host";
+	valueArray[paramIndex++] = hostList;
+
+	/* avoid name lookups in libpq, which block the scheduler */
+	if (hostAddrList != NULL)
+	{
+		keywordArray[paramIndex] = "hostaddr";
+		valueArray[paramIndex++] = hostAddrList;
+	}
+
+	keywordArray[paramIndex] = "port";
+	valueArray[paramIndex++] = psprintf("%d", cronJob->nodePort);
+
+	keywordArray[paramIndex] = "fallback_application_name";
+	valueArray[paramIndex++] = "pg_cron";
+
+	keywordArray[paramIndex] = "client_encoding";
+	valueArray[paramIndex++] = GetDatabaseEncodingName();
+
+	keywordArray[paramIndex] = "dbname";
+	valueArray[paramIndex++] = cronJob->database;
+
+	keywordArray[paramIndex] = "user";
+	valueArray[paramIndex++] = cronJob->userName;
+
+	initStringInfo(&options);
+
+	if (cronJob->connectionOptions != NULL)
+	{
+		appendStringInfoString(&options, cronJob->connectionOptions);
+	}
+
+	/* lets commands check that the run was started by the lease holder */
+	if (leaseToken != 0)
+	{
+		appendStringInfo(&options, "%s-c cron.lease_token=" INT64_FORMAT,
+						 options.len > 0 ? " " : "", leaseToken);
+	}
+
+	/* read-only comes last, such that the settings cannot override it */
+	if (cronJob->readOnly)
+	{
+		appendStringInfo(&options, "%s-c default_transaction_read_only=on",
+						 options.len > 0 ? " " : "");
+	}
+
+	if (options.len > 0)
+	{
+		keywordArray[paramIndex] = "options";
+		valueArray[paramIndex++] = options.data;
+	}
+
+	/* detect dead nodes while a command is running */
+	keywordArray[paramIndex] = "keepalives";
+	valueArray[paramIndex++] = "1";
+
+	if (CronKeepalivesIdle > 0)
+	{
+		keywordArray[paramIndex] = "keepalives_idle";
+		valueArray[paramIndex++] = psprintf("%d", CronKeepalivesIdle);
+	}
+
+	if (CronKeepalivesInterval > 0)
+	{
+		keywordArray[paramIndex] = "keepalives_interval";
+		valueArray[paramIndex++] = psprintf("%d", CronKeepalivesInterval);
+	}
+
+	if (CronKeepalivesCount > 0)
+	{
+		keywordArray[paramIndex] = "keepalives_count";
+		valueArray[paramIndex++] = psprintf("%d", CronKeepalivesCount);
+	}
+
+	if (CronTcpUserTimeout > 0 && LibpqHasTcpUserTimeout())
+	{
+		keywordArray[paramIndex] = "tcp_user_timeout";
+		valueArray[paramIndex++] = psprintf("%d", CronTcpUserTimeout);
+	}
+
+	Assert(paramIndex < MAX_CONNECTION_PARAMS);
+
+	keywordArray[paramIndex] = NULL;
+	valueArray[paramIndex] = NULL;
+}
+
+
+/*
+ * WaitForCronTasks blocks waiting for any runnable task for at most
+ * 1 second. If no task is runnable, it sleeps on the latch until the
+ * next run is due.
+ */
+static void
+WaitForCronTasks(List *taskList)
+{
+	int leaseSockets[MAX_LEASE_SOCKETS];
+	bool leaseForWrite[MAX_LEASE_SOCKETS];
+
+	/* renewals of leases in flight are waited for like tasks */
+	if (taskList != NIL || SchedulerLeaseSockets(leaseSockets, leaseForWrite) > 0)
+	{
+		PollForTasks(taskList);
+	}
+	else
+	{
+		int rc = 0;
+		int waitFlags = WL_LATCH_SET | WL_POSTMASTER_DEATH | WL_TIMEOUT;
+		int maxWait = MaxIdleWait;
+		TimestampTz currentTime = GetCurrentTimestamp();
+		TimestampTz wakeTime = 0;
+		long waitSeconds = 0;
+		int waitMicros = 0;
+		long waitTimeout = 0;
+
+		if (RecoveryInProgress())
+		{
+			/* job changes are replayed without setting our latch */
+			maxWait = MaxWait;
+		}
+
+		wakeTime = NextWakeTime(currentTime, maxWait);
+
+		TimestampDifference(currentTime, wakeTime, &waitSeconds, &waitMicros);
+
+		/* round up, such that we do not wake up just before the event */
+		waitTimeout = waitSeconds * 1000 + (waitMicros + 999) / 1000;
+		if (waitTimeout <= 0)
+		{
+			return;
+		}
+
+		/* nothing to do, wait for new jobs or the next run */
+		rc = WaitLatch(MyLatch, waitFlags, waitTimeout);
+
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+		{
+			/* postmaster died and we should bail out immediately */
+			proc_exit(1);
+		}
+	}
+}
+
+
+/*
+ * NextWakeTime returns the time at which the scheduler needs to wake up
+ * to start the next run, which is the earliest of the next minute in which
+ * a job is due, the moment its connections should be prewarmed, and the
+ * expiry of the next timer. It also wakes up for the summary of runs, the
+ * renewal of leases, when read-only jobs move between the primary and a
+ * standby, and to check on host names that are resolved in the background.
+ * It never returns a time more than maxWait ms ahead.
+ */
+static TimestampTz
+NextWakeTime(TimestampTz currentTime, int maxWait)
+{
+	TimestampTz wakeTime = TimestampTzPlusMilliseconds(currentTime, maxWait);
+	TimestampTz runTime = NextScheduledRunTime(currentTime, wakeTime);
+	TimestampTz timerDueTime = 0;
+	TimestampTz summaryTime = 0;
+	TimestampTz renewalTime = 0;
+	TimestampTz selectionChangeTime = 0;
+	TimestampTz lookupCheckTime = 0;
+
+	if (runTime < wakeTime)
+	{
+		wakeTime = runTime;
+	}
+
+	if (NextTimerDueTime(&timerDueTime) && timerDueTime < wakeTime)
+	{
+		wakeTime = timerDueTime;
+	}
+
+	if (NextRunSummaryTime(&summaryTime) && summaryTime < wakeTime)
+	{
+		wakeTime = summaryTime;
+	}
+
+	if (NextLeaseRenewalTime(&renewalTime) && renewalTime < wakeTime)
+	{
+		wakeTime = renewalTime;
+	}
+
+	/* read-only jobs move between the primary and a standby */
+	if (NextJobSelectionChangeTime(currentTime, &selectionChangeTime) &&
+		selectionChangeTime < wakeTime)
+	{
+		wakeTime = selectionChangeTime;
+	}
+
+	/* host names that are resolved in the background may be ready */
+	if (NextHostLookupCheckTime(currentTime, &lookupCheckTime) &&
+		lookupCheckTime < wakeTime)
+	{
+		wakeTime = lookupCheckTime;
+	}
+
+	if (CronPrewarmTime > 0)
+	{
+		TimestampTz prewarmTime = TimestampTzPlusMilliseconds(runTime,
+															  -CronPrewarmTime);
+
+		if (prewarmTime > currentTime && prewarmTime < wakeTime)
+		{
+			wakeTime = prewarmTime;
+		}
+	}
+
+	return wakeTime;
 }
 
 
 /*
- * ShouldRunTask returns whether a job should run in the current
- * minute according to its schedule.
+ * NextScheduledRunTime returns the start of the next minute in which a job
+ * with a cron schedule is due in any time zone, or maxTime if that is
+ * earlier. Minutes are evaluated in local time, and the result is capped
+ * at the next DST transition, after which the local time shifts.
  */
-static bool
-ShouldRunTask(entry *schedule, TimestampTz currentTime, bool doWild,
-			  bool doNonWild)
+static TimestampTz
+NextScheduledRunTime(TimestampTz currentTime, TimestampTz maxTime)
 {
-	time_t currentTime_t = timestamptz_to_time_t(currentTime);
-	struct tm *tm = gmtime(&currentTime_t);
-
-	int minute = tm->tm_min -FIRST_MINUTE;
-	int hour = tm->tm_hour -FIRST_HOUR;
-	int dayOfMonth = tm->tm_mday -FIRST_DOM;
-	int month = tm->tm_mon +1 -FIRST_MONTH;
-	int dayOfWeek = tm->tm_wday -FIRST_DOW;
-
-	if (bit_test(schedule->minute, minute) &&
-	    bit_test(schedule->hour, hour) &&
-	    bit_test(schedule->month, month) &&
-	    ( ((schedule->flags & DOM_STAR) || (schedule->flags & DOW_STAR))
-	      ? (bit_test(schedule->dow,dayOfWeek) && bit_test(schedule->dom,dayOfMonth))
-	      : (bit_test(schedule->dow,dayOfWeek) || bit_test(schedule->dom,dayOfMonth)))) {
-		if ((doNonWild && !(schedule->flags & (MIN_STAR|HR_STAR)))
-		    || (doWild && (schedule->flags & (MIN_STAR|HR_STAR))))
+	TimestampTz nextRunTime = maxTime;
+	List *timeZoneList = CronTimeZoneList();
+	ListCell *timeZoneCell = NULL;
+
+	foreach(timeZoneCell, timeZoneList)
+	{
+		CronTimeZone *timeZone = (CronTimeZone *) lfirst(timeZoneCell);
+		TimestampTz localTime = 0;
+		TimestampTz localMinute = 0;
+		TimestampTz runTime = 0;
+
+		if (timeZone->scheduleIndex == NULL)
 		{
-			return true;
+			continue;
+		}
+
+		localTime = TimestampToLocalTime(timeZone, currentTime);
+		localMinute = TimestampMinuteStart(localTime);
+
+		if (timeZone->nextRunCheckedMinute != localMinute)
+		{
+			/* look ahead as far as we might sleep, and a minute more */
+			int maxMinutes = MaxIdleWait / (60*1000) + 1;
+
+			timeZone->nextRunMinute = NextDueLocalMinute(timeZone->scheduleIndex,
+														 localMinute,
+														 maxMinutes);
+			timeZone->nextRunCheckedMinute = localMinute;
+		}
+
+		/* the moment at which the local minute starts */
+		runTime = currentTime + (timeZone->nextRunMinute - localTime);
+
+		/* TimestampToLocalTime cached the offset until the next transition */
+		if (timeZone->validUntil < timestamptz_to_time_t(runTime))
+		{
+			runTime = time_t_to_timestamptz(timeZone->validUntil);
+		}
+
+		if (runTime < nextRunTime)
+		{
+			nextRunTime = runTime;
 		}
 	}
 
-	return false;
+	return nextRunTime;
 }
 
 
 /*
- * WaitForCronTasks blocks waiting for any active task for at most
- * 1 second.
+ * NextDueLocalMinute returns the first local minute after the given one in
+ * which a task in the index is due, looking at most maxMinutes ahead.
  */
-static void
-WaitForCronTasks(List *taskList)
+static TimestampTz
+NextDueLocalMinute(ScheduleIndex *index, TimestampTz localMinute, int maxMinutes)
 {
-	int taskCount = list_length(taskList);
+	TimestampTz virtualTime = localMinute;
+	int minuteIndex = 0;
 
-	if (taskCount > 0)
+	for (minuteIndex = 0; minuteIndex < maxMinutes; minuteIndex++)
 	{
-		PollForTasks(taskList);
-	}
-	else
-	{
-		int rc = 0;
-		int waitFlags = WL_LATCH_SET | WL_POSTMASTER_DEATH | WL_TIMEOUT;
+		time_t virtualTime_t = 0;
+		struct tm tm;
 
-		/* nothing to do, wait for new jobs */
-		rc = WaitLatch(MyLatch, waitFlags, MaxWait);
+		virtualTime = TimestampTzPlusMilliseconds(virtualTime, 60*1000);
 
-		ResetLatch(MyLatch);
+		/* virtualTime is shifted to local time, so UTC fields are local */
+		virtualTime_t = timestamptz_to_time_t(virtualTime);
+		gmtime_r(&virtualTime_t, &tm);
 
-		if (rc & WL_POSTMASTER_DEATH)
+		if (AnyTaskDueInMinute(index, &tm))
 		{
-			/* postmaster died and we should bail out immediately */
-			proc_exit(1);
+			break;
 		}
 	}
+
+	return virtualTime;
 }
 
 
 /*
- * PollForTasks calls poll() for the sockets of all tasks. It checks for
- * read or write events based on the pollingStatus of the task.
+ * PollForTasks waits for the sockets of all tasks and for our latch. It
+ * checks for read or write events based on the pollingStatus of the task.
+ * The latch is reset before we check for pending work, such that a run
+ * requested after the check wakes up the wait rather than being lost.
  */
 static void
 PollForTasks(List *taskList)
@@ -593,19 +2064,38 @@ PollForTasks(List *taskList)
 	int waitMicros = 0;
 	struct pollfd *pollFDs = NULL;
 	int pollResult = 0;
+	int leaseSockets[MAX_LEASE_SOCKETS];
+	bool leaseForWrite[MAX_LEASE_SOCKETS];
+	int leaseSocketCount = 0;
+	int leaseIndex = 0;
+	bool socketsMayChange = false;
 
 	int taskIndex = 0;
 	int taskCount = list_length(taskList);
 	ListCell *taskCell = NULL;
 
-	pollFDs = (struct pollfd *) palloc0(taskCount * sizeof(struct pollfd));
+	/* the last entries are for the renewals of leases */
+	pollFDs = (struct pollfd *) palloc0((taskCount + MAX_LEASE_SOCKETS) *
+										sizeof(struct pollfd));
+
+	ResetLatch(MyLatch);
 
 	currentTime = GetCurrentTimestamp();
 
+	if (RunRequestsPending() || OneShotRequestsPending() ||
+		(QueuedJobCount() - RunningOneShotJobCount() < CronQueueConcurrency &&
+		 QueuedTasksPending() && HoldsSchedulerLease(currentTime)))
+	{
+		/* a run was requested or a task queued since we last checked */
+		pfree(pollFDs);
+		return;
+	}
+
 	/*
-	 * At the latest, wake up when the next minute starts.
+	 * At the latest, wake up when the next run is due or when the next
+	 * timer expires.
 	 */
-	nextEventTime = TimestampMinuteEnd(currentTime);
+	nextEventTime = NextWakeTime(currentTime, MaxWait);
 
 	foreach(taskCell, taskList)
 	{
@@ -613,7 +2103,10 @@ PollForTasks(List *taskList)
 		PostgresPollingStatusType pollingStatus = task->pollingStatus;
 		struct pollfd *pollFileDescriptor = &pollFDs[taskIndex];
 
-		if ((task->state == CRON_TASK_WAITING && task->pendingRunCount > 0) ||
+		if ((task->state == CRON_TASK_WAITING &&
+			 (task->pendingRunCount > 0 || task->runRequests != NIL ||
+			  task->retryPending)) ||
+			(task->state == CRON_TASK_START && !task->awaitingHost) ||
 			task->state == CRON_TASK_ERROR || task->state == CRON_TASK_DONE)
 		{
 			/* there is work to be done, don't wait */
@@ -621,7 +2114,19 @@ PollForTasks(List *taskList)
 			return;
 		}
 
-		if (task->state == CRON_TASK_CONNECTING ||
+		if (task->state == CRON_TASK_SENDING && task->isPrewarmed)
+		{
+			/* connection is parked until the minute starts */
+			pollFileDescriptor->fd = -1;
+			pollFileDescriptor->events = 0;
+			pollFileDescriptor->revents = 0;
+
+			taskIndex++;
+			continue;
+		}
+
+		if (task->state == CRON_TASK_START ||
+			task->state == CRON_TASK_CONNECTING ||
 			task->state == CRON_TASK_SENDING)
 		{
 			/*
@@ -657,6 +2162,12 @@ PollForTasks(List *taskList)
 
 			pollFileDescriptor->fd = PQsocket(connection);
 			pollFileDescriptor->events = pollEventMask;
+
+			/* libpq may replace the socket while it connects */
+			if (task->state == CRON_TASK_CONNECTING)
+			{
+				socketsMayChange = true;
+			}
 		}
 		else
 		{
@@ -668,76 +2179,525 @@ PollForTasks(List *taskList)
 			pollFileDescriptor->events = 0;
 		}
 
-		pollFileDescriptor->revents = 0;
+		pollFileDescriptor->revents = 0;
+
+		taskIndex++;
+	}
+
+	leaseSocketCount = SchedulerLeaseSockets(leaseSockets, leaseForWrite);
+
+	for (leaseIndex = 0; leaseIndex < leaseSocketCount; leaseIndex++)
+	{
+		struct pollfd *pollFileDescriptor = &pollFDs[taskCount + leaseIndex];
+
+		pollFileDescriptor->fd = leaseSockets[leaseIndex];
+		pollFileDescriptor->events = POLLERR |
+									 (leaseForWrite[leaseIndex] ? POLLOUT : POLLIN);
+
+		/* renewals are short and may reconnect, so we do not keep them */
+		socketsMayChange = true;
+	}
+
+	/*
+	 * Find the first time-based event, which is either the start of a new
+	 * minute or a timeout.
+	 */
+	TimestampDifference(currentTime, nextEventTime, &waitSeconds, &waitMicros);
+
+	pollTimeout = waitSeconds * 1000 + waitMicros / 1000;
+	if (pollTimeout <= 0)
+	{
+		pfree(pollFDs);
+		return;
+	}
+	else if (pollTimeout > MaxWait)
+	{
+		/*
+		 * We never wait more than 1 second, this gives us a chance to react
+		 * to external events like a TERM signal and job changes.
+		 */
+
+		pollTimeout = MaxWait;
+	}
+
+	pollResult = WaitForSockets(pollFDs, taskCount + leaseSocketCount,
+								pollTimeout, socketsMayChange);
+	if (pollResult < 0)
+	{
+		/*
+		 * This typically happens in case of a signal, including the
+		 * SIGUSR1 that SetLatch sends when a run is requested, though we
+		 * should probably check errno in case something bad happened.
+		 */
+
+		pfree(pollFDs);
+		return;
+	}
+
+	taskIndex = 0;
+
+	foreach(taskCell, taskList)
+	{
+		CronTask *task = (CronTask *) lfirst(taskCell);
+		struct pollfd *pollFileDescriptor = &pollFDs[taskIndex];
+
+		task->isSocketReady = pollFileDescriptor->revents &
+							  pollFileDescriptor->events;
+
+		taskIndex++;
+	}
+
+	pfree(pollFDs);
+}
+
+
+/*
+ * WaitForSockets waits until one of the given sockets is ready, our latch is
+ * set, or the timeout expires, and fills in the revents of the sockets that
+ * are ready. It returns the number of ready sockets, or -1 when the wait was
+ * interrupted.
+ *
+ * The wait event set persists across waits, since building it costs a few
+ * system calls per socket. It is rebuilt when the sockets differ from the
+ * previous wait, or when the caller indicates that a socket may have been
+ * replaced under the same descriptor number, which libpq does while it
+ * connects. Otherwise, only the events of the sockets that changed are
+ * modified.
+ *
+ * PostgreSQL 9.5 cannot wait for a latch and several sockets at once. There
+ * we fall back to poll(), which SetLatch interrupts by sending SIGUSR1.
+ */
+static int
+WaitForSockets(struct pollfd *pollFDs, int fdCount, int timeout,
+			   bool socketsMayChange)
+{
+#if PG_VERSION_NUM >= 90600
+	int *fdIndexArray = NULL;
+	uint32 *waitFlagsArray = NULL;
+	int socketCount = 0;
+	int socketIndex = 0;
+	int eventCount = 0;
+	int eventIndex = 0;
+	int fdIndex = 0;
+	int readyCount = 0;
+	bool rebuildSet = socketsMayChange || SocketWaitSet == NULL;
+
+	fdIndexArray = (int *) palloc0((fdCount + 1) * sizeof(int));
+	waitFlagsArray = (uint32 *) palloc0((fdCount + 1) * sizeof(uint32));
+
+	for (fdIndex = 0; fdIndex < fdCount; fdIndex++)
+	{
+		struct pollfd *pollFileDescriptor = &pollFDs[fdIndex];
+		uint32 waitFlags = 0;
+
+		if (pollFileDescriptor->fd < 0)
+		{
+			continue;
+		}
+
+		if (pollFileDescriptor->events & POLLIN)
+		{
+			waitFlags |= WL_SOCKET_READABLE;
+		}
+
+		if (pollFileDescriptor->events & POLLOUT)
+		{
+			waitFlags |= WL_SOCKET_WRITEABLE;
+		}
+
+		if (waitFlags == 0)
+		{
+			continue;
+		}
+
+		fdIndexArray[socketCount] = fdIndex;
+		waitFlagsArray[socketCount] = waitFlags;
+		socketCount++;
+	}
+
+	if (socketCount != SocketWaitCount)
+	{
+		rebuildSet = true;
+	}
+
+	for (socketIndex = 0; socketIndex < socketCount && !rebuildSet; socketIndex++)
+	{
+		pgsocket socket = pollFDs[fdIndexArray[socketIndex]].fd;
+
+		if (socket != SocketWaitSockets[socketIndex])
+		{
+			rebuildSet = true;
+		}
+	}
+
+	if (rebuildSet)
+	{
+		BuildSocketWaitSet(pollFDs, fdIndexArray, waitFlagsArray, socketCount);
+	}
+	else
+	{
+		for (socketIndex = 0; socketIndex < socketCount; socketIndex++)
+		{
+			uint32 waitFlags = waitFlagsArray[socketIndex];
+
+			if (waitFlags != SocketWaitFlags[socketIndex])
+			{
+				ModifyWaitEvent(SocketWaitSet,
+								FIRST_SOCKET_WAIT_POSITION + socketIndex,
+								waitFlags, NULL);
+				SocketWaitFlags[socketIndex] = waitFlags;
+			}
+		}
+	}
+
+	eventCount = WaitEventSetWait(SocketWaitSet, timeout, SocketWaitEvents,
+								  FIRST_SOCKET_WAIT_POSITION + socketCount);
+
+	for (eventIndex = 0; eventIndex < eventCount; eventIndex++)
+	{
+		WaitEvent *event = &SocketWaitEvents[eventIndex];
+		struct pollfd *pollFileDescriptor = NULL;
+
+		if (event->events & WL_POSTMASTER_DEATH)
+		{
+			/* postmaster died and we should bail out immediately */
+			proc_exit(1);
+		}
+
+		if (event->events & WL_LATCH_SET)
+		{
+			/* reset now, the main loop checks what caused it */
+			ResetLatch(MyLatch);
+			continue;
+		}
+
+		if (event->pos < FIRST_SOCKET_WAIT_POSITION)
+		{
+			continue;
+		}
+
+		socketIndex = event->pos - FIRST_SOCKET_WAIT_POSITION;
+		pollFileDescriptor = &pollFDs[fdIndexArray[socketIndex]];
+
+		if (event->events & WL_SOCKET_READABLE)
+		{
+			pollFileDescriptor->revents |= POLLIN;
+		}
+
+		if (event->events & WL_SOCKET_WRITEABLE)
+		{
+			pollFileDescriptor->revents |= POLLOUT;
+		}
+
+		readyCount++;
+	}
+
+	pfree(fdIndexArray);
+	pfree(waitFlagsArray);
+
+	return readyCount;
+#else
+	return poll(pollFDs, fdCount, timeout);
+#endif
+}
+
+
+#if PG_VERSION_NUM >= 90600
+
+/*
+ * BuildSocketWaitSet replaces the wait event set that persists across waits
+ * by one for our latch, postmaster death and the given sockets.
+ */
+static void
+BuildSocketWaitSet(struct pollfd *pollFDs, int *fdIndexArray,
+				   uint32 *waitFlagsArray, int socketCount)
+{
+	MemoryContext oldContext = NULL;
+	int socketIndex = 0;
+
+	if (SocketWaitSet != NULL)
+	{
+		FreeWaitEventSet(SocketWaitSet);
+		pfree(SocketWaitEvents);
+		pfree(SocketWaitSockets);
+		pfree(SocketWaitFlags);
+	}
+
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	SocketWaitSet = CreateWaitEventSet(TopMemoryContext,
+									   FIRST_SOCKET_WAIT_POSITION + socketCount);
+	SocketWaitEvents = (WaitEvent *) palloc0((FIRST_SOCKET_WAIT_POSITION +
+											  socketCount) * sizeof(WaitEvent));
+	SocketWaitSockets = (pgsocket *) palloc0((socketCount + 1) *
+											 sizeof(pgsocket));
+	SocketWaitFlags = (uint32 *) palloc0((socketCount + 1) * sizeof(uint32));
+	SocketWaitCount = socketCount;
+
+	MemoryContextSwitchTo(oldContext);
+
+	AddWaitEventToSet(SocketWaitSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch,
+					  NULL);
+	AddWaitEventToSet(SocketWaitSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET,
+					  NULL, NULL);
+
+	for (socketIndex = 0; socketIndex < socketCount; socketIndex++)
+	{
+		pgsocket socket = pollFDs[fdIndexArray[socketIndex]].fd;
+		uint32 waitFlags = waitFlagsArray[socketIndex];
+
+		AddWaitEventToSet(SocketWaitSet, waitFlags, socket, NULL, NULL);
+
+		SocketWaitSockets[socketIndex] = socket;
+		SocketWaitFlags[socketIndex] = waitFlags;
+	}
+}
+#endif
+
+/*
+ * ManageCronTasks proceeds the state machines of the given list of tasks.
+ */
+static void
+ManageCronTasks(List *taskList, TimestampTz currentTime)
+{
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskList)
+	{
+		CronTask *task = (CronTask *) lfirst(taskCell);
+
+		ManageCronTask(task, currentTime);
+	}
+}
+
+
+/*
+ * TakeNextRun assigns the next pending run to the given task: requested
+ * runs first, then the retry of a failed run, then scheduled runs. It
+ * returns false if no run is pending.
+ */
+static bool
+TakeNextRun(CronTask *task)
+{
+	bool isRetry = false;
+
+	if (task->runRequests != NIL)
+	{
+		RunRequest *runRequest = (RunRequest *) linitial(task->runRequests);
+
+		task->runId = runRequest->runId;
+		task->runRequests = list_delete_first(task->runRequests);
+		pfree(runRequest);
+	}
+	else if (task->retryPending)
+	{
+		task->runId = NextRunId();
+		isRetry = true;
+	}
+	else if (task->pendingRunCount > 0)
+	{
+		task->runId = NextRunId();
+		task->pendingRunCount -= 1;
+	}
+	else
+	{
+		return false;
+	}
+
+	/* a new run supersedes the retries of a failed run */
+	if (!isRetry)
+	{
+		task->attemptCount = 0;
+		task->retryDueTime = 0;
+	}
+
+	task->retryPending = false;
+	task->attemptCount += 1;
+
+	return true;
+}
+
+
+/*
+ * StartFanOut starts the run that was assigned to the task of a job on a
+ * node group, by queueing it on the members of the task. The task waits in
+ * the CRON_TASK_FANNING_OUT state until the run completed on all nodes.
+ */
+static void
+StartFanOut(CronTask *task, TimestampTz currentTime)
+{
+	CronJob *cronJob = task->cronJob;
+	ListCell *memberCell = NULL;
+
+	task->runStartTime = currentTime;
+	task->memberSuccessCount = 0;
+	task->memberFailureCount = 0;
+
+	foreach(memberCell, task->memberTasks)
+	{
+		CronTask *member = (CronTask *) lfirst(memberCell);
+
+		member->memberPending = member->isActive;
+	}
+
+	if (ShouldLogRun(cronJob))
+	{
+		ereport(LOG, (errmsg("cron job %ld starting on %d nodes: %s",
+							 task->jobId, list_length(task->memberTasks),
+							 cronJob->command)));
+	}
+
+	task->state = CRON_TASK_FANNING_OUT;
+
+	AdvanceFanOut(task);
+}
 
-		taskIndex++;
-	}
 
-	/*
-	 * Find the first time-based event, which is either the start of a new
-	 * minute or a timeout.
-	 */
-	TimestampDifference(currentTime, nextEventTime, &waitSeconds, &waitMicros);
+/*
+ * AdvanceFanOut starts the run of the given task on the next nodes, such
+ * that it runs on at most fanout_concurrency nodes at a time, and completes
+ * the run once it finished on all nodes. A run fails if it failed on any
+ * node, or if the node group has no nodes. Each node counts as a running
+ * job against cron.max_running_jobs and cron.max_running_jobs_per_user,
+ * and nodes that do not fit are started when the task is managed again.
+ */
+static void
+AdvanceFanOut(CronTask *task)
+{
+	CronJob *cronJob = task->cronJob;
+	ListCell *memberCell = NULL;
+	int runningCount = 0;
+	int runningJobCount = 0;
+	bool hasPendingMembers = false;
 
-	pollTimeout = waitSeconds * 1000 + waitMicros / 1000;
-	if (pollTimeout <= 0)
+	if (task->state != CRON_TASK_FANNING_OUT)
 	{
-		pfree(pollFDs);
 		return;
 	}
-	else if (pollTimeout > MaxWait)
+
+	runningJobCount = CountRunningJobs();
+
+	foreach(memberCell, task->memberTasks)
 	{
-		/*
-		 * We never wait more than 1 second, this gives us a chance to react
-		 * to external events like a TERM signal and job changes.
-		 */
+		CronTask *member = (CronTask *) lfirst(memberCell);
 
-		pollTimeout = MaxWait;
+		if (member->memberRunning)
+		{
+			runningCount++;
+		}
 	}
 
-	pollResult = poll(pollFDs, taskCount, pollTimeout);
-	if (pollResult < 0)
+	foreach(memberCell, task->memberTasks)
 	{
-		/*
-		 * This typically happens in case of a signal, though we should
-		 * probably check errno in case something bad happened.
-		 */
+		CronTask *member = (CronTask *) lfirst(memberCell);
 
-		pfree(pollFDs);
-		return;
-	}
+		if (!member->memberPending)
+		{
+			continue;
+		}
 
-	taskIndex = 0;
+		/* nodes that did not start yet are skipped once the job is removed */
+		if (!task->isActive || !member->isActive)
+		{
+			member->memberPending = false;
+			continue;
+		}
 
-	foreach(taskCell, taskList)
-	{
-		CronTask *task = (CronTask *) lfirst(taskCell);
-		struct pollfd *pollFileDescriptor = &pollFDs[taskIndex];
+		if (runningCount >= cronJob->fanOutConcurrency ||
+			(CronMaxRunningJobs > 0 && runningJobCount >= CronMaxRunningJobs) ||
+			!UserMayStartJob(cronJob->userName, CronMaxRunningJobsPerUser))
+		{
+			hasPendingMembers = true;
+			break;
+		}
 
-		task->isSocketReady = pollFileDescriptor->revents &
-							  pollFileDescriptor->events;
+		member->memberPending = false;
+		member->memberRunning = true;
+		runningCount++;
 
-		taskIndex++;
+		CountRunningJob(cronJob->userName);
+		runningJobCount++;
+
+		StartMemberRun(member, task->runId);
 	}
 
-	pfree(pollFDs);
+	if (runningCount > 0 || hasPendingMembers)
+	{
+		return;
+	}
+
+	if (!task->isActive)
+	{
+		task->errorMessage = "job cancelled";
+		task->state = CRON_TASK_ERROR;
+	}
+	else if (task->memberFailureCount > 0)
+	{
+		task->errorMessage = "failed on one or more nodes";
+		task->state = CRON_TASK_ERROR;
+	}
+	else if (task->memberSuccessCount == 0)
+	{
+		task->errorMessage = "node group has no nodes";
+		task->state = CRON_TASK_ERROR;
+	}
+	else
+	{
+		task->state = CRON_TASK_DONE;
+	}
+
+	if (task->isActive && ShouldLogRun(cronJob))
+	{
+		ereport(LOG, (errmsg("cron job %ld completed on %d of %d nodes",
+							 task->jobId, task->memberSuccessCount,
+							 task->memberSuccessCount +
+							 task->memberFailureCount)));
+	}
 }
 
 
 /*
- * ManageCronTasks proceeds the state machines of the given list of tasks.
+ * CompleteMemberRun adds the result of a run on one node to the run of the
+ * job, records it for cron.job_node_status, and starts the run on the next
+ * node. Nodes that left the node group during the run do not count.
  */
 static void
-ManageCronTasks(List *taskList, TimestampTz currentTime)
+CompleteMemberRun(CronTask *member, bool succeeded, TimestampTz currentTime)
 {
-	ListCell *taskCell = NULL;
+	CronTask *parentTask = member->parentTask;
+	bool isActive = member->isActive;
 
-	foreach(taskCell, taskList)
+	if (isActive && succeeded)
 	{
-		CronTask *task = (CronTask *) lfirst(taskCell);
+		parentTask->memberSuccessCount += 1;
+	}
+	else if (isActive)
+	{
+		parentTask->memberFailureCount += 1;
 
-		ManageCronTask(task, currentTime);
+		/* retries of the job are decided by the first error */
+		if (parentTask->sqlState[0] == '\0')
+		{
+			strlcpy(parentTask->sqlState, member->sqlState,
+					sizeof(parentTask->sqlState));
+		}
+	}
+
+	if (isActive && member->cronJob != NULL)
+	{
+		RecordNodeResult(member, succeeded, currentTime);
+	}
+
+	ResetCronTask(member);
+	member->isActive = isActive;
+	member->memberRunning = false;
+
+	if (!isActive)
+	{
+		RemoveMemberTask(member);
 	}
+
+	AdvanceFanOut(parentTask);
 }
 
 
@@ -749,14 +2709,27 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 {
 	CronTaskState checkState = task->state;
 	int64 jobId = task->jobId;
-	CronJob *cronJob = GetCronJob(jobId);
+	CronJob *cronJob = task->cronJob;
 	PGconn *connection = task->connection;
 	ConnStatusType connectionStatus = CONNECTION_BAD;
 
+	/* the runs on the nodes of a node group are logged as one */
+	bool logRun = task->parentTask == NULL && ShouldLogRun(cronJob);
+
 	switch (checkState)
 	{
 		case CRON_TASK_WAITING:
 		{
+			/* the node left the group before its run started */
+			if (!task->isActive && task->parentTask != NULL)
+			{
+				list_free_deep(task->runRequests);
+				task->runRequests = NIL;
+				task->errorMessage = "job cancelled";
+				task->state = CRON_TASK_ERROR;
+				break;
+			}
+
 			/* check if job has been removed */
 			if (!task->isActive)
 			{
@@ -765,46 +2738,122 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				break;
 			}
 
-			/* check whether runs are pending */
-			if (task->pendingRunCount == 0)
+			/*
+			 * Runs that fall due without the lease are left to the holder.
+			 * Members finish the run that their job started.
+			 */
+			if (task->parentTask == NULL && !HoldsSchedulerLease(currentTime))
+			{
+				if (!IsQueuedJobId(jobId))
+				{
+					list_free_deep(task->runRequests);
+					task->runRequests = NIL;
+					task->pendingRunCount = 0;
+					task->retryPending = false;
+					task->isAdmitted = false;
+				}
+
+				break;
+			}
+
+			/*
+			 * Runs of jobs, including queued tasks and one-shot jobs, wait
+			 * in the admission queue for their turn. Members are limited
+			 * when their job fans out.
+			 */
+			if (!task->isAdmitted && task->parentTask == NULL)
+			{
+				if (task->pendingRunCount > 0 || task->runRequests != NIL ||
+					task->retryPending)
+				{
+					task->awaitingAdmission = true;
+					AddAdmissionRequest(jobId, cronJob->userName,
+										cronJob->priority);
+				}
+
+				break;
+			}
+
+			if (!TakeNextRun(task))
+			{
+				task->isAdmitted = false;
+				break;
+			}
+
+			if (cronJob->nodeGroup != NULL)
 			{
+				StartFanOut(task, currentTime);
 				break;
 			}
 
-			task->runId = RunCount++;
-			task->pendingRunCount -= 1;
 			task->state = CRON_TASK_START;
 		}
 
 		case CRON_TASK_START:
 		{
-			const char *clientEncoding = GetDatabaseEncodingName();
-			char nodePortString[12];
 			TimestampTz startDeadline = 0;
+			const char *keywordArray[MAX_CONNECTION_PARAMS];
+			const char *valueArray[MAX_CONNECTION_PARAMS];
+			char *hostList = NULL;
+			char *hostAddrList = NULL;
+			HostLookupResult lookupResult = HOST_LOOKUP_DONE;
+
+			/* a prewarmed task may have lost its job before it connects */
+			if (!task->isActive)
+			{
+				task->errorMessage = "job cancelled";
+				task->pollingStatus = 0;
+				task->state = CRON_TASK_ERROR;
+				break;
+			}
+
+			if (!task->awaitingHost)
+			{
+				task->runStartTime = currentTime;
+				task->startDeadline = TimestampTzPlusMilliseconds(currentTime,
+																  CronTaskStartTimeout);
+			}
+
+			/* new names are resolved by the host cache without blocking us */
+			lookupResult = LookupHostAddresses(ConnectionHostName(cronJob),
+											   currentTime, &hostList,
+											   &hostAddrList);
+			if (lookupResult == HOST_LOOKUP_PENDING &&
+				currentTime < task->startDeadline)
+			{
+				/* try again when the lookup is checked for completion */
+				task->awaitingHost = true;
+				break;
+			}
+
+			task->awaitingHost = false;
 
-			const char *keywordArray[] = {
-				"host",
-				"port",
-				"fallback_application_name",
-				"client_encoding",
-				"dbname",
-				"user",
-				NULL
-			};
-			const char *valueArray[] = {
-				cronJob->nodeName,
-				nodePortString,
-				"pg_cron",
-				clientEncoding,
-				cronJob->database,
-				cronJob->userName,
-				NULL
-			};
-			sprintf(nodePortString, "%d", cronJob->nodePort);
-
-			Assert(sizeof(keywordArray) == sizeof(valueArray));
-
-			if (CronLogStatement)
+			/* fail fast while the node is known to be down */
+			if (!NodeAcceptsConnection(cronJob->nodeName, cronJob->nodePort,
+									   currentTime))
+			{
+				task->errorMessage = "skipped, node is unavailable";
+				task->pollingStatus = 0;
+				task->state = CRON_TASK_ERROR;
+				break;
+			}
+
+			if (lookupResult != HOST_LOOKUP_DONE)
+			{
+				RecordNodeFailure(cronJob->nodeName, cronJob->nodePort,
+								  currentTime);
+				task->errorMessage = "could not resolve host";
+				task->pollingStatus = 0;
+				task->state = CRON_TASK_ERROR;
+				break;
+			}
+
+			task->leaseToken = SchedulerLeaseToken();
+
+			BuildConnectionParams(cronJob, task->leaseToken, hostList,
+								  hostAddrList, keywordArray, valueArray);
+
+			if (logRun && !task->isPrewarmed)
 			{
 				char *command = cronJob->command;
 
@@ -818,6 +2867,7 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			connectionStatus = PQstatus(connection);
 			if (connectionStatus == CONNECTION_BAD)
 			{
+				RecordConnectionFailure(task, cronJob, currentTime);
 				task->errorMessage = "connection failed";
 				task->pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
@@ -851,6 +2901,8 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			/* check if timeout has been reached */
 			if (TimestampDifferenceExceeds(task->startDeadline, currentTime, 0))
 			{
+				RecordNodeFailure(cronJob->nodeName, cronJob->nodePort,
+								  currentTime);
 				task->errorMessage = "connection timeout";
 				task->pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
@@ -861,6 +2913,7 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			connectionStatus = PQstatus(connection);
 			if (connectionStatus == CONNECTION_BAD)
 			{
+				RecordConnectionFailure(task, cronJob, currentTime);
 				task->errorMessage = "connection failed";
 				task->pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
@@ -877,6 +2930,8 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			pollingStatus = PQconnectPoll(connection);
 			if (pollingStatus == PGRES_POLLING_OK)
 			{
+				RecordNodeSuccess(cronJob->nodeName, cronJob->nodePort);
+
 				/* wait for socket to be ready to send a query */
 				task->pollingStatus = PGRES_POLLING_WRITING;
 
@@ -884,12 +2939,22 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			}
 			else if (pollingStatus == PGRES_POLLING_FAILED)
 			{
+				RecordConnectionFailure(task, cronJob, currentTime);
 				task->errorMessage = "connection failed";
 				task->pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
 			}
 			else
 			{
+				connectionStatus = PQstatus(connection);
+
+				/* past these states, the node accepted the connection */
+				if (connectionStatus != CONNECTION_STARTED &&
+					connectionStatus != CONNECTION_NEEDED)
+				{
+					task->connectionMade = true;
+				}
+
 				/*
 				 * Connection is still being established.
 				 *
@@ -905,7 +2970,7 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 
 		case CRON_TASK_SENDING:
 		{
-			char *command = cronJob->command;
+			char *command = NULL;
 			int sendResult = 0;
 
 			/* check if job has been removed */
@@ -917,9 +2982,45 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				break;
 			}
 
+			/* the job is only valid while the task is active */
+			command = cronJob->command;
+
+			/* a prewarmed connection waits for a run to become due */
+			if (task->isPrewarmed)
+			{
+				if (HoldsSchedulerLease(currentTime) && TakeNextRun(task))
+				{
+					task->isPrewarmed = false;
+					task->runStartTime = currentTime;
+					task->startDeadline =
+						TimestampTzPlusMilliseconds(currentTime,
+													CronTaskStartTimeout);
+
+					if (logRun)
+					{
+						ereport(LOG, (errmsg("cron job %ld starting: %s",
+											 jobId, command)));
+					}
+				}
+				else if (currentTime >= task->prewarmTime)
+				{
+					/* the job turned out not to be due */
+					PQfinish(connection);
+					ResetCronTask(task);
+					StartDependentRunIfMet(task, currentTime);
+					break;
+				}
+				else
+				{
+					break;
+				}
+			}
+
 			/* check if timeout has been reached */
 			if (TimestampDifferenceExceeds(task->startDeadline, currentTime, 0))
 			{
+				RecordNodeFailure(cronJob->nodeName, cronJob->nodePort,
+								  currentTime);
 				task->errorMessage = "connection timeout";
 				task->pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
@@ -936,15 +3037,39 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			connectionStatus = PQstatus(connection);
 			if (connectionStatus == CONNECTION_BAD)
 			{
+				/* libpq saw the connection break, the server did not say why */
+				RecordNodeFailure(cronJob->nodeName, cronJob->nodePort,
+								  currentTime);
 				task->errorMessage = "connection lost";
 				task->pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
 				break;
 			}
 
+			/*
+			 * Connecting takes up to CronTaskStartTimeout, during which
+			 * another scheduler may have taken over the lease. Only send the
+			 * command while the lease under which we connected is held.
+			 */
+			if (!HoldsSchedulerLease(currentTime) ||
+				SchedulerLeaseToken() != task->leaseToken)
+			{
+				task->errorMessage = "skipped, scheduler lost the lease";
+				task->pollingStatus = 0;
+				task->state = CRON_TASK_ERROR;
+				break;
+			}
+
 			sendResult = PQsendQuery(connection, command);
 			if (sendResult == 1)
 			{
+				/* receive rows one at a time, to capture only the first ones */
+				task->output = StartTaskOutput(cronJob, task->runId);
+				if (task->output != NULL)
+				{
+					PQsetSingleRowMode(connection);
+				}
+
 				/* wait for socket to be ready to receive results */
 				task->pollingStatus = PGRES_POLLING_READING;
 
@@ -962,8 +3087,8 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 
 		case CRON_TASK_RUNNING:
 		{
-			int connectionBusy = 0;
 			PGresult *result = NULL;
+			bool commandDone = false;
 
 			/* check if job has been removed */
 			if (!task->isActive)
@@ -978,6 +3103,9 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			connectionStatus = PQstatus(connection);
 			if (connectionStatus == CONNECTION_BAD)
 			{
+				/* libpq saw the connection break, the server did not say why */
+				RecordNodeFailure(cronJob->nodeName, cronJob->nodePort,
+								  currentTime);
 				task->errorMessage = "connection lost";
 				task->pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
@@ -992,22 +3120,36 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 
 			PQconsumeInput(connection);
 
-			connectionBusy = PQisBusy(connection);
-			if (connectionBusy)
+			/* process the results that arrived, without blocking */
+			while (!PQisBusy(connection))
 			{
-				/* still waiting for results */
-				break;
-			}
+				ExecStatusType executionStatus = 0;
 
-			while ((result = PQgetResult(connection)) != NULL)
-			{
-				ExecStatusType executionStatus = PQresultStatus(result);
+				result = PQgetResult(connection);
+				if (result == NULL)
+				{
+					commandDone = true;
+					break;
+				}
+
+				executionStatus = PQresultStatus(result);
 
 				switch (executionStatus)
 				{
+					case PGRES_SINGLE_TUPLE:
+					{
+						CaptureResultRow(task->output, result);
+						break;
+					}
+
 					case PGRES_COMMAND_OK:
 					{
-						if (CronLogStatement)
+						if (task->output != NULL)
+						{
+							EndTaskResult(task->output);
+						}
+
+						if (logRun)
 						{
 							char *cmdStatus = PQcmdStatus(result);
 							char *cmdTuples = PQcmdTuples(result);
@@ -1022,6 +3164,21 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 					case PGRES_BAD_RESPONSE:
 					case PGRES_FATAL_ERROR:
 					{
+						char *sqlState = PQresultErrorField(result,
+															PG_DIAG_SQLSTATE);
+
+						if (sqlState != NULL)
+						{
+							strlcpy(task->sqlState, sqlState,
+									sizeof(task->sqlState));
+						}
+						else if (PQstatus(connection) == CONNECTION_BAD)
+						{
+							/* the error came from libpq, as the connection broke */
+							RecordNodeFailure(cronJob->nodeName,
+											  cronJob->nodePort, currentTime);
+						}
+
 						task->errorMessage = PQresultErrorMessage(result);
 						task->pollingStatus = 0;
 						task->state = CRON_TASK_ERROR;
@@ -1036,6 +3193,7 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 					case PGRES_COPY_BOTH:
 					{
 						/* cannot handle COPY input/output */
+						strlcpy(task->sqlState, "0A000", sizeof(task->sqlState));
 						task->errorMessage = "COPY not supported";
 						task->pollingStatus = 0;
 						task->state = CRON_TASK_ERROR;
@@ -1047,13 +3205,19 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 
 					case PGRES_TUPLES_OK:
 					case PGRES_EMPTY_QUERY:
-					case PGRES_SINGLE_TUPLE:
 					case PGRES_NONFATAL_ERROR:
 					default:
 					{
-						if (CronLogStatement)
+						int tupleCount = PQntuples(result);
+
+						/* in single-row mode, the rows came before */
+						if (task->output != NULL)
+						{
+							tupleCount = (int) EndTaskResult(task->output);
+						}
+
+						if (logRun)
 						{
-							int tupleCount = PQntuples(result);
 							char *rowString = ngettext("row", "rows",
 													   tupleCount);
 
@@ -1071,6 +3235,12 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				PQclear(result);
 			}
 
+			if (!commandDone)
+			{
+				/* still waiting for results */
+				break;
+			}
+
 			PQfinish(connection);
 
 			task->connection = NULL;
@@ -1081,27 +3251,61 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			break;
 		}
 
+		case CRON_TASK_FANNING_OUT:
+		{
+			AdvanceFanOut(task);
+			break;
+		}
+
 		case CRON_TASK_ERROR:
 		{
+			int suppressedCount = 0;
+			bool logFailure = ShouldLogRunFailure(task, currentTime,
+												  &suppressedCount);
+
 			if (connection != NULL)
 			{
 				PQfinish(connection);
 				task->connection = NULL;
 			}
 
-			if (!task->isActive)
+			if (logFailure && task->isPrewarmed)
 			{
-				RemoveTask(jobId);
+				/* a run that fell due in the meantime starts over below */
+				ereport(LOG, (errmsg("cron job %ld could not prewarm a "
+									 "connection: %s", jobId,
+									 task->errorMessage != NULL ?
+									 task->errorMessage : "failed"),
+							  suppressedCount > 0 ?
+							  errdetail("%d earlier failures of this job were "
+										"not logged.", suppressedCount) : 0));
 			}
-
-			if (task->errorMessage != NULL)
+			else if (logFailure && task->parentTask != NULL)
 			{
-				ereport(LOG, (errmsg("cron job %ld %s",
-									 jobId, task->errorMessage)));
+				ereport(LOG, (errmsg("cron job %ld on node %s:%d %s", jobId,
+									 task->memberNodeName,
+									 task->memberNodePort,
+									 task->errorMessage != NULL ?
+									 task->errorMessage : "failed"),
+							  suppressedCount > 0 ?
+							  errdetail("%d earlier failures of this job were "
+										"not logged.", suppressedCount) : 0));
 			}
-			else
+			else if (logFailure)
+			{
+				ereport(LOG, (errmsg("cron job %ld %s", jobId,
+									 task->errorMessage != NULL ?
+									 task->errorMessage : "failed"),
+							  suppressedCount > 0 ?
+							  errdetail("%d earlier failures of this job were "
+										"not logged.", suppressedCount) : 0));
+			}
+
+			/* a node group retries the run of the job on all its nodes */
+			if (task->isActive && cronJob != NULL && !task->isPrewarmed &&
+				task->parentTask == NULL && ShouldRetryRun(task, cronJob))
 			{
-				ereport(LOG, (errmsg("cron job %ld failed", jobId)));
+				ScheduleRetry(task, cronJob, currentTime, logFailure);
 			}
 
 			task->startDeadline = 0;
@@ -1114,7 +3318,86 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 		case CRON_TASK_DONE:
 		default:
 		{
-			InitializeCronTask(task, jobId);
+			/* failed runs fell through from CRON_TASK_ERROR */
+			bool runSucceeded = (checkState == CRON_TASK_DONE);
+
+			if (task->parentTask != NULL)
+			{
+				CompleteMemberRun(task, runSucceeded, currentTime);
+				break;
+			}
+
+			/* a prewarmed connection that failed did not start a run */
+			if (!task->isPrewarmed)
+			{
+				RecordRunCompletion(task->runStartTime, currentTime,
+									runSucceeded);
+			}
+
+			if (task->output != NULL)
+			{
+				if (runSucceeded)
+				{
+					CompleteTaskOutput(task->output, currentTime);
+				}
+				else
+				{
+					DiscardTaskOutput(task->output);
+				}
+
+				task->output = NULL;
+			}
+
+			/* queued tasks and one-shot jobs only run once */
+			if (IsQueuedJobId(jobId))
+			{
+				CompleteOneShotJob(jobId);
+				RemoveQueuedJob(jobId);
+				RemoveTask(jobId);
+				break;
+			}
+
+			/* the job was removed while it ran */
+			if (!task->isActive)
+			{
+				RemoveTask(jobId);
+				break;
+			}
+
+			/*
+			 * A prewarm can fail after the minute started and the run fell
+			 * due. The run was not taken yet, so it starts with a new
+			 * connection like any other run, and is retried if that fails.
+			 */
+			if (task->isPrewarmed)
+			{
+				uint pendingRunCount = task->pendingRunCount;
+
+				ResetCronTask(task);
+				task->pendingRunCount = pendingRunCount;
+
+				StartDependentRunIfMet(task, currentTime);
+				MarkTaskRunnable(task);
+				break;
+			}
+
+			/* time the next run of intervals that count from the end */
+			if (cronJob != NULL && task->interval > 0 && task->nextDueTime == 0 &&
+				(cronJob->schedule.flags & INTERVAL_FROM_END))
+			{
+				ScheduleIntervalRun(task, TimestampTzPlusMilliseconds(currentTime,
+																	  (int64) task->interval * 1000));
+			}
+
+			if (runSucceeded && task->isActive)
+			{
+				StartDependentRuns(task, currentTime);
+			}
+
+			ResetCronTask(task);
+
+			/* dependencies that were met while the task ran start a run now */
+			StartDependentRunIfMet(task, currentTime);
 		}
 
 	}
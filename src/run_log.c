@@ -0,0 +1,250 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/run_log.c
+ *
+ * Decides which lines are logged about runs. Jobs log their start and
+ * completion depending on their log level and cron.log_statement, and
+ * failures are logged at most once per cron.log_error_interval for each
+ * job. Instead of a line per run, cron.log_summary_interval logs a line
+ * with the number of runs, the failures, and the run time percentiles,
+ * which are estimated from a histogram with logarithmic buckets.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "math.h"
+
+#include "run_log.h"
+
+
+/* each doubling of the run time is split into this many buckets */
+#define BUCKETS_PER_DOUBLING 4
+
+/* the last bucket holds runs of 2^32 ms, about 50 days, and longer */
+#define RUN_TIME_BUCKET_COUNT (BUCKETS_PER_DOUBLING * 32 + 1)
+
+
+/* forward declarations */
+static int RunTimeBucket(double runTime);
+static double RunTimePercentile(double fraction);
+
+/* global settings */
+bool CronLogStatement = true;
+int CronLogSummaryInterval = 0;
+int CronLogErrorInterval = 0;
+
+/* runs since the last summary */
+static TimestampTz SummaryStartTime = 0;
+static int64 RunCount = 0;
+static int64 FailedRunCount = 0;
+static int64 SuppressedFailureCount = 0;
+static double MaxRunTime = 0;
+static int64 RunTimeHistogram[RUN_TIME_BUCKET_COUNT];
+
+
+/*
+ * ShouldLogRun returns whether the start and completion of the runs of
+ * the given job are logged. Jobs without a log level follow
+ * cron.log_statement.
+ */
+bool
+ShouldLogRun(CronJob *cronJob)
+{
+	if (cronJob == NULL || cronJob->logLevel == CRON_LOG_DEFAULT)
+	{
+		return CronLogStatement;
+	}
+
+	return cronJob->logLevel == CRON_LOG_ALL;
+}
+
+
+/*
+ * ShouldLogRunFailure returns whether a failure of the current run of
+ * the given task is logged. Failures of a job are not logged within
+ * cron.log_error_interval of the last failure that was, and the number
+ * of failures that were left out since then is returned in
+ * suppressedCount when the next one is logged.
+ */
+bool
+ShouldLogRunFailure(CronTask *task, TimestampTz currentTime,
+					int *suppressedCount)
+{
+	CronJob *cronJob = task->cronJob;
+
+	*suppressedCount = 0;
+
+	if (cronJob != NULL && cronJob->logLevel == CRON_LOG_NONE)
+	{
+		return false;
+	}
+
+	if (CronLogErrorInterval > 0 && task->lastFailureLogTime != 0 &&
+		!TimestampDifferenceExceeds(task->lastFailureLogTime, currentTime,
+									CronLogErrorInterval))
+	{
+		task->suppressedFailureCount += 1;
+
+		if (CronLogSummaryInterval > 0)
+		{
+			SuppressedFailureCount += 1;
+		}
+
+		return false;
+	}
+
+	*suppressedCount = task->suppressedFailureCount;
+
+	task->lastFailureLogTime = currentTime;
+	task->suppressedFailureCount = 0;
+
+	return true;
+}
+
+
+/*
+ * RecordRunCompletion adds a run that started and ended at the given times
+ * to the next summary.
+ */
+void
+RecordRunCompletion(TimestampTz startTime, TimestampTz endTime, bool succeeded)
+{
+	long seconds = 0;
+	int microseconds = 0;
+	double runTime = 0;
+
+	if (CronLogSummaryInterval <= 0)
+	{
+		return;
+	}
+
+	if (RunCount == 0)
+	{
+		SummaryStartTime = startTime;
+	}
+
+	TimestampDifference(startTime, endTime, &seconds, &microseconds);
+	runTime = seconds * 1000.0 + microseconds / 1000.0;
+
+	RunTimeHistogram[RunTimeBucket(runTime)] += 1;
+	MaxRunTime = Max(MaxRunTime, runTime);
+
+	RunCount += 1;
+
+	if (!succeeded)
+	{
+		FailedRunCount += 1;
+	}
+}
+
+
+/*
+ * RunTimeBucket returns the histogram bucket of a run time in ms. Bucket
+ * 0 holds runs shorter than 1 ms, and bucket i holds runs of up to
+ * 2^(i / BUCKETS_PER_DOUBLING) ms, such that the estimated percentiles
+ * are off by at most 19%.
+ */
+static int
+RunTimeBucket(double runTime)
+{
+	int bucket = 0;
+
+	if (runTime < 1.0)
+	{
+		return 0;
+	}
+
+	bucket = (int) ceil(log2(runTime) * BUCKETS_PER_DOUBLING);
+
+	return Min(Max(bucket, 1), RUN_TIME_BUCKET_COUNT - 1);
+}
+
+
+/*
+ * RunTimePercentile returns the run time in ms below which the given
+ * fraction of the runs in the histogram completed.
+ */
+static double
+RunTimePercentile(double fraction)
+{
+	int64 rank = (int64) ceil(RunCount * fraction);
+	int64 cumulativeCount = 0;
+	int bucket = 0;
+
+	for (bucket = 0; bucket < RUN_TIME_BUCKET_COUNT; bucket++)
+	{
+		cumulativeCount += RunTimeHistogram[bucket];
+
+		if (cumulativeCount >= rank)
+		{
+			double upperBound = pow(2.0, (double) bucket / BUCKETS_PER_DOUBLING);
+
+			return Min(upperBound, MaxRunTime);
+		}
+	}
+
+	return MaxRunTime;
+}
+
+
+/*
+ * NextRunSummaryTime sets summaryTime to the time at which the next
+ * summary is due, and returns whether one is due at all.
+ */
+bool
+NextRunSummaryTime(TimestampTz *summaryTime)
+{
+	if (CronLogSummaryInterval <= 0 || RunCount == 0)
+	{
+		return false;
+	}
+
+	*summaryTime = TimestampTzPlusMilliseconds(SummaryStartTime,
+											   CronLogSummaryInterval);
+
+	return true;
+}
+
+
+/*
+ * LogRunSummary logs a line about the runs since the last summary once
+ * cron.log_summary_interval has passed since the first of them, and
+ * starts a new summary. No line is logged while no job runs.
+ */
+void
+LogRunSummary(TimestampTz currentTime)
+{
+	TimestampTz summaryTime = 0;
+	long seconds = 0;
+	int microseconds = 0;
+
+	if (!NextRunSummaryTime(&summaryTime) || currentTime < summaryTime)
+	{
+		return;
+	}
+
+	TimestampDifference(SummaryStartTime, currentTime, &seconds, &microseconds);
+
+	ereport(LOG, (errmsg("pg_cron completed %ld runs in the last %ld s, "
+						 "%ld failed, run time p50 %.0f ms, p99 %.0f ms, "
+						 "max %.0f ms", RunCount, seconds, FailedRunCount,
+						 RunTimePercentile(0.5), RunTimePercentile(0.99),
+						 MaxRunTime),
+				  SuppressedFailureCount > 0 ?
+				  errdetail("%ld failures were not logged because of "
+							"cron.log_error_interval.",
+							SuppressedFailureCount) : 0));
+
+	SummaryStartTime = 0;
+	RunCount = 0;
+	FailedRunCount = 0;
+	SuppressedFailureCount = 0;
+	MaxRunTime = 0;
+	memset(RunTimeHistogram, 0, sizeof(RunTimeHistogram));
+}
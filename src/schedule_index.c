@@ -0,0 +1,358 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/schedule_index.c
+ *
+ * Inverted index over job schedules, used to find the tasks that should
+ * run in a given minute without evaluating every schedule. Each time zone
+ * has its own index, which is rebuilt whenever the job cache is reloaded.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "cron.h"
+#include "pg_cron.h"
+#include "job_metadata.h"
+#include "schedule_index.h"
+#include "task_states.h"
+#include "time_zones.h"
+
+#include "utils/memutils.h"
+
+
+#define BITS_PER_WORD 64
+
+#define IndexBitmap(index, bitmapNumber) \
+	(&(index)->bitmaps[(bitmapNumber) * (index)->wordCount])
+
+#define IndexWordSetBit(bitmap, slot) \
+	((bitmap)[(slot) / BITS_PER_WORD] |= ((uint64) 1) << ((slot) % BITS_PER_WORD))
+
+
+/* what VisitDueTasks does with the tasks that are due */
+typedef enum DueTaskAction
+{
+	DUE_TASKS_ADD_RUNS = 0,
+	DUE_TASKS_LIST = 1,
+	DUE_TASKS_FIRST = 2
+} DueTaskAction;
+
+
+/* forward declarations */
+static ScheduleIndex * CreateScheduleIndex(List *taskList);
+static void IndexScheduleField(ScheduleIndex *index, int offset, int valueCount,
+							   bitstr_t *bits, int slot);
+static List * VisitDueTasks(ScheduleIndex *index, struct tm *tm, bool doWild,
+						   bool doNonWild, DueTaskAction action);
+static inline int RightmostOnePosition(uint64 word);
+
+/* global variables */
+static MemoryContext CronScheduleIndexContext = NULL;
+
+
+/*
+ * InitializeScheduleIndexes creates the memory context for the schedule
+ * indexes.
+ */
+void
+InitializeScheduleIndexes(void)
+{
+	CronScheduleIndexContext = AllocSetContextCreate(CurrentMemoryContext,
+													 "pg_cron schedule index context",
+													 ALLOCSET_DEFAULT_MINSIZE,
+													 ALLOCSET_DEFAULT_INITSIZE,
+													 ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+
+/*
+ * RebuildScheduleIndexes replaces the schedule index of every time zone by
+ * an index over the given tasks in that time zone. The tasks must remain
+ * valid until the next rebuild, which holds for active tasks since tasks
+ * are only removed after the job cache has been reloaded without them.
+ */
+void
+RebuildScheduleIndexes(List *taskList)
+{
+	List *timeZoneList = CronTimeZoneList();
+	ListCell *timeZoneCell = NULL;
+	ListCell *taskCell = NULL;
+
+	MemoryContextResetAndDeleteChildren(CronScheduleIndexContext);
+
+	foreach(timeZoneCell, timeZoneList)
+	{
+		CronTimeZone *timeZone = (CronTimeZone *) lfirst(timeZoneCell);
+
+		timeZone->scheduleIndex = NULL;
+		timeZone->taskList = NIL;
+		timeZone->nextRunCheckedMinute = 0;
+	}
+
+	/* group the tasks by the time zone of their job */
+	foreach(taskCell, taskList)
+	{
+		CronTask *task = (CronTask *) lfirst(taskCell);
+		CronJob *cronJob = task->cronJob;
+		CronTimeZone *timeZone = NULL;
+
+		if (cronJob == NULL || cronJob->timeZone == NULL)
+		{
+			continue;
+		}
+
+		/* interval schedules do not depend on the wall clock */
+		if (cronJob->schedule.flags & WHEN_INTERVAL)
+		{
+			continue;
+		}
+
+		timeZone = cronJob->timeZone;
+		timeZone->taskList = lappend(timeZone->taskList, task);
+	}
+
+	foreach(timeZoneCell, timeZoneList)
+	{
+		CronTimeZone *timeZone = (CronTimeZone *) lfirst(timeZoneCell);
+
+		if (timeZone->taskList != NIL)
+		{
+			timeZone->scheduleIndex = CreateScheduleIndex(timeZone->taskList);
+		}
+
+		timeZone->taskList = NIL;
+	}
+}
+
+
+/*
+ * CreateScheduleIndex builds an index over the schedules of the given
+ * tasks.
+ */
+static ScheduleIndex *
+CreateScheduleIndex(List *taskList)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(CronScheduleIndexContext);
+	ScheduleIndex *index = NULL;
+	ListCell *taskCell = NULL;
+	int slot = 0;
+
+	index = (ScheduleIndex *) palloc0(sizeof(ScheduleIndex));
+	index->taskCount = list_length(taskList);
+	index->wordCount = (index->taskCount + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	index->tasks = (CronTask **) palloc(index->taskCount * sizeof(CronTask *));
+	index->bitmaps = (uint64 *) palloc0(INDEX_BITMAP_COUNT * index->wordCount *
+										sizeof(uint64));
+
+	foreach(taskCell, taskList)
+	{
+		CronTask *task = (CronTask *) lfirst(taskCell);
+		CronJob *cronJob = task->cronJob;
+		entry *schedule = &cronJob->schedule;
+
+		index->tasks[slot] = task;
+
+		IndexScheduleField(index, INDEX_MINUTE_OFFSET, MINUTE_COUNT,
+						   schedule->minute, slot);
+		IndexScheduleField(index, INDEX_HOUR_OFFSET, HOUR_COUNT,
+						   schedule->hour, slot);
+		IndexScheduleField(index, INDEX_DOM_OFFSET, DOM_COUNT,
+						   schedule->dom, slot);
+		IndexScheduleField(index, INDEX_MONTH_OFFSET, MONTH_COUNT,
+						   schedule->month, slot);
+		IndexScheduleField(index, INDEX_DOW_OFFSET, DOW_COUNT,
+						   schedule->dow, slot);
+
+		if (schedule->flags & (DOM_STAR | DOW_STAR))
+		{
+			IndexWordSetBit(IndexBitmap(index, INDEX_DAY_STAR_OFFSET), slot);
+		}
+
+		if (schedule->flags & (MIN_STAR | HR_STAR))
+		{
+			IndexWordSetBit(IndexBitmap(index, INDEX_WILD_OFFSET), slot);
+		}
+
+		slot++;
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	return index;
+}
+
+
+/*
+ * IndexScheduleField sets the bit for the given slot in the bitmap of each
+ * value that is set in one field of a schedule.
+ */
+static void
+IndexScheduleField(ScheduleIndex *index, int offset, int valueCount,
+				   bitstr_t *bits, int slot)
+{
+	int value = 0;
+
+	for (value = 0; value < valueCount; value++)
+	{
+		if (bit_test(bits, value))
+		{
+			IndexWordSetBit(IndexBitmap(index, offset + value), slot);
+		}
+	}
+}
+
+
+/*
+ * AddPendingRunsForMinute adds a pending run to every task in the index
+ * whose schedule matches the given broken-down (local) time.
+ */
+void
+AddPendingRunsForMinute(ScheduleIndex *index, struct tm *tm, bool doWild,
+						bool doNonWild)
+{
+	VisitDueTasks(index, tm, doWild, doNonWild, DUE_TASKS_ADD_RUNS);
+}
+
+
+/*
+ * DueTasksForMinute returns the tasks in the index whose schedule matches
+ * the given broken-down (local) time, without adding pending runs.
+ */
+List *
+DueTasksForMinute(ScheduleIndex *index, struct tm *tm)
+{
+	return VisitDueTasks(index, tm, true, true, DUE_TASKS_LIST);
+}
+
+
+/*
+ * AnyTaskDueInMinute returns whether any task in the index has a schedule
+ * that matches the given broken-down (local) time.
+ */
+bool
+AnyTaskDueInMinute(ScheduleIndex *index, struct tm *tm)
+{
+	return VisitDueTasks(index, tm, true, true, DUE_TASKS_FIRST) != NIL;
+}
+
+
+/*
+ * VisitDueTasks finds the tasks in the index whose schedule matches the
+ * given broken-down (local) time, following the same rules as Vixie cron:
+ * if either day field is *, both day fields need to match, otherwise
+ * either one of them. It either adds a pending run to each of those tasks,
+ * returns them in a list, or returns only the first one.
+ */
+static List *
+VisitDueTasks(ScheduleIndex *index, struct tm *tm, bool doWild,
+			  bool doNonWild, DueTaskAction action)
+{
+	List *dueTaskList = NIL;
+	uint64 *minuteBitmap = NULL;
+	uint64 *hourBitmap = NULL;
+	uint64 *domBitmap = NULL;
+	uint64 *monthBitmap = NULL;
+	uint64 *dowBitmap = NULL;
+	uint64 *dayStarBitmap = NULL;
+	uint64 *wildBitmap = NULL;
+	uint64 wildMask = 0;
+	uint64 nonWildMask = 0;
+	int wordIndex = 0;
+
+	if (index == NULL || !(doWild || doNonWild))
+	{
+		return NIL;
+	}
+
+	minuteBitmap = IndexBitmap(index, INDEX_MINUTE_OFFSET +
+							   tm->tm_min - FIRST_MINUTE);
+	hourBitmap = IndexBitmap(index, INDEX_HOUR_OFFSET +
+							 tm->tm_hour - FIRST_HOUR);
+	domBitmap = IndexBitmap(index, INDEX_DOM_OFFSET +
+							tm->tm_mday - FIRST_DOM);
+	monthBitmap = IndexBitmap(index, INDEX_MONTH_OFFSET +
+							  tm->tm_mon + 1 - FIRST_MONTH);
+	dowBitmap = IndexBitmap(index, INDEX_DOW_OFFSET +
+							tm->tm_wday - FIRST_DOW);
+	dayStarBitmap = IndexBitmap(index, INDEX_DAY_STAR_OFFSET);
+	wildBitmap = IndexBitmap(index, INDEX_WILD_OFFSET);
+
+	wildMask = doWild ? ~((uint64) 0) : 0;
+	nonWildMask = doNonWild ? ~((uint64) 0) : 0;
+
+	for (wordIndex = 0; wordIndex < index->wordCount; wordIndex++)
+	{
+		uint64 dueWord = minuteBitmap[wordIndex] & hourBitmap[wordIndex] &
+						 monthBitmap[wordIndex];
+		uint64 domWord = 0;
+		uint64 dowWord = 0;
+		uint64 dayStarWord = 0;
+		uint64 wildWord = 0;
+
+		if (dueWord == 0)
+		{
+			continue;
+		}
+
+		domWord = domBitmap[wordIndex];
+		dowWord = dowBitmap[wordIndex];
+		dayStarWord = dayStarBitmap[wordIndex];
+		wildWord = wildBitmap[wordIndex];
+
+		dueWord &= (dayStarWord & domWord & dowWord) |
+				   (~dayStarWord & (domWord | dowWord));
+		dueWord &= (wildWord & wildMask) | (~wildWord & nonWildMask);
+
+		while (dueWord != 0)
+		{
+			int bit = RightmostOnePosition(dueWord);
+			CronTask *task = index->tasks[wordIndex * BITS_PER_WORD + bit];
+
+			if (action == DUE_TASKS_ADD_RUNS)
+			{
+				task->pendingRunCount += 1;
+				MarkTaskRunnable(task);
+			}
+			else if (action == DUE_TASKS_LIST)
+			{
+				dueTaskList = lappend(dueTaskList, task);
+			}
+			else
+			{
+				return list_make1(task);
+			}
+
+			dueWord &= dueWord - 1;
+		}
+	}
+
+	return dueTaskList;
+}
+
+
+/*
+ * RightmostOnePosition returns the position of the lowest set bit in a
+ * non-zero word.
+ */
+static inline int
+RightmostOnePosition(uint64 word)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(word);
+#else
+	int position = 0;
+
+	while ((word & 1) == 0)
+	{
+		word >>= 1;
+		position++;
+	}
+
+	return position;
+#endif
+}
@@ -0,0 +1,1103 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/scheduler_lease.c
+ *
+ * Election of the one scheduler that starts runs among several servers
+ * that schedule the same jobs. When cron.lease_conninfo is set, the
+ * schedulers compete for a lease row in the cron.scheduler_lease table
+ * of that database. The holder renews the lease every third of
+ * cron.lease_time, and the others try to take it over once it expires.
+ *
+ * A renewal is a small state machine that the main loop advances like the
+ * tasks, such that a slow or unreachable lease database, or a slow
+ * resolver, never blocks the scheduler. A renewal that did not complete within a third of
+ * cron.lease_time is abandoned, and keepalives detect a connection that
+ * went away while it was idle.
+ *
+ * Every change of holder increments the token of the lease, and only a
+ * scheduler that presents the current token can renew it. A scheduler
+ * that fails to renew stops starting runs one lease time after it sent
+ * its last successful renewal, which is before the lease expires in the
+ * lease database, such that two schedulers never start runs at the same
+ * time. Schedulers that do not hold the lease keep their jobs loaded and
+ * follow the clock, but drop the runs that fall due.
+ *
+ * The token fences off runs of a scheduler that lost the lease while it
+ * connected: a command is only sent while the token under which its
+ * connection was opened is still held. Job connections also carry the
+ * token in the cron.lease_token setting, such that commands can compare
+ * it with the current token in cron.scheduler_lease before they write.
+ *
+ * The same kind of lease hands read-only jobs over to the scheduler of a
+ * hot standby. The standby scheduler holds the standby lease, named after
+ * cron.lease_name with a ":standby" suffix, in cron.scheduler_lease on the
+ * primary that cron.primary_conninfo points to. The primary reads the
+ * lease from its own table and leaves read-only jobs to the standby until
+ * the lease expires. The standby only starts runs one lease time after it
+ * acquired the lease, by which time the primary saw it, and stops before
+ * the lease expires.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "cron.h"
+#include "pg_cron.h"
+#include "cron_scheduler_lease.h"
+#include "host_cache.h"
+#include "job_metadata.h"
+#include "scheduler_lease.h"
+#include "shared_state.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/skey.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/namespace.h"
+#include "libpq-fe.h"
+#include "pgstat.h"
+#include "postmaster/postmaster.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+
+#define MAX_HOST_NAME_LENGTH 256
+
+#define CRON_SCHEMA_NAME "cron"
+#define SCHEDULER_LEASE_TABLE_NAME "scheduler_lease"
+#define SCHEDULER_LEASE_INDEX_NAME "scheduler_lease_pkey"
+#define STANDBY_LEASE_SUFFIX ":standby"
+
+/*
+ * Takes the lease when it is free or expired, and renews it when it is
+ * held by us with the token we know. The token changes with the holder.
+ */
+#define RENEW_LEASE_QUERY \
+	"INSERT INTO cron.scheduler_lease AS lease " \
+	"(lease_name, holder, token, expires_at) " \
+	"VALUES ($1, $2, 1, clock_timestamp() + $4::interval) " \
+	"ON CONFLICT (lease_name) DO UPDATE " \
+	"SET holder = excluded.holder, " \
+	"token = CASE WHEN lease.holder = $2 AND lease.token = $3 " \
+	"THEN lease.token ELSE lease.token + 1 END, " \
+	"expires_at = excluded.expires_at " \
+	"WHERE (lease.holder = $2 AND lease.token = $3) " \
+	"OR lease.expires_at < clock_timestamp() " \
+	"RETURNING token"
+
+/* lets the other schedulers take over right away */
+#define RELEASE_LEASE_QUERY \
+	"UPDATE cron.scheduler_lease SET expires_at = clock_timestamp() " \
+	"WHERE lease_name = $1 AND holder = $2 AND token = $3"
+
+
+/*
+ * LeaseRenewalState is the state of a renewal of a lease.
+ */
+typedef enum
+{
+	LEASE_RENEWAL_IDLE = 0,
+	LEASE_RENEWAL_CONNECTING = 1,
+	LEASE_RENEWAL_SENDING = 2,
+	LEASE_RENEWAL_RUNNING = 3,
+	LEASE_RENEWAL_RESOLVING = 4
+} LeaseRenewalState;
+
+
+/*
+ * CronLease is a lease that this scheduler holds or tries to take over,
+ * along with the renewal that is in flight.
+ */
+typedef struct CronLease
+{
+	/* where the lease is held, and under which name */
+	char *connInfo;
+	char leaseName[NAMEDATALEN + sizeof(STANDBY_LEASE_SUFFIX)];
+	const char *databaseName;
+
+	PGconn *connection;
+	int64 token;
+	TimestampTz acquiredTime;
+	TimestampTz validUntil;
+	TimestampTz renewalTime;
+
+	LeaseRenewalState renewalState;
+	PostgresPollingStatusType pollingStatus;
+	TimestampTz renewalStartTime;
+	TimestampTz renewalDeadline;
+} CronLease;
+
+
+/* forward declarations */
+static bool LeaseEnabled(CronLease *lease);
+static bool StandbyLeaseEnabled(void);
+static bool RenewLease(CronLease *lease, TimestampTz currentTime);
+static bool HoldsLease(CronLease *lease, TimestampTz currentTime);
+static void StartLeaseRenewal(CronLease *lease, TimestampTz currentTime);
+static void ManageLeaseRenewal(CronLease *lease, TimestampTz currentTime);
+static bool StartLeaseConnection(CronLease *lease, TimestampTz currentTime,
+								 bool *lookupPending);
+static bool SendLeaseRenewal(CronLease *lease);
+static void CompleteLeaseRenewal(CronLease *lease, PGresult *result);
+static void FailLeaseRenewal(CronLease *lease, const char *reason);
+static void ReleaseLease(CronLease *lease);
+static void DisconnectLeaseDatabase(CronLease *lease);
+static TimestampTz LoadStandbyLeaseExpiry(void);
+
+/* global settings */
+char *CronLeaseConnInfo = "";
+char *CronLeaseName = "pg_cron";
+int CronLeaseTime = 10000;
+char *CronLeaseTokenSetting = "";
+char *CronPrimaryConnInfo = "";
+
+/* global variables */
+static char LeaseHolder[MAX_HOST_NAME_LENGTH + 16];
+static CronLease SchedulerLease;
+static CronLease StandbyLease;
+
+/* expiry of the scheduler lease as last published to backends */
+static TimestampTz PublishedLeaseExpiry = 0;
+
+/* expiry of the standby lease as last read by the primary, and next read */
+static TimestampTz StandbyLeaseExpiryTime = 0;
+static TimestampTz StandbyLeaseCheckTime = 0;
+
+
+/*
+ * InitializeSchedulerLease determines the name under which this scheduler
+ * holds leases, which is the host name and port of the server, and sets
+ * up the scheduler lease and the standby lease.
+ */
+void
+InitializeSchedulerLease(void)
+{
+	char hostName[MAX_HOST_NAME_LENGTH];
+
+	if (gethostname(hostName, sizeof(hostName)) != 0)
+	{
+		strlcpy(hostName, "localhost", sizeof(hostName));
+	}
+
+	hostName[sizeof(hostName) - 1] = '\0';
+
+	snprintf(LeaseHolder, sizeof(LeaseHolder), "%s:%d", hostName,
+			 PostPortNumber);
+
+	memset(&SchedulerLease, 0, sizeof(CronLease));
+	SchedulerLease.connInfo = CronLeaseConnInfo;
+	strlcpy(SchedulerLease.leaseName, CronLeaseName,
+			sizeof(SchedulerLease.leaseName));
+	SchedulerLease.databaseName = "lease database";
+	SchedulerLease.pollingStatus = PGRES_POLLING_FAILED;
+
+	memset(&StandbyLease, 0, sizeof(CronLease));
+	StandbyLease.connInfo = CronPrimaryConnInfo;
+	snprintf(StandbyLease.leaseName, sizeof(StandbyLease.leaseName), "%s%s",
+			 CronLeaseName, STANDBY_LEASE_SUFFIX);
+	StandbyLease.databaseName = "primary";
+	StandbyLease.pollingStatus = PGRES_POLLING_FAILED;
+}
+
+
+/*
+ * LeaseEnabled returns whether the given lease is used.
+ */
+static bool
+LeaseEnabled(CronLease *lease)
+{
+	if (lease == &StandbyLease && !StandbyLeaseEnabled())
+	{
+		return false;
+	}
+
+	return lease->connInfo != NULL && lease->connInfo[0] != '\0';
+}
+
+
+/*
+ * StandbyLeaseEnabled returns whether this scheduler runs on a hot standby
+ * and registers with the primary to run read-only jobs.
+ */
+static bool
+StandbyLeaseEnabled(void)
+{
+	return EnableStandbyScheduler && RecoveryInProgress();
+}
+
+
+/*
+ * RenewSchedulerLease starts a renewal of the scheduler lease if one is
+ * due, makes progress on a renewal that is in flight, and returns whether
+ * this scheduler holds the lease. It never blocks: the main loop waits for
+ * the sockets returned by SchedulerLeaseSockets and calls it again.
+ */
+bool
+RenewSchedulerLease(TimestampTz currentTime)
+{
+	bool holdsLease = false;
+	TimestampTz validUntil = 0;
+
+	if (!LeaseEnabled(&SchedulerLease))
+	{
+		return true;
+	}
+
+	holdsLease = RenewLease(&SchedulerLease, currentTime);
+
+	/* cron.run_now only accepts runs while we hold the lease */
+	validUntil = holdsLease ? SchedulerLease.validUntil : 0;
+	if (validUntil != PublishedLeaseExpiry)
+	{
+		SetSchedulerLeaseExpiry(validUntil);
+		PublishedLeaseExpiry = validUntil;
+	}
+
+	return holdsLease;
+}
+
+
+/*
+ * RenewStandbyLease does the same for the standby lease, which the
+ * scheduler of a hot standby holds on the primary, and returns whether
+ * it may run read-only jobs.
+ */
+bool
+RenewStandbyLease(TimestampTz currentTime)
+{
+	if (!LeaseEnabled(&StandbyLease))
+	{
+		/* after promotion, the primary takes over once the lease expires */
+		DisconnectLeaseDatabase(&StandbyLease);
+		StandbyLease.renewalState = LEASE_RENEWAL_IDLE;
+		StandbyLease.token = 0;
+		StandbyLease.validUntil = 0;
+
+		return false;
+	}
+
+	RenewLease(&StandbyLease, currentTime);
+
+	return HoldsStandbyLease(GetCurrentTimestamp());
+}
+
+
+/*
+ * RenewLease starts a renewal of the given lease if one is due, makes
+ * progress on a renewal that is in flight, and returns whether this
+ * scheduler holds the lease.
+ */
+static bool
+RenewLease(CronLease *lease, TimestampTz currentTime)
+{
+	if (lease->renewalState == LEASE_RENEWAL_IDLE)
+	{
+		if (currentTime < lease->renewalTime)
+		{
+			return HoldsLease(lease, currentTime);
+		}
+
+		StartLeaseRenewal(lease, currentTime);
+	}
+
+	if (lease->renewalState != LEASE_RENEWAL_IDLE &&
+		currentTime >= lease->renewalDeadline)
+	{
+		FailLeaseRenewal(lease, "renewal timed out");
+	}
+
+	if (lease->renewalState != LEASE_RENEWAL_IDLE)
+	{
+		ManageLeaseRenewal(lease, currentTime);
+	}
+
+	return HoldsLease(lease, GetCurrentTimestamp());
+}
+
+
+/*
+ * StartLeaseRenewal starts a renewal, either on the open connection to the
+ * lease database or by opening one. The renewal has to complete within a
+ * third of cron.lease_time, after which the next one is due.
+ */
+static void
+StartLeaseRenewal(CronLease *lease, TimestampTz currentTime)
+{
+	lease->renewalStartTime = currentTime;
+	lease->renewalDeadline = TimestampTzPlusMilliseconds(currentTime,
+														 CronLeaseTime / 3);
+	lease->renewalTime = lease->renewalDeadline;
+
+	if (lease->connection != NULL &&
+		PQstatus(lease->connection) == CONNECTION_OK && SendLeaseRenewal(lease))
+	{
+		return;
+	}
+
+	/* there is no connection, or it broke while idle */
+	DisconnectLeaseDatabase(lease);
+
+	lease->renewalState = LEASE_RENEWAL_RESOLVING;
+}
+
+
+/*
+ * ManageLeaseRenewal proceeds the state machine of the renewal that is in
+ * flight, as far as it can without waiting.
+ */
+static void
+ManageLeaseRenewal(CronLease *lease, TimestampTz currentTime)
+{
+	if (lease->renewalState == LEASE_RENEWAL_RESOLVING)
+	{
+		bool lookupPending = false;
+
+		if (!StartLeaseConnection(lease, currentTime, &lookupPending))
+		{
+			if (!lookupPending)
+			{
+				lease->renewalState = LEASE_RENEWAL_IDLE;
+			}
+
+			/* otherwise wait for the host cache */
+			return;
+		}
+
+		lease->renewalState = LEASE_RENEWAL_CONNECTING;
+		lease->pollingStatus = PGRES_POLLING_WRITING;
+	}
+
+	if (lease->renewalState == LEASE_RENEWAL_CONNECTING)
+	{
+		lease->pollingStatus = PQconnectPoll(lease->connection);
+
+		if (lease->pollingStatus == PGRES_POLLING_FAILED)
+		{
+			FailLeaseRenewal(lease, "could not connect");
+			return;
+		}
+
+		if (lease->pollingStatus != PGRES_POLLING_OK)
+		{
+			/* wait for the socket */
+			return;
+		}
+
+		if (!SendLeaseRenewal(lease))
+		{
+			return;
+		}
+	}
+
+	if (lease->renewalState == LEASE_RENEWAL_SENDING)
+	{
+		int flushResult = PQflush(lease->connection);
+
+		if (flushResult < 0)
+		{
+			FailLeaseRenewal(lease, "could not send renewal");
+			return;
+		}
+
+		if (flushResult == 1)
+		{
+			/* wait until we can write */
+			lease->pollingStatus = PGRES_POLLING_WRITING;
+			return;
+		}
+
+		lease->renewalState = LEASE_RENEWAL_RUNNING;
+		lease->pollingStatus = PGRES_POLLING_READING;
+	}
+
+	if (lease->renewalState == LEASE_RENEWAL_RUNNING)
+	{
+		PGresult *result = NULL;
+		PGresult *nextResult = NULL;
+
+		if (PQconsumeInput(lease->connection) == 0)
+		{
+			FailLeaseRenewal(lease, "connection lost");
+			return;
+		}
+
+		if (PQisBusy(lease->connection))
+		{
+			/* wait for the result */
+			return;
+		}
+
+		result = PQgetResult(lease->connection);
+
+		/* drain the connection, the renewal has a single result */
+		while ((nextResult = PQgetResult(lease->connection)) != NULL)
+		{
+			PQclear(nextResult);
+		}
+
+		lease->renewalState = LEASE_RENEWAL_IDLE;
+		lease->pollingStatus = PGRES_POLLING_FAILED;
+
+		CompleteLeaseRenewal(lease, result);
+		PQclear(result);
+	}
+}
+
+
+/*
+ * StartLeaseConnection starts to open a connection to the lease database,
+ * and returns whether it could. The host is resolved through the host
+ * cache, since libpq would otherwise resolve it synchronously, and
+ * lookupPending is set while the host cache resolves it. Statements
+ * time out after a third of cron.lease_time, and keepalives detect a peer
+ * that went away within about the same time.
+ */
+static bool
+StartLeaseConnection(CronLease *lease, TimestampTz currentTime,
+					 bool *lookupPending)
+{
+	const char *keywordArray[10];
+	const char *valueArray[10];
+	PQconninfoOption *optionArray = NULL;
+	PQconninfoOption *option = NULL;
+	char *errorMessage = NULL;
+	char *hostName = NULL;
+	char *hostAddr = NULL;
+	char *hostList = NULL;
+	char *hostAddrList = NULL;
+	int keepaliveSeconds = Max(1, CronLeaseTime / 3000);
+	int paramIndex = 0;
+
+	optionArray = PQconninfoParse(lease->connInfo, &errorMessage);
+	if (optionArray == NULL)
+	{
+		ereport(LOG, (errmsg("pg_cron scheduler could not parse the "
+							 "connection string of the %s: %s",
+							 lease->databaseName,
+							 errorMessage != NULL ? errorMessage :
+							 "out of memory")));
+
+		PQfreemem(errorMessage);
+		return false;
+	}
+
+	for (option = optionArray; option->keyword != NULL; option++)
+	{
+		if (option->val == NULL || option->val[0] == '\0')
+		{
+			continue;
+		}
+
+		if (strcmp(option->keyword, "host") == 0)
+		{
+			hostName = pstrdup(option->val);
+		}
+		else if (strcmp(option->keyword, "hostaddr") == 0)
+		{
+			hostAddr = option->val;
+		}
+	}
+
+	/* lists of hosts are left to libpq */
+	if (hostName != NULL && hostAddr == NULL && strchr(hostName, ',') == NULL)
+	{
+		HostLookupResult lookupResult = LookupHostAddresses(hostName,
+															currentTime,
+															&hostList,
+															&hostAddrList);
+
+		if (lookupResult == HOST_LOOKUP_PENDING)
+		{
+			*lookupPending = true;
+
+			PQconninfoFree(optionArray);
+			return false;
+		}
+
+		if (lookupResult == HOST_LOOKUP_FAILED)
+		{
+			ereport(LOG, (errmsg("pg_cron scheduler could not resolve the "
+								 "host of the %s", lease->databaseName)));
+
+			PQconninfoFree(optionArray);
+			return false;
+		}
+	}
+
+	PQconninfoFree(optionArray);
+
+	/* later keywords override those of the connection string */
+	keywordArray[paramIndex] = "dbname";
+	valueArray[paramIndex++] = lease->connInfo;
+	keywordArray[paramIndex] = "fallback_application_name";
+	valueArray[paramIndex++] = "pg_cron scheduler";
+	keywordArray[paramIndex] = "keepalives";
+	valueArray[paramIndex++] = "1";
+	keywordArray[paramIndex] = "keepalives_idle";
+	valueArray[paramIndex++] = psprintf("%d", keepaliveSeconds);
+	keywordArray[paramIndex] = "keepalives_interval";
+	valueArray[paramIndex++] = psprintf("%d", keepaliveSeconds);
+	keywordArray[paramIndex] = "keepalives_count";
+	valueArray[paramIndex++] = "3";
+	keywordArray[paramIndex] = "options";
+	valueArray[paramIndex++] = psprintf("-c statement_timeout=%d",
+										Max(1, CronLeaseTime / 3));
+
+	if (hostAddrList != NULL)
+	{
+		keywordArray[paramIndex] = "host";
+		valueArray[paramIndex++] = hostList;
+		keywordArray[paramIndex] = "hostaddr";
+		valueArray[paramIndex++] = hostAddrList;
+	}
+
+	keywordArray[paramIndex] = NULL;
+	valueArray[paramIndex] = NULL;
+
+	lease->connection = PQconnectStartParams(keywordArray, valueArray, true);
+	if (lease->connection == NULL ||
+		PQstatus(lease->connection) == CONNECTION_BAD)
+	{
+		ereport(LOG, (errmsg("pg_cron scheduler could not connect to the "
+							 "%s: %s", lease->databaseName,
+							 lease->connection != NULL ?
+							 PQerrorMessage(lease->connection) :
+							 "out of memory")));
+
+		DisconnectLeaseDatabase(lease);
+		return false;
+	}
+
+	PQsetnonblocking(lease->connection, 1);
+
+	return true;
+}
+
+
+/*
+ * SendLeaseRenewal sends the statement that takes or renews the lease, and
+ * returns whether it could.
+ */
+static bool
+SendLeaseRenewal(CronLease *lease)
+{
+	const char *paramValues[4];
+	int sendResult = 0;
+
+	paramValues[0] = lease->leaseName;
+	paramValues[1] = LeaseHolder;
+	paramValues[2] = psprintf(INT64_FORMAT, lease->token);
+	paramValues[3] = psprintf("%d milliseconds", CronLeaseTime);
+
+	sendResult = PQsendQueryParams(lease->connection, RENEW_LEASE_QUERY, 4,
+								   NULL, paramValues, NULL, NULL, 0);
+	if (sendResult == 0)
+	{
+		FailLeaseRenewal(lease, "could not send renewal");
+		return false;
+	}
+
+	lease->renewalState = LEASE_RENEWAL_SENDING;
+	lease->pollingStatus = PGRES_POLLING_WRITING;
+
+	return true;
+}
+
+
+/*
+ * CompleteLeaseRenewal takes the token from the result of a renewal. The
+ * lease is valid for cron.lease_time from the start of the renewal, which
+ * is before the lease database started its clock.
+ */
+static void
+CompleteLeaseRenewal(CronLease *lease, PGresult *result)
+{
+	int64 previousToken = lease->token;
+	bool heldLease = HoldsLease(lease, lease->renewalStartTime);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		/* the lease stays valid until it would expire */
+		ereport(LOG, (errmsg("pg_cron scheduler could not renew lease %s: %s",
+							 lease->leaseName,
+							 PQerrorMessage(lease->connection))));
+
+		DisconnectLeaseDatabase(lease);
+		return;
+	}
+
+	if (PQntuples(result) == 1)
+	{
+		lease->token = strtoll(PQgetvalue(result, 0, 0), NULL, 10);
+		lease->validUntil = TimestampTzPlusMilliseconds(lease->renewalStartTime,
+														CronLeaseTime);
+
+		if (lease->token != previousToken || !heldLease)
+		{
+			ereport(LOG, (errmsg("pg_cron scheduler %s acquired lease %s "
+								 "with token %ld", LeaseHolder,
+								 lease->leaseName, lease->token)));
+
+			lease->acquiredTime = lease->renewalStartTime;
+
+			/* one-shot timers were dropped while we did not hold the lease */
+			if (lease == &SchedulerLease)
+			{
+				SetOneShotReloadNeeded();
+			}
+		}
+	}
+	else
+	{
+		if (previousToken != 0)
+		{
+			ereport(LOG, (errmsg("pg_cron scheduler %s lost lease %s",
+								 LeaseHolder, lease->leaseName)));
+		}
+
+		lease->token = 0;
+		lease->validUntil = 0;
+	}
+}
+
+
+/*
+ * FailLeaseRenewal abandons the renewal that is in flight and closes the
+ * connection. The lease stays valid until it would expire, and the next
+ * renewal opens a new connection.
+ */
+static void
+FailLeaseRenewal(CronLease *lease, const char *reason)
+{
+	ereport(LOG, (errmsg("pg_cron scheduler could not renew lease %s: %s%s%s",
+						 lease->leaseName, reason,
+						 lease->connection != NULL ? ": " : "",
+						 lease->connection != NULL ?
+						 PQerrorMessage(lease->connection) : "")));
+
+	lease->renewalState = LEASE_RENEWAL_IDLE;
+	lease->pollingStatus = PGRES_POLLING_FAILED;
+
+	DisconnectLeaseDatabase(lease);
+}
+
+
+/*
+ * HoldsSchedulerLease returns whether this scheduler may start runs at the
+ * given time, which is always the case when there is no lease.
+ */
+bool
+HoldsSchedulerLease(TimestampTz currentTime)
+{
+	if (!LeaseEnabled(&SchedulerLease))
+	{
+		return true;
+	}
+
+	return HoldsLease(&SchedulerLease, currentTime);
+}
+
+
+/*
+ * HoldsStandbyLease returns whether the scheduler of a hot standby may run
+ * read-only jobs at the given time. It holds the standby lease, and has
+ * held it long enough for the primary to have seen it.
+ */
+bool
+HoldsStandbyLease(TimestampTz currentTime)
+{
+	TimestampTz handOverTime = 0;
+
+	if (!LeaseEnabled(&StandbyLease) || !HoldsLease(&StandbyLease, currentTime))
+	{
+		return false;
+	}
+
+	handOverTime = TimestampTzPlusMilliseconds(StandbyLease.acquiredTime,
+											   CronLeaseTime);
+
+	return currentTime >= handOverTime;
+}
+
+
+/*
+ * HoldsLease returns whether this scheduler holds the given lease at the
+ * given time.
+ */
+static bool
+HoldsLease(CronLease *lease, TimestampTz currentTime)
+{
+	return lease->token != 0 && currentTime < lease->validUntil;
+}
+
+
+/*
+ * SchedulerLeaseToken returns the token of the lease that this scheduler
+ * holds, or 0 if it holds none or there is no lease.
+ */
+int64
+SchedulerLeaseToken(void)
+{
+	if (!LeaseEnabled(&SchedulerLease))
+	{
+		return 0;
+	}
+
+	return SchedulerLease.token;
+}
+
+
+/*
+ * CheckStandbyLease reads the standby lease from cron.scheduler_lease on
+ * the primary every third of cron.lease_time, such that the primary leaves
+ * read-only jobs to a standby scheduler that registered.
+ */
+void
+CheckStandbyLease(TimestampTz currentTime)
+{
+	if (!EnableStandbyScheduler || RecoveryInProgress())
+	{
+		StandbyLeaseExpiryTime = 0;
+		return;
+	}
+
+	if (currentTime < StandbyLeaseCheckTime)
+	{
+		return;
+	}
+
+	StandbyLeaseCheckTime = TimestampTzPlusMilliseconds(currentTime,
+														CronLeaseTime / 3);
+	StandbyLeaseExpiryTime = LoadStandbyLeaseExpiry();
+}
+
+
+/*
+ * StandbyLeaseIsHeld returns whether the primary should leave read-only
+ * jobs to a standby scheduler at the given time.
+ */
+bool
+StandbyLeaseIsHeld(TimestampTz currentTime)
+{
+	return currentTime < StandbyLeaseExpiryTime;
+}
+
+
+/*
+ * LoadStandbyLeaseExpiry returns the time at which the standby lease in
+ * cron.scheduler_lease expires, or 0 if there is none. A lease that this
+ * server held before it was promoted does not count.
+ */
+static TimestampTz
+LoadStandbyLeaseExpiry(void)
+{
+	TimestampTz expiryTime = 0;
+	Oid cronSchemaId = InvalidOid;
+	Oid leaseTableId = InvalidOid;
+	Oid leaseIndexId = InvalidOid;
+	Relation leaseTable = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	MemoryContext oldContext = CurrentMemoryContext;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (PgCronHasBeenLoaded())
+	{
+		cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+		leaseTableId = get_relname_relid(SCHEDULER_LEASE_TABLE_NAME,
+										 cronSchemaId);
+		leaseIndexId = get_relname_relid(SCHEDULER_LEASE_INDEX_NAME,
+										 cronSchemaId);
+	}
+
+	if (leaseTableId != InvalidOid && leaseIndexId != InvalidOid)
+	{
+		leaseTable = heap_open(leaseTableId, AccessShareLock);
+
+		ScanKeyInit(&scanKey[0], Anum_cron_scheduler_lease_lease_name,
+					BTEqualStrategyNumber, F_TEXTEQ,
+					CStringGetTextDatum(StandbyLease.leaseName));
+
+		scanDescriptor = systable_beginscan(leaseTable, leaseIndexId, indexOK,
+											NULL, scanKeyCount, scanKey);
+
+		tupleDescriptor = RelationGetDescr(leaseTable);
+
+		heapTuple = systable_getnext(scanDescriptor);
+		if (HeapTupleIsValid(heapTuple))
+		{
+			bool isNull = false;
+			Datum holderDatum = heap_getattr(heapTuple,
+											 Anum_cron_scheduler_lease_holder,
+											 tupleDescriptor, &isNull);
+			Datum expiresAtDatum = heap_getattr(heapTuple,
+												Anum_cron_scheduler_lease_expires_at,
+												tupleDescriptor, &isNull);
+			char *holder = TextDatumGetCString(holderDatum);
+
+			if (strcmp(holder, LeaseHolder) != 0)
+			{
+				expiryTime = DatumGetTimestampTz(expiresAtDatum);
+			}
+		}
+
+		systable_endscan(scanDescriptor);
+		heap_close(leaseTable, AccessShareLock);
+	}
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	/* committing leaves us in the top memory context */
+	MemoryContextSwitchTo(oldContext);
+
+	return expiryTime;
+}
+
+
+/*
+ * NextLeaseRenewalTime sets renewalTime to the earliest time at which a
+ * lease is next renewed or taken over, a renewal in flight times out, or
+ * the primary next reads the standby lease, and returns whether there is
+ * such a time.
+ */
+bool
+NextLeaseRenewalTime(TimestampTz *renewalTime)
+{
+	CronLease *leaseArray[2] = { &SchedulerLease, &StandbyLease };
+	bool hasRenewalTime = false;
+	int leaseIndex = 0;
+
+	for (leaseIndex = 0; leaseIndex < 2; leaseIndex++)
+	{
+		CronLease *lease = leaseArray[leaseIndex];
+		TimestampTz leaseTime = 0;
+
+		if (!LeaseEnabled(lease))
+		{
+			continue;
+		}
+
+		if (lease->renewalState != LEASE_RENEWAL_IDLE)
+		{
+			leaseTime = lease->renewalDeadline;
+		}
+		else
+		{
+			leaseTime = lease->renewalTime;
+		}
+
+		if (!hasRenewalTime || leaseTime < *renewalTime)
+		{
+			*renewalTime = leaseTime;
+			hasRenewalTime = true;
+		}
+	}
+
+	if (EnableStandbyScheduler && !RecoveryInProgress() &&
+		(!hasRenewalTime || StandbyLeaseCheckTime < *renewalTime))
+	{
+		*renewalTime = StandbyLeaseCheckTime;
+		hasRenewalTime = true;
+	}
+
+	return hasRenewalTime;
+}
+
+
+/*
+ * NextJobSelectionChangeTime sets changeTime to the next time at which the
+ * jobs that this scheduler runs change without any renewal completing:
+ * when a standby scheduler may start running read-only jobs or has to stop
+ * because its lease runs out, or when the primary takes read-only jobs
+ * back because the standby lease expired. It returns whether there is
+ * such a time.
+ */
+bool
+NextJobSelectionChangeTime(TimestampTz currentTime, TimestampTz *changeTime)
+{
+	if (LeaseEnabled(&StandbyLease) && HoldsLease(&StandbyLease, currentTime))
+	{
+		TimestampTz handOverTime =
+			TimestampTzPlusMilliseconds(StandbyLease.acquiredTime,
+										CronLeaseTime);
+
+		*changeTime = currentTime < handOverTime ? handOverTime :
+					  StandbyLease.validUntil;
+		return true;
+	}
+
+	if (StandbyLeaseIsHeld(currentTime))
+	{
+		*changeTime = StandbyLeaseExpiryTime;
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * SchedulerLeaseSockets fills in the sockets of the renewals in flight and
+ * whether each of them waits to write, and returns the number of sockets,
+ * which is at most MAX_LEASE_SOCKETS.
+ */
+int
+SchedulerLeaseSockets(int *socketArray, bool *forWriteArray)
+{
+	CronLease *leaseArray[MAX_LEASE_SOCKETS] = { &SchedulerLease, &StandbyLease };
+	int socketCount = 0;
+	int leaseIndex = 0;
+
+	for (leaseIndex = 0; leaseIndex < MAX_LEASE_SOCKETS; leaseIndex++)
+	{
+		CronLease *lease = leaseArray[leaseIndex];
+
+		if (!LeaseEnabled(lease) || lease->renewalState == LEASE_RENEWAL_IDLE ||
+			lease->connection == NULL || PQsocket(lease->connection) < 0)
+		{
+			continue;
+		}
+
+		socketArray[socketCount] = PQsocket(lease->connection);
+		forWriteArray[socketCount] =
+			lease->pollingStatus == PGRES_POLLING_WRITING;
+		socketCount++;
+	}
+
+	return socketCount;
+}
+
+
+/*
+ * ReleaseSchedulerLease gives up the scheduler lease and the standby lease
+ * when the scheduler exits, such that another scheduler, or the primary,
+ * can take over without waiting for them to expire.
+ */
+void
+ReleaseSchedulerLease(void)
+{
+	ReleaseLease(&SchedulerLease);
+	ReleaseLease(&StandbyLease);
+}
+
+
+/*
+ * ReleaseLease gives up the given lease. It waits at most a third of
+ * cron.lease_time for the lease database, and leaves the lease to expire
+ * when a renewal is in flight.
+ */
+static void
+ReleaseLease(CronLease *lease)
+{
+	const char *paramValues[3];
+	TimestampTz deadline = 0;
+
+	if (!LeaseEnabled(lease) || lease->token == 0 ||
+		lease->connection == NULL ||
+		lease->renewalState != LEASE_RENEWAL_IDLE ||
+		PQstatus(lease->connection) != CONNECTION_OK)
+	{
+		DisconnectLeaseDatabase(lease);
+		return;
+	}
+
+	paramValues[0] = lease->leaseName;
+	paramValues[1] = LeaseHolder;
+	paramValues[2] = psprintf(INT64_FORMAT, lease->token);
+
+	lease->token = 0;
+	lease->validUntil = 0;
+
+	if (PQsendQueryParams(lease->connection, RELEASE_LEASE_QUERY, 3, NULL,
+						  paramValues, NULL, NULL, 0) == 0)
+	{
+		DisconnectLeaseDatabase(lease);
+		return;
+	}
+
+	deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+										   CronLeaseTime / 3);
+
+	for (;;)
+	{
+		struct pollfd pollFileDescriptor;
+		TimestampTz currentTime = GetCurrentTimestamp();
+		long waitSeconds = 0;
+		int waitMicros = 0;
+		int flushResult = PQflush(lease->connection);
+		PGresult *result = NULL;
+
+		if (flushResult < 0 || PQconsumeInput(lease->connection) == 0)
+		{
+			break;
+		}
+
+		if (flushResult == 0 && !PQisBusy(lease->connection))
+		{
+			while ((result = PQgetResult(lease->connection)) != NULL)
+			{
+				PQclear(result);
+			}
+
+			break;
+		}
+
+		if (currentTime >= deadline)
+		{
+			break;
+		}
+
+		TimestampDifference(currentTime, deadline, &waitSeconds, &waitMicros);
+
+		pollFileDescriptor.fd = PQsocket(lease->connection);
+		pollFileDescriptor.events = POLLERR | POLLIN |
+									(flushResult == 1 ? POLLOUT : 0);
+		pollFileDescriptor.revents = 0;
+
+		if (poll(&pollFileDescriptor, 1,
+				 waitSeconds * 1000 + (waitMicros + 999) / 1000) < 0 &&
+			errno != EINTR)
+		{
+			break;
+		}
+	}
+
+	DisconnectLeaseDatabase(lease);
+}
+
+
+/*
+ * DisconnectLeaseDatabase closes the connection to the database of the
+ * given lease, if there is one.
+ */
+static void
+DisconnectLeaseDatabase(CronLease *lease)
+{
+	if (lease->connection != NULL)
+	{
+		PQfinish(lease->connection);
+		lease->connection = NULL;
+	}
+}
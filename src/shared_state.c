@@ -0,0 +1,532 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/shared_state.c
+ *
+ * State in shared memory that lets backends hand requests to the
+ * scheduler and wake it up through its latch, rather than waiting for
+ * the scheduler to notice changes on its next round.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "shared_state.h"
+
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+
+
+/* forward declarations */
+static void CronSharedStateStartup(void);
+static void DetachScheduler(int code, Datum arg);
+
+/* global variables */
+static shmem_startup_hook_type PreviousShmemStartupHook = NULL;
+static CronSharedState *SharedState = NULL;
+
+
+/*
+ * RequestCronSharedState reserves shared memory for the shared state and
+ * installs the hook that initializes it. It should be called from _PG_init.
+ */
+void
+RequestCronSharedState(void)
+{
+	RequestAddinShmemSpace(MAXALIGN(sizeof(CronSharedState)));
+
+	PreviousShmemStartupHook = shmem_startup_hook;
+	shmem_startup_hook = CronSharedStateStartup;
+}
+
+
+/*
+ * CronSharedStateStartup allocates or attaches to the shared state.
+ */
+static void
+CronSharedStateStartup(void)
+{
+	bool found = false;
+
+	if (PreviousShmemStartupHook != NULL)
+	{
+		PreviousShmemStartupHook();
+	}
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedState = ShmemInitStruct("pg_cron shared state",
+								  sizeof(CronSharedState), &found);
+	if (!found)
+	{
+		memset(SharedState, 0, sizeof(CronSharedState));
+		SpinLockInit(&SharedState->mutex);
+
+		/* tasks may have been left in cron.task_queue before a restart */
+		SharedState->tasksOverflowed = true;
+
+		/* the one-shot jobs in cron.one_shot_job are not known yet */
+		SharedState->oneShotReloadNeeded = true;
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+
+/*
+ * AttachScheduler registers the latch of the scheduler, such that backends
+ * can wake it up, until the scheduler exits. A scheduler that restarts
+ * starts with an empty timer heap, so it reloads all one-shot jobs.
+ */
+void
+AttachScheduler(Latch *schedulerLatch)
+{
+	SpinLockAcquire(&SharedState->mutex);
+	SharedState->schedulerLatch = schedulerLatch;
+	SharedState->oneShotReloadNeeded = true;
+	SpinLockRelease(&SharedState->mutex);
+
+	on_shmem_exit(DetachScheduler, 0);
+}
+
+
+/*
+ * DetachScheduler clears the latch of the scheduler on exit, along with
+ * the lease that it gave up.
+ */
+static void
+DetachScheduler(int code, Datum arg)
+{
+	SpinLockAcquire(&SharedState->mutex);
+	SharedState->schedulerLatch = NULL;
+	SharedState->leaseValidUntil = 0;
+	SpinLockRelease(&SharedState->mutex);
+}
+
+
+/*
+ * WakeScheduler sets the latch of the scheduler, if it is running.
+ */
+void
+WakeScheduler(void)
+{
+	Latch *schedulerLatch = NULL;
+
+	SpinLockAcquire(&SharedState->mutex);
+	schedulerLatch = SharedState->schedulerLatch;
+	SpinLockRelease(&SharedState->mutex);
+
+	if (schedulerLatch != NULL)
+	{
+		SetLatch(schedulerLatch);
+	}
+}
+
+
+/*
+ * NextRunId returns a run ID that is unique across the server.
+ */
+int64
+NextRunId(void)
+{
+	int64 runId = 0;
+
+	SpinLockAcquire(&SharedState->mutex);
+	runId = SharedState->nextRunId++;
+	SpinLockRelease(&SharedState->mutex);
+
+	return runId;
+}
+
+
+/*
+ * RequestJobRun adds a request to run the given job immediately to the
+ * queue, wakes up the scheduler, and returns the ID of the requested run.
+ */
+int64
+RequestJobRun(int64 jobId)
+{
+	int64 runId = 0;
+	bool queueIsFull = false;
+
+	SpinLockAcquire(&SharedState->mutex);
+
+	if (SharedState->requestCount >= MAX_RUN_REQUESTS)
+	{
+		queueIsFull = true;
+	}
+	else
+	{
+		int requestIndex = (SharedState->requestHead +
+							SharedState->requestCount) % MAX_RUN_REQUESTS;
+		RunRequest *request = &SharedState->requests[requestIndex];
+
+		runId = SharedState->nextRunId++;
+
+		request->jobId = jobId;
+		request->runId = runId;
+
+		SharedState->requestCount++;
+	}
+
+	SpinLockRelease(&SharedState->mutex);
+
+	if (queueIsFull)
+	{
+		ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						errmsg("too many pending run requests"),
+						errhint("Wait for the pg_cron scheduler to start the "
+								"pending runs.")));
+	}
+
+	WakeScheduler();
+
+	return runId;
+}
+
+
+/*
+ * DequeueRunRequests removes up to maxRequests requests from the queue,
+ * copies them into the given array, and returns the number of requests.
+ */
+int
+DequeueRunRequests(RunRequest *requests, int maxRequests)
+{
+	int requestCount = 0;
+
+	SpinLockAcquire(&SharedState->mutex);
+
+	while (requestCount < maxRequests && SharedState->requestCount > 0)
+	{
+		requests[requestCount] = SharedState->requests[SharedState->requestHead];
+
+		SharedState->requestHead = (SharedState->requestHead + 1) %
+								   MAX_RUN_REQUESTS;
+		SharedState->requestCount--;
+		requestCount++;
+	}
+
+	SpinLockRelease(&SharedState->mutex);
+
+	return requestCount;
+}
+
+
+/*
+ * RunRequestsPending returns whether there are run requests in the queue.
+ */
+bool
+RunRequestsPending(void)
+{
+	bool requestsPending = false;
+
+	SpinLockAcquire(&SharedState->mutex);
+	requestsPending = SharedState->requestCount > 0;
+	SpinLockRelease(&SharedState->mutex);
+
+	return requestsPending;
+}
+
+
+/*
+ * ReserveQueuedTasks reserves up to taskCount slots in the task queue and
+ * returns the number of slots that were reserved.
+ */
+int
+ReserveQueuedTasks(int taskCount)
+{
+	int freeCount = 0;
+	int reservedCount = 0;
+
+	SpinLockAcquire(&SharedState->mutex);
+
+	freeCount = MAX_QUEUED_TASKS - SharedState->taskCount -
+				SharedState->reservedTaskCount;
+	reservedCount = Min(taskCount, freeCount);
+	SharedState->reservedTaskCount += reservedCount;
+
+	SpinLockRelease(&SharedState->mutex);
+
+	return reservedCount;
+}
+
+
+/*
+ * ReleaseQueuedTasks releases slots that were reserved, but not used.
+ */
+void
+ReleaseQueuedTasks(int taskCount)
+{
+	SpinLockAcquire(&SharedState->mutex);
+	SharedState->reservedTaskCount -= taskCount;
+	SpinLockRelease(&SharedState->mutex);
+}
+
+
+/*
+ * PushQueuedTask adds a task to the task queue in a previously reserved
+ * slot.
+ */
+void
+PushQueuedTask(QueuedTask *task)
+{
+	int taskIndex = 0;
+
+	SpinLockAcquire(&SharedState->mutex);
+
+	Assert(SharedState->reservedTaskCount > 0);
+
+	taskIndex = (SharedState->taskHead + SharedState->taskCount) %
+				MAX_QUEUED_TASKS;
+	memcpy(&SharedState->tasks[taskIndex], task, sizeof(QueuedTask));
+
+	SharedState->reservedTaskCount--;
+	SharedState->taskCount++;
+
+	SpinLockRelease(&SharedState->mutex);
+}
+
+
+/*
+ * PopQueuedTask removes the oldest task from the task queue and copies it
+ * into the given task. It returns false if the queue is empty.
+ */
+bool
+PopQueuedTask(QueuedTask *task)
+{
+	bool taskFound = false;
+
+	SpinLockAcquire(&SharedState->mutex);
+
+	if (SharedState->taskCount > 0)
+	{
+		memcpy(task, &SharedState->tasks[SharedState->taskHead],
+			   sizeof(QueuedTask));
+
+		SharedState->taskHead = (SharedState->taskHead + 1) % MAX_QUEUED_TASKS;
+		SharedState->taskCount--;
+		taskFound = true;
+	}
+
+	SpinLockRelease(&SharedState->mutex);
+
+	return taskFound;
+}
+
+
+/*
+ * SetQueuedTasksOverflowed records that tasks were added to the
+ * cron.task_queue table.
+ */
+void
+SetQueuedTasksOverflowed(void)
+{
+	SpinLockAcquire(&SharedState->mutex);
+	SharedState->tasksOverflowed = true;
+	SpinLockRelease(&SharedState->mutex);
+}
+
+
+/*
+ * TakeQueuedTasksOverflowed returns whether tasks may have been added to
+ * the cron.task_queue table since the last call, and clears the flag.
+ */
+bool
+TakeQueuedTasksOverflowed(void)
+{
+	bool tasksOverflowed = false;
+
+	SpinLockAcquire(&SharedState->mutex);
+	tasksOverflowed = SharedState->tasksOverflowed;
+	SharedState->tasksOverflowed = false;
+	SpinLockRelease(&SharedState->mutex);
+
+	return tasksOverflowed;
+}
+
+
+/*
+ * QueuedTasksPending returns whether there are queued tasks in shared
+ * memory or possibly in the cron.task_queue table.
+ */
+bool
+QueuedTasksPending(void)
+{
+	bool tasksPending = false;
+
+	SpinLockAcquire(&SharedState->mutex);
+	tasksPending = SharedState->taskCount > 0 || SharedState->tasksOverflowed;
+	SpinLockRelease(&SharedState->mutex);
+
+	return tasksPending;
+}
+
+
+/*
+ * PushOneShotRequest notifies the scheduler of a new one-shot job. If the
+ * queue is full, the scheduler is told to reload all one-shot jobs.
+ */
+void
+PushOneShotRequest(OneShotRequest *request)
+{
+	SpinLockAcquire(&SharedState->mutex);
+
+	if (SharedState->oneShotCount >= MAX_ONE_SHOT_REQUESTS)
+	{
+		SharedState->oneShotReloadNeeded = true;
+	}
+	else
+	{
+		int requestIndex = (SharedState->oneShotHead +
+							SharedState->oneShotCount) % MAX_ONE_SHOT_REQUESTS;
+
+		SharedState->oneShotRequests[requestIndex] = *request;
+		SharedState->oneShotCount++;
+	}
+
+	SpinLockRelease(&SharedState->mutex);
+}
+
+
+/*
+ * DequeueOneShotRequests removes up to maxRequests notifications of new
+ * one-shot jobs from the queue, copies them into the given array, and
+ * returns the number of notifications.
+ */
+int
+DequeueOneShotRequests(OneShotRequest *requests, int maxRequests)
+{
+	int requestCount = 0;
+
+	SpinLockAcquire(&SharedState->mutex);
+
+	while (requestCount < maxRequests && SharedState->oneShotCount > 0)
+	{
+		requests[requestCount] =
+			SharedState->oneShotRequests[SharedState->oneShotHead];
+
+		SharedState->oneShotHead = (SharedState->oneShotHead + 1) %
+								   MAX_ONE_SHOT_REQUESTS;
+		SharedState->oneShotCount--;
+		requestCount++;
+	}
+
+	SpinLockRelease(&SharedState->mutex);
+
+	return requestCount;
+}
+
+
+/*
+ * SetOneShotReloadNeeded tells the scheduler to reload all one-shot jobs.
+ */
+void
+SetOneShotReloadNeeded(void)
+{
+	SpinLockAcquire(&SharedState->mutex);
+	SharedState->oneShotReloadNeeded = true;
+	SpinLockRelease(&SharedState->mutex);
+}
+
+
+/*
+ * TakeOneShotReloadNeeded returns whether the scheduler should reload all
+ * one-shot jobs, and clears the flag.
+ */
+bool
+TakeOneShotReloadNeeded(void)
+{
+	bool reloadNeeded = false;
+
+	SpinLockAcquire(&SharedState->mutex);
+	reloadNeeded = SharedState->oneShotReloadNeeded;
+	SharedState->oneShotReloadNeeded = false;
+	SpinLockRelease(&SharedState->mutex);
+
+	return reloadNeeded;
+}
+
+
+/*
+ * OneShotRequestsPending returns whether there are notifications of new
+ * one-shot jobs in the queue.
+ */
+bool
+OneShotRequestsPending(void)
+{
+	bool requestsPending = false;
+
+	SpinLockAcquire(&SharedState->mutex);
+	requestsPending = SharedState->oneShotCount > 0;
+	SpinLockRelease(&SharedState->mutex);
+
+	return requestsPending;
+}
+
+
+/*
+ * SetJobReloadNeeded tells the scheduler that cron.job changed, and wakes
+ * it up. It should be called once the change is committed.
+ */
+void
+SetJobReloadNeeded(void)
+{
+	SpinLockAcquire(&SharedState->mutex);
+	SharedState->jobReloadNeeded = true;
+	SpinLockRelease(&SharedState->mutex);
+
+	WakeScheduler();
+}
+
+
+/*
+ * TakeJobReloadNeeded returns whether the scheduler should reload the
+ * jobs in cron.job, and clears the flag.
+ */
+bool
+TakeJobReloadNeeded(void)
+{
+	bool reloadNeeded = false;
+
+	SpinLockAcquire(&SharedState->mutex);
+	reloadNeeded = SharedState->jobReloadNeeded;
+	SharedState->jobReloadNeeded = false;
+	SpinLockRelease(&SharedState->mutex);
+
+	return reloadNeeded;
+}
+
+
+/*
+ * SetSchedulerLeaseExpiry publishes until when the scheduler holds the
+ * scheduler lease, or 0 if it does not hold it.
+ */
+void
+SetSchedulerLeaseExpiry(TimestampTz validUntil)
+{
+	SpinLockAcquire(&SharedState->mutex);
+	SharedState->leaseValidUntil = validUntil;
+	SpinLockRelease(&SharedState->mutex);
+}
+
+
+/*
+ * SchedulerLeaseExpiry returns until when the scheduler of this server
+ * holds the scheduler lease, or 0 if it does not hold it.
+ */
+TimestampTz
+SchedulerLeaseExpiry(void)
+{
+	TimestampTz validUntil = 0;
+
+	SpinLockAcquire(&SharedState->mutex);
+	validUntil = SharedState->leaseValidUntil;
+	SpinLockRelease(&SharedState->mutex);
+
+	return validUntil;
+}
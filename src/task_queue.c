@@ -0,0 +1,609 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/task_queue.c
+ *
+ * Queue of ad-hoc tasks that are run once by the scheduler. Tasks are
+ * handed to the scheduler through a ring buffer in shared memory when
+ * the enqueueing transaction commits. Tasks that do not fit in the ring
+ * buffer are kept in the cron.task_queue table until the scheduler picks
+ * them up. Neither path invalidates the job cache.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "cron.h"
+#include "pg_cron.h"
+#include "job_metadata.h"
+#include "cron_task_queue.h"
+#include "shared_state.h"
+#include "task_queue.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "commands/sequence.h"
+#include "pgstat.h"
+#include "postmaster/postmaster.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+
+#define CRON_SCHEMA_NAME "cron"
+#define TASK_QUEUE_TABLE_NAME "task_queue"
+#define TASK_ID_INDEX_NAME "task_queue_pkey"
+#define TASK_ID_SEQUENCE_NAME "cron.taskid_seq"
+
+
+/* task that is handed to the scheduler when the transaction commits */
+typedef struct PendingTask
+{
+	int nestLevel;
+	QueuedTask task;
+} PendingTask;
+
+
+/* forward declarations */
+static Oid TaskQueueRelationId(void);
+static void InsertQueuedTask(int64 taskId, char *command, char *database,
+							 char *userName);
+static void TaskQueueXactCallback(XactEvent event, void *arg);
+static void TaskQueueSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+									 SubTransactionId parentSubid, void *arg);
+static void ReserveOrInsertPendingTasks(void);
+static void ResetPendingTasks(void);
+static List * LoadOverflowedJobs(List *jobList, int maxJobCount);
+
+
+/* SQL-callable functions */
+PG_FUNCTION_INFO_V1(cron_enqueue);
+
+
+/* global variables */
+static bool XactCallbacksRegistered = false;
+static List *PendingTaskList = NIL;
+static int ReservedTaskCount = 0;
+static bool TasksInserted = false;
+static MemoryContext QueuedJobContext = NULL;
+static HTAB *QueuedJobHash = NULL;
+
+
+/*
+ * cron_enqueue queues a command to be run once by the scheduler as soon
+ * as possible after the current transaction commits, and returns the ID
+ * of the task.
+ */
+Datum
+cron_enqueue(PG_FUNCTION_ARGS)
+{
+	char *command = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char *database = text_to_cstring(PG_GETARG_TEXT_P(1));
+	char *userName = text_to_cstring(PG_GETARG_TEXT_P(2));
+	char *currentUserName = GetUserNameFromId(GetUserId(), false);
+	int64 taskId = 0;
+
+	if (strcmp(userName, currentUserName) != 0 && !superuser())
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("only superusers can enqueue tasks for other "
+							   "users")));
+	}
+
+	if (!XactCallbacksRegistered)
+	{
+		RegisterXactCallback(TaskQueueXactCallback, NULL);
+		RegisterSubXactCallback(TaskQueueSubXactCallback, NULL);
+		XactCallbacksRegistered = true;
+	}
+
+	taskId = NextTaskId();
+
+	if (strlen(command) < QUEUED_COMMAND_SIZE &&
+		strlen(database) < NAMEDATALEN &&
+		strlen(userName) < NAMEDATALEN)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+		PendingTask *pendingTask = (PendingTask *) palloc0(sizeof(PendingTask));
+
+		pendingTask->nestLevel = GetCurrentTransactionNestLevel();
+		pendingTask->task.taskId = taskId;
+		strlcpy(pendingTask->task.command, command, QUEUED_COMMAND_SIZE);
+		strlcpy(pendingTask->task.database, database, NAMEDATALEN);
+		strlcpy(pendingTask->task.userName, userName, NAMEDATALEN);
+
+		PendingTaskList = lappend(PendingTaskList, pendingTask);
+
+		MemoryContextSwitchTo(oldContext);
+	}
+	else
+	{
+		/* too large for shared memory, keep it in the table */
+		InsertQueuedTask(taskId, command, database, userName);
+	}
+
+	PG_RETURN_INT64(taskId);
+}
+
+
+/*
+ * NextTaskId returns a new, unique task ID using the task ID sequence.
+ */
+int64
+NextTaskId(void)
+{
+	text *sequenceName = NULL;
+	List *sequenceNameList = NIL;
+	RangeVar *sequenceVar = NULL;
+	Oid sequenceId = InvalidOid;
+	Oid savedUserId = InvalidOid;
+	int savedSecurityContext = 0;
+	Datum taskIdDatum = 0;
+	bool failOK = false;
+
+	sequenceName = cstring_to_text(TASK_ID_SEQUENCE_NAME);
+	sequenceNameList = textToQualifiedNameList(sequenceName);
+	sequenceVar = makeRangeVarFromNameList(sequenceNameList);
+	sequenceId = RangeVarGetRelid(sequenceVar, NoLock, failOK);
+
+	GetUserIdAndSecContext(&savedUserId, &savedSecurityContext);
+	SetUserIdAndSecContext(CronExtensionOwner(), SECURITY_LOCAL_USERID_CHANGE);
+
+	taskIdDatum = DirectFunctionCall1(nextval_oid, ObjectIdGetDatum(sequenceId));
+
+	SetUserIdAndSecContext(savedUserId, savedSecurityContext);
+
+	return DatumGetInt64(taskIdDatum);
+}
+
+
+/*
+ * TaskQueueRelationId returns the oid of the cron.task_queue relation.
+ */
+static Oid
+TaskQueueRelationId(void)
+{
+	Oid cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+
+	return get_relname_relid(TASK_QUEUE_TABLE_NAME, cronSchemaId);
+}
+
+
+/*
+ * InsertQueuedTask adds a task to the cron.task_queue table.
+ */
+static void
+InsertQueuedTask(int64 taskId, char *command, char *database, char *userName)
+{
+	Relation taskQueueTable = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_cron_task_queue];
+	bool isNulls[Natts_cron_task_queue];
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_cron_task_queue_taskid - 1] = Int64GetDatum(taskId);
+	values[Anum_cron_task_queue_command - 1] = CStringGetTextDatum(command);
+	values[Anum_cron_task_queue_database - 1] = CStringGetTextDatum(database);
+	values[Anum_cron_task_queue_username - 1] = CStringGetTextDatum(userName);
+
+	taskQueueTable = heap_open(TaskQueueRelationId(), RowExclusiveLock);
+
+	tupleDescriptor = RelationGetDescr(taskQueueTable);
+	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	simple_heap_insert(taskQueueTable, heapTuple);
+	CatalogUpdateIndexes(taskQueueTable, heapTuple);
+	CommandCounterIncrement();
+
+	heap_close(taskQueueTable, RowExclusiveLock);
+
+	TasksInserted = true;
+}
+
+
+/*
+ * TaskQueueXactCallback hands the tasks that were queued in a transaction
+ * to the scheduler when the transaction commits. Slots in shared memory
+ * are reserved before commit, when we can still fall back to inserting
+ * into the cron.task_queue table, and are filled after commit, when the
+ * data written by the transaction has become visible to the tasks.
+ */
+static void
+TaskQueueXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_PRE_COMMIT:
+		{
+			ReserveOrInsertPendingTasks();
+			break;
+		}
+
+		case XACT_EVENT_PRE_PREPARE:
+		{
+			if (PendingTaskList != NIL || TasksInserted)
+			{
+				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+								errmsg("cannot prepare a transaction that "
+									   "enqueued pg_cron tasks")));
+			}
+
+			break;
+		}
+
+		case XACT_EVENT_COMMIT:
+		{
+			ListCell *pendingTaskCell = NULL;
+			bool wakeScheduler = PendingTaskList != NIL || TasksInserted;
+
+			foreach(pendingTaskCell, PendingTaskList)
+			{
+				PendingTask *pendingTask = (PendingTask *) lfirst(pendingTaskCell);
+
+				PushQueuedTask(&pendingTask->task);
+				ReservedTaskCount--;
+			}
+
+			if (TasksInserted)
+			{
+				SetQueuedTasksOverflowed();
+			}
+
+			ResetPendingTasks();
+
+			if (wakeScheduler)
+			{
+				WakeScheduler();
+			}
+
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		{
+			ResetPendingTasks();
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * ReserveOrInsertPendingTasks reserves slots in shared memory for the
+ * pending tasks and moves the tasks for which there is no slot into the
+ * cron.task_queue table.
+ */
+static void
+ReserveOrInsertPendingTasks(void)
+{
+	List *reservedTaskList = NIL;
+	ListCell *pendingTaskCell = NULL;
+	int taskIndex = 0;
+
+	if (PendingTaskList == NIL)
+	{
+		return;
+	}
+
+	ReservedTaskCount = ReserveQueuedTasks(list_length(PendingTaskList));
+
+	foreach(pendingTaskCell, PendingTaskList)
+	{
+		PendingTask *pendingTask = (PendingTask *) lfirst(pendingTaskCell);
+		QueuedTask *task = &pendingTask->task;
+
+		if (taskIndex < ReservedTaskCount)
+		{
+			reservedTaskList = lappend(reservedTaskList, pendingTask);
+		}
+		else
+		{
+			InsertQueuedTask(task->taskId, task->command, task->database,
+							 task->userName);
+		}
+
+		taskIndex++;
+	}
+
+	PendingTaskList = reservedTaskList;
+}
+
+
+/*
+ * TaskQueueSubXactCallback forgets the tasks that were queued in a
+ * subtransaction that is rolled back.
+ */
+static void
+TaskQueueSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+						 SubTransactionId parentSubid, void *arg)
+{
+	int nestLevel = GetCurrentTransactionNestLevel();
+	List *remainingTaskList = NIL;
+	ListCell *pendingTaskCell = NULL;
+
+	if (event != SUBXACT_EVENT_COMMIT_SUB && event != SUBXACT_EVENT_ABORT_SUB)
+	{
+		return;
+	}
+
+	foreach(pendingTaskCell, PendingTaskList)
+	{
+		PendingTask *pendingTask = (PendingTask *) lfirst(pendingTaskCell);
+
+		if (pendingTask->nestLevel < nestLevel)
+		{
+			remainingTaskList = lappend(remainingTaskList, pendingTask);
+		}
+		else if (event == SUBXACT_EVENT_COMMIT_SUB)
+		{
+			/* task now belongs to the parent transaction */
+			pendingTask->nestLevel = nestLevel - 1;
+			remainingTaskList = lappend(remainingTaskList, pendingTask);
+		}
+	}
+
+	PendingTaskList = remainingTaskList;
+}
+
+
+/*
+ * ResetPendingTasks forgets the pending tasks of the current transaction
+ * and releases any slots that were reserved for them, but not used.
+ */
+static void
+ResetPendingTasks(void)
+{
+	if (ReservedTaskCount > 0)
+	{
+		ReleaseQueuedTasks(ReservedTaskCount);
+	}
+
+	/* the list itself lives in TopTransactionContext */
+	PendingTaskList = NIL;
+	ReservedTaskCount = 0;
+	TasksInserted = false;
+}
+
+
+/*
+ * InitializeQueuedJobHash initializes the hash for the jobs of queued
+ * tasks that the scheduler is running.
+ */
+void
+InitializeQueuedJobHash(void)
+{
+	HASHCTL info;
+	int hashFlags = 0;
+
+	QueuedJobContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "pg_cron queued job context",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(int64);
+	info.entrysize = sizeof(CronJob);
+	info.hash = tag_hash;
+	info.hcxt = QueuedJobContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	QueuedJobHash = hash_create("pg_cron queued jobs", 32, &info, hashFlags);
+}
+
+
+/*
+ * DequeueQueuedJobs takes up to maxJobCount tasks from the queue in
+ * shared memory and, if needed, from the cron.task_queue table, and
+ * returns a job for each of them.
+ */
+List *
+DequeueQueuedJobs(int maxJobCount)
+{
+	List *jobList = NIL;
+	QueuedTask queuedTask;
+
+	while (list_length(jobList) < maxJobCount && PopQueuedTask(&queuedTask))
+	{
+		CronJob *job = CreateQueuedJob(queuedTask.taskId, queuedTask.command,
+									   queuedTask.database,
+									   queuedTask.userName);
+
+		jobList = lappend(jobList, job);
+	}
+
+	if (list_length(jobList) < maxJobCount && TakeQueuedTasksOverflowed())
+	{
+		jobList = LoadOverflowedJobs(jobList, maxJobCount);
+	}
+
+	return jobList;
+}
+
+
+/*
+ * LoadOverflowedJobs removes tasks from the cron.task_queue table in the
+ * order in which they were queued, and adds a job for each of them to the
+ * job list until it contains maxJobCount jobs.
+ */
+static List *
+LoadOverflowedJobs(List *jobList, int maxJobCount)
+{
+	Relation taskQueueTable = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 0;
+	bool indexOK = true;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	Oid cronSchemaId = InvalidOid;
+	Oid taskIdIndexId = InvalidOid;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	/*
+	 * Tasks are only taken from the table on the primary, and only once the
+	 * extension has been updated to a version that has the table.
+	 */
+	if (!PgCronHasBeenLoaded() || RecoveryInProgress() ||
+		TaskQueueRelationId() == InvalidOid)
+	{
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		return jobList;
+	}
+
+	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+	taskIdIndexId = get_relname_relid(TASK_ID_INDEX_NAME, cronSchemaId);
+
+	taskQueueTable = heap_open(TaskQueueRelationId(), RowExclusiveLock);
+
+	scanDescriptor = systable_beginscan(taskQueueTable,
+										taskIdIndexId, indexOK,
+										NULL, scanKeyCount, scanKey);
+
+	tupleDescriptor = RelationGetDescr(taskQueueTable);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		bool isNull = false;
+		Datum taskId = 0;
+		Datum command = 0;
+		Datum database = 0;
+		Datum userName = 0;
+		CronJob *job = NULL;
+
+		if (list_length(jobList) >= maxJobCount)
+		{
+			/* look again once some of the tasks are done */
+			SetQueuedTasksOverflowed();
+			break;
+		}
+
+		taskId = heap_getattr(heapTuple, Anum_cron_task_queue_taskid,
+							  tupleDescriptor, &isNull);
+		command = heap_getattr(heapTuple, Anum_cron_task_queue_command,
+							   tupleDescriptor, &isNull);
+		database = heap_getattr(heapTuple, Anum_cron_task_queue_database,
+								tupleDescriptor, &isNull);
+		userName = heap_getattr(heapTuple, Anum_cron_task_queue_username,
+								tupleDescriptor, &isNull);
+
+		job = CreateQueuedJob(DatumGetInt64(taskId),
+							  TextDatumGetCString(command),
+							  TextDatumGetCString(database),
+							  TextDatumGetCString(userName));
+
+		jobList = lappend(jobList, job);
+
+		simple_heap_delete(taskQueueTable, &heapTuple->t_self);
+
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(taskQueueTable, RowExclusiveLock);
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return jobList;
+}
+
+
+/*
+ * CreateQueuedJob adds a job for a queued task or one-shot job to the
+ * queued job hash. Such jobs always run on the local node.
+ */
+CronJob *
+CreateQueuedJob(int64 taskId, char *command, char *database, char *userName)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(QueuedJobContext);
+	int64 jobId = -taskId;
+	bool isPresent = false;
+
+	CronJob *job = hash_search(QueuedJobHash, &jobId, HASH_ENTER, &isPresent);
+
+	memset(job, 0, sizeof(CronJob));
+	job->jobId = jobId;
+	job->scheduleText = "";
+	job->command = pstrdup(command);
+	job->nodeName = "localhost";
+	job->nodePort = PostPortNumber;
+	job->database = pstrdup(database);
+	job->userName = pstrdup(userName);
+
+	MemoryContextSwitchTo(oldContext);
+
+	return job;
+}
+
+
+/*
+ * GetQueuedJob returns the job of a queued task that is being run.
+ */
+CronJob *
+GetQueuedJob(int64 jobId)
+{
+	bool isPresent = false;
+
+	return hash_search(QueuedJobHash, &jobId, HASH_FIND, &isPresent);
+}
+
+
+/*
+ * RemoveQueuedJob removes the job of a queued task once it is done.
+ */
+void
+RemoveQueuedJob(int64 jobId)
+{
+	bool isPresent = false;
+
+	CronJob *job = hash_search(QueuedJobHash, &jobId, HASH_FIND, &isPresent);
+	if (!isPresent)
+	{
+		return;
+	}
+
+	pfree(job->command);
+	pfree(job->database);
+	pfree(job->userName);
+
+	hash_search(QueuedJobHash, &jobId, HASH_REMOVE, &isPresent);
+}
+
+
+/*
+ * QueuedJobCount returns the number of queued tasks that are being run.
+ */
+int
+QueuedJobCount(void)
+{
+	return hash_get_num_entries(QueuedJobHash);
+}
@@ -16,6 +16,11 @@
 #include "cron.h"
 #include "pg_cron.h"
 #include "task_states.h"
+#include "job_dependencies.h"
+#include "job_output.h"
+#include "schedule_index.h"
+#include "shared_state.h"
+#include "task_queue.h"
 
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
@@ -24,11 +29,20 @@
 /* forward declarations */
 static HTAB * CreateCronTaskHash(void);
 static CronTask * GetCronTask(int64 jobId);
+static bool TaskIsIdle(CronTask *task);
+static void SyncMemberTasks(CronTask *task);
+static CronTask * FindMemberTask(CronTask *task, char *nodeName, int nodePort);
 
 /* global variables */
 static MemoryContext CronTaskContext = NULL;
 static HTAB *CronTaskHash = NULL;
 
+/*
+ * Tasks that may be able to make progress. Idle tasks are not in the list,
+ * such that the scheduler does not visit them on every round.
+ */
+static dlist_head RunnableTasks = DLIST_STATIC_INIT(RunnableTasks);
+
 
 /*
  * InitializeTaskStateHash initializes the hash for storing task states.
@@ -78,6 +92,7 @@ void
 RefreshTaskHash(void)
 {
 	List *jobList = NIL;
+	List *activeTaskList = NIL;
 	ListCell *jobCell = NULL;
 	CronTask *task = NULL;
 	HASH_SEQ_STATUS status;
@@ -86,10 +101,29 @@ RefreshTaskHash(void)
 
 	hash_seq_init(&status, CronTaskHash);
 
-	/* mark all tasks as inactive */
+	/*
+	 * Mark all tasks as inactive, except those of queued tasks. Inactive
+	 * tasks are made runnable, such that they are removed or cancelled.
+	 */
 	while ((task = hash_seq_search(&status)) != NULL)
 	{
-		task->isActive = false;
+		if (!IsQueuedJobId(task->jobId))
+		{
+			ListCell *memberCell = NULL;
+
+			task->isActive = false;
+			task->cronJob = NULL;
+
+			MarkTaskRunnable(task);
+
+			foreach(memberCell, task->memberTasks)
+			{
+				CronTask *member = (CronTask *) lfirst(memberCell);
+
+				member->isActive = false;
+				member->cronJob = NULL;
+			}
+		}
 	}
 
 	jobList = LoadCronJobList();
@@ -101,8 +135,16 @@ RefreshTaskHash(void)
 
 		CronTask *task = GetCronTask(job->jobId);
 		task->isActive = true;
+		task->cronJob = job;
+
+		SyncMemberTasks(task);
+
+		activeTaskList = lappend(activeTaskList, task);
 	}
 
+	RebuildScheduleIndexes(activeTaskList);
+	RebuildJobDependencies(activeTaskList);
+
 	CronJobCacheValid = true;
 }
 
@@ -137,12 +179,86 @@ InitializeCronTask(CronTask *task, int64 jobId)
 	task->jobId = jobId;
 	task->state = CRON_TASK_WAITING;
 	task->pendingRunCount = 0;
+	task->runRequests = NIL;
 	task->connection = NULL;
 	task->pollingStatus = 0;
 	task->startDeadline = 0;
 	task->isSocketReady = false;
 	task->isActive = true;
 	task->errorMessage = NULL;
+	task->nextDueTime = 0;
+	task->interval = 0;
+	task->lastSuccessTime = 0;
+	task->dependenciesMetTime = 0;
+	task->attemptCount = 0;
+	task->retryPending = false;
+	task->retryDueTime = 0;
+	task->sqlState[0] = '\0';
+	task->runStartTime = 0;
+	task->awaitingHost = false;
+	task->connectionMade = false;
+	task->lastFailureLogTime = 0;
+	task->suppressedFailureCount = 0;
+	task->isPrewarmed = false;
+	task->prewarmTime = 0;
+	task->prewarmTurn = 0;
+	task->output = NULL;
+	task->cronJob = NULL;
+	task->isRunnable = false;
+	task->awaitingAdmission = false;
+	task->isAdmitted = false;
+	task->leaseToken = 0;
+	task->memberTasks = NIL;
+	task->memberSuccessCount = 0;
+	task->memberFailureCount = 0;
+	task->parentTask = NULL;
+	task->memberNodeName = NULL;
+	task->memberNodePort = 0;
+	task->memberPending = false;
+	task->memberRunning = false;
+}
+
+
+/*
+ * ResetCronTask returns a task to the waiting state after a run. Unlike
+ * InitializeCronTask, it keeps the state that spans runs: requested runs
+ * that have not started yet, the timing of interval schedules, the
+ * progress of dependencies, and retries of failed runs.
+ */
+void
+ResetCronTask(CronTask *task)
+{
+	task->runId = 0;
+	task->state = CRON_TASK_WAITING;
+	task->pendingRunCount = 0;
+	task->connection = NULL;
+	task->pollingStatus = 0;
+	task->startDeadline = 0;
+	task->isSocketReady = false;
+	task->isActive = true;
+	task->errorMessage = NULL;
+	task->sqlState[0] = '\0';
+	task->runStartTime = 0;
+	task->awaitingHost = false;
+	task->connectionMade = false;
+	task->isPrewarmed = false;
+	task->prewarmTime = 0;
+	task->output = NULL;
+	task->isAdmitted = false;
+	task->leaseToken = 0;
+}
+
+
+/*
+ * FindCronTask returns the task with the given job ID, or NULL if there
+ * is none.
+ */
+CronTask *
+FindCronTask(int64 jobId)
+{
+	bool isPresent = false;
+
+	return hash_search(CronTaskHash, &jobId, HASH_FIND, &isPresent);
 }
 
 
@@ -168,6 +284,153 @@ CurrentTaskList(void)
 }
 
 
+/*
+ * RunnableTaskList returns the tasks that may be able to make progress,
+ * that is the tasks that have a pending run, are running, or need to be
+ * cleaned up. Tasks that turned idle since the last call are taken out
+ * of the list, such that the cost of a round of the scheduler depends on
+ * the number of runnable tasks rather than on the number of jobs.
+ */
+List *
+RunnableTaskList(void)
+{
+	List *taskList = NIL;
+	dlist_mutable_iter iter;
+
+	dlist_foreach_modify(iter, &RunnableTasks)
+	{
+		CronTask *task = dlist_container(CronTask, runnableNode, iter.cur);
+
+		if (TaskIsIdle(task))
+		{
+			dlist_delete(&task->runnableNode);
+			task->isRunnable = false;
+			continue;
+		}
+
+		taskList = lappend(taskList, task);
+	}
+
+	return taskList;
+}
+
+
+/*
+ * TaskIsIdle returns whether the given task waits without a pending run.
+ */
+static bool
+TaskIsIdle(CronTask *task)
+{
+	/* members of a node group are removed along with the task of their job */
+	if (task->parentTask != NULL)
+	{
+		return task->state == CRON_TASK_WAITING && task->runRequests == NIL;
+	}
+
+	/* runs in the admission queue are resumed by MarkTaskAdmitted */
+	if (task->awaitingAdmission)
+	{
+		return task->state == CRON_TASK_WAITING && task->isActive;
+	}
+
+	return task->state == CRON_TASK_WAITING && task->isActive &&
+		   task->pendingRunCount == 0 && task->runRequests == NIL &&
+		   !task->retryPending;
+}
+
+
+/*
+ * MarkTaskRunnable adds the given task to the list of runnable tasks. It
+ * should be called whenever a run becomes pending on an idle task, or the
+ * state of an idle task changes otherwise.
+ */
+void
+MarkTaskRunnable(CronTask *task)
+{
+	if (task->isRunnable)
+	{
+		return;
+	}
+
+	dlist_push_tail(&RunnableTasks, &task->runnableNode);
+	task->isRunnable = true;
+}
+
+
+/*
+ * MarkTaskAdmitted lets the given task start the run that waited in the
+ * admission queue. The task moves to the end of the list of runnable
+ * tasks, such that tasks connect in the order in which they are admitted.
+ */
+void
+MarkTaskAdmitted(CronTask *task)
+{
+	task->awaitingAdmission = false;
+	task->isAdmitted = true;
+
+	if (task->isRunnable)
+	{
+		dlist_delete(&task->runnableNode);
+		task->isRunnable = false;
+	}
+
+	MarkTaskRunnable(task);
+}
+
+
+/*
+ * RunningTaskList returns the tasks of jobs that have a run in progress or
+ * were admitted to start one, including queued tasks and one-shot jobs.
+ * A job on a node group is represented by its members that run, since
+ * each of them has a connection. Only runnable tasks can be running, so
+ * only those are visited.
+ */
+List *
+RunningTaskList(void)
+{
+	List *taskList = NIL;
+	dlist_iter iter;
+
+	dlist_foreach(iter, &RunnableTasks)
+	{
+		CronTask *task = dlist_container(CronTask, runnableNode, iter.cur);
+
+		if (task->parentTask != NULL)
+		{
+			if (task->memberRunning)
+			{
+				taskList = lappend(taskList, task);
+			}
+
+			continue;
+		}
+
+		/* the members of the job count instead */
+		if (task->state == CRON_TASK_FANNING_OUT)
+		{
+			continue;
+		}
+
+		if (task->state != CRON_TASK_WAITING || task->isAdmitted)
+		{
+			taskList = lappend(taskList, task);
+		}
+	}
+
+	return taskList;
+}
+
+
+/*
+ * CronTaskCount returns the number of tasks.
+ */
+long
+CronTaskCount(void)
+{
+	return hash_get_num_entries(CronTaskHash);
+}
+
+
 /*
  * RemoveTask remove the task for the given job ID.
  */
@@ -176,5 +439,205 @@ RemoveTask(int64 jobId)
 {
 	bool isPresent = false;
 
+	CronTask *task = hash_search(CronTaskHash, &jobId, HASH_FIND, &isPresent);
+	if (isPresent)
+	{
+		/* the members of a job are idle while its task is */
+		while (task->memberTasks != NIL)
+		{
+			RemoveMemberTask((CronTask *) linitial(task->memberTasks));
+		}
+
+		list_free_deep(task->runRequests);
+		task->runRequests = NIL;
+
+		if (task->output != NULL)
+		{
+			DiscardTaskOutput(task->output);
+			task->output = NULL;
+		}
+
+		if (task->isRunnable)
+		{
+			dlist_delete(&task->runnableNode);
+			task->isRunnable = false;
+		}
+	}
+
 	hash_search(CronTaskHash, &jobId, HASH_REMOVE, &isPresent);
 }
+
+
+/*
+ * AddRunRequest queues a requested run with the given run ID on the task
+ * of the given job. It returns false if the job has no active task.
+ */
+bool
+AddRunRequest(int64 jobId, int64 runId)
+{
+	MemoryContext oldContext = NULL;
+	RunRequest *runRequest = NULL;
+	bool isPresent = false;
+
+	CronTask *task = hash_search(CronTaskHash, &jobId, HASH_FIND, &isPresent);
+	if (!isPresent || !task->isActive)
+	{
+		return false;
+	}
+
+	oldContext = MemoryContextSwitchTo(CronTaskContext);
+
+	runRequest = (RunRequest *) palloc(sizeof(RunRequest));
+	runRequest->jobId = jobId;
+	runRequest->runId = runId;
+
+	task->runRequests = lappend(task->runRequests, runRequest);
+
+	MemoryContextSwitchTo(oldContext);
+
+	MarkTaskRunnable(task);
+
+	return true;
+}
+
+
+/*
+ * AddQueuedTask creates a task with a single pending run for the job of
+ * a queued task.
+ */
+void
+AddQueuedTask(int64 jobId)
+{
+	CronTask *task = GetCronTask(jobId);
+
+	task->cronJob = GetCronJob(jobId);
+	task->pendingRunCount = 1;
+
+	MarkTaskRunnable(task);
+}
+
+
+/*
+ * SyncMemberTasks makes sure that the task of a job on a node group has a
+ * member task for each node in the group, and removes the idle members of
+ * nodes that left the group. Members that are running when their node
+ * leaves the group are cancelled, and removed once they are done.
+ */
+static void
+SyncMemberTasks(CronTask *task)
+{
+	List *idleMemberList = NIL;
+	ListCell *memberJobCell = NULL;
+	ListCell *memberCell = NULL;
+
+	foreach(memberJobCell, task->cronJob->memberJobs)
+	{
+		CronJob *memberJob = (CronJob *) lfirst(memberJobCell);
+		CronTask *member = FindMemberTask(task, memberJob->nodeName,
+										  memberJob->nodePort);
+
+		if (member == NULL)
+		{
+			MemoryContext oldContext = MemoryContextSwitchTo(CronTaskContext);
+
+			member = (CronTask *) palloc0(sizeof(CronTask));
+			InitializeCronTask(member, task->jobId);
+			member->parentTask = task;
+			member->memberNodeName = pstrdup(memberJob->nodeName);
+			member->memberNodePort = memberJob->nodePort;
+
+			task->memberTasks = lappend(task->memberTasks, member);
+
+			MemoryContextSwitchTo(oldContext);
+		}
+
+		member->isActive = true;
+		member->cronJob = memberJob;
+	}
+
+	foreach(memberCell, task->memberTasks)
+	{
+		CronTask *member = (CronTask *) lfirst(memberCell);
+
+		if (!member->isActive && member->state == CRON_TASK_WAITING &&
+			!member->memberRunning)
+		{
+			idleMemberList = lappend(idleMemberList, member);
+		}
+	}
+
+	foreach(memberCell, idleMemberList)
+	{
+		RemoveMemberTask((CronTask *) lfirst(memberCell));
+	}
+
+	list_free(idleMemberList);
+}
+
+
+/*
+ * FindMemberTask returns the member task of the given task for the given
+ * node, or NULL if there is none.
+ */
+static CronTask *
+FindMemberTask(CronTask *task, char *nodeName, int nodePort)
+{
+	ListCell *memberCell = NULL;
+
+	foreach(memberCell, task->memberTasks)
+	{
+		CronTask *member = (CronTask *) lfirst(memberCell);
+
+		if (member->memberNodePort == nodePort &&
+			strcmp(member->memberNodeName, nodeName) == 0)
+		{
+			return member;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * StartMemberRun queues a run with the run ID of the job on the task of a
+ * node in its node group.
+ */
+void
+StartMemberRun(CronTask *member, int64 runId)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(CronTaskContext);
+	RunRequest *runRequest = (RunRequest *) palloc(sizeof(RunRequest));
+
+	runRequest->jobId = member->jobId;
+	runRequest->runId = runId;
+
+	member->runRequests = lappend(member->runRequests, runRequest);
+
+	MemoryContextSwitchTo(oldContext);
+
+	MarkTaskRunnable(member);
+}
+
+
+/*
+ * RemoveMemberTask removes the given member task from the task of its job
+ * and frees it.
+ */
+void
+RemoveMemberTask(CronTask *member)
+{
+	CronTask *parentTask = member->parentTask;
+
+	parentTask->memberTasks = list_delete_ptr(parentTask->memberTasks, member);
+
+	if (member->isRunnable)
+	{
+		dlist_delete(&member->runnableNode);
+		member->isRunnable = false;
+	}
+
+	list_free_deep(member->runRequests);
+	pfree(member->memberNodeName);
+	pfree(member);
+}
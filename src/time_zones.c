@@ -0,0 +1,181 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/time_zones.c
+ *
+ * Cache of the time zones in which jobs are scheduled. For each distinct
+ * time zone, we remember the UTC offset that applies until the next DST
+ * transition, such that converting the current time to local time is a
+ * single addition for all but a few minutes per year.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "time_zones.h"
+
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* forward declarations */
+static long TimeZoneOffset(CronTimeZone *timeZone, pg_time_t time);
+
+/* global variables */
+static MemoryContext CronTimeZoneContext = NULL;
+static HTAB *CronTimeZoneHash = NULL;
+
+
+/*
+ * InitializeTimeZoneCache initializes the hash for caching time zones.
+ */
+void
+InitializeTimeZoneCache(void)
+{
+	HASHCTL info;
+	int hashFlags = 0;
+
+	CronTimeZoneContext = AllocSetContextCreate(CurrentMemoryContext,
+												"pg_cron time zone context",
+												ALLOCSET_DEFAULT_MINSIZE,
+												ALLOCSET_DEFAULT_INITSIZE,
+												ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = TZ_STRLEN_MAX + 1;
+	info.entrysize = sizeof(CronTimeZone);
+	info.hash = string_hash;
+	info.hcxt = CronTimeZoneContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	CronTimeZoneHash = hash_create("pg_cron time zones", 8, &info, hashFlags);
+}
+
+
+/*
+ * GetCronTimeZone returns the cached time zone with the given name, or
+ * NULL if the time zone is unknown. Entries are kept across job cache
+ * reloads, such that the last minute that was processed in a time zone
+ * survives schedule changes.
+ */
+CronTimeZone *
+GetCronTimeZone(const char *timeZoneName)
+{
+	CronTimeZone *timeZone = NULL;
+	const char *canonicalName = NULL;
+	bool isPresent = false;
+
+	pg_tz *tz = pg_tzset(timeZoneName);
+	if (tz == NULL)
+	{
+		return NULL;
+	}
+
+	/* different spellings of the same zone share an entry */
+	canonicalName = pg_get_timezone_name(tz);
+
+	timeZone = hash_search(CronTimeZoneHash, canonicalName, HASH_ENTER,
+						   &isPresent);
+	if (!isPresent)
+	{
+		timeZone->tz = tz;
+		timeZone->gmtOffset = 0;
+		timeZone->validFrom = 0;
+		timeZone->validUntil = 0;
+		timeZone->lastMinute = 0;
+		timeZone->lastClockMinute = 0;
+		timeZone->prewarmedMinute = 0;
+		timeZone->nextRunMinute = 0;
+		timeZone->nextRunCheckedMinute = 0;
+		timeZone->scheduleIndex = NULL;
+		timeZone->taskList = NIL;
+	}
+
+	return timeZone;
+}
+
+
+/*
+ * CronTimeZoneList returns the list of all cached time zones.
+ */
+List *
+CronTimeZoneList(void)
+{
+	List *timeZoneList = NIL;
+	CronTimeZone *timeZone = NULL;
+	HASH_SEQ_STATUS status;
+
+	hash_seq_init(&status, CronTimeZoneHash);
+
+	while ((timeZone = hash_seq_search(&status)) != NULL)
+	{
+		timeZoneList = lappend(timeZoneList, timeZone);
+	}
+
+	return timeZoneList;
+}
+
+
+/*
+ * TimestampToLocalTime shifts a timestamp by the UTC offset of the given
+ * time zone, such that the UTC fields of the result (e.g. via gmtime) are
+ * the local wall clock time.
+ */
+TimestampTz
+TimestampToLocalTime(CronTimeZone *timeZone, TimestampTz time)
+{
+	pg_time_t utcTime = (pg_time_t) timestamptz_to_time_t(time);
+	long gmtOffset = TimeZoneOffset(timeZone, utcTime);
+
+	return TimestampTzPlusMilliseconds(time, gmtOffset * 1000);
+}
+
+
+/*
+ * TimeZoneOffset returns the UTC offset in seconds of the time zone at
+ * the given time. The offset is only recomputed when the time falls
+ * outside the interval between DST transitions that we cached last.
+ */
+static long
+TimeZoneOffset(CronTimeZone *timeZone, pg_time_t time)
+{
+	if (time < timeZone->validFrom || time >= timeZone->validUntil)
+	{
+		long beforeOffset = 0;
+		int beforeIsDst = 0;
+		pg_time_t boundary = 0;
+		long afterOffset = 0;
+		int afterIsDst = 0;
+		int boundaryResult = 0;
+
+		boundaryResult = pg_next_dst_boundary(&time, &beforeOffset,
+											  &beforeIsDst, &boundary,
+											  &afterOffset, &afterIsDst,
+											  timeZone->tz);
+		if (boundaryResult < 0)
+		{
+			/* should not happen for a zone that pg_tzset accepted */
+			ereport(LOG, (errmsg("could not determine UTC offset of time "
+								 "zone %s", timeZone->name)));
+
+			timeZone->gmtOffset = 0;
+			timeZone->validFrom = time;
+			timeZone->validUntil = time + SECS_PER_MINUTE;
+		}
+		else
+		{
+			timeZone->gmtOffset = beforeOffset;
+			timeZone->validFrom = time;
+
+			/* zones without DST keep the same offset forever */
+			timeZone->validUntil = (boundaryResult == 1) ? boundary :
+								   PG_INT64_MAX;
+		}
+	}
+
+	return timeZone->gmtOffset;
+}
@@ -0,0 +1,224 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/timer_heap.c
+ *
+ * Min-heap of timers, ordered by the time at which they expire, used by
+ * the scheduler for events that are not tied to the start of a minute.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "timer_heap.h"
+
+#include "utils/memutils.h"
+
+
+#define INITIAL_TIMER_CAPACITY 64
+
+#define TimerParent(position) (((position) - 1) / 2)
+#define TimerLeftChild(position) (2 * (position) + 1)
+
+
+/* forward declarations */
+static void SiftUp(int position);
+static void SiftDown(int position);
+static inline void SwapTimers(int position, int otherPosition);
+
+/* global variables */
+static MemoryContext CronTimerContext = NULL;
+static CronTimer *Timers = NULL;
+static int TimerCount = 0;
+static int TimerCapacity = 0;
+
+
+/*
+ * InitializeTimerHeap allocates the timer heap.
+ */
+void
+InitializeTimerHeap(void)
+{
+	CronTimerContext = AllocSetContextCreate(CurrentMemoryContext,
+											 "pg_cron timer context",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+
+	TimerCapacity = INITIAL_TIMER_CAPACITY;
+	TimerCount = 0;
+	Timers = (CronTimer *) MemoryContextAlloc(CronTimerContext,
+											  TimerCapacity * sizeof(CronTimer));
+}
+
+
+/*
+ * AddTimer adds a timer of the given kind that expires at dueTime.
+ */
+void
+AddTimer(CronTimerKind kind, int64 id, TimestampTz dueTime)
+{
+	CronTimer *timer = NULL;
+
+	if (TimerCount == TimerCapacity)
+	{
+		TimerCapacity *= 2;
+		Timers = (CronTimer *) repalloc(Timers, TimerCapacity * sizeof(CronTimer));
+	}
+
+	timer = &Timers[TimerCount];
+	timer->dueTime = dueTime;
+	timer->kind = kind;
+	timer->id = id;
+
+	TimerCount++;
+
+	SiftUp(TimerCount - 1);
+}
+
+
+/*
+ * PopDueTimer removes the earliest timer from the heap if it expired at
+ * or before currentTime, copies it into timer, and returns true.
+ * Otherwise, it returns false.
+ */
+bool
+PopDueTimer(TimestampTz currentTime, CronTimer *timer)
+{
+	if (TimerCount == 0 || Timers[0].dueTime > currentTime)
+	{
+		return false;
+	}
+
+	*timer = Timers[0];
+
+	TimerCount--;
+	if (TimerCount > 0)
+	{
+		Timers[0] = Timers[TimerCount];
+		SiftDown(0);
+	}
+
+	return true;
+}
+
+
+/*
+ * NextTimerDueTime sets dueTime to the time at which the earliest timer
+ * expires, and returns false if there are no timers.
+ */
+bool
+NextTimerDueTime(TimestampTz *dueTime)
+{
+	if (TimerCount == 0)
+	{
+		return false;
+	}
+
+	*dueTime = Timers[0].dueTime;
+
+	return true;
+}
+
+
+/*
+ * RemoveTimers removes all timers of the given kind.
+ */
+void
+RemoveTimers(CronTimerKind kind)
+{
+	int timerIndex = 0;
+	int remainingCount = 0;
+	int position = 0;
+
+	for (timerIndex = 0; timerIndex < TimerCount; timerIndex++)
+	{
+		if (Timers[timerIndex].kind != kind)
+		{
+			Timers[remainingCount++] = Timers[timerIndex];
+		}
+	}
+
+	TimerCount = remainingCount;
+
+	/* restore the heap property bottom-up */
+	for (position = TimerCount / 2 - 1; position >= 0; position--)
+	{
+		SiftDown(position);
+	}
+}
+
+
+/*
+ * SiftUp moves the timer at the given position up until its parent does
+ * not expire later.
+ */
+static void
+SiftUp(int position)
+{
+	while (position > 0)
+	{
+		int parent = TimerParent(position);
+
+		if (Timers[parent].dueTime <= Timers[position].dueTime)
+		{
+			break;
+		}
+
+		SwapTimers(position, parent);
+		position = parent;
+	}
+}
+
+
+/*
+ * SiftDown moves the timer at the given position down until none of its
+ * children expire earlier.
+ */
+static void
+SiftDown(int position)
+{
+	while (true)
+	{
+		int leftChild = TimerLeftChild(position);
+		int rightChild = leftChild + 1;
+		int earliest = position;
+
+		if (leftChild < TimerCount &&
+			Timers[leftChild].dueTime < Timers[earliest].dueTime)
+		{
+			earliest = leftChild;
+		}
+
+		if (rightChild < TimerCount &&
+			Timers[rightChild].dueTime < Timers[earliest].dueTime)
+		{
+			earliest = rightChild;
+		}
+
+		if (earliest == position)
+		{
+			break;
+		}
+
+		SwapTimers(position, earliest);
+		position = earliest;
+	}
+}
+
+
+/*
+ * SwapTimers swaps the timers at the given positions.
+ */
+static inline void
+SwapTimers(int position, int otherPosition)
+{
+	CronTimer timer = Timers[position];
+
+	Timers[position] = Timers[otherPosition];
+	Timers[otherPosition] = timer;
+}